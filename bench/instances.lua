@@ -0,0 +1,106 @@
+-- instances.lua -- Benchmark scene containing many instances
+--
+--  Copyright (C) 2014  Miles Bader <miles@gnu.org>
+--
+-- This source code is free software; you can redistribute it and/or
+-- modify it under the terms of the GNU General Public License as
+-- published by the Free Software Foundation; either version 3, or (at
+-- your option) any later version.  See the file COPYING for more details.
+--
+-- Written by Miles Bader <miles@gnu.org>
+--
+
+-- A "forest" of trees scattered over a ground plane, where each tree
+-- is an instance of one of a small number of tree models.  This is
+-- intended for measuring the performance of instancing, and of search
+-- accelerators in scenes containing many instances.
+--
+-- The scene may be adjusted using scene options (the -I command-line
+-- option):
+--
+--   instances=N  -- the number of trees (default 100000)
+--   models=N     -- the number of different tree models (default 8)
+--
+-- e.g.:  snogray -I instances=250000 bench/instances.lua out.exr
+--
+
+local color = require 'snogray.color'
+
+local scene_opts = params.scene or {}
+
+local num_instances = tonumber (scene_opts.instances) or 100000
+local num_models = tonumber (scene_opts.models) or 8
+
+-- Use a fixed random seed, so that the scene is exactly the same
+-- every time.
+--
+math.randomseed (1)
+
+local function rand (lo, hi)
+   return lo + math.random () * (hi - lo)
+end
+
+
+-- Materials
+--
+local bark = material.lambert (color.rgb (0.3, 0.2, 0.1))
+local leaves = material.lambert (color.rgb (0.1, 0.35, 0.08))
+local ground = material.lambert (color.rgb (0.35, 0.3, 0.2))
+
+
+-- Tree models.  Each has a cylindrical trunk and a tessellated
+-- ellipsoidal crown, and is about 1 unit in diameter, with its base at
+-- the origin.
+--
+local models = {}
+for i = 1, num_models do
+   local height = rand (1.5, 3)
+   local crown_radius = rand (0.35, 0.5)
+   local crown_height = rand (0.5, 1) * height
+
+   local trunk = surface.cylinder (bark, pos (0, 0, 0),
+				   vec (0, 0, height - crown_height * 0.5),
+				   0.05 + 0.02 * height)
+   local crown = surface.tessel_sphere (
+      leaves,
+      pos (0, 0, height - crown_height * 0.5),
+      vec (0, 0, crown_height * 0.5),
+      vec (crown_radius, 0, 0),
+      0.002)
+
+   models[i] = surface.model { trunk, crown }
+end
+
+
+-- Scatter the trees over a square area, whose size is chosen to keep
+-- the density of trees constant regardless of how many there are.
+--
+local half_size = math.sqrt (num_instances) * 0.75
+
+for i = 1, num_instances do
+   local model = models[math.random (num_models)]
+   local xf = transform.translate (rand (-half_size, half_size),
+				   rand (-half_size, half_size),
+				   0)
+      * transform.rotate_z (rand (0, 2 * math.pi))
+      * transform.scale (rand (0.7, 1.3))
+   scene:add (surface.instance (model, xf))
+end
+
+scene:add (surface.rectangle (ground,
+			      pos (-half_size * 2, -half_size * 2, 0),
+			      vec (half_size * 4, 0, 0),
+			      vec (0, half_size * 4, 0)))
+
+
+-- Lighting
+--
+scene:add (light.far (vec (1, 0.5, 1.5), 0.05, 2))
+scene:add (light.far (vec (0, 0, 1), 2, color.rgb (0.2, 0.25, 0.4)))
+
+
+-- Look out over the forest from above one corner.
+--
+camera:move (pos (-half_size * 1.1, -half_size * 1.1, half_size * 0.3))
+camera:point (pos (0, 0, 0), vec (0, 0, 1))
+camera:set_vert_fov (math.pi / 5)
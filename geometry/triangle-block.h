@@ -0,0 +1,339 @@
+// triangle-block.h -- Block of triangles intersected in parallel
+//
+//  Copyright (C) 2014  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#ifndef SNOGRAY_TRIANGLE_BLOCK_H
+#define SNOGRAY_TRIANGLE_BLOCK_H
+
+#include "config.h"
+
+#if USE_AVX
+# include <immintrin.h>
+#elif USE_SSE
+# include <xmmintrin.h>
+#endif
+
+#include "pos.h"
+#include "vec.h"
+#include "ray.h"
+
+
+namespace snogray {
+
+
+// A fixed-size block of triangles, stored in "structure-of-arrays"
+// form, so that a ray can be tested against every triangle in the
+// block at once using SIMD instructions.
+//
+// The intersection test is the same Möller-Trumbore algorithm used by
+// tripar_intersects (see "tripar-isec.h"), but is always done in
+// single-precision.  Depending on what configure found, either SSE
+// (4 triangles per block), AVX (8 triangles per block), or a plain
+// C++ loop (4 triangles per block) is used.
+//
+// Unused entries in a block have zero-length edges, which can never
+// be intersected.
+//
+struct TriangleBlock
+{
+#if USE_AVX
+  static const unsigned SIZE = 8;
+#else
+  static const unsigned SIZE = 4;
+#endif
+
+  TriangleBlock ()
+  {
+    for (unsigned axis = 0; axis < 3; axis++)
+      for (unsigned i = 0; i < SIZE; i++)
+	corner[axis][i] = edge1[axis][i] = edge2[axis][i] = 0;
+  }
+
+  // Set entry NUM in this block to the triangle defined by the points
+  // CORNER, CORNER+EDGE1, and CORNER+EDGE2.
+  //
+  void set (unsigned num,
+	    const SPos &_corner, const SVec &_edge1, const SVec &_edge2)
+  {
+    corner[0][num] = _corner.x;
+    corner[1][num] = _corner.y;
+    corner[2][num] = _corner.z;
+    edge1[0][num] = _edge1.x;
+    edge1[1][num] = _edge1.y;
+    edge1[2][num] = _edge1.z;
+    edge2[0][num] = _edge2.x;
+    edge2[1][num] = _edge2.y;
+    edge2[2][num] = _edge2.z;
+  }
+
+  // Test RAY against every triangle in this block, and return a
+  // bit-mask with bit N set if triangle N is intersected by RAY
+  // within its bounds (Ray::t0 to Ray::t1).  For every such
+  // triangle, the parametric distance of the intersection is returned
+  // in T[N], and the barycentric coordinates in U[N] and V[N]; other
+  // entries in T, U, and V are undefined.
+  //
+  unsigned intersect (const Ray &ray,
+		      float t[SIZE], float u[SIZE], float v[SIZE])
+    const;
+
+  // The corner and two edges of each triangle, with the coordinates
+  // for each axis stored contiguously.
+  //
+  float corner[3][SIZE];
+  float edge1[3][SIZE];
+  float edge2[3][SIZE];
+};
+
+
+
+// TriangleBlock::intersect
+
+#if USE_AVX
+
+inline unsigned
+TriangleBlock::intersect (const Ray &ray,
+			  float t_out[SIZE], float u_out[SIZE], float v_out[SIZE])
+  const
+{
+  __m256 dx = _mm256_set1_ps (ray.dir.x);
+  __m256 dy = _mm256_set1_ps (ray.dir.y);
+  __m256 dz = _mm256_set1_ps (ray.dir.z);
+
+  __m256 e1x = _mm256_loadu_ps (edge1[0]);
+  __m256 e1y = _mm256_loadu_ps (edge1[1]);
+  __m256 e1z = _mm256_loadu_ps (edge1[2]);
+  __m256 e2x = _mm256_loadu_ps (edge2[0]);
+  __m256 e2y = _mm256_loadu_ps (edge2[1]);
+  __m256 e2z = _mm256_loadu_ps (edge2[2]);
+
+  // pvec = cross (ray.dir, edge2)
+  //
+  __m256 px = _mm256_sub_ps (_mm256_mul_ps (dy, e2z), _mm256_mul_ps (dz, e2y));
+  __m256 py = _mm256_sub_ps (_mm256_mul_ps (dz, e2x), _mm256_mul_ps (dx, e2z));
+  __m256 pz = _mm256_sub_ps (_mm256_mul_ps (dx, e2y), _mm256_mul_ps (dy, e2x));
+
+  // det = dot (edge1, pvec)
+  //
+  __m256 det = _mm256_add_ps (_mm256_add_ps (_mm256_mul_ps (e1x, px),
+					     _mm256_mul_ps (e1y, py)),
+			      _mm256_mul_ps (e1z, pz));
+  __m256 inv_det = _mm256_div_ps (_mm256_set1_ps (1.f), det);
+
+  // tvec = ray.origin - corner
+  //
+  __m256 tx = _mm256_sub_ps (_mm256_set1_ps (ray.origin.x),
+			     _mm256_loadu_ps (corner[0]));
+  __m256 ty = _mm256_sub_ps (_mm256_set1_ps (ray.origin.y),
+			     _mm256_loadu_ps (corner[1]));
+  __m256 tz = _mm256_sub_ps (_mm256_set1_ps (ray.origin.z),
+			     _mm256_loadu_ps (corner[2]));
+
+  // u = dot (tvec, pvec) * inv_det
+  //
+  __m256 u = _mm256_mul_ps (_mm256_add_ps (_mm256_add_ps (
+					     _mm256_mul_ps (tx, px),
+					     _mm256_mul_ps (ty, py)),
+					   _mm256_mul_ps (tz, pz)),
+			    inv_det);
+
+  // qvec = cross (tvec, edge1)
+  //
+  __m256 qx = _mm256_sub_ps (_mm256_mul_ps (ty, e1z), _mm256_mul_ps (tz, e1y));
+  __m256 qy = _mm256_sub_ps (_mm256_mul_ps (tz, e1x), _mm256_mul_ps (tx, e1z));
+  __m256 qz = _mm256_sub_ps (_mm256_mul_ps (tx, e1y), _mm256_mul_ps (ty, e1x));
+
+  // v = dot (ray.dir, qvec) * inv_det
+  //
+  __m256 v = _mm256_mul_ps (_mm256_add_ps (_mm256_add_ps (
+					     _mm256_mul_ps (dx, qx),
+					     _mm256_mul_ps (dy, qy)),
+					   _mm256_mul_ps (dz, qz)),
+			    inv_det);
+
+  // t = dot (edge2, qvec) * inv_det
+  //
+  __m256 t = _mm256_mul_ps (_mm256_add_ps (_mm256_add_ps (
+					     _mm256_mul_ps (e2x, qx),
+					     _mm256_mul_ps (e2y, qy)),
+					   _mm256_mul_ps (e2z, qz)),
+			    inv_det);
+
+  __m256 zero = _mm256_setzero_ps ();
+  __m256 one = _mm256_set1_ps (1.f);
+  __m256 eps = _mm256_set1_ps (float (Eps));
+
+  __m256 ok
+    = _mm256_or_ps (_mm256_cmp_ps (det, eps, _CMP_GE_OQ),
+		    _mm256_cmp_ps (det, _mm256_sub_ps (zero, eps), _CMP_LE_OQ));
+  ok = _mm256_and_ps (ok, _mm256_cmp_ps (u, zero, _CMP_GE_OQ));
+  ok = _mm256_and_ps (ok, _mm256_cmp_ps (u, one, _CMP_LE_OQ));
+  ok = _mm256_and_ps (ok, _mm256_cmp_ps (v, zero, _CMP_GE_OQ));
+  ok = _mm256_and_ps (ok, _mm256_cmp_ps (_mm256_add_ps (u, v), one,
+					 _CMP_LE_OQ));
+  ok = _mm256_and_ps (ok, _mm256_cmp_ps (t, _mm256_set1_ps (ray.t0),
+					 _CMP_GT_OQ));
+  ok = _mm256_and_ps (ok, _mm256_cmp_ps (t, _mm256_set1_ps (ray.t1),
+					 _CMP_LT_OQ));
+
+  _mm256_storeu_ps (t_out, t);
+  _mm256_storeu_ps (u_out, u);
+  _mm256_storeu_ps (v_out, v);
+
+  return _mm256_movemask_ps (ok);
+}
+
+#elif USE_SSE
+
+inline unsigned
+TriangleBlock::intersect (const Ray &ray,
+			  float t_out[SIZE], float u_out[SIZE], float v_out[SIZE])
+  const
+{
+  __m128 dx = _mm_set1_ps (ray.dir.x);
+  __m128 dy = _mm_set1_ps (ray.dir.y);
+  __m128 dz = _mm_set1_ps (ray.dir.z);
+
+  __m128 e1x = _mm_loadu_ps (edge1[0]);
+  __m128 e1y = _mm_loadu_ps (edge1[1]);
+  __m128 e1z = _mm_loadu_ps (edge1[2]);
+  __m128 e2x = _mm_loadu_ps (edge2[0]);
+  __m128 e2y = _mm_loadu_ps (edge2[1]);
+  __m128 e2z = _mm_loadu_ps (edge2[2]);
+
+  // pvec = cross (ray.dir, edge2)
+  //
+  __m128 px = _mm_sub_ps (_mm_mul_ps (dy, e2z), _mm_mul_ps (dz, e2y));
+  __m128 py = _mm_sub_ps (_mm_mul_ps (dz, e2x), _mm_mul_ps (dx, e2z));
+  __m128 pz = _mm_sub_ps (_mm_mul_ps (dx, e2y), _mm_mul_ps (dy, e2x));
+
+  // det = dot (edge1, pvec)
+  //
+  __m128 det = _mm_add_ps (_mm_add_ps (_mm_mul_ps (e1x, px),
+				       _mm_mul_ps (e1y, py)),
+			   _mm_mul_ps (e1z, pz));
+  __m128 inv_det = _mm_div_ps (_mm_set1_ps (1.f), det);
+
+  // tvec = ray.origin - corner
+  //
+  __m128 tx = _mm_sub_ps (_mm_set1_ps (ray.origin.x), _mm_loadu_ps (corner[0]));
+  __m128 ty = _mm_sub_ps (_mm_set1_ps (ray.origin.y), _mm_loadu_ps (corner[1]));
+  __m128 tz = _mm_sub_ps (_mm_set1_ps (ray.origin.z), _mm_loadu_ps (corner[2]));
+
+  // u = dot (tvec, pvec) * inv_det
+  //
+  __m128 u = _mm_mul_ps (_mm_add_ps (_mm_add_ps (_mm_mul_ps (tx, px),
+						 _mm_mul_ps (ty, py)),
+				     _mm_mul_ps (tz, pz)),
+			 inv_det);
+
+  // qvec = cross (tvec, edge1)
+  //
+  __m128 qx = _mm_sub_ps (_mm_mul_ps (ty, e1z), _mm_mul_ps (tz, e1y));
+  __m128 qy = _mm_sub_ps (_mm_mul_ps (tz, e1x), _mm_mul_ps (tx, e1z));
+  __m128 qz = _mm_sub_ps (_mm_mul_ps (tx, e1y), _mm_mul_ps (ty, e1x));
+
+  // v = dot (ray.dir, qvec) * inv_det
+  //
+  __m128 v = _mm_mul_ps (_mm_add_ps (_mm_add_ps (_mm_mul_ps (dx, qx),
+						 _mm_mul_ps (dy, qy)),
+				     _mm_mul_ps (dz, qz)),
+			 inv_det);
+
+  // t = dot (edge2, qvec) * inv_det
+  //
+  __m128 t = _mm_mul_ps (_mm_add_ps (_mm_add_ps (_mm_mul_ps (e2x, qx),
+						 _mm_mul_ps (e2y, qy)),
+				     _mm_mul_ps (e2z, qz)),
+			 inv_det);
+
+  __m128 zero = _mm_setzero_ps ();
+  __m128 one = _mm_set1_ps (1.f);
+  __m128 eps = _mm_set1_ps (float (Eps));
+
+  __m128 ok = _mm_or_ps (_mm_cmpge_ps (det, eps),
+			 _mm_cmple_ps (det, _mm_sub_ps (zero, eps)));
+  ok = _mm_and_ps (ok, _mm_cmpge_ps (u, zero));
+  ok = _mm_and_ps (ok, _mm_cmple_ps (u, one));
+  ok = _mm_and_ps (ok, _mm_cmpge_ps (v, zero));
+  ok = _mm_and_ps (ok, _mm_cmple_ps (_mm_add_ps (u, v), one));
+  ok = _mm_and_ps (ok, _mm_cmpgt_ps (t, _mm_set1_ps (ray.t0)));
+  ok = _mm_and_ps (ok, _mm_cmplt_ps (t, _mm_set1_ps (ray.t1)));
+
+  _mm_storeu_ps (t_out, t);
+  _mm_storeu_ps (u_out, u);
+  _mm_storeu_ps (v_out, v);
+
+  return _mm_movemask_ps (ok);
+}
+
+#else // !USE_AVX && !USE_SSE
+
+// Portable version.  This is written as a simple loop over the block
+// with no early exits, so a vectorizing compiler can often do a
+// reasonable job with it.
+//
+inline unsigned
+TriangleBlock::intersect (const Ray &ray,
+			  float t_out[SIZE], float u_out[SIZE], float v_out[SIZE])
+  const
+{
+  float ox = ray.origin.x, oy = ray.origin.y, oz = ray.origin.z;
+  float dx = ray.dir.x, dy = ray.dir.y, dz = ray.dir.z;
+  float t0 = ray.t0, t1 = ray.t1;
+
+  unsigned mask = 0;
+
+  for (unsigned i = 0; i < SIZE; i++)
+    {
+      float e1x = edge1[0][i], e1y = edge1[1][i], e1z = edge1[2][i];
+      float e2x = edge2[0][i], e2y = edge2[1][i], e2z = edge2[2][i];
+
+      float px = dy * e2z - dz * e2y;
+      float py = dz * e2x - dx * e2z;
+      float pz = dx * e2y - dy * e2x;
+
+      float det = e1x * px + e1y * py + e1z * pz;
+      float inv_det = 1.f / det;
+
+      float tx = ox - corner[0][i];
+      float ty = oy - corner[1][i];
+      float tz = oz - corner[2][i];
+
+      float u = (tx * px + ty * py + tz * pz) * inv_det;
+
+      float qx = ty * e1z - tz * e1y;
+      float qy = tz * e1x - tx * e1z;
+      float qz = tx * e1y - ty * e1x;
+
+      float v = (dx * qx + dy * qy + dz * qz) * inv_det;
+      float t = (e2x * qx + e2y * qy + e2z * qz) * inv_det;
+
+      bool ok = ((det >= float (Eps) || det <= -float (Eps))
+		 && u >= 0 && u <= 1 && v >= 0 && u + v <= 1
+		 && t > t0 && t < t1);
+
+      t_out[i] = t;
+      u_out[i] = u;
+      v_out[i] = v;
+
+      mask |= unsigned (ok) << i;
+    }
+
+  return mask;
+}
+
+#endif // USE_AVX / USE_SSE
+
+
+}
+
+#endif // SNOGRAY_TRIANGLE_BLOCK_H
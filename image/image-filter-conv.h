@@ -1,6 +1,6 @@
 // image-filter-conv.h -- "Filter Convolver" for convolving samples through a filter
 //
-//  Copyright (C) 2005-2008, 2010-2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2005-2008, 2010-2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -70,6 +70,10 @@ public:
 // called, will convolve the sample through the filter and apply the
 // resulting derived samples to a generic destination of type Dst.
 //
+// As the convolver itself is never modified by adding samples, it may
+// be used to add samples to different destinations (for instance, a
+// separate buffer for each thread) simultaneously.
+//
 // Dst should support the following methods:
 //
 //   // Add a sample with value SAMP at integer coordinates PX, PY.
@@ -83,7 +87,7 @@ public:
 //   bool valid_x (int px) { return px >= 0 && px < int (width); }
 //   bool valid_y (int py) { return py >= min_y && py < int (height); }
 //
-template<class Dst, typename Samp>
+template<typename Samp>
 class ImageFilterConv : public ImageFilterConvBase
 {
 public:
@@ -106,7 +110,8 @@ public:
   // point coordinates.
 #endif
   //
-  void add_sample (float sx, float sy, const Samp &samp, Dst &dst)
+  template<class Dst>
+  void add_sample (float sx, float sy, const Samp &samp, Dst &dst) const
   {
     // The center pixel affected
     //
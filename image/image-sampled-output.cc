@@ -1,6 +1,6 @@
 // image-sampled-output.cc -- High-level image output
 //
-//  Copyright (C) 2005-2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2005-2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -37,6 +37,7 @@ ImageSampledOutput::ImageSampledOutput (const std::string &filename,
     sample_base_x (params.get_float ("sample_base_x", 0)),
     sample_base_y (params.get_float ("sample_base_y", 0)),
     sink (ImageSink::open (filename, _width, _height, params)),
+    sink_params (params),
     filter_conv (params.readonly_subtable ("filter"))
 {
 }
@@ -47,6 +48,13 @@ ImageSampledOutput::~ImageSampledOutput ()
   //
   set_raw_min_y (height);
   flush ();
+
+  for (std::deque<SampleRow *>::iterator ri = rows.begin ();
+       ri != rows.end (); ++ri)
+    delete *ri;
+  for (std::vector<SampleRow *>::iterator ri = free_rows.begin ();
+       ri != free_rows.end (); ++ri)
+    delete *ri;
 }
 
 
@@ -83,49 +91,96 @@ ImageSampledOutput::set_raw_min_y (int new_min_y)
       rows.pop_front ();
       min_y++;
 
-      for (unsigned x = 0; x < width; x++)
-	{
-	  Tint pixel = r->pixels[x];
-	  Color col = pixel.alpha_scaled_color ();
-	  Tint::alpha_t alpha = pixel.alpha;
-
-	  float weight = r->weights[x];
-	  if (weight > 0 && weight != 1)
-	    {
-	      col *= 1 / weight;
-	      alpha *= 1 / weight;
-	    }
-
-	  // Discard negative values.
-	  //
-	  alpha = clamp (alpha, 0.f, 1.f);
-	  col = max (col, Color (0));
-
-	  // We "alpha unscale" COL ourselves, instead of using
-	  // Tint::unscaled_color above, as we need to do it _after_
-	  // scaling ALPHA by 1/WEIGHT; otherwise the alpha value will
-	  // be wrong.
-	  //
-	  if (alpha != 0 && alpha != 1)
-	    col *= 1 / alpha;
-
-	  if (intensity_scale != 1)
-	    col *= intensity_scale;
-	  if (intensity_power != 1)
-	    col = pow (max (col, 0.f), intensity_power);
-
-	  r->pixels[x] = Tint (col, alpha);
-	}
+      finish_row (*r, r->pixels);
 
       sink->write_row (r->pixels);
 
-      delete r;
+      r->clear ();
+      free_rows.push_back (r);
     }
 
   ASSERT (min_y == new_min_y);
 }
 
 
+
+// ImageSampledOutput::finish_row
+
+// Store into DST the final output pixels for the accumulated samples
+// in SRC:  each pixel is divided by its total weight, clamped, and has
+// the intensity modifiers applied.  DST may be SRC.pixels.
+//
+void
+ImageSampledOutput::finish_row (const SampleRow &src, ImageRow &dst) const
+{
+  for (unsigned x = 0; x < width; x++)
+    {
+      Tint pixel = src.pixels[x];
+      Color col = pixel.alpha_scaled_color ();
+      Tint::alpha_t alpha = pixel.alpha;
+
+      float weight = src.weights[x];
+      if (weight > 0 && weight != 1)
+	{
+	  col *= 1 / weight;
+	  alpha *= 1 / weight;
+	}
+
+      // Discard negative values.
+      //
+      alpha = clamp (alpha, 0.f, 1.f);
+      col = max (col, Color (0));
+
+      // We "alpha unscale" COL ourselves, instead of using
+      // Tint::unscaled_color above, as we need to do it _after_
+      // scaling ALPHA by 1/WEIGHT; otherwise the alpha value will be
+      // wrong.
+      //
+      if (alpha != 0 && alpha != 1)
+	col *= 1 / alpha;
+
+      if (intensity_scale != 1)
+	col *= intensity_scale;
+      if (intensity_power != 1)
+	col = pow (max (col, 0.f), intensity_power);
+
+      dst[x] = Tint (col, alpha);
+    }
+}
+
+
+
+// ImageSampledOutput::write_snapshot
+
+// Write an image containing the current state of the output to the
+// file FILENAME, without changing the output itself.  Only rows which
+// are still buffered (ImageSampledOutput::min_y and later) have
+// useful contents; any earlier rows, which have already been written
+// to the real output, are written as zero.  This is mainly useful
+// when rendering progressively, where no rows are written until the
+// end.
+//
+void
+ImageSampledOutput::write_snapshot (const std::string &filename)
+{
+  UniquePtr<ImageSink> snapshot
+    (ImageSink::open (filename, width, height, sink_params));
+
+  ImageRow out_row (width);
+
+  for (int y = 0; y < int (height); y++)
+    {
+      int offs = y - min_y;
+      if (offs >= 0 && offs < int (rows.size ()))
+	finish_row (*rows[offs], out_row);
+      else
+	out_row.clear ();
+
+      snapshot->write_row (out_row);
+    }
+}
+
+
 
 // Low-level row handling
 
@@ -142,7 +197,13 @@ ImageSampledOutput::_row (int y)
   // Add new rows as necessary
   //
   while (y >= min_y + int (rows.size ()))
-    rows.push_back (new SampleRow (width));
+    if (free_rows.empty ())
+      rows.push_back (new SampleRow (width));
+    else
+      {
+	rows.push_back (free_rows.back ());
+	free_rows.pop_back ();
+      }
 
   return *rows[y - min_y];
 }
@@ -165,4 +226,60 @@ void ImageSampledOutput::add_sample (float sx, float sy, const Tint &tint)
 }
 
 
+
+// Sample tiles
+
+// Make TILE cover all output pixels which may be affected by samples
+// in the rectangle from MIN_SX, MIN_SY to MAX_SX, MAX_SY (in the
+// sample coordinate-system), and clear it.
+//
+void
+ImageSampledOutput::reset_tile (SampleTile &tile,
+				float min_sx, float min_sy,
+				float max_sx, float max_sy)
+  const
+{
+  int x_rad = filter_x_radius (), y_rad = filter_y_radius ();
+
+  // Pixel bounds, expanded by the filter support, and clipped to the
+  // output image.
+  //
+  int x_lo = max (int (floor (min_sx - sample_base_x)) - x_rad, 0);
+  int y_lo = max (int (floor (min_sy - sample_base_y)) - y_rad, 0);
+  int x_hi = min (int (ceil (max_sx - sample_base_x)) + x_rad + 1,
+		  int (width));
+  int y_hi = min (int (ceil (max_sy - sample_base_y)) + y_rad + 1,
+		  int (height));
+
+  if (x_lo < x_hi && y_lo < y_hi)
+    tile.reset (x_lo, y_lo, x_hi - x_lo, y_hi - y_lo);
+  else
+    tile.reset (0, 0, 0, 0);
+}
+
+// Add all the samples accumulated in TILE to the output.  Any part
+// of TILE in rows which have already been written out is ignored.
+//
+void
+ImageSampledOutput::add_tile (const SampleTile &tile)
+{
+  for (unsigned ty = 0; ty < tile.height; ty++)
+    {
+      int y = tile.y_min + int (ty);
+      if (y < min_y)
+	continue;
+
+      SampleRow &r = row (y);
+
+      unsigned offs = ty * tile.width;
+      for (unsigned tx = 0; tx < tile.width; tx++, offs++)
+	{
+	  unsigned x = tile.x_min + tx;
+	  r.pixels[x] += tile.pixels[offs];
+	  r.weights[x] += tile.weights[offs];
+	}
+    }
+}
+
+
 // arch-tag: b4e1bbd7-c070-4ac9-9075-b9abcaefc30a
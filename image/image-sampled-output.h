@@ -1,6 +1,6 @@
 // image-sampled-output.h -- High-level image output
 //
-//  Copyright (C) 2005-2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2005-2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -47,6 +47,63 @@ public:
     std::vector<float> weights;
   };
 
+  // A rectangular buffer of filtered samples, covering some portion
+  // of the output image.  Samples may be added to a tile using
+  // ImageSampledOutput::add_sample without modifying the output, so
+  // each thread can accumulate its own samples (including the
+  // relatively expensive filter convolution) in parallel; the tile is
+  // then merged into the output using ImageSampledOutput::add_tile.
+  //
+  class SampleTile
+  {
+  public:
+
+    SampleTile () : x_min (0), y_min (0), width (0), height (0) { }
+
+    // Make this tile cover the output-image pixels from X_MIN, Y_MIN,
+    // of size WIDTH x HEIGHT, and clear it.
+    //
+    void reset (int _x_min, int _y_min, unsigned _width, unsigned _height)
+    {
+      x_min = _x_min;
+      y_min = _y_min;
+      width = _width;
+      height = _height;
+
+      unsigned size = width * height;
+      pixels.assign (size, Tint (0, 0));
+      weights.assign (size, 0);
+    }
+
+    // Add a sample with value TINT at integer coordinates PX, PY.
+    //
+    // [This method is a callback used by ImageFilterConv.]
+    //
+    void add_sample (int px, int py, const Tint &tint, float weight)
+    {
+      unsigned offs = (py - y_min) * width + (px - x_min);
+      pixels[offs] += tint;
+      weights[offs] += weight;
+    }
+
+    // Return true if the given X or Y coordinate is inside this tile.
+    //
+    // [These methods are callbacks used by ImageFilterConv.]
+    //
+    bool valid_x (int px) { return px >= x_min && px < x_min + int (width); }
+    bool valid_y (int py) { return py >= y_min && py < y_min + int (height); }
+
+    // Position and size of this tile in the output image.
+    //
+    int x_min, y_min;
+    unsigned width, height;
+
+    // Accumulated pixel values and weights, in row-major order.
+    //
+    std::vector<Tint> pixels;
+    std::vector<float> weights;
+  };
+
   // Create an ImageSampledOutput object for writing to FILENAME, with
   // a size of WIDTH, HEIGHT.  PARAMS holds any additional optional
   // parameters.
@@ -64,6 +121,40 @@ public:
   //
   void add_sample (float sx, float sy, const Tint &tint);
 
+  // Make TILE cover all output pixels which may be affected by samples
+  // in the rectangle from MIN_SX, MIN_SY to MAX_SX, MAX_SY (in the
+  // sample coordinate-system), and clear it.
+  //
+  void reset_tile (SampleTile &tile, float min_sx, float min_sy,
+		   float max_sx, float max_sy)
+    const;
+
+  // Add a sample with value TINT at floating point position SX, SY to
+  // TILE instead of directly to the output.  This does not modify the
+  // output, so it may be called by multiple threads simultaneously
+  // (for different tiles).  SX, SY must be within the rectangle TILE
+  // was last reset with using ImageSampledOutput::reset_tile.
+  //
+  void add_sample (float sx, float sy, const Tint &tint, SampleTile &tile)
+    const
+  {
+    filter_conv.add_sample (sx - sample_base_x, sy - sample_base_y,
+			    tint, tile);
+  }
+
+  // Add all the samples accumulated in TILE to the output.  Any part
+  // of TILE in rows which have already been written out is ignored.
+  //
+  void add_tile (const SampleTile &tile);
+
+  // Write an image containing the current state of the output to the
+  // file FILENAME, without changing the output itself.  Only rows
+  // which are still buffered have useful contents; any earlier rows,
+  // which have already been written to the real output, are written
+  // as zero.
+  //
+  void write_snapshot (const std::string &filename);
+
   // Write the completed portion of the output image to disk, if possible.
   // This may flush I/O buffers etc., but will not in any way change the
   // output (so for instance, it will _not_ flush the compression state of
@@ -137,7 +228,7 @@ public:
   // at the same coordinates.  It is assumed that TINT has already been
   // scaled by WEIGHT.
   //
-  // [This method is a callback used by ImageFilterConv<ImageSampledOutput>.]
+  // [This method is a callback used by ImageFilterConv.]
   //
   void add_sample (int px, int py, const Tint &tint, float weight)
   {
@@ -150,7 +241,7 @@ public:
   // The coordinates are in the output image's coordinate-system
   // (so in the range 0,0 - WIDTH,HEIGHT).
   //
-  // [These methods are callbacks used by ImageFilterConv<ImageSampledOutput>.]
+  // [These methods are callbacks used by ImageFilterConv.]
   //
   bool valid_x (int px) { return px >= 0 && px < int (width); }
   bool valid_y (int py) { return py >= min_y && py < int (height); }
@@ -197,6 +288,11 @@ private:
   //
   float sample_base_x, sample_base_y;
 
+  // Store into DST the final output pixels for the accumulated
+  // samples in SRC.  DST may be SRC.pixels.
+  //
+  void finish_row (const SampleRow &src, ImageRow &dst) const;
+
   // Internal version of the ImageSampledOutput::row() method which
   // handles rows not in ImageSampledOutput::rows.
   //
@@ -206,12 +302,25 @@ private:
   //
   UniquePtr<ImageSink> sink;
 
-  ImageFilterConv<ImageSampledOutput, Tint> filter_conv;
+  // Parameters used to open SINK, for opening snapshot images.
+  //
+  ValTable sink_params;
+
+  ImageFilterConv<Tint> filter_conv;
 
   // Currently available rows.  The row number of the first row is
   // ImageSampledOutput::min_y.
   //
   std::deque<SampleRow *> rows;
+
+  // Rows which have been written out, and can be reused.  As the
+  // number of rows buffered at once is bounded by how far ahead of
+  // ImageSampledOutput::min_y samples are added (for instance, the
+  // height of a band of tiles from a RenderPattern), recycling rows
+  // means that after the first few rows, no further allocation is
+  // needed, regardless of the order in which samples arrive.
+  //
+  std::vector<SampleRow *> free_rows;
 };
 
 
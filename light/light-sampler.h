@@ -1,6 +1,6 @@
 // light-sampler.h -- Sampling interface for lights
 //
-//  Copyright (C) 2010, 2011, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2010, 2011, 2013, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -13,6 +13,8 @@
 #ifndef SNOGRAY_LIGHT_SAMPLER_H
 #define SNOGRAY_LIGHT_SAMPLER_H
 
+#include "geometry/bbox.h"
+
 #include "light.h"
 
 
@@ -111,6 +113,38 @@ public:
     dist_t dist;
   };
 
+  // A conservative description of where a light is, how much light
+  // it emits, and in which directions, used to estimate its
+  // contribution to points in the scene (e.g., by LightTree).
+  //
+  struct Bounds
+  {
+    Bounds (const BBox &_bbox, float _power, const Vec &_axis,
+	    float _theta_o, float _theta_e)
+      : bbox (_bbox), power (_power), axis (_axis),
+	theta_o (_theta_o), theta_e (_theta_e)
+    { }
+    Bounds () : power (0), axis (0, 0, 1), theta_o (0), theta_e (0) { }
+
+    // A bounding-box, in world coordinates, containing every point
+    // which emits light.
+    //
+    BBox bbox;
+
+    // An estimate of the total power emitted, as a scalar.
+    //
+    float power;
+
+    // The normals (or spotlight directions) of all emitting points lie
+    // within a cone around the unit vector AXIS, with half-angle
+    // THETA_O.  Each point emits light within a further angle THETA_E
+    // of its normal (PI/2 for a diffuse surface).  A light which emits
+    // in all directions has a THETA_O of PI.
+    //
+    Vec axis;
+    float theta_o, theta_e;
+  };
+
   // Return a sample of this light from the viewpoint of ISEC (using a
   // surface-normal coordinate system, where the surface normal is
   // (0,0,1)), based on the parameter PARAM.
@@ -139,6 +173,12 @@ public:
   // Evaluate this environmental light in direction DIR (in world-coordinates).
   //
   virtual Color eval_environ (const Vec &/*dir*/) const { return 0; }
+
+  // If this light has a finite extent, set BOUNDS to describe it, and
+  // return true.  Otherwise (e.g., for an environmental light), return
+  // false.  The default implementation returns false.
+  //
+  virtual bool get_bounds (Bounds &/*bounds*/) const { return false; }
 };
 
 
@@ -1,6 +1,6 @@
 // point-light.cc -- Point light
 //
-//  Copyright (C) 2005-2008, 2010, 2012, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2005-2008, 2010, 2012-2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -49,6 +49,11 @@ public:
   //
   virtual bool is_point_light () const { return true; }
 
+  // If this light has a finite extent, set BOUNDS to describe it, and
+  // return true.  Otherwise, return false.
+  //
+  virtual bool get_bounds (Bounds &bounds) const;
+
 private:
 
   const PointLight &light;
@@ -132,6 +137,24 @@ PointLight::Sampler::eval (const Intersect &, const Vec &) const
   return Value ();  // DIR will always fail to point exactly to th
 }
 
+// If this light has a finite extent, set BOUNDS to describe it, and
+// return true.  Otherwise, return false.
+//
+bool
+PointLight::Sampler::get_bounds (Bounds &bounds) const
+{
+  // A point light emits light in every direction within its cone;
+  // THETA_E is zero, as no light is emitted outside the cone.
+  //
+  float theta_o = acos (light.cos_half_angle);
+  float solid_angle = 2 * PIf * (1 - light.cos_half_angle);
+  float power = light.color.intensity () * solid_angle;
+
+  bounds = Bounds (BBox (light.frame.origin), power, light.frame.z,
+		   theta_o, 0);
+  return true;
+}
+
 
 
 // PointLight::transform
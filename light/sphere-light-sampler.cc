@@ -1,6 +1,6 @@
 // sphere-light-sampler.cc -- Spherical light sampler
 //
-//  Copyright (C) 2006-2008, 2010, 2012, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2006-2008, 2010, 2012-2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -194,4 +194,28 @@ SphereLightSampler::eval (const Intersect &isec, const Vec &dir) const
 }
 
 
+
+// SphereLightSampler::get_bounds
+
+// If this light has a finite extent, set BOUNDS to describe it, and
+// return true.  Otherwise, return false.
+//
+bool
+SphereLightSampler::get_bounds (Bounds &bounds) const
+{
+  Vec rvec (radius, radius, radius);
+
+  // Each point on the surface emits diffusely (PI * intensity per unit
+  // area) in the direction of its normal, and the normals point in
+  // every direction.
+  //
+  float area = 4 * PIf * float (radius * radius);
+  float power = PIf * intensity.intensity () * area;
+
+  bounds = Bounds (BBox (pos - rvec, pos + rvec), power,
+		   Vec (0, 0, 1), PIf, PIf / 2);
+  return true;
+}
+
+
 // arch-tag: 1caf0ba2-7ec6-4814-be51-b57bbda71fe8
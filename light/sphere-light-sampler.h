@@ -1,6 +1,6 @@
 // sphere-light-sampler.h -- Spherical light sampler
 //
-//  Copyright (C) 2006-2008, 2010, 2011, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2006-2008, 2010, 2011, 2013, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -46,6 +46,11 @@ public:
   //
   virtual Value eval (const Intersect &isec, const Vec &dir) const;
 
+  // If this light has a finite extent, set BOUNDS to describe it, and
+  // return true.  Otherwise, return false.
+  //
+  virtual bool get_bounds (Bounds &bounds) const;
+
 private:
 
   // Location and size of the light.
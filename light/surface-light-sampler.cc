@@ -1,6 +1,6 @@
 // surface-light-sampler.cc -- General-purpose area light sampler
 //
-//  Copyright (C) 2010, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2010, 2013, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -25,7 +25,8 @@ using namespace snogray;
 
 SurfaceLightSampler::SurfaceLightSampler (const Surface &surface,
 					  const TexVal<Color> &_intensity)
-  : sampler (surface.make_sampler ()), intensity (_intensity.default_val)
+  : sampler (surface.make_sampler ()), intensity (_intensity.default_val),
+    bbox (surface.bbox ())
 {
   if (! sampler)
     throw std::runtime_error
@@ -132,4 +133,61 @@ SurfaceLightSampler::eval (const Intersect &isec, const Vec &dir) const
 }
 
 
+
+
+// SurfaceLightSampler::get_bounds
+
+// If this light has a finite extent, set BOUNDS to describe it, and
+// return true.  Otherwise, return false.
+//
+bool
+SurfaceLightSampler::get_bounds (Bounds &bounds) const
+{
+  // Surface samplers don't tell us the surface's area or normals
+  // directly, so we estimate them from a small grid of samples:  the
+  // area from the sample PDFs (which are 1 / area for uniform
+  // sampling), and the normals by seeing whether they're all the same
+  // (as for a flat surface).  If not, we conservatively assume the
+  // normals may point in any direction.
+  //
+  static const unsigned GRID_SIZE = 3;
+
+  float inv_pdf_sum = 0;
+  unsigned num_pdfs = 0;
+  Vec axis;
+  bool flat = true;
+
+  for (unsigned i = 0; i < GRID_SIZE; i++)
+    for (unsigned j = 0; j < GRID_SIZE; j++)
+      {
+	UV param ((i + 0.5f) / GRID_SIZE, (j + 0.5f) / GRID_SIZE);
+	Surface::Sampler::AreaSample samp = sampler->sample (param);
+
+	if (samp.pdf > 0)
+	  {
+	    inv_pdf_sum += 1 / samp.pdf;
+	    num_pdfs++;
+	  }
+
+	Vec norm = samp.normal.unit ();
+	if (i == 0 && j == 0)
+	  axis = norm;
+	else if (dot (axis, norm) < 0.9999f)
+	  flat = false;
+      }
+
+  if (num_pdfs == 0)
+    return false;
+
+  // Each point on the surface emits diffusely, PI * intensity per unit
+  // area, in the direction of its normal.
+  //
+  float area = inv_pdf_sum / num_pdfs;
+  float power = PIf * intensity.intensity () * area;
+
+  bounds = Bounds (bbox, power, axis, flat ? 0 : PIf, PIf / 2);
+  return true;
+}
+
+
 // arch-tag: 60165b73-d34e-4f49-9a90-958daefdeb78
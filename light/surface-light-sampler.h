@@ -1,6 +1,6 @@
 // surface-light-sampler.h -- General-purpose area light sampler
 //
-//  Copyright (C) 2010, 2011, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2010, 2011, 2013, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -46,6 +46,11 @@ public:
   //
   virtual Value eval (const Intersect &isec, const Vec &dir) const;
 
+  // If this light has a finite extent, set BOUNDS to describe it, and
+  // return true.  Otherwise, return false.
+  //
+  virtual bool get_bounds (Bounds &bounds) const;
+
   // A sampler for the surface which is lit.
   //
   UniquePtr<const Surface::Sampler> sampler;
@@ -55,6 +60,10 @@ private:
   // Radiant emittance of this light (W / m^2).
   //
   Color intensity;
+
+  // Bounding-box of the lit surface.
+  //
+  BBox bbox;
 };
 
 
@@ -1,6 +1,6 @@
 -- sys.lua -- Miscellaneous system functions
 --
---  Copyright (C) 2012  Miles Bader <miles@gnu.org>
+--  Copyright (C) 2012, 2014  Miles Bader <miles@gnu.org>
 --
 -- This source code is free software; you can redistribute it and/or
 -- modify it under the terms of the GNU General Public License as
@@ -27,6 +27,8 @@ sys.rusage = raw.Rusage
 
 sys.num_cores = raw.num_cores
 
+sys.wall_clock_time = raw.wall_clock_time
+
 
 -- return the module
 --
@@ -0,0 +1,180 @@
+// photon-block.h -- Block of photon positions searched in parallel
+//
+//  Copyright (C) 2014  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#ifndef SNOGRAY_PHOTON_BLOCK_H
+#define SNOGRAY_PHOTON_BLOCK_H
+
+#include "config.h"
+
+#if USE_AVX
+# include <immintrin.h>
+#elif USE_SSE
+# include <xmmintrin.h>
+#endif
+
+#include <limits>
+
+#include "geometry/pos.h"
+
+
+namespace snogray {
+
+
+// A fixed-size block of photon positions, stored in
+// "structure-of-arrays" form, so that the distance from a point to
+// every photon in the block can be calculated at once using SIMD
+// instructions.
+//
+// Positions are always stored in single-precision.  Depending on what
+// configure found, either SSE (4 photons per block), AVX (8 photons
+// per block), or a plain C++ loop (4 photons per block) is used.
+//
+// Unused entries in a block are positioned so far away that they are
+// never within any search distance.
+//
+struct PhotonBlock
+{
+#if USE_AVX
+  static const unsigned SIZE = 8;
+#else
+  static const unsigned SIZE = 4;
+#endif
+
+  PhotonBlock ()
+  {
+    for (unsigned axis = 0; axis < 3; axis++)
+      for (unsigned i = 0; i < SIZE; i++)
+	pos[axis][i] = unused_coord ();
+  }
+
+  // Set the position of entry NUM in this block to POS.
+  //
+  void set (unsigned num, const Pos &_pos)
+  {
+    pos[0][num] = _pos.x;
+    pos[1][num] = _pos.y;
+    pos[2][num] = _pos.z;
+  }
+
+  // Return the position of entry NUM in this block.
+  //
+  Pos get (unsigned num) const
+  {
+    return Pos (pos[0][num], pos[1][num], pos[2][num]);
+  }
+
+  // Return a bit-mask with bit N set if entry N in this block is
+  // within a distance of sqrt(MAX_DIST_SQ) of CENTER.  For every such
+  // entry, the square of its distance from CENTER is returned in
+  // DIST_SQ[N]; other entries in DIST_SQ are undefined.
+  //
+  unsigned find (const Pos &center, float max_dist_sq, float dist_sq[SIZE])
+    const;
+
+  // Return the coordinate used for each axis of unused entries.  Its
+  // square overflows to infinity, so it can never be within a search
+  // distance.
+  //
+  static float unused_coord () { return std::numeric_limits<float>::max (); }
+
+  // The position of each photon, with the coordinates for each axis
+  // stored contiguously.
+  //
+  float pos[3][SIZE];
+};
+
+
+
+// PhotonBlock::find
+
+#if USE_AVX
+
+inline unsigned
+PhotonBlock::find (const Pos &center, float max_dist_sq,
+		   float dist_sq_out[SIZE])
+  const
+{
+  __m256 dx = _mm256_sub_ps (_mm256_loadu_ps (pos[0]),
+			     _mm256_set1_ps (center.x));
+  __m256 dy = _mm256_sub_ps (_mm256_loadu_ps (pos[1]),
+			     _mm256_set1_ps (center.y));
+  __m256 dz = _mm256_sub_ps (_mm256_loadu_ps (pos[2]),
+			     _mm256_set1_ps (center.z));
+
+  __m256 dist_sq = _mm256_add_ps (_mm256_add_ps (_mm256_mul_ps (dx, dx),
+						 _mm256_mul_ps (dy, dy)),
+				  _mm256_mul_ps (dz, dz));
+
+  _mm256_storeu_ps (dist_sq_out, dist_sq);
+
+  return _mm256_movemask_ps (_mm256_cmp_ps (dist_sq,
+					    _mm256_set1_ps (max_dist_sq),
+					    _CMP_LT_OQ));
+}
+
+#elif USE_SSE
+
+inline unsigned
+PhotonBlock::find (const Pos &center, float max_dist_sq,
+		   float dist_sq_out[SIZE])
+  const
+{
+  __m128 dx = _mm_sub_ps (_mm_loadu_ps (pos[0]), _mm_set1_ps (center.x));
+  __m128 dy = _mm_sub_ps (_mm_loadu_ps (pos[1]), _mm_set1_ps (center.y));
+  __m128 dz = _mm_sub_ps (_mm_loadu_ps (pos[2]), _mm_set1_ps (center.z));
+
+  __m128 dist_sq = _mm_add_ps (_mm_add_ps (_mm_mul_ps (dx, dx),
+					   _mm_mul_ps (dy, dy)),
+			       _mm_mul_ps (dz, dz));
+
+  _mm_storeu_ps (dist_sq_out, dist_sq);
+
+  return _mm_movemask_ps (_mm_cmplt_ps (dist_sq, _mm_set1_ps (max_dist_sq)));
+}
+
+#else // !USE_AVX && !USE_SSE
+
+// Portable version.  This is written as a simple loop over the block
+// with no early exits, so a vectorizing compiler can often do a
+// reasonable job with it.
+//
+inline unsigned
+PhotonBlock::find (const Pos &center, float max_dist_sq,
+		   float dist_sq_out[SIZE])
+  const
+{
+  float cx = center.x, cy = center.y, cz = center.z;
+
+  unsigned mask = 0;
+
+  for (unsigned i = 0; i < SIZE; i++)
+    {
+      float dx = pos[0][i] - cx;
+      float dy = pos[1][i] - cy;
+      float dz = pos[2][i] - cz;
+
+      float dist_sq = dx * dx + dy * dy + dz * dz;
+
+      dist_sq_out[i] = dist_sq;
+
+      mask |= unsigned (dist_sq < max_dist_sq) << i;
+    }
+
+  return mask;
+}
+
+#endif // USE_AVX / USE_SSE
+
+
+}
+
+#endif // SNOGRAY_PHOTON_BLOCK_H
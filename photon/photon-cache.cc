@@ -0,0 +1,559 @@
+// photon-cache.cc -- On-disk cache of photon-maps
+//
+//  Copyright (C) 2014  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#include "config.h"
+
+#include <fstream>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+
+extern "C"
+{
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#if HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#if HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+}
+
+#include "util/snogassert.h"
+#include "util/excepts.h"
+#include "util/unique-ptr.h"
+#include "util/file-funs.h"
+#include "geometry/bbox.h"
+#include "geometry/uv.h"
+#include "light/light-sampler.h"
+#include "render/scene.h"
+
+#include "photon-cache.h"
+
+
+using namespace snogray;
+
+
+// Header at the beginning of every cache file.  Everything following
+// the header is covered by the checksum.
+//
+struct PhotonCache::Header
+{
+  // Always MAGIC.
+  //
+  char magic[8];
+
+  // The type of user which wrote the file, as passed to
+  // PhotonCache::save.
+  //
+  char type[16];
+
+  // Always BYTE_ORDER_MARK, as written by the machine which wrote the
+  // file; this detects files written with a different byte order.
+  //
+  unsigned byte_order_mark;
+
+  // Sizes of various types in the program which wrote the file, and
+  // the number of photons in each photon block.
+  //
+  unsigned header_size, map_info_size;
+  unsigned node_size, block_size, packed_photon_size;
+  unsigned block_photons;
+
+  // The number of photon-maps in the file.
+  //
+  unsigned num_maps;
+
+  // The key of the inputs the photons were generated from.
+  //
+  unsigned long long key_hash;
+
+  // The total file size.
+  //
+  unsigned long long file_size;
+
+  // Hash of everything in the file following the header.
+  //
+  unsigned long long checksum;
+};
+
+// Information about a single photon-map in a cache file.
+//
+struct PhotonCache::MapInfo
+{
+  // The number of photons, kd-tree nodes, and photon blocks.
+  //
+  unsigned num_photons, num_nodes, num_blocks;
+
+  // Amount by which each photon should be scaled during rendering.
+  //
+  float scale;
+
+  // Offsets in the file of the map's nodes, blocks, and packed
+  // photons.
+  //
+  unsigned long long nodes_offset, blocks_offset, packed_photons_offset;
+};
+
+static const char MAGIC[8] = "snogpht";
+static const unsigned BYTE_ORDER_MARK = 0x01020304;
+
+// Each section of a cache file starts at a multiple of this many
+// bytes, which is larger than the alignment any photon-map data
+// structure should need.
+//
+static const unsigned SECTION_ALIGNMENT = 64;
+
+// Return OFFSET rounded up to a multiple of SECTION_ALIGNMENT.
+//
+static unsigned long long
+align_offset (unsigned long long offset)
+{
+  return (offset + SECTION_ALIGNMENT - 1) & ~(SECTION_ALIGNMENT - 1ULL);
+}
+
+
+// PhotonCache::hash_words
+
+// Update HASH with the SIZE bytes at DATA, and return the result.
+// SIZE should be a multiple of sizeof (unsigned).
+//
+// This is basically FNV-1a, but operating on a word at a time, as
+// bytewise hashing is unnecessarily slow for large cache files.
+//
+unsigned long long
+PhotonCache::hash_words (unsigned long long hash, const void *data,
+			 size_t size)
+{
+  const char *bytes = static_cast<const char *> (data);
+  size_t num_words = size / sizeof (unsigned);
+
+  for (size_t i = 0; i < num_words; i++)
+    {
+      // DATA may be of any type, so use memcpy to avoid aliasing
+      // problems (it will be optimized into a simple load).
+      //
+      unsigned word;
+      memcpy (&word, bytes + i * sizeof word, sizeof word);
+
+      hash = (hash ^ word) * 1099511628211ULL;
+    }
+
+  return hash;
+}
+
+
+// PhotonCache::Key
+
+// Add the SIZE bytes at DATA to the key.  SIZE should be a multiple of
+// sizeof (unsigned).
+//
+void
+PhotonCache::Key::add (const void *data, size_t size)
+{
+  hash = hash_words (hash, data, size);
+}
+
+// Add a parameter value to the key.  Coordinates are always added in
+// single-precision, so keys don't depend on how the program was
+// configured.
+//
+void
+PhotonCache::Key::add (const Pos &pos)
+{
+  float coords[3] = { float (pos.x), float (pos.y), float (pos.z) };
+  add (coords, sizeof coords);
+}
+void
+PhotonCache::Key::add (const Vec &vec)
+{
+  float coords[3] = { float (vec.x), float (vec.y), float (vec.z) };
+  add (coords, sizeof coords);
+}
+void
+PhotonCache::Key::add (const Color &color)
+{
+  float comps[3] = { float (color.r ()), float (color.g ()),
+		     float (color.b ()) };
+  add (comps, sizeof comps);
+}
+
+// Add a description of SCENE to the key.  This uses the scene's
+// bounding-box and surface statistics, and for every light, its bounds
+// and a fixed set of samples of its emission, which detects most
+// changes to the geometry or the lighting.  It does not detect changes
+// to materials, or movement of surfaces within the scene, which don't
+// change these.
+//
+void
+PhotonCache::Key::add (const Scene &scene)
+{
+  // Number of light-sample parameters along each dimension; every
+  // light is sampled this many times squared.
+  //
+  static const unsigned LIGHT_SAMPLE_STEPS = 4;
+
+  BBox bbox = scene.bbox ();
+  add (bbox.min);
+  add (bbox.max);
+
+  Surface::Stats stats = scene.surface_stats ();
+  add (unsigned (stats.num_render_surfaces));
+  add (unsigned (stats.num_real_surfaces));
+  add (unsigned (stats.num_lights));
+
+  add (unsigned (scene.light_samplers.size ()));
+
+  for (std::vector<const Light::Sampler *>::const_iterator si
+	 = scene.light_samplers.begin ();
+       si != scene.light_samplers.end (); ++si)
+    {
+      const Light::Sampler *sampler = *si;
+
+      add (unsigned (sampler->is_point_light ()));
+      add (unsigned (sampler->is_environ_light ()));
+
+      Light::Sampler::Bounds bounds;
+      if (sampler->get_bounds (bounds))
+	{
+	  add (bounds.bbox.min);
+	  add (bounds.bbox.max);
+	  add (bounds.power);
+	  add (bounds.axis);
+	  add (bounds.theta_o);
+	  add (bounds.theta_e);
+	}
+
+      // Samples at fixed parameters reflect the light's shape,
+      // position, and emission.
+      //
+      for (unsigned i = 0; i < LIGHT_SAMPLE_STEPS; i++)
+	for (unsigned j = 0; j < LIGHT_SAMPLE_STEPS; j++)
+	  {
+	    UV param ((i + 0.5f) / LIGHT_SAMPLE_STEPS,
+		      (j + 0.5f) / LIGHT_SAMPLE_STEPS);
+	    UV dir_param (param.v, param.u);
+
+	    Light::Sampler::FreeSample samp
+	      = sampler->sample (param, dir_param);
+
+	    add (samp.val);
+	    add (samp.pdf);
+	    add (samp.pos);
+	    add (samp.dir);
+	  }
+    }
+}
+
+
+// PhotonCache::load
+
+// Return a PhotonCache object for the cache file FILE_NAME, if it holds
+// NUM_MAPS photon-maps for a user of type TYPE, generated from the
+// inputs identified by KEY.  If the file doesn't exist or is unusable
+// for any reason, return a null pointer instead.
+//
+PhotonCache *
+PhotonCache::load (const std::string &file_name, const char *type,
+		   unsigned num_maps, const Key &key)
+{
+#if HAVE_UNISTD_H && HAVE_FCNTL_H && HAVE_SYS_MMAN_H && HAVE_SYS_STAT_H
+
+  int fd = open (file_name.c_str (), O_RDONLY);
+  if (fd < 0)
+    return 0;
+
+  void *map = MAP_FAILED;
+  size_t map_size = 0;
+
+  struct stat statb;
+  if (fstat (fd, &statb) == 0 && size_t (statb.st_size) >= sizeof (Header))
+    {
+      map_size = statb.st_size;
+      map = mmap (0, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+
+  // The mapping remains valid after the file is closed.
+  //
+  close (fd);
+
+  if (map == MAP_FAILED)
+    return 0;
+
+  UniquePtr<PhotonCache> cache (new PhotonCache (map, map_size));
+
+  if (! cache->valid (type, num_maps, key))
+    return 0;
+
+  return cache.release ();
+
+#else // !(HAVE_UNISTD_H && HAVE_FCNTL_H && HAVE_SYS_MMAN_H && HAVE_SYS_STAT_H)
+
+  // Without mmap, just always shoot photons.
+  //
+  return 0;
+
+#endif // HAVE_UNISTD_H && HAVE_FCNTL_H && HAVE_SYS_MMAN_H && HAVE_SYS_STAT_H
+}
+
+PhotonCache::~PhotonCache ()
+{
+#if HAVE_SYS_MMAN_H
+  munmap (const_cast<void *> (map), map_size);
+#endif
+}
+
+
+// PhotonCache::layout
+
+// Set the section offsets in the NUM_MAPS entries of MAP_INFOS, from
+// their sizes, and return the total file size.
+//
+unsigned long long
+PhotonCache::layout (MapInfo *map_infos, unsigned num_maps)
+{
+  unsigned long long offset
+    = align_offset (sizeof (Header) + num_maps * sizeof (MapInfo));
+
+  for (unsigned m = 0; m < num_maps; m++)
+    {
+      MapInfo &info = map_infos[m];
+
+      info.nodes_offset = offset;
+      offset += (unsigned long long)info.num_nodes * sizeof (PhotonMap::Node);
+
+      info.blocks_offset = align_offset (offset);
+      offset = (info.blocks_offset
+		+ (unsigned long long)info.num_blocks * sizeof (PhotonBlock));
+
+      info.packed_photons_offset = align_offset (offset);
+      offset = (info.packed_photons_offset
+		+ ((unsigned long long)info.num_blocks * PhotonBlock::SIZE
+		   * sizeof (PhotonMap::PackedPhoton)));
+
+      offset = align_offset (offset);
+    }
+
+  return offset;
+}
+
+
+// PhotonCache::valid
+
+// Return true if this cache file holds NUM_MAPS photon-maps for a user
+// of type TYPE, generated from the inputs identified by KEY, and isn't
+// corrupt.
+//
+bool
+PhotonCache::valid (const char *type, unsigned num_maps, const Key &key)
+  const
+{
+  const Header &hdr = header ();
+
+  // Check that this is the kind of file we want, written by a
+  // compatible program, from the same inputs.
+  //
+  if (memcmp (hdr.magic, MAGIC, sizeof MAGIC) != 0
+      || strncmp (hdr.type, type, sizeof hdr.type) != 0
+      || hdr.byte_order_mark != BYTE_ORDER_MARK
+      || hdr.header_size != sizeof (Header)
+      || hdr.map_info_size != sizeof (MapInfo)
+      || hdr.node_size != sizeof (PhotonMap::Node)
+      || hdr.block_size != sizeof (PhotonBlock)
+      || hdr.packed_photon_size != sizeof (PhotonMap::PackedPhoton)
+      || hdr.block_photons != PhotonBlock::SIZE
+      || hdr.num_maps != num_maps
+      || hdr.key_hash != key.hash
+      || hdr.file_size != map_size
+      || map_size < sizeof (Header) + num_maps * sizeof (MapInfo))
+    return false;
+
+  // Check that the file layout is sane.
+  //
+  std::vector<MapInfo> expected (num_maps);
+  for (unsigned m = 0; m < num_maps; m++)
+    expected[m] = map_info (m);
+
+  if (layout (num_maps ? &expected[0] : 0, num_maps) != hdr.file_size)
+    return false;
+
+  for (unsigned m = 0; m < num_maps; m++)
+    {
+      const MapInfo &info = map_info (m);
+      if (info.nodes_offset != expected[m].nodes_offset
+	  || info.blocks_offset != expected[m].blocks_offset
+	  || (info.packed_photons_offset
+	      != expected[m].packed_photons_offset))
+	return false;
+    }
+
+  // Finally, make sure the contents weren't corrupted.
+  //
+  unsigned long long checksum
+    = hash_words (HASH_INIT, at (sizeof (Header)),
+		  map_size - sizeof (Header));
+
+  return checksum == hdr.checksum;
+}
+
+
+// PhotonCache::save
+
+// Write a cache file FILE_NAME holding the photon-maps MAPS, with
+// photon scale-factors SCALES, for a user of type TYPE, generated from
+// the inputs identified by KEY.
+//
+// The file is written under a temporary name and then renamed, so
+// other processes using an old version of the file are unaffected.  If
+// the file can't be written, an exception is thrown.
+//
+void
+PhotonCache::save (const std::string &file_name, const char *type,
+		   const Key &key,
+		   const std::vector<const PhotonMap *> &maps,
+		   const std::vector<float> &scales)
+{
+  ASSERT (scales.size () == maps.size ());
+
+  unsigned num_maps = maps.size ();
+
+  Header hdr;
+  memset (&hdr, 0, sizeof hdr);
+
+  memcpy (hdr.magic, MAGIC, sizeof MAGIC);
+  strncpy (hdr.type, type, sizeof hdr.type - 1);
+
+  hdr.byte_order_mark = BYTE_ORDER_MARK;
+  hdr.header_size = sizeof (Header);
+  hdr.map_info_size = sizeof (MapInfo);
+  hdr.node_size = sizeof (PhotonMap::Node);
+  hdr.block_size = sizeof (PhotonBlock);
+  hdr.packed_photon_size = sizeof (PhotonMap::PackedPhoton);
+  hdr.block_photons = PhotonBlock::SIZE;
+
+  hdr.num_maps = num_maps;
+  hdr.key_hash = key.hash;
+
+  std::vector<MapInfo> map_infos (num_maps);
+  for (unsigned m = 0; m < num_maps; m++)
+    {
+      MapInfo &info = map_infos[m];
+      memset (&info, 0, sizeof info);
+
+      info.num_photons = maps[m]->num_photons;
+      info.num_nodes = maps[m]->num_nodes;
+      info.num_blocks = maps[m]->num_blocks;
+      info.scale = scales[m];
+    }
+
+  hdr.file_size = layout (num_maps ? &map_infos[0] : 0, num_maps);
+
+  // Assemble the whole file in memory, so we can compute the
+  // checksum of everything following the header before writing
+  // anything.  The header is always present, so CONTENTS is never
+  // empty, even if there are no photon-maps.
+  //
+  std::vector<char> contents (hdr.file_size, 0);
+  char *file_start = &contents[0];
+
+  if (num_maps != 0)
+    memcpy (file_start + sizeof (Header), &map_infos[0],
+	    num_maps * sizeof (MapInfo));
+
+  for (unsigned m = 0; m < num_maps; m++)
+    {
+      const PhotonMap &pmap = *maps[m];
+      const MapInfo &info = map_infos[m];
+
+      if (info.num_nodes != 0)
+	memcpy (file_start + info.nodes_offset, pmap.nodes,
+		info.num_nodes * sizeof (PhotonMap::Node));
+      if (info.num_blocks != 0)
+	{
+	  memcpy (file_start + info.blocks_offset, pmap.blocks,
+		  info.num_blocks * sizeof (PhotonBlock));
+	  memcpy (file_start + info.packed_photons_offset,
+		  pmap.packed_photons,
+		  (info.num_blocks * PhotonBlock::SIZE
+		   * sizeof (PhotonMap::PackedPhoton)));
+	}
+    }
+
+  hdr.checksum = hash_words (HASH_INIT, file_start + sizeof (Header),
+			     contents.size () - sizeof (Header));
+
+  memcpy (file_start, &hdr, sizeof hdr);
+
+  std::string temp_name = temp_file_name (file_name);
+
+  {
+    std::ofstream out (temp_name.c_str (), std::ios::binary);
+
+    out.write (file_start, contents.size ());
+
+    if (! out)
+      {
+	int err = errno;
+	out.close ();
+	remove (temp_name.c_str ());
+	throw file_error (temp_name + ": " + strerror (err));
+      }
+  }
+
+  if (rename (temp_name.c_str (), file_name.c_str ()) != 0)
+    {
+      int err = errno;
+      remove (temp_name.c_str ());
+      throw file_error (file_name + ": " + strerror (err));
+    }
+}
+
+
+// PhotonCache accessors
+
+// Return the information for photon-map number MAP_NUM.
+//
+const PhotonCache::MapInfo &
+PhotonCache::map_info (unsigned map_num) const
+{
+  return static_cast<const MapInfo *> (at (sizeof (Header)))[map_num];
+}
+
+// Make MAP use photon-map number MAP_NUM in this cache file, and return
+// its photon scale-factor in SCALE.  MAP refers directly to the mapped
+// file, so may only be used as long as this object exists.  Return
+// false if the cached photon-map is unusable (in which case MAP is left
+// empty).
+//
+bool
+PhotonCache::get_map (unsigned map_num, PhotonMap &map, float &scale) const
+{
+  ASSERT (map_num < header ().num_maps);
+
+  const MapInfo &info = map_info (map_num);
+
+  scale = info.scale;
+
+  return map.set_cached (
+	       static_cast<const PhotonMap::Node *> (at (info.nodes_offset)),
+	       info.num_nodes,
+	       static_cast<const PhotonBlock *> (at (info.blocks_offset)),
+	       info.num_blocks,
+	       static_cast<const PhotonMap::PackedPhoton *> (
+		 at (info.packed_photons_offset)),
+	       info.num_photons);
+}
@@ -0,0 +1,185 @@
+// photon-cache.h -- On-disk cache of photon-maps
+//
+//  Copyright (C) 2014  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#ifndef SNOGRAY_PHOTON_CACHE_H
+#define SNOGRAY_PHOTON_CACHE_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+#include "color/color.h"
+#include "geometry/pos.h"
+#include "geometry/vec.h"
+#include "photon-map.h"
+
+
+namespace snogray {
+
+
+class Scene;
+
+
+// A PhotonCache is a cache file holding one or more photon-maps,
+// mapped into memory.  When a static scene is rendered many times
+// (e.g., from different viewpoints), the same photons are shot every
+// time, so the photon-maps built once can be saved with
+// PhotonCache::save, and later mapped back in with PhotonCache::load.
+//
+// Each photon-map is stored as its kd-tree nodes, photon blocks, and
+// packed photons, which a PhotonMap uses directly from the mapped
+// file, along with a scale factor for its photons.
+//
+// Every cache file is tagged with a PhotonCache::Key, computed from
+// the scene, its lights, and whatever parameters affect the photons,
+// and with the type of the photon-maps' user, and the layout of
+// photon-map data structures; PhotonCache::load ignores any file that
+// doesn't match, or which appears to be corrupt, and the caller should
+// then shoot photons normally (and probably save them to the cache
+// again).
+//
+class PhotonCache
+{
+public:
+
+  // A key identifying the inputs photons were generated from.
+  //
+  class Key
+  {
+  public:
+
+    Key () : hash (HASH_INIT) { }
+
+    // Add the SIZE bytes at DATA to the key.  SIZE should be a
+    // multiple of sizeof (unsigned).
+    //
+    void add (const void *data, size_t size);
+
+    // Add a parameter value to the key.
+    //
+    void add (unsigned val) { add (&val, sizeof val); }
+    void add (float val) { add (&val, sizeof val); }
+    void add (const Pos &pos);
+    void add (const Vec &vec);
+    void add (const Color &color);
+
+    // Add a description of SCENE to the key.  This uses the scene's
+    // bounding-box and surface statistics, and for every light, its
+    // bounds and a fixed set of samples of its emission, which
+    // detects most changes to the geometry or the lighting.  It does
+    // not detect changes to materials, or movement of surfaces
+    // within the scene, which don't change these; the caller should
+    // also add something which does, such as a small sample of the
+    // photons themselves.
+    //
+    void add (const Scene &scene);
+
+    unsigned long long hash;
+  };
+
+  ~PhotonCache ();
+
+  // Return a PhotonCache object for the cache file FILE_NAME, if it
+  // holds NUM_MAPS photon-maps for a user of type TYPE, generated
+  // from the inputs identified by KEY.  If the file doesn't exist or
+  // is unusable for any reason, return a null pointer instead.
+  //
+  // TYPE is a short string (at most 15 characters) naming the user of
+  // the cache; it should also include a version number, which must
+  // be changed whenever the way its photons are generated changes.
+  //
+  static PhotonCache *load (const std::string &file_name, const char *type,
+			    unsigned num_maps, const Key &key);
+
+  // Write a cache file FILE_NAME holding the photon-maps MAPS, with
+  // photon scale-factors SCALES, for a user of type TYPE, generated
+  // from the inputs identified by KEY.
+  //
+  // The file is written under a temporary name and then renamed, so
+  // other processes using an old version of the file are unaffected.
+  // If the file can't be written, an exception is thrown.
+  //
+  static void save (const std::string &file_name, const char *type,
+		    const Key &key,
+		    const std::vector<const PhotonMap *> &maps,
+		    const std::vector<float> &scales);
+
+  // Make MAP use photon-map number MAP_NUM in this cache file, and
+  // return its photon scale-factor in SCALE.  MAP refers directly to
+  // the mapped file, so may only be used as long as this object
+  // exists.  Return false if the cached photon-map is unusable (in
+  // which case MAP is left empty).
+  //
+  bool get_map (unsigned map_num, PhotonMap &map, float &scale) const;
+
+private:
+
+  // Header at the beginning of every cache file.
+  //
+  struct Header;
+
+  // Information about a single photon-map in a cache file.  An array
+  // of these immediately follows the header.
+  //
+  struct MapInfo;
+
+  // Initial hash value used for both Key and file checksums.
+  //
+  static const unsigned long long HASH_INIT = 14695981039346656037ULL;
+
+  // Update HASH with the SIZE bytes at DATA, and return the result.
+  // SIZE should be a multiple of sizeof (unsigned).
+  //
+  static unsigned long long hash_words (unsigned long long hash,
+					const void *data, size_t size);
+
+  // Set the section offsets in the NUM_MAPS entries of MAP_INFOS, from
+  // their sizes, and return the total file size.
+  //
+  static unsigned long long layout (MapInfo *map_infos, unsigned num_maps);
+
+  PhotonCache (const void *_map, size_t _map_size)
+    : map (_map), map_size (_map_size)
+  { }
+
+  // Return true if this cache file holds NUM_MAPS photon-maps for a
+  // user of type TYPE, generated from the inputs identified by KEY,
+  // and isn't corrupt.
+  //
+  bool valid (const char *type, unsigned num_maps, const Key &key) const;
+
+  const Header &header () const
+  {
+    return *static_cast<const Header *> (map);
+  }
+
+  // Return the information for photon-map number MAP_NUM.
+  //
+  const MapInfo &map_info (unsigned map_num) const;
+
+  // Return a pointer to the data at OFFSET bytes into the file.
+  //
+  const void *at (unsigned long long offset) const
+  {
+    return static_cast<const char *> (map) + offset;
+  }
+
+  // The memory-mapped file.
+  //
+  const void *map;
+  size_t map_size;
+};
+
+
+}
+
+#endif // SNOGRAY_PHOTON_CACHE_H
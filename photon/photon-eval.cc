@@ -1,6 +1,6 @@
 // photon-eval.cc -- Photon-map evaluation (lighting, etc)
 //
-//  Copyright (C) 2010, 2012, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2010, 2012, 2013, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -88,10 +88,10 @@ PhotonEval::Lo (const Intersect &isec, const PhotonMap &photon_map,
 
   Color radiance = 0;
 
-  for (std::vector<const Photon *>::iterator i = found_photons.begin();
+  for (std::vector<Photon>::iterator i = found_photons.begin();
        i != found_photons.end (); ++i)
     {
-      const Photon &ph = **i;
+      const Photon &ph = *i;
 
       // Evaluate the BSDF in the photon's direction.
       //
@@ -117,10 +117,10 @@ PhotonEval::Lo (const Intersect &isec, const PhotonMap &photon_map,
   //
   if (global.marker_radius_sq != 0)
     {
-      for (std::vector<const Photon *>::iterator i = found_photons.begin();
+      for (std::vector<Photon>::iterator i = found_photons.begin();
 	   i != found_photons.end (); ++i)
 	{
-	  const Photon &ph = **i;
+	  const Photon &ph = *i;
 	  dist_t dist_sq = (ph.pos - isec.normal_frame.origin).length_squared();
 	  if (dist_sq < global.marker_radius_sq)
 	    {
@@ -159,10 +159,10 @@ PhotonEval::photon_dist (const Intersect &isec, const PhotonMap &photon_map)
 
   // Generate a distribution from the photon directions we found.
   //
-  for (std::vector<const Photon *>::iterator i = found_photons.begin();
+  for (std::vector<Photon>::iterator i = found_photons.begin();
        i != found_photons.end (); ++i)
     {
-      const Vec &dir = (*i)->dir;
+      const Vec &dir = i->dir;
 
 #if 0
       // Incorporate the BSDF response into the photon distribution
@@ -171,11 +171,11 @@ PhotonEval::photon_dist (const Intersect &isec, const PhotonMap &photon_map)
       Bsdf::Value bsdf_val
 	= isec.bsdf->eval (bsdf_dir, Bsdf::ALL & ~Bsdf::SPECULAR);
 
-      Color ph_pow = (*i)->power;
+      Color ph_pow = i->power;
       Color filt_ph_pow = ph_pow * bsdf_val.val;
       intens_t filt_ph_intens = filt_ph_pow.intensity();
 #else
-      Color ph_pow = (*i)->power;
+      Color ph_pow = i->power;
       intens_t filt_ph_intens = ph_pow.intensity();
 #endif
 
@@ -1,6 +1,6 @@
 // photon-eval.h -- Photon-map evaluation (lighting, etc)
 //
-//  Copyright (C) 2010, 2011, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2010, 2011, 2013, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -58,7 +58,7 @@ public:
   // This is a temporary vector used by PhotonEval::Lo.  We keep it as
   // a field here to avoid memory-allocation churn.
   //
-  std::vector<const Photon *> found_photons;
+  std::vector<Photon> found_photons;
 
   // Temporary objects used by PhotonEval::photon_dist to avoid memory
   // allocation overhead.
@@ -1,6 +1,6 @@
-// photon-map.h -- Data structure to hold photons in space
+// photon-map.cc -- Data structure to hold photons in space
 //
-//  Copyright (C) 2010, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2010, 2013, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -20,7 +20,6 @@
 using namespace snogray;
 
 
-
 
 // Set the photons in this PhotonMap to the photons in NEW_PHOTONS, and
 // build a kd-tree for them.  The contents of NEW_PHOTONS are modified
@@ -29,82 +28,44 @@ using namespace snogray;
 void
 PhotonMap::set_photons (std::vector<Photon> &new_photons)
 {
-  // Size the PHOTONS and KD_TREE_NODE_SPLIT_AXES vectors appropriately.
+  num_photons = new_photons.size ();
+
+  unsigned new_num_blocks
+    = (num_photons + PhotonBlock::SIZE - 1) / PhotonBlock::SIZE;
+
+  // A kd-tree with NEW_NUM_BLOCKS leaves has 2 * NEW_NUM_BLOCKS - 1
+  // nodes.
   //
-  photons.resize (new_photons.size ());
-  kd_tree_node_split_axes.resize (photons.size ());
+  node_storage.clear ();
+  node_storage.reserve (new_num_blocks * 2);
+  block_storage.clear ();
+  block_storage.reserve (new_num_blocks);
+  packed_photon_storage.clear ();
+  packed_photon_storage.reserve (new_num_blocks * PhotonBlock::SIZE);
 
   // Build the kdtree.
   //
-  if (! photons.empty ())
-    make_kdtree (new_photons.begin(), new_photons.end(), 0);
-}
+  if (num_photons != 0)
+    make_kdtree (new_photons.begin(), new_photons.end());
 
-
-// left_balanced_left_child_nodes
+  use_storage ();
+}
 
-// Return the number of nodes in the left child of a left-balanced
-// tree with NUM total nodes.
+// Make the pointers to nodes, blocks, and packed photons refer to the
+// storage vectors.
 //
-// See J. A. Bærentzen, "On Left-balancing Binary Trees",
-// Image Analysis & Computer Graphics, 2003-Aug
-// http://www2.imm.dtu.dk/pubdb/p.php?2535
-//
-static unsigned
-left_balanced_left_child_nodes (unsigned num)
+void
+PhotonMap::use_storage ()
 {
-  // Maximum number of nodes at the bottom level of the tree _if the
-  // bottom level is completely filled_.
-  //
-  // A perfectly balanced binary tree will have 2^n - 1 nodes with
-  // 2^(n - 1) leaf nodes in the bottom row, and 2^(n - 1) - 1 nodes
-  // in the rest of the tree (the "non-bottom" nodes).
-  //
-  // For a tree with a number of nodes other than 2^n - 1, we can
-  // still think of there being 2^(n - 1) - 1 non-bottom nodes and
-  // fewer than 2^(n - 1) nodes in the bottom row.
-  //
-  unsigned max_bottom = 1;
-  while (max_bottom * 2 <= num)
-    max_bottom += max_bottom;
+  num_nodes = node_storage.size ();
+  num_blocks = block_storage.size ();
 
-  // Number of nodes in all levels except the bottom.
-  //
-  unsigned non_bottom = max_bottom - 1;
-
-  // Remainder of nodes, which must be stored in the bottom level.
-  //
-  unsigned bottom = num - non_bottom;
-
-  // Maximum possible (leaf) nodes in the bottom row of the
-  // left-child, if it were filled.
-  //
-  unsigned left_child_max_bottom = max_bottom / 2;
-
-  // The number of non-bottom nodes in the left child, which is simply
-  // the number of non-bottom nodes, minus 1 for this node, and then
-  // divided by two (the right half will have the same number of
-  // non-bottom nodes).
-  //
-  unsigned left_child_non_bottom = (non_bottom - 1) / 2;
-
-  // The number of bottom nodes in the left child.  If the total
-  // number of bottom nodes is less than half the maximum possible
-  // bottom nodes, then all bottom nodes will be in the left child
-  // (with the right-child having none); otherwise, the left child
-  // will have all the bottom nodes it can hold, with the remainder
-  // stored in the right-child.
-  //
-  unsigned left_child_bottom = min (bottom, left_child_max_bottom);
-
-  // The total number of nodes in the left child is simply the sum of
-  // the number of left-child non-bottom nodes and the number of
-  // left-child bottom nodes.
-  //
-  return left_child_non_bottom + left_child_bottom;
+  nodes = num_nodes ? &node_storage[0] : 0;
+  blocks = num_blocks ? &block_storage[0] : 0;
+  packed_photons = num_blocks ? &packed_photon_storage[0] : 0;
 }
 
-
+
 
 namespace { // keep local to file
 
@@ -126,231 +87,411 @@ struct photon_axis_cmp
 } // namespace
 
 
-// Copy photons from the source-range BEG to END, into the
-// PhotonMap::photons vector in kd-tree heap order, with the root at
-// index TARGET_INDEX (in PhotonMap::photons).  The ordering of photons
-// in the source range may be changed.
+// Add nodes for the photons from BEG to END to the kd-tree, along with
+// blocks holding the photons, and return the index of the first node
+// added.  The ordering of photons in the source range may be changed.
 //
-void
+unsigned
 PhotonMap::make_kdtree (const std::vector<Photon>::iterator &beg,
-			const std::vector<Photon>::iterator &end,
-			unsigned target_index)
+			const std::vector<Photon>::iterator &end)
 {
   // We always require at least a single photon range.
   //
   ASSERT (beg != end);
 
-  // Make sure we're writing to a valid position in PhotonMap::photons.
-  //
-  ASSERT (target_index < photons.size());
-    
-  // The position of the median photon in our range.  This starts as
-  // BEG to handle the leaf-node case; for other cases, the number of
-  // children in the left-child will be added below.
-  //
-  std::vector<Photon>::iterator median = beg;
+  unsigned node_index = node_storage.size ();
+  node_storage.push_back (Node ());
 
-  // This will be the split-axis, the axis along which we split this
-  // kd-tree node to form child nodes.
-  //
-  unsigned split_axis = 0;
+  unsigned num = end - beg;
 
-  // If there's more than a single-photon in our range, find the best
-  // axis to split along, re-arrange the photons in our range
-  // accordingly, and make child kd-tree nodes.
+  // If the photons in our range fit in a single block, just make a
+  // leaf node for them.
   //
-  if (beg + 1 != end)
+  if (num <= PhotonBlock::SIZE)
     {
-      // Find the bounding box of all the photons in our range.
-      //
-      // Note that we could avoid this calculation by passing the
-      // bounding box as an argument during recursion, and shrinking it
-      // to reflect splits, but re-calculating each time should yield
-      // smaller bounding boxes, and shouldn't add significant run-time
-      // -- it's O(beg-end), but so is our call to std::nth_element.
-      //
-      BBox bbox;
-      for (std::vector<Photon>::iterator i = beg; i != end; ++i)
-	bbox += i->pos;
+      unsigned block_index = block_storage.size ();
 
-      // Find the largest axis of the bounding-box, and make that our
-      // split-axis.
-      //
-      dist_t max_bbox_dimen = 0;
-      for (unsigned axis = 0; axis < 3; axis++)
+      block_storage.push_back (PhotonBlock ());
+      packed_photon_storage.resize (packed_photon_storage.size ()
+				    + PhotonBlock::SIZE);
+
+      PhotonBlock &block = block_storage.back ();
+      for (unsigned i = 0; i < num; i++)
 	{
-	  dist_t dimen = bbox.max[axis] - bbox.min[axis];
-	  if (dimen > max_bbox_dimen)
-	    {
-	      max_bbox_dimen = dimen;
-	      split_axis = axis;
-	    }
-	} 
+	  block.set (i, beg[i].pos);
+	  packed_photon_storage[block_index * PhotonBlock::SIZE + i]
+	    = PackedPhoton (beg[i]);
+	}
 
-      // Now add the number of photons in the the left-child to MEDIAN
-      // (which started as BEG) get the true median position.
-      //
-      median += left_balanced_left_child_nodes (end - beg);
-
-      // Now partition the photons in our range so the photon at
-      // position MEDIAN is the the median photon in our range, on the
-      // SPLIT_AXIS axis, and every photon from BEG to MEDIAN-1 has a
-      // position less than the median photon (on the SPLIT_AXIS axis),
-      // and every photon from MEDIAN+1 to END has a position greater
-      // than the median photon.
-      //
-      std::nth_element (beg, median, end, photon_axis_cmp (split_axis));
+      node_storage[node_index] = Node (0, block_index, Node::LEAF);
 
-      //
-      // Now recursively call ourselves to arrange the photons in the
-      // sub-sequences separated by MEDIAN.
-      //
+      return node_index;
+    }
 
-      // Left subtree:
-      //
-      if (median != beg)
-	make_kdtree (beg, median, target_index * 2 + 1);
+  // Find the bounding box of all the photons in our range.
+  //
+  // Note that we could avoid this calculation by passing the bounding
+  // box as an argument during recursion, and shrinking it to reflect
+  // splits, but re-calculating each time should yield smaller bounding
+  // boxes, and shouldn't add significant run-time -- it's O(beg-end),
+  // but so is our call to std::nth_element.
+  //
+  BBox bbox;
+  for (std::vector<Photon>::iterator i = beg; i != end; ++i)
+    bbox += i->pos;
 
-      // Right subtree:
-      //
-      if (median + 1 != end)
-	make_kdtree (median + 1, end, target_index * 2 + 2);
+  // Find the largest axis of the bounding-box, and make that our
+  // split-axis, the axis along which we split this kd-tree node to
+  // form child nodes.
+  //
+  unsigned split_axis = 0;
+  dist_t max_bbox_dimen = 0;
+  for (unsigned axis = 0; axis < 3; axis++)
+    {
+      dist_t dimen = bbox.max[axis] - bbox.min[axis];
+      if (dimen > max_bbox_dimen)
+	{
+	  max_bbox_dimen = dimen;
+	  split_axis = axis;
+	}
     }
-  
-  // Copy the median photon to PhotonMap::photons[TARGET_INDEX], with
-  // split-axis info added.
+
+  // The first photon in the second child.  The first child gets
+  // enough photons to exactly fill half the blocks needed for our
+  // range (rounded up), so that only the last block in the entire
+  // kd-tree may be partially filled.
+  //
+  unsigned num_blocks = (num + PhotonBlock::SIZE - 1) / PhotonBlock::SIZE;
+  std::vector<Photon>::iterator median
+    = beg + (num_blocks + 1) / 2 * PhotonBlock::SIZE;
+
+  // Now partition the photons in our range so the photon at position
+  // MEDIAN is the the median photon in our range, on the SPLIT_AXIS
+  // axis, and every photon from BEG to MEDIAN-1 has a position less
+  // than or equal to the median photon (on the SPLIT_AXIS axis), and
+  // every photon from MEDIAN+1 to END has a position greater than or
+  // equal to the median photon.
   //
-  photons[target_index] = *median;
-  kd_tree_node_split_axes[target_index] = split_axis;
+  std::nth_element (beg, median, end, photon_axis_cmp (split_axis));
+
+  float split_point = median->pos[split_axis];
+
+  // Now recursively call ourselves to make child nodes for the photons
+  // on either side of the split.  The first child immediately follows
+  // this node.
+  //
+  make_kdtree (beg, median);
+  unsigned second_child_index = make_kdtree (median, end);
+
+  node_storage[node_index]
+    = Node (split_point, second_child_index, split_axis);
+
+  return node_index;
 }
 
+
 
 // PhotonMap::find_photons
 
 namespace { // keep local to file
 
-// A comparison object for sorting vectors of photon pointers
-// according to their distance from a fixed point.
+// A photon found during a search, and the square of its distance from
+// the search position.  These are kept in a heap ordered by distance,
+// with the farthest photon on top.
 //
-struct photon_ptr_dist_cmp
+struct Found
 {
-  photon_ptr_dist_cmp (const Pos &_pos) : pos (_pos) { }
+  Found () { }
+  Found (float _dist_sq, unsigned _index)
+    : dist_sq (_dist_sq), index (_index)
+  { }
 
-  bool operator() (const Photon *i, const Photon *j) const
-  {
-    return
-      (i->pos - pos).length_squared ()
-      < (j->pos - pos).length_squared ();
-  }
+  bool operator< (const Found &f) const { return dist_sq < f.dist_sq; }
+
+  float dist_sq;
+
+  // Index of the photon in PhotonMap::packed_photons.
+  //
+  unsigned index;
+};
 
-  const Pos &pos;
+// A kd-tree node still to be searched, and the square of the distance
+// from the search position to the node's region along the split-axis
+// of its parent.
+//
+struct Pending
+{
+  unsigned node_index;
+  float dist_sq;
 };
 
+// Number of entries in the fixed-size buffer PhotonMap::find_photons
+// uses to hold the photons found, before switching to a larger,
+// heap-allocated, buffer.
+//
+static const unsigned LOCAL_FOUND_SIZE = 1024;
+
 } // namespace
 
 
-// Search the kd-tree starting from the node at KD_TREE_NODE_INDEX,
-// for the MAX_PHOTONS closest photons to POS.  Only photons within
-// a distance of sqrt(MAX_DIST_SQ) of POS are considered.
+// Find the MAX_PHOTONS closest photons to POS.  Only photons within a
+// distance of sqrt(MAX_DIST_SQ) of POS are considered.
 //
-// Pointers to the photons found are inserted into the heap-form
-// vector PHOTON_HEAP.  PHOTON_HEAP can never grow larger than
-// MAX_PHOTONS (but the photons in it will always be the closest
-// MAX_PHOTONS photons).
+// The photons found are added to the end of PHOTONS, in no particular
+// order.
 //
-// MAX_DIST_SQ is an in/out parameter -- when PHOTON_HEAP reaches
-// its maximum size (MAX_PHOTONS elements), then MAX_DIST_SQ will be
-// modified to be the most distance photon in PHOTON_HEAP; this
-// helps prune the search by avoiding obviously too-distance parts
-// of the kd-tree.
+// If MAX_PHOTONS is PhotonMap::ALL_PHOTONS, every photon within that
+// distance is found.
 //
-void
-PhotonMap::find_photons (const Pos &pos, unsigned kd_tree_node_index,
-			 unsigned max_photons,
-			 dist_t &max_dist_sq,
-			 std::vector<const Photon *> &photon_heap)
+// If MAX_PHOTONS or more photons are found, returns the square of the
+// distance of the farthest photon found, otherwise just returns
+// MAX_DIST_SQ.
+//
+dist_t
+PhotonMap::find_photons (const Pos &pos, unsigned max_photons,
+			 dist_t max_dist_sq, std::vector<Photon> &photons)
   const
 {
-  unsigned num_photons = photons.size ();
+  if (num_nodes == 0 || max_photons == 0)
+    return max_dist_sq;
 
-  const Photon &ph = photons[kd_tree_node_index];
+  // If we want every photon within MAX_DIST_SQ, the search distance
+  // never shrinks, and photons are added to PHOTONS directly as
+  // they're found, instead of keeping a heap of the closest ones.
+  //
+  bool all_photons = (max_photons == ALL_PHOTONS);
 
-  // First check child nodes in the kd-tree.
+  // A heap of the closest photons found so far.  This is kept in
+  // LOCAL_FOUND while it fits, which it almost always does, and only
+  // moved to the heap-allocated EXTRA_FOUND if more photons than
+  // that are wanted.
   //
-  // The two child nodes have indices 2*i+1 and 2*i+2 (where i is
-  // this node's index), so we can quickly check whether there are
-  // any children just by see whether 2*i+2 lies within the
-  // allowable indices.
+  Found local_found[LOCAL_FOUND_SIZE];
+  std::vector<Found> extra_found;
+  Found *found = local_found;
+  unsigned found_capacity = LOCAL_FOUND_SIZE;
+  unsigned num_found = 0;
+
+  // The search distance, which shrinks once we've found MAX_PHOTONS
+  // photons, to the distance of the farthest one.
   //
-  if (kd_tree_node_index * 2 + 2 < num_photons)
-    {
-      unsigned split_axis = kd_tree_node_split_axes[kd_tree_node_index];
+  float search_dist_sq = max_dist_sq;
 
-      // Position on the split-axis where this node splits it.
-      //
-      coord_t split_point = ph.pos[split_axis];
+  // A stack of nodes still to be searched.  As each entry is the
+  // second child of a node on the path to the current node, it never
+  // needs more entries than the depth of the kd-tree (which is about
+  // the log2 of the number of blocks).
+  //
+  Pending pending[MAX_DEPTH];
+  unsigned num_pending = 0;
+
+  unsigned node_index = 0;
 
-      // Distance along the split-axis between POS and SPLIT_POINT.
+  for (;;)
+    {
+      // Descend to a leaf, always first searching the child which POS
+      // is within, to allow better pruning, and remembering the other
+      // child if it's close enough to POS.
       //
-      dist_t split_dist = pos[split_axis] - split_point;
+      const Node *node = &nodes[node_index];
+      while (! node->is_leaf ())
+	{
+	  unsigned split_axis = node->split_axis ();
+	  float split_dist = float (pos[split_axis]) - node->split_point;
+
+	  unsigned near_index = node_index + 1;
+	  unsigned far_index = node->index ();
+	  if (split_dist >= 0)
+	    std::swap (near_index, far_index);
+
+	  float split_dist_sq = split_dist * split_dist;
+	  if (split_dist_sq < search_dist_sq)
+	    {
+	      pending[num_pending].node_index = far_index;
+	      pending[num_pending].dist_sq = split_dist_sq;
+	      num_pending++;
+	    }
+
+	  node_index = near_index;
+	  node = &nodes[node_index];
+	}
 
-      // kd-tree node indices of the first and second child nodes we'll search.
+      // Test every photon in the leaf's block at once.
       //
-      // We search the child which POS is within first, to allow better pruning.
+      unsigned block_index = node->index ();
+      float dist_sq[PhotonBlock::SIZE];
+      unsigned mask = blocks[block_index].find (pos, search_dist_sq, dist_sq);
+
+      for (unsigned i = 0; mask != 0; i++, mask >>= 1)
+	if ((mask & 1) && dist_sq[i] < search_dist_sq)
+	  {
+	    unsigned index = block_index * PhotonBlock::SIZE + i;
+
+	    if (all_photons)
+	      {
+		photons.push_back (get_photon (index));
+		continue;
+	      }
+
+	    Found f (dist_sq[i], index);
+
+	    // If FOUND is full, first remove the farthest photon from
+	    // it (to be replaced by F).
+	    //
+	    if (num_found == max_photons)
+	      std::pop_heap (found, found + num_found--);
+	    else if (num_found == found_capacity)
+	      {
+		// FOUND is full, but more photons are wanted, so move it
+		// to a buffer twice as large.
+		//
+		found_capacity
+		  = (found_capacity <= max_photons / 2
+		     ? found_capacity * 2
+		     : max_photons);
+
+		std::vector<Found> grown (found, found + num_found);
+		grown.resize (found_capacity, Found (0, 0));
+		extra_found.swap (grown);
+		found = &extra_found[0];
+	      }
+
+	    found[num_found++] = f;
+	    std::push_heap (found, found + num_found);
+
+	    // If we've already found MAX_PHOTONS photons, we know we
+	    // don't want anything more distant than what we've already
+	    // found.
+	    //
+	    if (num_found == max_photons)
+	      search_dist_sq = found[0].dist_sq;
+	  }
+
+      // Continue with the most recently remembered node which is
+      // still close enough to POS.
       //
-      unsigned first_child_index
-	= kd_tree_node_index * 2 + ((split_dist < 0) ? 1 : 2);
-      unsigned second_child_index
-	= kd_tree_node_index * 2 + ((split_dist < 0) ? 2 : 1);
+      while (num_pending != 0
+	     && pending[num_pending - 1].dist_sq >= search_dist_sq)
+	num_pending--;
 
-      // Search the first child.
-      //
-      find_photons (pos, first_child_index, max_photons, max_dist_sq,
-		    photon_heap);
+      if (num_pending == 0)
+	break;
 
-      // If POS is close enough to the split-point, search the second
-      // child too.
-      //
-      if (split_dist * split_dist < max_dist_sq)
-	find_photons (pos, second_child_index, max_photons, max_dist_sq,
-		      photon_heap);
+      node_index = pending[--num_pending].node_index;
     }
 
-  // Square of the distance between POS and PHOTON.
+  // Return the photons found.
   //
-  dist_t dist_sq = (pos - ph.pos).length_squared ();
+  for (unsigned i = 0; i < num_found; i++)
+    photons.push_back (get_photon (found[i].index));
+
+  if (num_found == max_photons)
+    max_dist_sq = search_dist_sq;
+
+  return max_dist_sq;
+}
+
 
-  if (dist_sq < max_dist_sq)
+
+// PhotonMap::PackedPhoton
+
+PhotonMap::PackedPhoton::PackedPhoton (const Photon &photon)
+{
+  //
+  // Power, in RGBE form (see Greg Ward, "Real Pixels", Graphics Gems
+  // II, 1991).
+  //
+
+  float r = max (photon.power.r (), 0.f);
+  float g = max (photon.power.g (), 0.f);
+  float b = max (photon.power.b (), 0.f);
+  float max_comp = max (r, max (g, b));
+
+  int exp;
+  frexp (max_comp, &exp);
+
+  if (max_comp < 1e-32f || exp < -128)
+    rgbe[0] = rgbe[1] = rgbe[2] = rgbe[3] = 0;
+  else
     {
-      photon_ptr_dist_cmp dist_cmp (pos);
+      exp = min (exp, 127);
 
-      // If PHOTON_HEAP is full, first remove the farthest photon
-      // from it (to be replaced by PHOTON).
+      // Scaling by SCALE puts MAX_COMP in the range [128, 256).
+      // Mantissas are rounded to the nearest value (rather than
+      // truncated, as in Ward's original), so that a zero component
+      // stays zero, and small components aren't biased upwards.
       //
-      if (photon_heap.size() == max_photons)
-     	{
-	  std::pop_heap (photon_heap.begin (), photon_heap.end (), dist_cmp);
-	  photon_heap.pop_back ();
+      float scale = ldexp (256.f, -exp);
+
+      rgbe[0] = (unsigned char)min (r * scale + 0.5f, 255.f);
+      rgbe[1] = (unsigned char)min (g * scale + 0.5f, 255.f);
+      rgbe[2] = (unsigned char)min (b * scale + 0.5f, 255.f);
+      rgbe[3] = (unsigned char)(exp + 128);
+    }
+
+  //
+  // Direction, in octahedral form:  the direction is projected onto
+  // the octahedron |x| + |y| + |z| = 1, whose lower half is then
+  // folded up over the upper half, and the resulting x and y
+  // coordinates are quantized.
+  //
+
+  const Vec &dir = photon.dir;
+  float l1_norm = abs (dir.x) + abs (dir.y) + abs (dir.z);
+
+  float u = 0, v = 0;
+  if (l1_norm > 0)
+    {
+      u = dir.x / l1_norm;
+      v = dir.y / l1_norm;
+
+      if (dir.z < 0)
+	{
+	  float fold_u = (1 - abs (v)) * (u < 0 ? -1 : 1);
+	  float fold_v = (1 - abs (u)) * (v < 0 ? -1 : 1);
+	  u = fold_u;
+	  v = fold_v;
 	}
+    }
 
-      // Add a pointer to PHOTON to PHOTON_HEAP.
-      //
-      photon_heap.push_back (&ph);
+  oct_dir[0] = (unsigned short)((u * 0.5f + 0.5f) * 65535 + 0.5f);
+  oct_dir[1] = (unsigned short)((v * 0.5f + 0.5f) * 65535 + 0.5f);
+}
 
-      // Keep PHOTON_HEAP in heap order.
-      //
-      std::push_heap (photon_heap.begin (), photon_heap.end (), dist_cmp);
+// Return the photon's power.
+//
+Color
+PhotonMap::PackedPhoton::power () const
+{
+  if (rgbe[3] == 0)
+    return 0;
 
-      // If we've already found MAX_PHOTONS photons, we know we
-      // don't want anything more distant than what we've already
-      // found, so update MAX_DIST_SQ (which an in/out parameter) to
-      // reflect the most distant photon in PHOTON_HEAP.
-      //
-      if (photon_heap.size() == max_photons)
-	max_dist_sq = (pos - photon_heap.front()->pos).length_squared ();
+  float scale = ldexp (1.f, int (rgbe[3]) - (128 + 8));
+
+  return Color (rgbe[0] * scale, rgbe[1] * scale, rgbe[2] * scale);
+}
+
+// Return the photon's direction.
+//
+Vec
+PhotonMap::PackedPhoton::dir () const
+{
+  float u = oct_dir[0] * (2.f / 65535) - 1;
+  float v = oct_dir[1] * (2.f / 65535) - 1;
+  float w = 1 - abs (u) - abs (v);
+
+  if (w < 0)
+    {
+      float unfold_u = (1 - abs (v)) * (u < 0 ? -1 : 1);
+      float unfold_v = (1 - abs (u)) * (v < 0 ? -1 : 1);
+      u = unfold_u;
+      v = unfold_v;
     }
+
+  return Vec (u, v, w).unit ();
 }
 
+
 
 // PhotonMap::check_kd_tree
 
@@ -359,39 +500,59 @@ PhotonMap::find_photons (const Pos &pos, unsigned kd_tree_node_index,
 void
 PhotonMap::check_kd_tree ()
 {
+  if (num_nodes == 0)
+    {
+      ASSERT (num_photons == 0);
+      return;
+    }
+
   BBox bbox;
-  for (std::vector<Photon>::iterator i = photons.begin();
-       i != photons.end(); ++i)
-    bbox += i->pos;
+  for (unsigned b = 0; b < num_blocks; b++)
+    for (unsigned i = 0; i < PhotonBlock::SIZE; i++)
+      if (blocks[b].pos[0][i] != PhotonBlock::unused_coord ())
+	bbox += blocks[b].get (i);
 
   unsigned num = check_kd_tree (0, bbox);
 
-  ASSERT (num == photons.size ());
+  ASSERT (num == num_photons);
 }
 
 // Do a consistency check on the kd-tree data-structure.
 // All photons in this sub-tree must be within BBOX.
-// Returns the number of nodes visited.
+// Returns the number of photons visited.
 //
 unsigned
-PhotonMap::check_kd_tree (unsigned kd_tree_node_index, const BBox &bbox)
+PhotonMap::check_kd_tree (unsigned node_index, const BBox &bbox)
 {
-  if (kd_tree_node_index >= photons.size ())
-    return 0;
+  ASSERT (node_index < num_nodes);
+
+  const Node &node = nodes[node_index];
 
-  const Photon &ph = photons[kd_tree_node_index];
+  if (node.is_leaf ())
+    {
+      ASSERT (node.index () < num_blocks);
 
-  unsigned split_axis = kd_tree_node_split_axes[kd_tree_node_index];
-  ASSERT (split_axis < 3);	// unsigned, so always >= 0
+      const PhotonBlock &block = blocks[node.index ()];
 
-  const Pos &pos = ph.pos;
-  const Pos &min = bbox.min;
-  const Pos &max = bbox.max;
+      unsigned num = 0;
+      for (unsigned i = 0; i < PhotonBlock::SIZE; i++)
+	if (block.pos[0][i] != PhotonBlock::unused_coord ())
+	  {
+	    Pos pos = block.get (i);
+	    const Pos &min = bbox.min;
+	    const Pos &max = bbox.max;
 
-  ASSERT (pos.x >= min.x && pos.y >= min.y && pos.z >= min.z);
-  ASSERT (pos.x <= max.x && pos.y <= max.y && pos.z <= max.z);
+	    ASSERT (pos.x >= min.x && pos.y >= min.y && pos.z >= min.z);
+	    ASSERT (pos.x <= max.x && pos.y <= max.y && pos.z <= max.z);
 
-  float split_point = pos[split_axis];
+	    num++;
+	  }
+
+      return num;
+    }
+
+  unsigned split_axis = node.split_axis ();
+  float split_point = node.split_point;
 
   BBox left_bbox = bbox;
   left_bbox.max[split_axis] = split_point;
@@ -399,9 +560,101 @@ PhotonMap::check_kd_tree (unsigned kd_tree_node_index, const BBox &bbox)
   BBox right_bbox = bbox;
   right_bbox.min[split_axis] = split_point;
 
-  unsigned lnum = check_kd_tree (kd_tree_node_index * 2 + 1, left_bbox);
-  unsigned rnum = check_kd_tree (kd_tree_node_index * 2 + 2, right_bbox);
+  unsigned lnum = check_kd_tree (node_index + 1, left_bbox);
+  unsigned rnum = check_kd_tree (node.index (), right_bbox);
+
+  return lnum + rnum;
+}
+
+
+
+// PhotonMap::set_cached
+
+// Make this photon-map use the NUM_NODES kd-tree nodes at _NODES, the
+// NUM_BLOCKS photon blocks at _BLOCKS, and the corresponding packed
+// photons at _PACKED_PHOTONS, holding NUM_PHOTONS photons in total.
+// These are not copied, so must remain valid as long as this map is
+// used (they are normally in a memory-mapped PhotonCache file).
+//
+// If they don't form a usable kd-tree, false is returned, and this
+// photon-map is left empty.
+//
+bool
+PhotonMap::set_cached (const Node *_nodes, unsigned _num_nodes,
+		       const PhotonBlock *_blocks, unsigned _num_blocks,
+		       const PackedPhoton *_packed_photons,
+		       unsigned _num_photons)
+{
+  std::vector<Node> ().swap (node_storage);
+  std::vector<PhotonBlock> ().swap (block_storage);
+  std::vector<PackedPhoton> ().swap (packed_photon_storage);
+
+  nodes = _nodes;
+  num_nodes = _num_nodes;
+  blocks = _blocks;
+  num_blocks = _num_blocks;
+  packed_photons = _packed_photons;
+  num_photons = _num_photons;
+
+  // Every block except the last must be full, and there's one more
+  // leaf node than interior nodes.
+  //
+  bool valid
+    = (num_photons + PhotonBlock::SIZE - 1) / PhotonBlock::SIZE == num_blocks
+      && num_nodes == (num_blocks == 0 ? 0 : num_blocks * 2 - 1);
+
+  if (valid && num_nodes != 0)
+    {
+      unsigned next_block = 0;
+      valid = (valid_kd_tree (0, 0, next_block) == num_nodes
+	       && next_block == num_blocks);
+    }
+
+  if (! valid)
+    {
+      nodes = 0;
+      blocks = 0;
+      packed_photons = 0;
+      num_nodes = num_blocks = num_photons = 0;
+    }
 
-  return lnum + rnum + 1;
+  return valid;
 }
 
+// Check that the sub-tree starting at NODE_INDEX, which is at depth
+// DEPTH in the kd-tree, has the layout PhotonMap::make_kdtree
+// produces:  nodes in depth-first order, and leaves referring to
+// consecutive blocks, starting with block NEXT_BLOCK.  NEXT_BLOCK is
+// updated to the block following the sub-tree's last block.
+//
+// Returns the index of the node following the sub-tree, or zero if
+// it's invalid.
+//
+unsigned
+PhotonMap::valid_kd_tree (unsigned node_index, unsigned depth,
+			  unsigned &next_block)
+  const
+{
+  if (node_index >= num_nodes || depth > MAX_DEPTH)
+    return 0;
+
+  const Node &node = nodes[node_index];
+
+  if (node.is_leaf ())
+    {
+      if (node.index () != next_block)
+	return 0;
+
+      next_block++;
+
+      return node_index + 1;
+    }
+
+  // The first child must end exactly where the second child starts.
+  //
+  unsigned first_end = valid_kd_tree (node_index + 1, depth + 1, next_block);
+  if (first_end == 0 || first_end != node.index ())
+    return 0;
+
+  return valid_kd_tree (node.index (), depth + 1, next_block);
+}
@@ -1,6 +1,6 @@
 // photon-map.h -- Data structure to hold photons in space
 //
-//  Copyright (C) 2010, 2011, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2010, 2011, 2013, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -17,6 +17,7 @@
 
 #include "util/snogmath.h"
 #include "photon.h"
+#include "photon-block.h"
 
 
 namespace snogray {
@@ -27,10 +28,25 @@ class BBox;
 
 // A group of photons organized for fast spatial lookup.
 //
+// Photons are stored in a compact form:  their positions are kept in
+// single-precision, in blocks of PhotonBlock::SIZE photons which can
+// be searched using SIMD instructions, and their power and direction
+// are quantized (see PhotonMap::PackedPhoton).  The blocks are the
+// leaves of a kd-tree, whose nodes are stored in depth-first order.
+//
+// The kd-tree and photons are either built in memory by
+// PhotonMap::set_photons, or used directly from a memory-mapped photon
+// cache file (see PhotonCache).
+//
 class PhotonMap
 {
 public:
 
+  PhotonMap ()
+    : nodes (0), num_nodes (0), blocks (0), num_blocks (0),
+      packed_photons (0), num_photons (0)
+  { }
+
   // Set the photons in this PhotonMap to the photons in NEW_PHOTONS,
   // and build a kd-tree for them.  The contents of NEW_PHOTONS are
   // modified (but unreferenced afterwards, so may be discarded).
@@ -40,29 +56,28 @@ public:
   // Find the MAX_PHOTONS closest photons to POS.  Only photons
   // within a distance of sqrt(MAX_DIST_SQ) of POS are considered.
   //
-  // Pointers to the photons found are inserted into the heap-form
-  // vector PHOTON_HEAP, in order of distance from POS.  PHOTON_HEAP
-  // can never grow larger than MAX_PHOTONS (but the photons in it
-  // will always be the closest MAX_PHOTONS photons).  [An empty
-  // vector is a valid (empty) heap; see std::make_heap for more
-  // description of heap-form vectors.]
+  // The photons found are added to the end of PHOTONS, in no
+  // particular order.
+  //
+  // If MAX_PHOTONS is PhotonMap::ALL_PHOTONS, every photon within
+  // that distance is found.
   //
   // If MAX_PHOTONS or more photons are found, returns the square of
-  // the distance of the farthest photon in RESULTS, otherwise just
+  // the distance of the farthest photon found, otherwise just
   // returns MAX_DIST_SQ.
   //
   dist_t find_photons (const Pos &pos, unsigned max_photons, dist_t max_dist_sq,
-		       std::vector<const Photon *> &photon_heap)
-    const
-  {
-    if (! photons.empty ())
-      find_photons (pos, 0, max_photons, max_dist_sq, photon_heap);
-    return max_dist_sq;
-  }
+		       std::vector<Photon> &photons)
+    const;
+
+  // A MAX_PHOTONS argument for PhotonMap::find_photons which finds
+  // every photon within the search distance, however many there are.
+  //
+  static const unsigned ALL_PHOTONS = ~0u;
 
   // Return the number of photons in this map.
   //
-  unsigned size () const { return photons.size (); }
+  unsigned size () const { return num_photons; }
 
   // Do a consistency check on the kd-tree data-structure.
   //
@@ -70,77 +85,169 @@ public:
 
 private:
 
+  friend class PhotonCache;
+
+  // A kd-tree node.  An interior node splits one axis (x, y, or z) in
+  // space (the "split-axis"), and has two child nodes, which hold
+  // only photons whose position on that axis is less than or equal to
+  // (first child), or greater than or equal to (second child), the
+  // "split-point" on the split-axis.  A leaf node refers to a single
+  // PhotonBlock holding its photons.
   //
-  // A kd-tree node describes a set of photons in a particular region of
-  // space.  Each node splits one axis (x, y, or z) in space (the
-  // "split-axis"), and has two sub-nodes, which hold only photons whose
-  // position on that axis is less than (left) or greater-than to, the
-  // "split-point" on the split-axis.
-  //
-  // Each kd-tree node is associated with a particular photon --
-  // the median photon which determines the node's split-point.
-  //
-  // In this particular implementation, the "split-point" of a node is
-  // the position on the node's split-axis of the median photon in that
-  // node's sequence of photons, where the node's photons are sorted by
-  // their position on the node's split-axis.
-  //
-  // As each node has an associated photon, and the only information
-  // _not_ available in the photon is the split-axis of each node, we
-  // just keep two vectors: an vector of photons, and a vector of
-  // split-axes.  Both vectors are arranged as "left-balanced heaps":
-  // the root node is at index 0, and for each node at index I, its
-  // children are at indices 2*I+1 and 2*I+2.
-  //
-
-  // Copy photons from the source-range BEG to END, into the
-  // PhotonMap::photons vector in kd-tree heap order, with the root at
-  // index TARGET_INDEX (in PhotonMap::photons).  The ordering of
-  // photons in the source range may be changed.
-  //
-  void make_kdtree (const std::vector<Photon>::iterator &beg,
-		    const std::vector<Photon>::iterator &end,
-		    unsigned target_index);
-
-  // Search the kd-tree starting from the node at
-  // KD_TREE_NODE_INDEX, for the MAX_PHOTONS closest photons to POS.
-  // Only photons within a distance of sqrt(MAX_DIST_SQ) of POS are
-  // considered.
-  //
-  // Pointers to the photons found are inserted into the heap-form
-  // vector PHOTON_HEAP.  PHOTON_HEAP can never grow larger than
-  // MAX_PHOTONS (but the photons in it will always be the closest
-  // MAX_PHOTONS photons).
-  //
-  // MAX_DIST_SQ is an in/out parameter -- when PHOTON_HEAP reaches
-  // its maximum size (MAX_PHOTONS elements), then MAX_DIST_SQ will
-  // be modified to be the most distance photon in PHOTON_HEAP; this
-  // helps prune the search by avoiding obviously too-distance parts
-  // of the kd-tree.
-  //
-  void find_photons (const Pos &pos, unsigned kd_tree_node_index,
-		     unsigned max_photons,
-		     dist_t &max_dist_sq,
-		     std::vector<const Photon *> &photon_heap)
-    const;
+  // Nodes are 8 bytes, so several fit in a cache line, and are stored
+  // in depth-first order, so a node's first child immediately follows
+  // it.
+  //
+  struct Node
+  {
+    Node () { }
+    Node (float _split_point, unsigned index, unsigned axis)
+      : split_point (_split_point), bits ((index << 2) | axis)
+    { }
+
+    // Value used instead of a split-axis to mark leaf nodes.
+    //
+    static const unsigned LEAF = 3;
+
+    bool is_leaf () const { return (bits & 3) == LEAF; }
+
+    // For interior nodes, the split-axis.
+    //
+    unsigned split_axis () const { return bits & 3; }
+
+    // For interior nodes, the index in PhotonMap::nodes of the second
+    // child; for leaf nodes, the index in PhotonMap::blocks of the
+    // node's photons.
+    //
+    unsigned index () const { return bits >> 2; }
+
+    // For interior nodes, the split-point; unused in leaf nodes.
+    //
+    float split_point;
+
+    // The split-axis (or LEAF) in the low two bits, and the result of
+    // Node::index in the remaining bits.
+    //
+    unsigned bits;
+  };
+
+  // The parts of a photon other than its position, stored compactly.
+  // The photon's power is stored in "RGBE" form (an 8-bit mantissa
+  // for each color component, and a shared 8-bit exponent), and its
+  // direction as a pair of 16-bit octahedral coordinates.
+  //
+  struct PackedPhoton
+  {
+    PackedPhoton () { }
+    PackedPhoton (const Photon &photon);
+
+    // Return the photon's power.
+    //
+    Color power () const;
+
+    // Return the photon's direction.
+    //
+    Vec dir () const;
+
+    unsigned char rgbe[4];
+
+    unsigned short oct_dir[2];
+  };
+
+  // Add nodes for the photons from BEG to END to the kd-tree, along
+  // with blocks holding the photons, and return the index of the
+  // first node added.  The ordering of photons in the source range
+  // may be changed.
+  //
+  unsigned make_kdtree (const std::vector<Photon>::iterator &beg,
+			const std::vector<Photon>::iterator &end);
 
   // Do a consistency check on the kd-tree data-structure.
-  // Returns the number of nodes visited.
+  // Returns the number of photons visited.
+  //
+  unsigned check_kd_tree (unsigned node_index, const BBox &bbox);
+
+  // Make this photon-map use the NUM_NODES kd-tree nodes at
+  // _NODES, the NUM_BLOCKS photon blocks at _BLOCKS, and the
+  // corresponding packed photons at _PACKED_PHOTONS, holding
+  // NUM_PHOTONS photons in total.  These are not copied, so must
+  // remain valid as long as this map is used (they are normally in a
+  // memory-mapped PhotonCache file).
+  //
+  // If they don't form a usable kd-tree, false is returned, and this
+  // photon-map is left empty.
+  //
+  bool set_cached (const Node *_nodes, unsigned _num_nodes,
+		   const PhotonBlock *_blocks, unsigned _num_blocks,
+		   const PackedPhoton *_packed_photons, unsigned _num_photons);
+
+  // Check that the sub-tree starting at NODE_INDEX, which is at depth
+  // DEPTH in the kd-tree, has the layout PhotonMap::make_kdtree
+  // produces:  nodes in depth-first order, and leaves referring to
+  // consecutive blocks, starting with block NEXT_BLOCK.  NEXT_BLOCK is
+  // updated to the block following the sub-tree's last block.
+  //
+  // Returns the index of the node following the sub-tree, or zero if
+  // it's invalid.
+  //
+  unsigned valid_kd_tree (unsigned node_index, unsigned depth,
+			  unsigned &next_block)
+    const;
+
+  // Return the photon at index INDEX in PACKED_PHOTONS.
+  //
+  Photon get_photon (unsigned index) const
+  {
+    const PackedPhoton &packed = packed_photons[index];
+    const PhotonBlock &block = blocks[index / PhotonBlock::SIZE];
+    return Photon (block.get (index % PhotonBlock::SIZE),
+		   packed.dir (), packed.power ());
+  }
+
+  // Make the pointers to nodes, blocks, and packed photons refer to
+  // the storage vectors.
+  //
+  void use_storage ();
+
+  // The maximum depth of the kd-tree (in nodes, not counting leaves).
+  // PhotonMap::find_photons assumes the tree is no deeper than this.
+  //
+  static const unsigned MAX_DEPTH = 64;
+
+  // The kd-tree nodes, in depth-first order; the root is at index 0.
+  // These are either in PhotonMap::node_storage, or in a memory-mapped
+  // photon cache file.
+  //
+  const Node *nodes;
+  unsigned num_nodes;
+
+  // The positions of the photons, in blocks.  Each leaf node of the
+  // kd-tree refers to one block.
+  //
+  const PhotonBlock *blocks;
+  unsigned num_blocks;
+
+  // The rest of each photon's information.  Entry N of block B
+  // corresponds to PACKED_PHOTONS[B * PhotonBlock::SIZE + N].
+  //
+  const PackedPhoton *packed_photons;
+
+  // The number of photons in this map.
   //
-  unsigned check_kd_tree (unsigned index, const BBox &bbox);
+  unsigned num_photons;
 
-  // The actual photons.  There is one kd-tree node for each photon, and
-  // each node's photon is the median split-point for that node.  The
-  // photons are arranged as a left-balanced heap:  the root node is at
-  // index 0, and for each node at index I, its children are at indices
-  // 2*I+1 and 2*I+2.
+  // Storage for nodes, blocks, and packed photons, if they were built
+  // in memory.
   //
-  std::vector<Photon> photons;
+  std::vector<Node> node_storage;
+  std::vector<PhotonBlock> block_storage;
+  std::vector<PackedPhoton> packed_photon_storage;
 
-  // For each node in the kd-tree, the axis along which the node is
-  // split (at the position of its median photon) to form child nodes.
+  // Not copyable, as the pointers above may refer to our own
+  // storage.
   //
-  std::vector<unsigned char> kd_tree_node_split_axes;
+  PhotonMap (const PhotonMap &);
+  PhotonMap &operator= (const PhotonMap &);
 };
 
 
@@ -1,6 +1,6 @@
 // photon-shooter.cc -- Photon-shooting infrastructure
 //
-//  Copyright (C) 2010, 2011, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2010, 2011, 2013, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -11,14 +11,22 @@
 //
 
 #include <iostream>
+#include <algorithm>
+#include <map>
 
+#include "config.h"
+
+#include "util/snogmath.h"
 #include "util/radical-inverse.h"
+#include "util/mutex.h"
+#include "util/thread.h"
 #include "light/light.h"
 #include "material/media.h"
 #include "material/bsdf.h"
 #include "render/scene.h"
 #include "render/render-context.h"
 #include "render/global-render-state.h"
+#include "render/volume-integ.h"
 
 #include "cli/tty-progress.h"
 #include "util/string-funs.h"
@@ -28,19 +36,191 @@
 using namespace snogray;
 
 
-// Shoot photons from the lights, depositing them in photon-sets at
-// appropriate points.
+// Number of consecutive photon paths in each batch shot by a thread.
+//
+static const unsigned PATHS_PER_BATCH = 4096;
+
+// Number of paths in a single call to PhotonShooter::shoot after which
+// we give up, even if some photon-sets aren't yet complete (e.g.,
+// because no paths in the scene can generate the type of photon they
+// want).
+//
+static const unsigned MAX_PATHS = 100000000;
+
+
+// A batch of photon paths being shot by a single thread.
+//
+// Each batch contains the paths numbered from NUM * PATHS_PER_BATCH to
+// (NUM + 1) * PATHS_PER_BATCH - 1.  The photons it generates depend
+// only on those numbers, not on which thread shoots it, and batches
+// are added to the photon-sets in order, so the final result is the
+// same regardless of how many threads are used.
+//
+struct PhotonShooter::Batch
+{
+  Batch (unsigned _num, const std::vector<PhotonSet *> &photon_sets)
+    : num (_num), num_paths (0),
+      photons (photon_sets.size ()), normals (photon_sets.size ()),
+      path_counts (photon_sets.size ()), complete (photon_sets.size ())
+  {
+    for (unsigned i = 0; i < photon_sets.size (); i++)
+      complete[i] = photon_sets[i]->complete ();
+  }
+
+  // The number of this batch.
+  //
+  unsigned num;
+
+  // The number of paths in this batch which were actually followed
+  // (some light samples are discarded).
+  //
+  unsigned num_paths;
+
+  // For each photon-set in PhotonShooter::photon_sets, the photons
+  // deposited in it by this batch, in order.
+  //
+  std::vector<std::vector<Photon> > photons;
+
+  // For each photon-set which records normals, the surface normal at
+  // each photon in PHOTONS.
+  //
+  std::vector<std::vector<Vec> > normals;
+
+  // For each photon in PHOTONS, the value of Batch::num_paths after
+  // the path which deposited it was counted.  This allows merging
+  // only part of a batch while keeping an exact path count.
+  //
+  std::vector<std::vector<unsigned> > path_counts;
+
+  // For each photon-set, true if it was complete when this batch was
+  // started, in which case we don't bother depositing photons for it.
+  //
+  std::vector<bool> complete;
+};
+
+
+// State shared by all threads shooting photons.
+//
+struct PhotonShooter::ShootState
+{
+  ShootState (PhotonShooter &_shooter,
+	      const GlobalRenderState &_global_render_state,
+	      Progress &_prog)
+    : shooter (_shooter), global_render_state (_global_render_state),
+      prog (_prog),
+      next_batch (_shooter.first_batch), next_merge (_shooter.first_batch),
+      done (_shooter.complete ())
+  { }
+  ~ShootState ();
+
+  // Shoot batches of photon paths until done.  This is the main
+  // function of each photon-shooting thread.
+  //
+  void run ();
+
+  PhotonShooter &shooter;
+
+  const GlobalRenderState &global_render_state;
+
+  // Progress indicator; only updated while holding LOCK.
+  //
+  Progress &prog;
+
+  // Lock protecting the following fields, and the photon-sets of
+  // SHOOTER.
+  //
+  Mutex lock;
+
+  // The number of the next batch to be shot.
+  //
+  unsigned next_batch;
+
+  // The number of the next batch to be added to the photon-sets.
+  //
+  unsigned next_merge;
+
+  // Batches which have been shot, but which can't yet be added to the
+  // photon-sets because some earlier batch is still being shot.
+  //
+  std::map<unsigned, Batch *> pending;
+
+  // True if all photon-sets are complete.
+  //
+  bool done;
+};
+
+PhotonShooter::ShootState::~ShootState ()
+{
+  for (std::map<unsigned, Batch *>::iterator pi = pending.begin ();
+       pi != pending.end (); ++pi)
+    delete pi->second;
+}
+
+// Shoot batches of photon paths until done.  This is the main
+// function of each photon-shooting thread.
 //
 void
-PhotonShooter::shoot (const GlobalRenderState &global_render_state)
+PhotonShooter::ShootState::run ()
 {
   RenderContext context (global_render_state);
-  Media surrounding_media (context.default_medium);
 
-  const std::vector<const Light::Sampler *> &light_samplers
-    = context.scene.light_samplers;
+  for (;;)
+    {
+      Batch *batch;
+
+      {
+	LockGuard guard (lock);
+
+	if (done
+	    || (next_batch - shooter.first_batch
+		>= MAX_PATHS / PATHS_PER_BATCH))
+	  break;
+
+	batch = new Batch (next_batch++, shooter.photon_sets);
+      }
+
+      shooter.shoot_batch (*batch, context);
+
+      LockGuard guard (lock);
+
+      pending[batch->num] = batch;
+
+      // Add any batches which are now in order to the photon-sets.
+      //
+      std::map<unsigned, Batch *>::iterator pi;
+      while (! done && (pi = pending.find (next_merge)) != pending.end ())
+	{
+	  shooter.merge_batch (*pi->second);
+
+	  delete pi->second;
+	  pending.erase (pi);
+	  next_merge++;
+
+	  prog.update (shooter.cur_count ());
+
+	  if (shooter.complete ())
+	    done = true;
+	}
+    }
+}
 
-  if (light_samplers.size () == 0)
+
+// Shoot photons from the lights, depositing them in photon-sets at
+// appropriate points.
+//
+// Photons are shot using the number of threads given by the
+// "setup_threads" parameter in GLOBAL_RENDER_STATE.  The resulting
+// photon-sets are the same regardless of the number of threads.
+//
+// Each call continues with the photon paths following those used by
+// the previous call, so calling this method again after clearing the
+// photon-sets (see PhotonSet::clear) yields a new, independent, set of
+// photons.
+//
+void
+PhotonShooter::shoot (const GlobalRenderState &global_render_state)
+{
+  if (global_render_state.scene.light_samplers.size () == 0)
     return;			// no lights, so no point
 
   TtyProgress prog (std::cout, "* " + name + ": shooting photons...");
@@ -48,10 +228,86 @@ PhotonShooter::shoot (const GlobalRenderState &global_render_state)
   prog.set_size (target_count ());
   prog.start ();
 
-  for (unsigned path_num = 0; ! complete(); path_num++) 
+  ShootState state (*this, global_render_state, prog);
+
+#if USE_THREADS
+  unsigned num_threads
+    = global_render_state.params.get_uint ("setup_threads", 1);
+
+  // Shoot photons in NUM_THREADS threads, one of which is the calling
+  // thread.
+  //
+  std::vector<Thread *> threads;
+  for (unsigned i = 1; i < num_threads; i++)
+    threads.push_back (new Thread (&ShootState::run, &state));
+#endif
+
+  state.run ();
+
+#if USE_THREADS
+  for (std::vector<Thread *>::iterator ti = threads.begin ();
+       ti != threads.end (); ++ti)
     {
-      prog.update (cur_count ());
+      (*ti)->join ();
+      delete *ti;
+    }
+#endif
+
+  // The next call continues with the batch following the last one
+  // whose photons we used.
+  //
+  first_batch = state.next_merge;
+
+  prog.end ();
+
+  // Output information message about results.
+  //
+  bool some = false;
+  std::cout << "* " << name << ": ";
+  for (std::vector<PhotonSet *>::iterator psi = photon_sets.begin();
+       psi != photon_sets.end(); ++ psi)
+    {
+      PhotonSet &ps = **psi;
+      if (ps.photons.size () != 0)
+	{
+	  if (some)
+	    std::cout << ", ";  
+	  std::cout << commify (ps.photons.size ()) << " " << ps.name;
+	  std::cout << " (" << commify (ps.num_paths) << " paths)";
+	  some = true;
+	}
+    }
+  if (! some)
+    std::cout << "no photons generated!";
+  std::cout << std::endl;
+}
+
+
+
+// PhotonShooter::shoot_batch
+
+// Shoot the photon paths in BATCH using CONTEXT, depositing photons in
+// BATCH rather than in our photon-sets.
+//
+void
+PhotonShooter::shoot_batch (Batch &batch, RenderContext &context) const
+{
+  Media surrounding_media (context.default_medium);
+
+  const std::vector<const Light::Sampler *> &light_samplers
+    = context.scene.light_samplers;
+
+  // Paths which continue past their first bounce use CONTEXT's
+  // random-number generator, so make it depend only on the batch.
+  //
+  context.random.seed (batch.num);
+
+  unsigned beg_path = batch.num * PATHS_PER_BATCH;
 
+  for (unsigned path_num = beg_path;
+       path_num < beg_path + PATHS_PER_BATCH;
+       path_num++)
+    {
       // Randomly choose a light-sampler.
       //
       unsigned sampler_num
@@ -74,10 +330,7 @@ PhotonShooter::shoot (const GlobalRenderState &global_render_state)
       // potential photon path for all photon types that haven't
       // finished yet (we do all types in parallel).
       //
-      for (std::vector<PhotonSet *>::iterator psi = photon_sets.begin();
-	   psi != photon_sets.end(); ++psi)
-	if (! (*psi)->complete ())
-	  (*psi)->num_paths++;
+      batch.num_paths++;
 
       // The logical-or of all the Bsdf::ALL_LAYERS flags we
       // encounter in while bouncing around surfaces in the scene.  It
@@ -138,10 +391,27 @@ PhotonShooter::shoot (const GlobalRenderState &global_render_state)
 	  //
 	  Photon photon (isec.normal_frame.origin, -dir, power);
 
-	  // Now maybe deposit a photon at this location.  This is done by
-	  // calling a subclass-specific method, which may want to 
+	  // Now maybe deposit a photon at this location, in a
+	  // photon-set chosen by a subclass-specific method.
 	  //
-	  deposit (photon, isec, bsdf_history);
+	  const PhotonSet *photon_set
+	    = choose_photon_set (photon, isec, bsdf_history);
+	  if (photon_set)
+	    {
+	      unsigned set_index
+		= (std::find (photon_sets.begin (), photon_sets.end (),
+			      photon_set)
+		   - photon_sets.begin ());
+
+	      if (! batch.complete[set_index])
+		{
+		  batch.photons[set_index].push_back (photon);
+		  batch.path_counts[set_index].push_back (batch.num_paths);
+
+		  if (photon_set->record_normals)
+		    batch.normals[set_index].push_back (isec.normal_frame.z);
+		}
+	    }
 
 	  // Now sample the BSDF to continue this photon's path.
 	  //
@@ -193,31 +463,47 @@ PhotonShooter::shoot (const GlobalRenderState &global_render_state)
 	}
 
       context.mempool.reset ();
-
-      if (path_num > 1e8)
-	break;
     }
+}
 
-  prog.end ();
 
-  // Output information message about results.
-  //
-  bool some = false;
-  std::cout << "* " << name << ": ";
-  for (std::vector<PhotonSet *>::iterator psi = photon_sets.begin();
-       psi != photon_sets.end(); ++ psi)
+
+// PhotonShooter::merge_batch
+
+// Add the photons from BATCH to our photon-sets, up to their target
+// counts.
+//
+void
+PhotonShooter::merge_batch (const Batch &batch)
+{
+  for (unsigned i = 0; i < photon_sets.size (); i++)
     {
-      PhotonSet &ps = **psi;
-      if (ps.photons.size () != 0)
-	{
-	  if (some)
-	    std::cout << ", ";  
-	  std::cout << commify (ps.photons.size ()) << " " << ps.name;
-	  std::cout << " (" << commify (ps.num_paths) << " paths)";
-	  some = true;
-	}
+      PhotonSet &ps = *photon_sets[i];
+
+      if (ps.complete ())
+	continue;
+
+      const std::vector<Photon> &photons = batch.photons[i];
+      const std::vector<Vec> &normals = batch.normals[i];
+      unsigned needed = ps.target_count - ps.photons.size ();
+
+      // Number of photons from BATCH we'll use.
+      //
+      unsigned num = min (unsigned (photons.size ()), needed);
+
+      ps.photons.insert (ps.photons.end (),
+			 photons.begin (), photons.begin () + num);
+
+      if (ps.record_normals)
+	ps.normals.insert (ps.normals.end (),
+			   normals.begin (), normals.begin () + num);
+
+      if (num < needed)
+	ps.num_paths += batch.num_paths;
+      else
+	// This batch completes PS, so only count the paths up to the
+	// one which deposited the last photon we use.
+	//
+	ps.num_paths += batch.path_counts[i][needed - 1];
     }
-  if (! some)
-    std::cout << "no photons generated!";
-  std::cout << std::endl;
 }
@@ -1,6 +1,6 @@
 // photon-shooter.h -- Photon-shooting infrastructure
 //
-//  Copyright (C) 2010, 2011  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2010, 2011, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -14,6 +14,7 @@
 #define SNOGRAY_PHOTON_SHOOTER_H
 
 #include <vector>
+#include <string>
 
 #include "photon.h"
 
@@ -21,6 +22,11 @@
 namespace snogray {
 
 
+class GlobalRenderState;
+class RenderContext;
+class Intersect;
+
+
 // A class used to shoot photons, for building photon maps.  This is an
 // abstract class, and must be subclassed.
 //
@@ -28,7 +34,7 @@ class PhotonShooter
 {
 public:
 
-  PhotonShooter (const std::string &_name) : name (_name) { }
+  PhotonShooter (const std::string &_name) : name (_name), first_batch (0) { }
 
   // A set of photons deposited during shooting.  Subclasses usually
   // have one or more PhotonSets which they are filling in.
@@ -36,21 +42,37 @@ public:
   class PhotonSet;
 
   // Shoot photons from the lights, depositing them in photon-sets
-  // at appropriate points by calling PhotonSet::deposit.
+  // at appropriate points chosen by calling
+  // PhotonShooter::choose_photon_set.
+  //
+  // Photons are shot using the number of threads given by the
+  // "setup_threads" parameter in GLOBAL_RENDER_STATE.  The resulting
+  // photon-sets are the same regardless of the number of threads.
+  //
+  // Each call continues with the photon paths following those used by
+  // the previous call, so calling this method again after clearing
+  // the photon-sets (see PhotonSet::clear) yields a new, independent,
+  // set of photons.
   //
   void shoot (const GlobalRenderState &global_render_state);
 
-  // Deposit (or ignore) the photon PHOTON in some photon-set.
-  // ISEC is the intersection where the photon is being stored, and
-  // BSDF_HISTORY is the bitwise-or of all BSDF past interactions
-  // since this photon was emitted by the light (it will be zero for
-  // the first intersection).
+  // Return the photon-set in which the photon PHOTON should be
+  // deposited, or zero if it should be ignored.  ISEC is the
+  // intersection where the photon is being stored, and BSDF_HISTORY
+  // is the bitwise-or of all BSDF past interactions since this photon
+  // was emitted by the light (it will be zero for the first
+  // intersection).
+  //
+  // The caller takes care of ignoring photons for photon-sets which
+  // are already complete.  As this method may be called by multiple
+  // threads simultaneously, it should not modify any state.
   //
   // This method must be defined by subclasses.
   //
-  virtual void deposit (const Photon &photon,
-			const Intersect &isec, unsigned bsdf_history)
-    = 0;
+  virtual const PhotonSet *choose_photon_set (const Photon &photon,
+					      const Intersect &isec,
+					      unsigned bsdf_history)
+    const = 0;
 
   // Return true if all photon-sets are complete.
   //
@@ -69,6 +91,31 @@ public:
   // Subclasses probably want to set this to something appropriate.
   //
   std::string name;
+
+private:
+
+  // A batch of photon paths being shot by a single thread.
+  //
+  struct Batch;
+
+  // State shared by all threads shooting photons.
+  //
+  struct ShootState;
+
+  // Shoot the photon paths in BATCH using CONTEXT, depositing photons
+  // in BATCH rather than in our photon-sets.
+  //
+  void shoot_batch (Batch &batch, RenderContext &context) const;
+
+  // Add the photons from BATCH to our photon-sets, up to their target
+  // counts.
+  //
+  void merge_batch (const Batch &batch);
+
+  // The number of the first batch of photon paths shot by the next
+  // call to PhotonShooter::shoot.
+  //
+  unsigned first_batch;
 };
 
 
@@ -81,7 +128,8 @@ public:
 
   PhotonSet (unsigned _target_count, const std::string &_name,
 	     PhotonShooter &shooter)
-    : num_paths (0), target_count (_target_count), name (_name)
+    : num_paths (0), target_count (_target_count), name (_name),
+      record_normals (false)
   {
     shooter.photon_sets.push_back (this);
   }
@@ -90,13 +138,16 @@ public:
   //
   bool complete () const { return photons.size () == target_count; }
 
+  // Remove all photons from this set, so that it may be filled again.
+  //
+  void clear () { photons.clear (); normals.clear (); num_paths = 0; }
+
   // Deposited photons;
   //
   std::vector<Photon> photons;
 
   // Number of paths tried so far in generating this set.  This will
-  // be incremented for each new path until this set is declare done
-  // by setting the field PhotonSet::done to true.
+  // be incremented for each new path until this set is complete.
   //
   unsigned num_paths;
 
@@ -108,6 +159,17 @@ public:
   // shooting.
   //
   std::string name;
+
+  // If true, the surface normal at each deposited photon is recorded
+  // in NORMALS.
+  //
+  bool record_normals;
+
+  // If RECORD_NORMALS is true, the surface normal at the location of
+  // each photon in PHOTONS, on the side of the surface the photon
+  // arrived from; otherwise, empty.
+  //
+  std::vector<Vec> normals;
 };
 
 
@@ -0,0 +1,94 @@
+// pixel-stats.cc -- Per-pixel sample statistics for progressive rendering
+//
+//  Copyright (C) 2014  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#include "util/snogmath.h"
+
+#include "render-packet.h"
+
+#include "pixel-stats.h"
+
+
+using namespace snogray;
+
+
+const float PixelStats::DARK_LEVEL = 0.1f;
+
+
+// Make statistics for the rectangle of pixels of size WIDTH x HEIGHT
+// with an upper-left corner at LEFT_X, TOP_Y.  All pixels are
+// initially active.
+//
+PixelStats::PixelStats (int _left_x, int _top_y,
+			unsigned _width, unsigned _height)
+  : left_x (_left_x), top_y (_top_y), width (_width), height (_height),
+    pixels (_width * _height)
+{
+}
+
+// Add the results in PACKET to our statistics.  This may be called
+// by multiple threads simultaneously, as long as they use packets
+// containing different pixels.
+//
+void
+PixelStats::add_results (const RenderPacket &packet)
+{
+  for (std::vector<RenderPacket::Result>::const_iterator ri
+	 = packet.results.begin ();
+       ri != packet.results.end (); ++ri)
+    {
+      // The result's coordinates include the offset of the sample
+      // within its pixel, so they're always inside the pixel.
+      //
+      UV pixel (floor (ri->coords.u), floor (ri->coords.v));
+
+      if (Pixel *p = lookup (pixel))
+	p->add (ri->val.alpha_scaled_color ().intensity ());
+    }
+}
+
+// Return the estimated error of this pixel's mean.
+//
+float
+PixelStats::Pixel::error () const
+{
+  if (num_samples < 2)
+    return 0;
+
+  float variance = m2 / (num_samples - 1);
+  float std_err = sqrt (variance / num_samples);
+
+  return std_err / max (mean, DARK_LEVEL);
+}
+
+// Deactivate every pixel whose estimated error is below THRESHOLD,
+// and return the number of pixels still active.  If THRESHOLD is
+// zero, no pixels are deactivated.
+//
+unsigned
+PixelStats::update_active (float threshold)
+{
+  unsigned num_active = 0;
+
+  for (std::vector<Pixel>::iterator pi = pixels.begin ();
+       pi != pixels.end (); ++pi)
+    if (pi->active)
+      {
+	if (threshold > 0
+	    && pi->num_samples >= MIN_SAMPLES
+	    && pi->error () < threshold)
+	  pi->active = false;
+	else
+	  num_active++;
+      }
+
+  return num_active;
+}
@@ -0,0 +1,131 @@
+// pixel-stats.h -- Per-pixel sample statistics for progressive rendering
+//
+//  Copyright (C) 2014  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#ifndef SNOGRAY_PIXEL_STATS_H
+#define SNOGRAY_PIXEL_STATS_H
+
+#include <vector>
+
+#include "geometry/uv.h"
+
+
+namespace snogray {
+
+
+class RenderPacket;
+
+
+// Running statistics for the samples rendered in each pixel of a
+// rectangular region, used by progressive rendering to decide which
+// pixels need more samples.
+//
+// For each pixel, we keep the number of samples, and the mean and
+// variance of their intensity (updated incrementally using Welford's
+// method), from which the standard error of the pixel's mean can be
+// estimated.  A pixel is "active" while it still needs more samples.
+//
+class PixelStats
+{
+public:
+
+  // A pixel's error is its standard error divided by the maximum of
+  // its mean and this value, so that very dark pixels don't need to
+  // be extremely precise to converge.
+  //
+  static const float DARK_LEVEL;
+
+  // Pixels with fewer than this many samples are never considered to
+  // have converged, as their variance estimate is too unreliable.
+  //
+  static const unsigned MIN_SAMPLES = 8;
+
+  // Make statistics for the rectangle of pixels of size WIDTH x HEIGHT
+  // with an upper-left corner at LEFT_X, TOP_Y.  All pixels are
+  // initially active.
+  //
+  PixelStats (int left_x, int top_y, unsigned width, unsigned height);
+
+  // Add the results in PACKET to our statistics.  This may be called
+  // by multiple threads simultaneously, as long as they use packets
+  // containing different pixels.
+  //
+  void add_results (const RenderPacket &packet);
+
+  // Return true if the pixel at PIXEL still needs more samples.
+  //
+  bool active (const UV &pixel) const
+  {
+    const Pixel *p = lookup (pixel);
+    return p && p->active;
+  }
+
+  // Deactivate every pixel whose estimated error is below THRESHOLD,
+  // and return the number of pixels still active.  If THRESHOLD is
+  // zero, no pixels are deactivated.
+  //
+  unsigned update_active (float threshold);
+
+private:
+
+  struct Pixel
+  {
+    Pixel () : num_samples (0), mean (0), m2 (0), active (true) { }
+
+    // Add a sample with intensity VAL.
+    //
+    void add (float val)
+    {
+      num_samples++;
+      float delta = val - mean;
+      mean += delta / num_samples;
+      m2 += delta * (val - mean);
+    }
+
+    // Return the estimated error of this pixel's mean.
+    //
+    float error () const;
+
+    unsigned num_samples;
+
+    // Mean of samples so far, and the sum of squared differences from
+    // the mean (so the sample variance is M2 / (NUM_SAMPLES - 1)).
+    //
+    float mean, m2;
+
+    bool active;
+  };
+
+  // Return the entry for the pixel at PIXEL, or zero if it isn't
+  // within our bounds.
+  //
+  Pixel *lookup (const UV &pixel)
+  {
+    int x = int (pixel.u) - left_x, y = int (pixel.v) - top_y;
+    if (x < 0 || x >= int (width) || y < 0 || y >= int (height))
+      return 0;
+    return &pixels[y * width + x];
+  }
+  const Pixel *lookup (const UV &pixel) const
+  {
+    return const_cast<PixelStats *> (this)->lookup (pixel);
+  }
+
+  int left_x, top_y;
+  unsigned width, height;
+
+  std::vector<Pixel> pixels;
+};
+
+
+}
+
+#endif // SNOGRAY_PIXEL_STATS_H
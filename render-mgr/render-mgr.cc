@@ -1,6 +1,6 @@
 // renderer.cc -- Output rendering object
 //
-//  Copyright (C) 2006-2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2006-2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -11,18 +11,19 @@
 //
 
 #include <list>
-#include <map>
 
 #include "util/snogmath.h"
 #include "util/snogassert.h"
 #include "util/progress.h"
 #include "util/float-excepts-guard.h"
+#include "util/timeval.h"
 #include "render/global-render-state.h"
 #include "renderer.h"
 #include "render-packet.h"
+#include "pixel-stats.h"
 #if USE_THREADS
 #include "render-thread.h"
-#include "render-queue.h"
+#include "render-scheduler.h"
 #endif
 
 #include "render-mgr.h"
@@ -35,7 +36,8 @@ RenderMgr::RenderMgr (const GlobalRenderState &_global_state,
 		      const Camera &_camera,
 		      unsigned _width, unsigned _height)
   : global_state (_global_state), camera (_camera),
-    width (_width), height (_height)
+    width (_width), height (_height),
+    pixel_stats (0), pass (0)
 {
 }
 
@@ -46,25 +48,46 @@ RenderMgr::RenderMgr (const GlobalRenderState &_global_state,
 // iterating through PATTERN.  STATS will be updated with rendering
 // statistics.
 //
+// If the global render parameter "passes" is greater than one,
+// rendering is done progressively (see RenderMgr::render_progressive).
+//
 void
 RenderMgr::render (unsigned num_threads,
 		   RenderPattern &pattern,
 		   ImageSampledOutput &output,
 		   Progress &prog, RenderStats &stats)
 {
-  // Tell the progress indicator the bounds we will be using.
-  //
-  prog.set_start (pattern.position (pattern.begin ()));
-  prog.set_size (pattern.position (pattern.end ())
-		 - pattern.position (pattern.begin ()));
-
   // Turn on floating-point exceptions during rendering if possible,
   // to detect errors.
   //
   FloatExceptsGuard fe_guard (FE_DIVBYZERO|FE_INVALID);
 
+  unsigned num_passes = global_state.params.get_uint ("passes", 1);
+
   // Render!
   //
+  if (num_passes > 1)
+    render_progressive (num_threads, num_passes, pattern, output,
+			prog, stats);
+  else
+    render_pass (num_threads, pattern, output, prog, stats);
+}
+
+// Render a single pass over the pixels in PATTERN to OUTPUT, using
+// NUM_THREADS threads.
+//
+void
+RenderMgr::render_pass (unsigned num_threads,
+			RenderPattern &pattern,
+			ImageSampledOutput &output,
+			Progress &prog, RenderStats &stats)
+{
+  // Tell the progress indicator the bounds we will be using.
+  //
+  prog.set_start (pattern.position (pattern.begin ()));
+  prog.set_size (pattern.position (pattern.end ())
+		 - pattern.position (pattern.begin ()));
+
 #if USE_THREADS
   if (num_threads != 1)
     render_multi_threaded (num_threads, pattern, output, prog, stats);
@@ -73,6 +96,73 @@ RenderMgr::render (unsigned num_threads,
     render_single_threaded (pattern, output, prog, stats);
 }
 
+
+
+// progressive rendering
+
+// Render the pixels in PATTERN to OUTPUT in a series of passes, each
+// of which renders the normal number of samples for every pixel which
+// is still "active."  After each pass, pixels whose estimated error
+// has fallen below the "adaptive_threshold" render parameter are
+// deactivated, so later passes only spend samples where they're still
+// needed.  Rendering stops after NUM_PASSES passes, or when no pixels
+// are active.  Before each pass after the first, the surface integrator
+// is notified (see SurfaceInteg::GlobalState::start_pass).
+//
+// As every pass may add samples anywhere, OUTPUT must buffer the
+// entire image, and nothing is actually written until rendering is
+// finished.  If the render parameter "snapshot_file" is set, an image
+// of the current state is written to that file after a pass, at most
+// once every "snapshot_interval" seconds.
+//
+void
+RenderMgr::render_progressive (unsigned num_threads, unsigned num_passes,
+			       RenderPattern &pattern,
+			       ImageSampledOutput &output,
+			       Progress &prog, RenderStats &stats)
+{
+  const ValTable &params = global_state.params;
+
+  float threshold = params.get_float ("adaptive_threshold", 0);
+  std::string snapshot_file = params.get_string ("snapshot_file");
+  double snapshot_interval
+    = double (params.get_float ("snapshot_interval", 60));
+
+  PixelStats stats_buf (pattern.left_x (), pattern.top_y (),
+			pattern.width (), pattern.height ());
+
+  pixel_stats = &stats_buf;
+
+  Timeval last_snapshot (Timeval::TIME_OF_DAY);
+
+  for (pass = 0; pass < num_passes; pass++)
+    {
+      // Let the surface integrator prepare for the new pass.
+      //
+      if (pass != 0)
+	global_state.surface_integ_global_state->start_pass (pass);
+
+      render_pass (num_threads, pattern, output, prog, stats);
+
+      if (pass + 1 == num_passes || stats_buf.update_active (threshold) == 0)
+	break;
+
+      if (! snapshot_file.empty ())
+	{
+	  Timeval now (Timeval::TIME_OF_DAY);
+	  if (now - last_snapshot >= snapshot_interval)
+	    {
+	      output.write_snapshot (snapshot_file);
+	      last_snapshot = now;
+	    }
+	}
+    }
+
+  pixel_stats = 0;
+  pass = 0;
+}
+
+
 
 // single-threaded rendering
 
@@ -95,8 +185,8 @@ RenderMgr::render_single_threaded (RenderPattern &pattern,
 
   while (pat_it != limit)
     {
-      output.set_min_sample_y (
-	       clamp (pattern.min_y (pat_it), 0, int (height) - 1));
+      retire_rows (output,
+		   clamp (pattern.min_y (pat_it), 0, int (height) - 1));
 
       fill_packet (pat_it, limit, packet);
 
@@ -128,84 +218,26 @@ RenderMgr::render_multi_threaded (unsigned num_threads,
 				  ImageSampledOutput &output,
 				  Progress &prog, RenderStats &stats)
 {
-  RenderPattern::iterator pat_it = pattern.begin ();
-  RenderPattern::iterator limit = pattern.end ();
-
-  // RenderPacket queues for communicating with rendering threads.
-  // PENDING_Q holds packets with pixels to be rendered, and DONE_Q holds
-  // packets with the results.
-  //
-  RenderQueue pending_q, done_q;
-
-  unsigned num_packets = num_threads * 2;
-
-  // A mapping from packets to "min_y" values.
-  //
-  std::map<RenderPacket *, int> packet_min_y;
-
-  // To start, we just add new empty packets to DONE_Q.  They'll be
-  // processed as if they contain results, but with no effect because
-  // they're empty, and then fed back into the processing loop.
+  // The scheduler hands out packets of pixels to rendering threads,
+  // and outputs their results.
   //
-  for (unsigned i = 0; i < num_packets; i++)
-    done_q.put (new RenderPacket);
+  RenderScheduler scheduler (*this, pattern, output, prog,
+			     num_threads * MAX_PACKETS_PER_THREAD);
 
-  // Now start our rendering threads; they'll just block waiting for
-  // packets to be added to PENDING_Q.
+  // Start our rendering threads; they'll just wait until the
+  // scheduler is started.
   //
   std::list<RenderThread *> threads;
   for (unsigned i = 0; i < num_threads; i++)
     threads.push_back (new RenderThread (global_state, camera, width, height,
-					 pending_q, done_q));
+					 scheduler));
 
   prog.start ();
 
-  while (pat_it != limit)
-    {
-      RenderPacket *packet = done_q.get ();
-      ASSERT (packet);
-
-      // Write out the results from PACKET.
-      //
-      output_packet (*packet, output);
-
-      // Update PACKET's min_y value to reflect the pixels it will be
-      // filled with.
-      //
-      packet_min_y[packet]
-	= clamp (pattern.min_y (pat_it), 0, int (height) - 1);
-
-      // Compute the "global min_y" value, which is the minimum of all
-      // packet min_y values.
-      //
-      int global_min_y = int (height) - 1;
-      for (std::map<RenderPacket *, int>::const_iterator i
-	     = packet_min_y.begin();
-	   i != packet_min_y.end (); ++i)
-	global_min_y = min (global_min_y, i->second);
-
-      // Set OUTPUT's min_y accordingly.
-      //
-      output.set_min_sample_y (global_min_y);
-
-      // Now add more pixels to PACKET and make it available for more
-      // processing.
-      //
-      fill_packet (pat_it, limit, *packet);
-      pending_q.put (packet);
-
-      prog.update (pattern.position (pat_it));
-    }
-
-  // Call RenderQueue::shutdown on PENDING_Q and DONE_Q so that that calls
-  // to RenderQueue::get won't block when the queues finally run out, but
-  // instead will return a null pointer.  This allows orderly shutdown.
-  //
-  pending_q.shutdown ();
-  done_q.shutdown ();
+  scheduler.start ();
 
-  // Join and destroy all rendering threads, which should have finished by
-  // now.
+  // Join and destroy all rendering threads, which will exit when
+  // there's nothing left to render.
   //
   while (! threads.empty ())
     {
@@ -216,17 +248,6 @@ RenderMgr::render_multi_threaded (unsigned num_threads,
       delete th;
     }
 
-  // Get the final batch of results, and destroy the packets.
-  //
-  while (RenderPacket *packet = done_q.get ())
-    {
-      output_packet (*packet, output);
-      delete packet;
-    }
-
-  ASSERT (pending_q.empty ());
-  ASSERT (done_q.empty ());
-
   prog.end ();
 }
 
@@ -251,8 +272,34 @@ RenderMgr::fill_packet (RenderPattern::iterator &pat_it,
   unsigned num_samps = global_state.num_samples;
   unsigned num_pix = (PACKET_SIZE + num_samps - 1) / num_samps;
 
-  for (unsigned i = 0; i < num_pix && pat_it != limit; i++)
-    packet.pixels.push_back (*pat_it++);
+  packet.pass = pass;
+
+  // The band of the pattern the packet's pixels come from.
+  //
+  int band_y = pat_it.min_y ();
+
+  // When rendering progressively, skip any pixels which don't need
+  // more samples.
+  //
+  while (packet.pixels.size () < num_pix && pat_it != limit)
+    {
+      // In later passes, most pixels may be skipped, so a packet
+      // could end up holding pixels from all over the image, and its
+      // results would need a huge tile to splat (see
+      // RenderScheduler::splat_packet).  Keep each packet within a
+      // single band of the pattern instead.
+      //
+      if (pixel_stats && pat_it.min_y () != band_y)
+	{
+	  if (! packet.pixels.empty ())
+	    break;
+	  band_y = pat_it.min_y ();
+	}
+
+      UV pixel = *pat_it++;
+      if (! pixel_stats || pixel_stats->active (pixel))
+	packet.pixels.push_back (pixel);
+    }
 }
 
 // Output results from PACKET to OUTPUT.
@@ -263,4 +310,7 @@ RenderMgr::output_packet (RenderPacket &packet, ImageSampledOutput &output)
   for (std::vector<RenderPacket::Result>::iterator ri = packet.results.begin ();
        ri != packet.results.end (); ++ri)
     output.add_sample (ri->coords.u, ri->coords.v, ri->val);
+
+  if (pixel_stats)
+    pixel_stats->add_results (packet);
 }
@@ -1,6 +1,6 @@
 // render-mgr.h -- Outer rendering driver
 //
-//  Copyright (C) 2010-2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2010-2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -24,6 +24,7 @@ namespace snogray {
 class Camera;
 class Progress;
 class RenderPacket;
+class PixelStats;
 struct RenderStats;
 class GlobalRenderState;
 
@@ -36,6 +37,13 @@ public:
   //
   static const unsigned PACKET_SIZE = 4096;
 
+  // When using multiple threads, the maximum number of packets per
+  // thread which may be "in flight" (generated, but whose results
+  // have not yet been output) at once.  This bounds the number of
+  // output rows that must be buffered in memory.
+  //
+  static const unsigned MAX_PACKETS_PER_THREAD = 4;
+
   RenderMgr (const GlobalRenderState &global_state,
 	     const Camera &_camera, unsigned _width, unsigned _height);
 
@@ -44,6 +52,9 @@ public:
   // RenderPattern::position on an iterator iterating through PATTERN.
   // STATS will be updated with rendering statistics.
   //
+  // If the global render parameter "passes" is greater than one,
+  // rendering is done progressively (see RenderMgr::render_progressive).
+  //
   void render (unsigned num_threads,
 	       RenderPattern &pattern,
 	       ImageSampledOutput &output,
@@ -51,6 +62,37 @@ public:
 
 private:
 
+  friend class RenderScheduler;
+
+  // Render the pixels in PATTERN to OUTPUT in a series of passes, each
+  // of which renders the normal number of samples for every pixel
+  // which is still "active."  After each pass, pixels whose estimated
+  // error has fallen below the "adaptive_threshold" render parameter
+  // are deactivated, so later passes only spend samples where they're
+  // still needed.  Rendering stops after NUM_PASSES passes, or when no
+  // pixels are active.  Before each pass after the first, the surface
+  // integrator is notified (see SurfaceInteg::GlobalState::start_pass).
+  //
+  // As every pass may add samples anywhere, OUTPUT must buffer the
+  // entire image, and nothing is actually written until rendering is
+  // finished.  If the render parameter "snapshot_file" is set, an
+  // image of the current state is written to that file after a pass,
+  // at most once every "snapshot_interval" seconds.
+  //
+  void render_progressive (unsigned num_threads, unsigned num_passes,
+			   RenderPattern &pattern,
+			   ImageSampledOutput &output,
+			   Progress &prog, RenderStats &stats);
+
+  // Render a single pass over the pixels in PATTERN to OUTPUT, using
+  // NUM_THREADS threads.
+  //
+  void render_pass (unsigned num_threads,
+		    RenderPattern &pattern,
+		    ImageSampledOutput &output,
+		    Progress &prog, RenderStats &stats);
+
+
   // Render the pixels in PATTERN to OUTPUT, using only the current
   // thread.  PROG will be periodically updated using the value of
   // RenderPattern::position on an iterator iterating through PATTERN.
@@ -82,6 +124,17 @@ private:
   //
   void output_packet (RenderPacket &packet, ImageSampledOutput &output);
 
+  // Tell OUTPUT that no more samples will be added to rows before
+  // MIN_Y (in the sample coordinate-system), so they can be written
+  // out.  When rendering progressively, later passes may still add
+  // samples anywhere, so this does nothing.
+  //
+  void retire_rows (ImageSampledOutput &output, int min_y)
+  {
+    if (! pixel_stats)
+      output.set_min_sample_y (min_y);
+  }
+
   const GlobalRenderState &global_state;
 
   // The camera being used.
@@ -93,6 +146,15 @@ private:
   // they are always used as such.
   //
   float width, height;
+
+  // When rendering progressively, per-pixel statistics used to decide
+  // which pixels need more samples; otherwise zero.
+  //
+  PixelStats *pixel_stats;
+
+  // The current progressive-rendering pass.
+  //
+  unsigned pass;
 };
 
 
@@ -1,6 +1,6 @@
 // render-packet.h -- Container for pixels to be rendered and the results
 //
-//  Copyright (C) 2010, 2011, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2010, 2011, 2013, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -13,6 +13,9 @@
 #ifndef SNOGRAY_RENDER_PACKET_H
 #define SNOGRAY_RENDER_PACKET_H
 
+#include <vector>
+
+#include "geometry/uv.h"
 #include "color/tint.h"
 
 
@@ -26,6 +29,8 @@ class RenderPacket
 {
 public:
 
+  RenderPacket () : min_y (0), pass (0) { }
+
   // The result of rendering a single sample inside a pixel.
   //
   struct Result
@@ -46,6 +51,19 @@ public:
   // so there are usually many more output results than input pixels.
   //
   std::vector<Result> results;
+
+  // The minimum y-coordinate of any pixel in this packet (as returned
+  // by RenderPattern::min_y when the packet was filled).  This is used
+  // to decide which output rows are finished when packets are
+  // rendered out of order.
+  //
+  int min_y;
+
+  // The rendering pass this packet belongs to, when rendering
+  // progressively (otherwise zero).  Each pass renders a fresh set of
+  // samples for every pixel in it.
+  //
+  unsigned pass;
 };
 
 
@@ -0,0 +1,280 @@
+// render-pattern.cc -- Generator for pixel coordinates to be rendered
+//
+//  Copyright (C) 2014  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#include <stdexcept>
+
+#include "util/snogmath.h"
+#include "util/val-table.h"
+
+#include "render-pattern.h"
+
+
+using namespace snogray;
+
+
+// Return the RenderPattern::Order called NAME.
+//
+static RenderPattern::Order
+parse_order (const std::string &name)
+{
+  if (name == "scanline" || name == "scan")
+    return RenderPattern::SCANLINE;
+  else if (name == "tiled" || name == "tile")
+    return RenderPattern::TILED;
+  else if (name == "morton" || name == "z")
+    return RenderPattern::MORTON;
+  else if (name == "hilbert")
+    return RenderPattern::HILBERT;
+  else
+    throw std::runtime_error ("Unknown render order \"" + name + "\"");
+}
+
+
+// RenderPattern constructors
+
+// Make a pattern covering the rectangle of pixels of size WIDTH x
+// HEIGHT with an upper-left corner at LEFT_X, TOP_Y.  PARAMS may
+// contain the entries "type", one of "scanline" (the default),
+// "tiled", "morton", or "hilbert", and "tile_size", the width and
+// height of tiles in pixels (for "morton" and "hilbert", this is
+// rounded up to a power of two).
+//
+RenderPattern::RenderPattern (int left_x, int top_y, int width, int height,
+			      const ValTable &params)
+  : x_beg (left_x), y_beg (top_y),
+    x_end (left_x + width), y_end (top_y + height),
+    order (parse_order (params.get_string ("type", "scanline")))
+{
+  unsigned tile_size = params.get_uint ("tile_size", DEFAULT_TILE_SIZE);
+  if (tile_size == 0)
+    throw std::runtime_error ("Render tile_size must be positive");
+
+  init_tiles (tile_size);
+}
+
+RenderPattern::RenderPattern (int left_x, int top_y, int width, int height,
+			      Order _order, unsigned tile_size)
+  : x_beg (left_x), y_beg (top_y),
+    x_end (left_x + width), y_end (top_y + height),
+    order (_order)
+{
+  init_tiles (tile_size);
+}
+
+// The largest tile size used for the curve orders (a power of two).
+//
+static const unsigned MAX_CURVE_TILE_SIZE = 1u << 15;
+
+// Set the tile size for this pattern's order to TILE_SIZE.
+//
+void
+RenderPattern::init_tiles (unsigned tile_size)
+{
+  if (order == SCANLINE)
+    {
+      tile_width = max (x_end - x_beg, 1);
+      tile_height = 1;
+    }
+  else
+    {
+      // A tile never needs to be larger than the pattern.  This also
+      // keeps the rounding below from looping forever on huge sizes.
+      //
+      unsigned max_size = unsigned (max (max (x_end - x_beg, y_end - y_beg),
+					 1));
+      tile_size = min (max (tile_size, 1u), max_size);
+
+      // The curve orders need a power-of-two tile size.  As their
+      // tiles are square, the size is also limited so that the number
+      // of pixels in a tile fits in an unsigned.
+      //
+      if (order == MORTON || order == HILBERT)
+	{
+	  unsigned pow2 = 1;
+	  while (pow2 < tile_size && pow2 < MAX_CURVE_TILE_SIZE)
+	    pow2 <<= 1;
+	  tile_size = pow2;
+	}
+
+      tile_width = tile_height = tile_size;
+    }
+}
+
+
+// Pattern iteration
+
+RenderPattern::iterator
+RenderPattern::begin () const
+{
+  iterator it (*this);
+
+  if (x_end > x_beg && y_end > y_beg)
+    {
+      it.tile_x = x_beg;
+      it.tile_y = y_beg;
+
+      // The first pixel of every tile is its upper-left corner, which
+      // is always inside the pattern.
+      //
+      set_tile_pixel (it);
+    }
+  else
+    it.tile_y = it.y = y_end;
+
+  return it;
+}
+
+RenderPattern::iterator
+RenderPattern::end () const
+{
+  iterator it (*this);
+
+  it.x = it.tile_x = x_beg;
+  it.y = it.tile_y = y_end;
+
+  if (x_end > x_beg && y_end > y_beg)
+    it.pos = unsigned (x_end - x_beg) * unsigned (y_end - y_beg);
+
+  return it;
+}
+
+// Advance IT to the next pixel in this pattern.
+//
+void
+RenderPattern::advance (iterator &it) const
+{
+  unsigned num_pixels = unsigned (x_end - x_beg) * unsigned (y_end - y_beg);
+
+  if (++it.pos == num_pixels)
+    {
+      // Finished; make IT look like RenderPattern::end().
+      //
+      it.x = it.tile_x = x_beg;
+      it.y = it.tile_y = y_end;
+      it.tile_index = 0;
+      return;
+    }
+
+  do
+    {
+      // Number of pixels in the current tile.  For the curve orders,
+      // tiles on the right and bottom edges may be partly outside the
+      // pattern, in which case set_tile_pixel skips the outside
+      // pixels; for the row orders, we just use a smaller tile.
+      //
+      unsigned tile_size;
+      if (order == MORTON || order == HILBERT)
+	tile_size = tile_width * tile_height;
+      else
+	tile_size = (min (tile_width, unsigned (x_end - it.tile_x))
+		     * min (tile_height, unsigned (y_end - it.tile_y)));
+
+      if (++it.tile_index == tile_size)
+	{
+	  it.tile_index = 0;
+	  it.tile_x += tile_width;
+
+	  if (it.tile_x >= x_end)
+	    {
+	      it.tile_x = x_beg;
+	      it.tile_y += tile_height;
+	    }
+	}
+    }
+  while (! set_tile_pixel (it));
+}
+
+
+// Curve decoding
+
+// Set X and Y to the coordinates of the point at distance INDEX along
+// a Morton ("Z-order") curve; these are just the even and odd bits of
+// INDEX respectively.
+//
+static void
+morton_point (unsigned index, unsigned &x, unsigned &y)
+{
+  x = y = 0;
+  for (unsigned bit = 0; index; bit++, index >>= 2)
+    {
+      x |= (index & 1) << bit;
+      y |= ((index >> 1) & 1) << bit;
+    }
+}
+
+// Set X and Y to the coordinates of the point at distance INDEX along
+// a Hilbert curve filling a square of size SIZE x SIZE, where SIZE is
+// a power of two.  The curve starts at (0, 0), and ends at (SIZE-1, 0).
+//
+static void
+hilbert_point (unsigned size, unsigned index, unsigned &x, unsigned &y)
+{
+  x = y = 0;
+
+  for (unsigned s = 1; s < size; s *= 2)
+    {
+      unsigned rx = 1 & (index / 2);
+      unsigned ry = 1 & (index ^ rx);
+
+      // Rotate/flip the quadrant appropriately.
+      //
+      if (ry == 0)
+	{
+	  if (rx == 1)
+	    {
+	      x = s - 1 - x;
+	      y = s - 1 - y;
+	    }
+
+	  unsigned t = x;
+	  x = y;
+	  y = t;
+	}
+
+      x += s * rx;
+      y += s * ry;
+
+      index /= 4;
+    }
+}
+
+// Set the current pixel in IT from IT.tile_index, returning false if
+// the resulting pixel lies outside the pattern.
+//
+bool
+RenderPattern::set_tile_pixel (iterator &it) const
+{
+  unsigned tx, ty;
+
+  switch (order)
+    {
+    case MORTON:
+      morton_point (it.tile_index, tx, ty);
+      break;
+
+    case HILBERT:
+      hilbert_point (tile_width, it.tile_index, tx, ty);
+      break;
+
+    default:
+      {
+	unsigned row_width = min (tile_width, unsigned (x_end - it.tile_x));
+	tx = it.tile_index % row_width;
+	ty = it.tile_index / row_width;
+      }
+    }
+
+  it.x = it.tile_x + int (tx);
+  it.y = it.tile_y + int (ty);
+
+  return it.x < x_end && it.y < y_end;
+}
@@ -1,6 +1,6 @@
 // render-pattern.h -- Generator for pixel coordinates to be rendered
 //
-//  Copyright (C) 2010, 2011, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2010, 2011, 2013, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -20,32 +20,47 @@
 namespace snogray {
 
 
+class ValTable;
+
+
 // A generator object, which yields pixel coordinates to be rendered.
 //
-// Currently this is hardwired to just scan from the upper-left in
-// scanline order.
+// The pixels are divided into rectangular "tiles", which are visited
+// in horizontal bands from top to bottom, and from left to right
+// within each band; the order in which the pixels inside each tile are
+// visited is determined by the pattern's "order":
+//
+//   SCANLINE -- Each tile is an entire row of pixels, so pixels are
+//		 simply visited in scanline order.
+//   TILED    -- Pixels within each tile are visited in scanline order.
+//   MORTON   -- Pixels within each tile are visited in Morton
+//		 ("Z-curve") order.
+//   HILBERT  -- Pixels within each tile are visited in the order of a
+//		 Hilbert curve.  Successive Hilbert tiles join up, so
+//		 adjacent pixels are always visited consecutively.
+//
+// The non-scanline orders keep consecutive pixels close together in
+// two dimensions, which gives rays traced for nearby pixels better
+// coherence (and thus better cache behavior).  Because all tiles in a
+// band are finished before the next band is started, the minimum
+// y-coordinate still to be rendered advances steadily, so the output
+// image only needs to buffer about one band's worth of rows at once.
 //
 class RenderPattern
 {
 public:
 
+  enum Order { SCANLINE, TILED, MORTON, HILBERT };
+
   // An iterator object for doing the actual iterating.
   //
   class iterator
   {
   public:
 
-    iterator (int _x, int _y, const RenderPattern &_pat)
-      : x (_x), y (_y), pat (_pat)
-    { }
-
-    iterator (const iterator &it)
-      : x (it.x), y (it.y), pat (it.pat)
-    { }
-
     bool operator== (const iterator &it) const
     {
-      return x == it.x && y == it.y;
+      return pos == it.pos;
     }
     bool operator!= (const iterator &it) const
     {
@@ -56,46 +71,66 @@ public:
 
     iterator &operator++ ()
     {
-      if (++x == pat.x_end)
-	{
-	  x = pat.x_beg;
-	  ++y;
-	}
+      pat.advance (*this);
       return *this;
     }
     iterator operator++ (int)
     {
       iterator result = *this;
-      if (++x == pat.x_end)
-	{
-	  x = pat.x_beg;
-	  ++y;
-	}
+      pat.advance (*this);
       return result;
     }
 
-    int min_y () const { return y; }
+    // No pixel yielded by this iterator in the future will have a
+    // y-coordinate less than the top of the current band.
+    //
+    int min_y () const { return tile_y; }
 
-    unsigned position () const
-    {
-      unsigned per_row = (pat.x_end - pat.x_beg);
-      return per_row * (y - pat.y_beg) + (x - pat.x_beg);
-    }
+    unsigned position () const { return pos; }
 
   private:
 
+    friend class RenderPattern;
+
+    iterator (const RenderPattern &_pat)
+      : x (0), y (0), tile_x (0), tile_y (0), tile_index (0), pos (0),
+	pat (_pat)
+    { }
+
+    // Current pixel.
+    //
     int x, y;
 
+    // Upper-left corner of the current tile.
+    //
+    int tile_x, tile_y;
+
+    // Index of the current pixel within the current tile, in the
+    // tile's own visiting order.
+    //
+    unsigned tile_index;
+
+    // Number of pixels already yielded by this iterator.
+    //
+    unsigned pos;
+
     const RenderPattern &pat;
   };
 
-  RenderPattern (int _left_x, int _top_y, int _width, int _height)
-    : x_beg (_left_x), y_beg (_top_y),
-      x_end (_left_x + _width), y_end (_top_y + _height)
-  { }
+  // Make a pattern covering the rectangle of pixels of size WIDTH x
+  // HEIGHT with an upper-left corner at LEFT_X, TOP_Y.  PARAMS may
+  // contain the entries "type", one of "scanline" (the default),
+  // "tiled", "morton", or "hilbert", and "tile_size", the width and
+  // height of tiles in pixels (for "morton" and "hilbert", this is
+  // rounded up to a power of two).
+  //
+  RenderPattern (int left_x, int top_y, int width, int height,
+		 const ValTable &params);
+  RenderPattern (int left_x, int top_y, int width, int height,
+		 Order order = SCANLINE, unsigned tile_size = DEFAULT_TILE_SIZE);
 
-  iterator begin () const { return iterator (x_beg, y_beg, *this); }
-  iterator end () const { return iterator (x_beg, y_end, *this); }
+  iterator begin () const;
+  iterator end () const;
 
   // Return the minimum y-value will ever be returned from the iterator
   // PAT_IT in the future.
@@ -114,9 +149,47 @@ public:
     return pat_it.position ();
   }
 
+  // Return the bounds of the rectangle of pixels this pattern covers.
+  //
+  int left_x () const { return x_beg; }
+  int top_y () const { return y_beg; }
+  unsigned width () const { return x_end - x_beg; }
+  unsigned height () const { return y_end - y_beg; }
+
+  // Return the height of each band of tiles.  This is the maximum
+  // number of rows which may be in progress at once (ignoring any
+  // additional rows due to packets being rendered out of order).
+  //
+  unsigned band_height () const { return tile_height; }
+
+  // Default width and height of tiles, for orders other than SCANLINE.
+  //
+  static const unsigned DEFAULT_TILE_SIZE = 16;
+
 private:
 
+  // Set the tile size for this pattern's order to TILE_SIZE.
+  //
+  void init_tiles (unsigned tile_size);
+
+  // Advance IT to the next pixel in this pattern.
+  //
+  void advance (iterator &it) const;
+
+  // Set the current pixel in IT from IT.tile_index, returning false if
+  // the resulting pixel lies outside the pattern.
+  //
+  bool set_tile_pixel (iterator &it) const;
+
   int x_beg, y_beg, x_end, y_end;
+
+  Order order;
+
+  // Size of each tile.  For SCANLINE order, a tile is a single row.
+  // For MORTON and HILBERT orders, tiles are square, with a size which
+  // is a power of two.
+  //
+  unsigned tile_width, tile_height;
 };
 
 
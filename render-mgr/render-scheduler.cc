@@ -0,0 +1,307 @@
+// render-scheduler.cc -- Work-stealing distribution of RenderPackets
+//
+//  Copyright (C) 2014  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#include "util/snogmath.h"
+#include "util/snogassert.h"
+#include "util/progress.h"
+#include "image/image-sampled-output.h"
+
+#include "render-mgr.h"
+#include "render-packet.h"
+#include "render-thread.h"
+#include "pixel-stats.h"
+
+#include "render-scheduler.h"
+
+
+using namespace snogray;
+
+
+// Make a scheduler for rendering the pixels in PATTERN to OUTPUT,
+// using MGR to fill and output packets.  PROG will be updated as
+// packets finish.  At most MAX_PACKETS packets will be in flight at
+// once.
+//
+RenderScheduler::RenderScheduler (RenderMgr &_mgr, RenderPattern &_pattern,
+				  ImageSampledOutput &_output,
+				  Progress &_prog,
+				  unsigned _max_packets)
+  : mgr (_mgr), pattern (_pattern),
+    pat_it (_pattern.begin ()), limit (_pattern.end ()),
+    output (_output), prog (_prog),
+    max_packets (_max_packets), started (false)
+{
+}
+
+RenderScheduler::~RenderScheduler ()
+{
+  ASSERT (packet_min_ys.empty ());
+
+  for (std::vector<RenderPacket *>::iterator pi = free_packets.begin ();
+       pi != free_packets.end (); ++pi)
+    delete *pi;
+}
+
+
+// Add WORKER to the set of workers handled by this scheduler, and
+// return its index.  This must be called before
+// RenderScheduler::start.
+//
+unsigned
+RenderScheduler::add_worker (RenderWorker *worker)
+{
+  LockGuard lock (mutex);
+
+  ASSERT (! started);
+
+  workers.push_back (worker);
+  return workers.size () - 1;
+}
+
+// Hand out the first packets, and allow workers to start.
+//
+void
+RenderScheduler::start ()
+{
+  UniqueLock lock (mutex);
+
+  if (! workers.empty ())
+    refill (0);
+
+  started = true;
+  cond.notify_all ();
+}
+
+// Wait until RenderScheduler::start has been called.  Each worker
+// should call this before doing anything else.
+//
+void
+RenderScheduler::await_start ()
+{
+  UniqueLock lock (mutex);
+
+  while (! started)
+    cond.wait (lock);
+}
+
+
+// RenderScheduler::get_packet
+
+// Return the next packet for WORKER to render, or a null pointer if
+// there is no more rendering to be done.  This tries, in order,
+// WORKER's own deque, stealing from other workers, and generating new
+// packets from the pattern; if the in-flight limit has been reached,
+// it waits for other packets to finish first.
+//
+RenderPacket *
+RenderScheduler::get_packet (RenderWorker &worker)
+{
+  unsigned num_workers = workers.size ();
+
+  for (;;)
+    {
+      if (RenderPacket *packet = worker.pop_packet ())
+	return packet;
+
+      // Our own deque is empty, so try to steal from other workers.
+      // Each worker starts with its successor, so that thieves don't
+      // all converge on the same victim.
+      //
+      for (unsigned i = 1; i < num_workers; i++)
+	{
+	  RenderWorker *victim = workers[(worker.index + i) % num_workers];
+	  if (RenderPacket *packet = victim->steal_packet ())
+	    return packet;
+	}
+
+      // There was nothing to steal, so we need to make more packets.
+      //
+      UniqueLock lock (mutex);
+
+      // Packets are only ever added to deques while holding
+      // RenderScheduler::mutex, so if another worker added some
+      // after we looked, we'll see them now.
+      //
+      if (any_queued_packets ())
+	continue;
+
+      if (pat_it == limit)
+	return 0;		// all done
+
+      if (packet_min_ys.size () < max_packets)
+	refill (worker.index);
+      else
+	cond.wait (lock);	// wait for some packet to finish
+    }
+}
+
+
+// RenderScheduler::packet_done
+
+// Output the results in PACKET, which has been rendered by WORKER, and
+// then recycle it.
+//
+void
+RenderScheduler::packet_done (RenderWorker &worker, RenderPacket *packet)
+{
+  // Convolve PACKET's results through the output filter into WORKER's
+  // private tile.  This doesn't touch the output, so it needs no
+  // locking, and all workers can do it in parallel.
+  //
+  splat_packet (*packet, worker.tile);
+
+  // When rendering progressively, record per-pixel statistics; each
+  // pixel is only in one packet per pass, so this needs no locking
+  // either.
+  //
+  if (mgr.pixel_stats)
+    mgr.pixel_stats->add_results (*packet);
+
+  LockGuard output_lock (output_mutex);
+
+  // Merging the tile into the output is just addition, so this
+  // serialized portion is short.
+  //
+  output.add_tile (worker.tile);
+
+  int min_y;
+  unsigned position;
+  {
+    LockGuard lock (mutex);
+
+    packet_min_ys.erase (packet_min_ys.find (packet->min_y));
+
+    min_y = unfinished_min_y ();
+    position = pattern.position (pat_it);
+
+    free_packets.push_back (packet);
+
+    // Wake up any workers waiting for room in the in-flight window.
+    //
+    cond.notify_all ();
+  }
+
+  // No more samples will be added to rows before MIN_Y, so they can
+  // be written out.
+  //
+  mgr.retire_rows (output, min_y);
+
+  prog.update (position);
+}
+
+
+// RenderScheduler::refill
+
+// Generate new packets from the pattern, until either the pattern is
+// exhausted or the in-flight limit is reached, and distribute them to
+// workers in round-robin order, starting with the worker at index
+// FIRST_WORKER.  RenderScheduler::mutex must be held.
+//
+void
+RenderScheduler::refill (unsigned first_worker)
+{
+  unsigned num_workers = workers.size ();
+  unsigned worker_index = first_worker;
+
+  while (pat_it != limit && packet_min_ys.size () < max_packets)
+    {
+      RenderPacket *packet;
+      if (free_packets.empty ())
+	packet = new RenderPacket;
+      else
+	{
+	  packet = free_packets.back ();
+	  free_packets.pop_back ();
+	}
+
+      packet->min_y
+	= clamp (pattern.min_y (pat_it), 0, int (mgr.height) - 1);
+      packet_min_ys.insert (packet->min_y);
+
+      mgr.fill_packet (pat_it, limit, *packet);
+
+      workers[worker_index]->push_packet (packet);
+
+      worker_index = (worker_index + 1) % num_workers;
+    }
+}
+
+
+// RenderScheduler helper methods
+
+// Add the results in PACKET to TILE, after resetting TILE to cover all
+// output pixels they affect.
+//
+void
+RenderScheduler::splat_packet (const RenderPacket &packet,
+			       ImageSampledOutput::SampleTile &tile)
+  const
+{
+  if (packet.results.empty ())
+    {
+      tile.reset (0, 0, 0, 0);
+      return;
+    }
+
+  float min_sx = packet.results[0].coords.u, max_sx = min_sx;
+  float min_sy = packet.results[0].coords.v, max_sy = min_sy;
+  for (std::vector<RenderPacket::Result>::const_iterator ri
+	 = packet.results.begin ();
+       ri != packet.results.end (); ++ri)
+    {
+      min_sx = min (min_sx, ri->coords.u);
+      max_sx = max (max_sx, ri->coords.u);
+      min_sy = min (min_sy, ri->coords.v);
+      max_sy = max (max_sy, ri->coords.v);
+    }
+
+  output.reset_tile (tile, min_sx, min_sy, max_sx, max_sy);
+
+  for (std::vector<RenderPacket::Result>::const_iterator ri
+	 = packet.results.begin ();
+       ri != packet.results.end (); ++ri)
+    output.add_sample (ri->coords.u, ri->coords.v, ri->val, tile);
+}
+
+// Return true if any worker has packets in its deque.
+// RenderScheduler::mutex must be held.
+//
+bool
+RenderScheduler::any_queued_packets () const
+{
+  for (std::vector<RenderWorker *>::const_iterator wi = workers.begin ();
+       wi != workers.end (); ++wi)
+    if ((*wi)->has_packets ())
+      return true;
+  return false;
+}
+
+// Return the minimum y-coordinate of any pixel which has not yet been
+// output.  RenderScheduler::mutex must be held.
+//
+int
+RenderScheduler::unfinished_min_y () const
+{
+  int min_y = int (mgr.height) - 1;
+
+  // Pixels not yet put into any packet.
+  //
+  if (pat_it != limit)
+    min_y = min (min_y, clamp (pattern.min_y (pat_it), 0, min_y));
+
+  // Pixels in packets that are still in flight.
+  //
+  if (! packet_min_ys.empty ())
+    min_y = min (min_y, *packet_min_ys.begin ());
+
+  return min_y;
+}
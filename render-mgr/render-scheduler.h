@@ -0,0 +1,177 @@
+// render-scheduler.h -- Work-stealing distribution of RenderPackets
+//
+//  Copyright (C) 2014  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#ifndef SNOGRAY_RENDER_SCHEDULER_H
+#define SNOGRAY_RENDER_SCHEDULER_H
+
+#include <vector>
+#include <set>
+
+#include "util/mutex.h"
+#include "util/cond-var.h"
+#include "image/image-sampled-output.h"
+
+#include "render-pattern.h"
+
+
+namespace snogray {
+
+
+class RenderMgr;
+class RenderPacket;
+class RenderWorker;
+class Progress;
+
+
+// A RenderScheduler hands out RenderPackets ("tiles" of pixels from a
+// RenderPattern) to a set of RenderWorkers running in separate
+// threads, and collects their results.
+//
+// There is no central queue:  each RenderWorker owns a deque of
+// packets, and when its own deque runs dry, it steals packets from
+// the other workers' deques.  Only when there's nothing left to steal
+// does a worker generate new packets from the pattern, which it then
+// distributes amongst all the workers.
+//
+// The number of packets "in flight" (generated but whose results have
+// not yet been output) is limited, so that the range of output-image
+// rows which ImageSampledOutput must buffer in memory stays bounded;
+// whenever a packet finishes, the output's minimum row is advanced to
+// the minimum row of any packet still in flight (see
+// ImageSampledOutput::set_min_sample_y).
+//
+class RenderScheduler
+{
+public:
+
+  // Make a scheduler for rendering the pixels in PATTERN to OUTPUT,
+  // using MGR to fill and output packets.  PROG will be updated as
+  // packets finish.  At most MAX_PACKETS packets will be in flight
+  // at once.
+  //
+  RenderScheduler (RenderMgr &mgr, RenderPattern &pattern,
+		   ImageSampledOutput &output, Progress &prog,
+		   unsigned max_packets);
+  ~RenderScheduler ();
+
+  // Add WORKER to the set of workers handled by this scheduler, and
+  // return its index.  This must be called before
+  // RenderScheduler::start.
+  //
+  unsigned add_worker (RenderWorker *worker);
+
+  // Hand out the first packets, and allow workers to start.
+  //
+  void start ();
+
+  // Wait until RenderScheduler::start has been called.  Each worker
+  // should call this before doing anything else.
+  //
+  void await_start ();
+
+  // Return the next packet for WORKER to render, or a null pointer if
+  // there is no more rendering to be done.  This tries, in order,
+  // WORKER's own deque, stealing from other workers, and generating
+  // new packets from the pattern; if the in-flight limit has been
+  // reached, it waits for other packets to finish first.
+  //
+  RenderPacket *get_packet (RenderWorker &worker);
+
+  // Output the results in PACKET, which has been rendered by WORKER,
+  // and then recycle it.  The results are first filtered into WORKER's
+  // own SampleTile without any locking, so only merging the tile into
+  // the output is serialized.
+  //
+  void packet_done (RenderWorker &worker, RenderPacket *packet);
+
+private:
+
+  // Generate new packets from the pattern, until either the pattern is
+  // exhausted or the in-flight limit is reached, and distribute them
+  // to workers in round-robin order, starting with the worker at index
+  // FIRST_WORKER.  RenderScheduler::mutex must be held.
+  //
+  void refill (unsigned first_worker);
+
+  // Add the results in PACKET to TILE, after resetting TILE to cover
+  // all output pixels they affect.
+  //
+  void splat_packet (const RenderPacket &packet,
+		     ImageSampledOutput::SampleTile &tile)
+    const;
+
+  // Return true if any worker has packets in its deque.
+  // RenderScheduler::mutex must be held.
+  //
+  bool any_queued_packets () const;
+
+  // Return the minimum y-coordinate of any pixel which has not yet been
+  // output.  RenderScheduler::mutex must be held.
+  //
+  int unfinished_min_y () const;
+
+  RenderMgr &mgr;
+
+  RenderPattern &pattern;
+
+  // Our position in the pattern.  Packets are generated in pattern
+  // order.
+  //
+  RenderPattern::iterator pat_it, limit;
+
+  ImageSampledOutput &output;
+
+  Progress &prog;
+
+  // All workers, indexed by their worker index.
+  //
+  std::vector<RenderWorker *> workers;
+
+  // The maximum number of packets in flight.
+  //
+  unsigned max_packets;
+
+  // The min_y value of every packet currently in flight.  The first
+  // entry is the first output row which may still receive samples.
+  //
+  std::multiset<int> packet_min_ys;
+
+  // Packets which have been output, and can be reused.
+  //
+  std::vector<RenderPacket *> free_packets;
+
+  // True if RenderScheduler::start has been called.
+  //
+  bool started;
+
+  // Mutex protecting the pattern position, the in-flight state, and
+  // the set of workers.  Note that individual worker deques have their
+  // own locks, so stealing does not require this.
+  //
+  Mutex mutex;
+
+  // Condition variable used to wait for the scheduler to start, or for
+  // in-flight packets to finish.
+  //
+  CondVar cond;
+
+  // Mutex serializing access to the output image and progress
+  // indicator.  If both this and RenderScheduler::mutex are held,
+  // this must be acquired first.
+  //
+  Mutex output_mutex;
+};
+
+
+}
+
+#endif // SNOGRAY_RENDER_SCHEDULER_H
@@ -1,6 +1,6 @@
 // render-thread.cc -- single rendering thread
 //
-//  Copyright (C) 2010  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2010, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -10,7 +10,7 @@
 // Written by Miles Bader <miles@gnu.org>
 //
 
-#include "render-queue.h"
+#include "render-scheduler.h"
 
 #include "render-thread.h"
 
@@ -18,12 +18,23 @@
 using namespace snogray;
 
 
+RenderWorker::RenderWorker (const GlobalRenderState &global_state,
+			    const Camera &camera,
+			    unsigned width, unsigned height,
+			    RenderScheduler &_scheduler)
+  : renderer (global_state, camera, width, height),
+    scheduler (_scheduler), index (_scheduler.add_worker (this))
+{
+}
+
 void
 RenderWorker::run ()
 {
-  while (RenderPacket *packet = in_q.get ())
+  scheduler.await_start ();
+
+  while (RenderPacket *packet = scheduler.get_packet (*this))
     {
       renderer.render_packet (*packet);
-      out_q.put (packet);
+      scheduler.packet_done (*this, packet);
     }
 }
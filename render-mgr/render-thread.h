@@ -1,6 +1,6 @@
 // render-thread.h -- single rendering thread
 //
-//  Copyright (C) 2010, 2011, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2010, 2011, 2013, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -13,7 +13,11 @@
 #ifndef SNOGRAY_RENDER_THREAD_H
 #define SNOGRAY_RENDER_THREAD_H
 
+#include <deque>
+
 #include "util/thread.h"
+#include "util/mutex.h"
+#include "image/image-sampled-output.h"
 
 #include "renderer.h"
 
@@ -21,23 +25,25 @@
 namespace snogray {
 
 
-class RenderQueue;
+class RenderScheduler;
 class GlobalRenderState;
 class Camera;
 
 
 // The guts of a single rendering thread.
 //
+// Each worker owns a deque of RenderPackets waiting to be rendered.
+// The worker itself takes packets from the front of its deque, and
+// other workers whose own deques are empty may steal packets from the
+// back (see RenderScheduler::get_packet).
+//
 class RenderWorker
 {
 public:
 
   RenderWorker (const GlobalRenderState &global_state,
 		const Camera &camera, unsigned width, unsigned height,
-		RenderQueue &_in_q, RenderQueue &_out_q)
-    : renderer (global_state, camera, width, height),
-      in_q (_in_q), out_q (_out_q)
-  { }
+		RenderScheduler &_scheduler);
 
   // Return rendering statistics from this thread.
   //
@@ -45,17 +51,80 @@ public:
 
   void run ();
 
+  // Add PACKET to the back of this worker's deque.
+  //
+  void push_packet (RenderPacket *packet)
+  {
+    LockGuard lock (packets_mutex);
+    packets.push_back (packet);
+  }
+
+  // Remove and return the packet at the front of this worker's deque,
+  // or return a null pointer if it's empty.  This is used by the
+  // worker itself.
+  //
+  RenderPacket *pop_packet ()
+  {
+    LockGuard lock (packets_mutex);
+    if (packets.empty ())
+      return 0;
+    RenderPacket *packet = packets.front ();
+    packets.pop_front ();
+    return packet;
+  }
+
+  // Remove and return the packet at the back of this worker's deque,
+  // or return a null pointer if it's empty.  This is used by other
+  // workers to steal work.
+  //
+  RenderPacket *steal_packet ()
+  {
+    LockGuard lock (packets_mutex);
+    if (packets.empty ())
+      return 0;
+    RenderPacket *packet = packets.back ();
+    packets.pop_back ();
+    return packet;
+  }
+
+  // Return true if this worker's deque is not empty.
+  //
+  bool has_packets ()
+  {
+    LockGuard lock (packets_mutex);
+    return ! packets.empty ();
+  }
+
 private:
 
+  friend class RenderScheduler;
+
   // Per-thread rendering state.
   //
   Renderer renderer;
 
-  // RenderPacket queues for communicating with the global thread manager.
-  // IN_Q holds packets to be rendered, and OUT_Q holds packets with
-  // rendering results.
+  // The scheduler which gives us packets to render, and to which we
+  // return the results.
+  //
+  RenderScheduler &scheduler;
+
+  // Our index in the scheduler's list of workers.
+  //
+  unsigned index;
+
+  // Buffer into which the results of each packet we render are
+  // filtered before being added to the output.
+  //
+  ImageSampledOutput::SampleTile tile;
+
+  // Packets waiting to be rendered by this worker (unless stolen by
+  // another worker first).
+  //
+  std::deque<RenderPacket *> packets;
+
+  // Mutex protecting RenderWorker::packets.
   //
-  RenderQueue &in_q, &out_q;
+  Mutex packets_mutex;
 };
 
 // Thread that runs a RenderWorker.
@@ -66,8 +135,8 @@ public:
 
   RenderThread (const GlobalRenderState &global_state,
 		const Camera &camera, unsigned width, unsigned height,
-		RenderQueue &_in_q, RenderQueue &_out_q)
-    : RenderWorker (global_state, camera, width, height, _in_q, _out_q),
+		RenderScheduler &_scheduler)
+    : RenderWorker (global_state, camera, width, height, _scheduler),
       Thread (&RenderThread::run, this)
   { }
 };
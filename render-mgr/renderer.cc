@@ -1,6 +1,6 @@
 // renderer.cc -- Output rendering object
 //
-//  Copyright (C) 2006-2010, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2006-2010, 2013, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -15,6 +15,8 @@
 #include "render/global-render-state.h"
 #include "render/scene.h"
 #include "render/sample-set.h"
+#include "render/surface-integ.h"
+#include "space/space.h"
 #include "render-packet.h"
 
 #include "renderer.h"
@@ -30,8 +32,11 @@ Renderer::Renderer (const GlobalRenderState &_global_state,
     camera_samples (context.samples.add_channel<UV> ()),
     focus_samples (context.samples.add_channel<UV> ()),
     per_pixel_random_seeds (
-      _global_state.params.get_bool ("per_pixel_random_seeds", false))
+      _global_state.params.get_bool ("per_pixel_random_seeds", false)),
+    pixel_samples (Space::MAX_PACKET_SIZE, context.samples)
 {
+  batch_rays.reserve (Space::MAX_PACKET_SIZE);
+  batch_entries.reserve (Space::MAX_PACKET_SIZE);
 }
 
 
@@ -43,9 +48,6 @@ Renderer::render_packet (RenderPacket &packet)
 {
   SampleSet &samples = context.samples;
 
-  SurfaceInteg &surface_integ = *context.surface_integ;
-  Media media (context.default_medium);
-
   packet.results.clear ();
 
   // Maximum length of a camera-ray.  We make it long enough to reach
@@ -53,22 +55,55 @@ Renderer::render_packet (RenderPacket &packet)
   //
   dist_t max_trace = (context.scene.bbox () + camera.pos).diameter ();
 
+  // The maximum number of pixels whose rays we batch together.  When
+  // using per-pixel random seeds, each pixel must be completely
+  // rendered before the next pixel's seed is set, so we can't batch
+  // multiple pixels.
+  //
+  unsigned max_batch_pixels
+    = per_pixel_random_seeds ? 1 : pixel_samples.size ();
+
+  unsigned num_batch_pixels = 0;
+
   for (std::vector<UV>::const_iterator pi = packet.pixels.begin ();
        pi != packet.pixels.end (); ++pi)
     {
       UV pixel = *pi;
 
+      // If there's not enough room in the current batch for this
+      // pixel's rays, render it first.
+      //
+      if (num_batch_pixels == max_batch_pixels
+	  || (num_batch_pixels != 0
+	      && (batch_rays.size () + samples.num_samples
+		  > Space::MAX_PACKET_SIZE)))
+	{
+	  render_batch (packet);
+	  num_batch_pixels = 0;
+	}
+
       if (per_pixel_random_seeds)
 	{
+	  // Later progressive-rendering passes must use different
+	  // samples than earlier ones, so include the pass in the seed.
+	  //
 	  unsigned seed = unsigned (pixel.u) * 57123 + unsigned (pixel.v);
+	  seed += packet.pass * 0x9e3779b9;
 	  context.random.seed (seed);
 	}
 
       samples.generate ();
 
+      // Save this pixel's samples, as SAMPLES may be re-generated
+      // before this pixel's rays are rendered.
+      //
+      unsigned pixel_index = num_batch_pixels++;
+      SampleSet &pixel_samps = pixel_samples[pixel_index];
+      pixel_samps.copy_samples (samples);
+
       for (unsigned snum = 0; snum < samples.num_samples; snum++)
 	{
-	  SampleSet::Sample sample (samples, snum);
+	  SampleSet::Sample sample (pixel_samps, snum);
 
 	  UV camera_samp = sample.get (camera_samples);
 	  UV focus_samp = sample.get (focus_samples);
@@ -84,19 +119,64 @@ Renderer::render_packet (RenderPacket &packet)
 	  UV film_loc (coords.u / width, (height - coords.v) / height);
 
 	  // Translate the image position U, V into a ray coming from the
-	  // camera.
+	  // camera, and add it to the current batch.
 	  //
-	  Ray camera_ray = camera.eye_ray (film_loc, focus_samp, max_trace);
+	  batch_rays.push_back (
+		       camera.eye_ray (film_loc, focus_samp, max_trace));
+	  batch_entries.push_back (BatchEntry (coords, pixel_index, snum));
+	}
+    }
 
-	  // .. calculate what light arrives via that ray.
-	  //
-	  Tint tint = surface_integ.Li (camera_ray, media, sample);
+  if (num_batch_pixels != 0)
+    render_batch (packet);
+}
 
-	  packet.results.push_back (RenderPacket::Result (coords, tint));
 
-	  context.mempool.reset ();
+// Trace and render all camera-rays in the current batch, adding results
+// to PACKET, and then clear the batch.
+//
+void
+Renderer::render_batch (RenderPacket &packet)
+{
+  SurfaceInteg &surface_integ = *context.surface_integ;
+  Media media (context.default_medium);
+
+  unsigned num_batch_rays = batch_rays.size ();
+
+  for (unsigned base = 0; base < num_batch_rays;
+       base += Space::MAX_PACKET_SIZE)
+    {
+      unsigned num_rays = min (num_batch_rays - base, Space::MAX_PACKET_SIZE);
+
+      // Find the closest intersection for each ray in this packet.
+      //
+      const Surface::Renderable::IsecInfo *isec_infos[Space::MAX_PACKET_SIZE];
+      context.scene.intersect (num_rays, &batch_rays[base], isec_infos,
+			       context);
+
+      // ... and calculate what light arrives via each ray.
+      //
+      for (unsigned i = 0; i < num_rays; i++)
+	{
+	  const BatchEntry &entry = batch_entries[base + i];
+
+	  SampleSet::Sample sample (pixel_samples[entry.pixel_index],
+				    entry.sample_num);
+
+	  Tint tint = surface_integ.Li (batch_rays[base + i], isec_infos[i],
+					media, sample);
+
+	  packet.results.push_back (RenderPacket::Result (entry.coords, tint));
 	}
+
+      // Resetting the mempool must wait until all rays in the packet
+      // have been rendered, as ISEC_INFOS are allocated from it.
+      //
+      context.mempool.reset ();
     }
+
+  batch_rays.clear ();
+  batch_entries.clear ();
 }
 
 
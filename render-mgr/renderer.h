@@ -1,6 +1,6 @@
 // renderer.h -- Low-level rendering driver
 //
-//  Copyright (C) 2006, 2007, 2008, 2009, 2010, 2011, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2006, 2007, 2008, 2009, 2010, 2011, 2013, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -13,6 +13,10 @@
 #ifndef SNOGRAY_RENDERER_H
 #define SNOGRAY_RENDERER_H
 
+#include <vector>
+
+#include "geometry/ray.h"
+#include "geometry/uv.h"
 #include "render/render-context.h"
 #include "render/render-stats.h"
 #include "render/sample-set.h"
@@ -46,6 +50,30 @@ public:
 
 private:
 
+  // A camera-ray waiting to be traced, as part of a batch of rays
+  // being traced together.
+  //
+  struct BatchEntry
+  {
+    BatchEntry (const UV &_coords, unsigned _pixel_index, unsigned _sample_num)
+      : coords (_coords), pixel_index (_pixel_index), sample_num (_sample_num)
+    { }
+
+    // The X/Y coordinates of the sample in the output image.
+    //
+    UV coords;
+
+    // The index in PIXEL_SAMPLES of the sample-set for this ray's
+    // pixel, and the top-level sample-number in that sample-set.
+    //
+    unsigned pixel_index, sample_num;
+  };
+
+  // Trace and render all camera-rays in the current batch, adding
+  // results to PACKET, and then clear the batch.
+  //
+  void render_batch (RenderPacket &packet);
+
   // The camera being used.
   //
   const Camera &camera;
@@ -74,6 +102,21 @@ private:
   // multiple threads and doing partial renders.
   //
   bool per_pixel_random_seeds;
+
+  // The current batch of camera-rays, and information about each.
+  //
+  // Rays from several pixels are batched together, so that they can
+  // be traced as a packet (see Scene::intersect), which is
+  // considerably more efficient than tracing them individually.
+  //
+  std::vector<Ray> batch_rays;
+  std::vector<BatchEntry> batch_entries;
+
+  // Saved sample-sets for pixels with rays in the current batch.
+  // These are copies of CONTEXT.samples, which is used to generate
+  // new samples for each pixel.
+  //
+  std::vector<SampleSet> pixel_samples;
 };
 
 
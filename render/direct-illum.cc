@@ -1,6 +1,6 @@
 // direct-illum.cc -- Direct-lighting calculations
 //
-//  Copyright (C) 2010, 2012, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2010, 2012, 2013, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -10,11 +10,14 @@
 // Written by Miles Bader <miles@gnu.org>
 //
 
+#include "util/val-table.h"
 #include "material/bsdf.h"
 #include "material/media.h"
 #include "light/light.h"
 #include "scene.h"
+#include "light-tree.h"
 #include "mis-sample-weight.h"
+#include "volume-integ.h"
 
 #include "direct-illum.h"
 
@@ -24,22 +27,29 @@ using namespace snogray;
 
 
 // Constructor that allows explicitly setting the number of samples.
+// PARAMS are the global render parameters.
 //
-DirectIllum::GlobalState::GlobalState (unsigned _num_samples)
-  : num_samples (_num_samples)
+DirectIllum::GlobalState::GlobalState (unsigned _num_samples,
+				       const ValTable &params)
+  : num_samples (_num_samples),
+    light_tree_threshold (params.get_uint ("light_tree_threshold", 64))
 {
 }
 
 
 DirectIllum::DirectIllum (RenderContext &context,
 			  const GlobalState &global_state)
-  : num_lights_to_sample (
-      global_state.num_samples == 0
-      ? 0
-      : context.scene.num_light_samplers ()),
-    light_select_chan (context.samples.add_channel<float> ())
+  : use_light_tree (uses_light_tree (context.scene, global_state)),
+    light_select_chan (
+      light_tree_channel<float> (context.samples, global_state)),
+    tree_light_samp_chan (
+      light_tree_channel<UV> (context.samples, global_state)),
+    tree_bsdf_samp_chan (
+      light_tree_channel<UV> (context.samples, global_state)),
+    tree_bsdf_layer_chan (
+      light_tree_channel<float> (context.samples, global_state))
 {
-  finish_init (context.samples, global_state);
+  finish_init (context.samples, context, global_state);
 }
 
 // Variant constructor which allows specifying a SampleSet other than the
@@ -47,37 +57,68 @@ DirectIllum::DirectIllum (RenderContext &context,
 //
 DirectIllum::DirectIllum (SampleSet &samples, RenderContext &context,
 			  const GlobalState &global_state)
-  : num_lights_to_sample (
-      global_state.num_samples == 0
-      ? 0
-      : context.scene.num_light_samplers ()),
-    light_select_chan (samples.add_channel<float> ())
+  : use_light_tree (uses_light_tree (context.scene, global_state)),
+    light_select_chan (light_tree_channel<float> (samples, global_state)),
+    tree_light_samp_chan (light_tree_channel<UV> (samples, global_state)),
+    tree_bsdf_samp_chan (light_tree_channel<UV> (samples, global_state)),
+    tree_bsdf_layer_chan (light_tree_channel<float> (samples, global_state))
 {
-  finish_init (samples, global_state);
+  finish_init (samples, context, global_state);
 }
     
+// Return true if a DirectIllum object should use SCENE's light-tree
+// to choose lights to sample.
+//
+bool
+DirectIllum::uses_light_tree (const Scene &scene,
+			      const GlobalState &global_state)
+{
+  if (global_state.num_samples == 0)
+    return false;
+
+  const LightTree &light_tree = *scene.light_tree;
+
+  return (light_tree.num_lights () != 0
+	  && light_tree.num_lights () >= global_state.light_tree_threshold);
+}
+
 // Common portion of constructors.
 //
 void
-DirectIllum::finish_init (SampleSet &samples, const GlobalState &global_state)
+DirectIllum::finish_init (SampleSet &samples, RenderContext &context,
+			  const GlobalState &global_state)
 {
+  const Scene &scene = context.scene;
   unsigned num_samples = global_state.num_samples;
 
-  for (unsigned i = 0; i < num_lights_to_sample; i++)
+  if (use_light_tree)
+    // Lights in the tree are sampled via the tree, so only those
+    // outside it need to be sampled individually.
+    //
+    light_indices = scene.light_tree->unbounded_lights;
+  else if (num_samples != 0)
+    for (unsigned i = 0; i < scene.num_light_samplers (); i++)
+      light_indices.push_back (i);
+
+  for (unsigned i = 0; i < light_indices.size (); i++)
     {
       light_samp_channels.push_back (samples.add_channel<UV> (num_samples));
       bsdf_samp_channels.push_back (samples.add_channel<UV> (num_samples));
       bsdf_layer_channels.push_back (samples.add_channel<float> (num_samples));
     }  
+
+  last_occluders.resize (scene.num_light_samplers (), 0);
 }
 
 
 // DirectIllum::sample_all_lights
 
-// Given the intersection ISEC, resulting from a cast ray, sample
-// all lights in the scene, and return the sum of their contribution
-// in that ray's direction.  FLAGS specifies what part of the BSDF
-// will be used.
+// Given the intersection ISEC, resulting from a cast ray, sample all
+// lights in the scene which are sampled individually, and return the
+// sum of their contribution in that ray's direction.  Normally this is
+// every light in the scene, but if the scene's light-tree is being
+// used, only lights not in the tree are included.  FLAGS specifies
+// what part of the BSDF will be used.
 //
 Color
 DirectIllum::sample_all_lights (const Intersect &isec,
@@ -91,9 +132,11 @@ DirectIllum::sample_all_lights (const Intersect &isec,
 
   Color radiance = 0;
 
-  for (unsigned i = 0; i < num_lights_to_sample; i++)
+  for (unsigned i = 0; i < light_indices.size (); i++)
     {
-      const Light::Sampler *light_sampler = context.scene.light_samplers[i];
+      unsigned light_index = light_indices[i];
+      const Light::Sampler *light_sampler
+	= context.scene.light_samplers[light_index];
       const SampleSet::Channel<UV> &light_chan = light_samp_channels[i];
       const SampleSet::Channel<UV> &bsdf_chan = bsdf_samp_channels[i];
       const SampleSet::Channel<float> &bsdf_layer_chan = bsdf_layer_channels[i];
@@ -103,10 +146,14 @@ DirectIllum::sample_all_lights (const Intersect &isec,
       std::vector<UV>::const_iterator bi = sample.begin (bsdf_chan);
       std::vector<float>::const_iterator bli = sample.begin (bsdf_layer_chan);
 
-      Color light_radiance = 0;
+      // Generate shadow-rays for all samples of this light, and then
+      // test them for occlusion together.
+      //
       for (unsigned j = 0; j < num_samples; j++)
-	light_radiance
-	  += sample_light (isec, light_sampler, *li++, *bi++, *bli++, flags);
+	gen_shadow_rays (isec, light_sampler, *li++, *bi++, *bli++, flags);
+
+      Color light_radiance
+	= shadow_rays_radiance (isec, &last_occluders[light_index]);
 
       radiance += light_radiance / float (num_samples);
     }
@@ -114,6 +161,76 @@ DirectIllum::sample_all_lights (const Intersect &isec,
   return radiance;
 }
 
+
+
+// DirectIllum::sample_light_tree
+
+// Given the intersection ISEC, resulting from a cast ray, sample
+// lights chosen randomly using the scene's light-tree, and return an
+// estimate of the sum of the contribution of all lights in the tree in
+// that ray's direction.  FLAGS specifies what part of the BSDF will be
+// used.
+//
+// Each sample chooses a single light, with a probability roughly
+// proportional to its contribution to ISEC, and samples it exactly as
+// DirectIllum::sample_all_lights would, dividing the result by the
+// probability with which the light was chosen.
+//
+Color
+DirectIllum::sample_light_tree (const Intersect &isec,
+				const SampleSet::Sample &sample,
+				unsigned flags)
+  const
+{
+  RenderContext &context = isec.context;
+  const Scene &scene = context.scene;
+  const LightTree &light_tree = *scene.light_tree;
+
+  // Lights behind the surface can only contribute if the BSDF
+  // transmits light.
+  //
+  bool two_sided = (isec.bsdf->supports (flags) & Bsdf::TRANSMISSIVE) != 0;
+
+  const Pos &pos = isec.normal_frame.origin;
+  const Vec &norm = isec.normal_frame.z;
+
+  unsigned num_samples = light_select_chan.size;
+
+  std::vector<float>::const_iterator si = sample.begin (light_select_chan);
+  std::vector<UV>::const_iterator li = sample.begin (tree_light_samp_chan);
+  std::vector<UV>::const_iterator bi = sample.begin (tree_bsdf_samp_chan);
+  std::vector<float>::const_iterator bli
+    = sample.begin (tree_bsdf_layer_chan);
+
+  Color radiance = 0;
+
+  for (unsigned i = 0; i < num_samples; i++)
+    {
+      unsigned light_index;
+      float select_pdf;
+
+      if (light_tree.choose_light (pos, norm, two_sided, *si++,
+				   light_index, select_pdf))
+	{
+	  const Light::Sampler *light_sampler
+	    = scene.light_samplers[light_index];
+
+	  gen_shadow_rays (isec, light_sampler, *li, *bi, *bli, flags,
+			   select_pdf);
+
+	  radiance
+	    += (shadow_rays_radiance (isec, &last_occluders[light_index])
+		/ select_pdf);
+	}
+
+      ++li;
+      ++bi;
+      ++bli;
+    }
+
+  return radiance / float (num_samples);
+}
+
 
 // DirectIllum::sample_light
 
@@ -130,14 +247,42 @@ DirectIllum::sample_light (const Intersect &isec,
 			   unsigned flags)
   const
 {
-  RenderContext &context = isec.context;
-  const Scene &scene = context.scene;
+  gen_shadow_rays (isec, light_sampler, light_param,
+		   bsdf_param, bsdf_layer_param, flags);
 
-  // Final result, which will be the sum of one light sample and one
-  // BSDF sample.
+  // We don't know the index of LIGHT_SAMPLER, so no occluder cache is
+  // used.
   //
-  Color radiance = 0;
+  return shadow_rays_radiance (isec, 0);
+}
+
+
 
+
+// DirectIllum::gen_shadow_rays
+
+// Add to SHADOW_RAYS the shadow-rays needed for one light sample and
+// one BSDF sample of LIGHT_SAMPLER towards ISEC (using LIGHT_PARAM,
+// BSDF_PARAM, and BSDF_LAYER_PARAM), and to SHADOW_RAY_RADIANCES the
+// radiance each will contribute if not occluded.  FLAGS specifies what
+// part of the BSDF will be used.
+//
+// LIGHT_SELECT_PDF is the probability with which LIGHT_SAMPLER was
+// chosen to be sampled (1 if every light is sampled); it only affects
+// the multiple-importance-sampling weights, as the caller divides the
+// result by it.
+//
+// The final radiance estimate is the sum of the light sample and the
+// BSDF sample, weighted using multiple-importance-sampling.
+//
+void
+DirectIllum::gen_shadow_rays (const Intersect &isec,
+			      const Light::Sampler *light_sampler,
+			      const UV &light_param,
+			      const UV &bsdf_param, float bsdf_layer_param,
+			      unsigned flags, float light_select_pdf)
+  const
+{
   //
   // First, sample the light.
   //
@@ -154,39 +299,32 @@ DirectIllum::sample_light (const Intersect &isec,
 
       if (bval.val > 0)
 	{
-	  // Now we know there's a potential contribution, so check to
-	  // see if this sample is occluded or not.
-
-	  Ray ray = isec.recursive_ray (lsamp.dir, lsamp.dist);
-	  Color transmittance = 1;
-	  if (! scene.occludes (ray, isec.media.medium, transmittance, context))
-	    {
-	      // The sample is not occluded, calculate the actual radiance.
+	  // Now we know there's a potential contribution, so calculate
+	  // the radiance it would contribute, and add a shadow-ray to
+	  // see if it's occluded or not.
 
-	      Color lsamp_radiance = lsamp.val * transmittance;
+	  Color lsamp_radiance = lsamp.val;
 
-	      lsamp_radiance
-		*= context.volume_integ->transmittance (ray, isec.media.medium);
-
-	      // Apply the "power heuristic" to weight our sample based
-	      // on the relative pro
-	      //
-	      if (! light_sampler->is_point_light ())
-		lsamp_radiance
-		  *= mis_sample_weight (lsamp.pdf, 1, bval.pdf, 1);
+	  // Apply the "power heuristic" to weight our sample based
+	  // on the relative pro
+	  //
+	  if (! light_sampler->is_point_light ())
+	    lsamp_radiance
+	      *= mis_sample_weight (lsamp.pdf * light_select_pdf, 1,
+				    bval.pdf, 1);
 
-	      // Filter the light through the BSDF function.
-	      //
-	      lsamp_radiance *= bval.val;
+	  // Filter the light through the BSDF function.
+	  //
+	  lsamp_radiance *= bval.val;
 
-	      // Apply cos theta term.
-	      //
-	      lsamp_radiance *= abs (isec.cos_n (lsamp.dir));
+	  // Apply cos theta term.
+	  //
+	  lsamp_radiance *= abs (isec.cos_n (lsamp.dir));
 
-	      lsamp_radiance /= lsamp.pdf;
+	  lsamp_radiance /= lsamp.pdf;
 
-	      radiance += lsamp_radiance;
- 	    }
+	  shadow_rays.push_back (isec.recursive_ray (lsamp.dir, lsamp.dist));
+	  shadow_ray_radiances.push_back (lsamp_radiance);
 	}
     }
 
@@ -213,43 +351,92 @@ DirectIllum::sample_light (const Intersect &isec,
 
 	  if (lval.pdf > 0 && lval.val > 0)
 	    {
-	      // Now we know there's a potential contribution, so check to
-	      // see if this sample is occluded or not.
+	      // Now we know there's a potential contribution, so
+	      // calculate the radiance it would contribute, and add a
+	      // shadow-ray to see if it's occluded or not.
 
-	      Ray ray = isec.recursive_ray (bsamp.dir, lval.dist);
-	      Color transmittance = 1;
-	      if (! scene.occludes (ray, isec.media.medium, transmittance,
-				    context))
-		{
-		  // The sample is not occluded
+	      Color bsamp_radiance = lval.val;
 
-		  Color bsamp_radiance = lval.val * transmittance;
-
-		  bsamp_radiance
-		    *= context.volume_integ->transmittance (ray,
-							    isec.media.medium);
-
-		  // Apply the "power heuristic" to weight our sample based
-		  // on the relative pro
-		  //
-		  bsamp_radiance
-		    *= mis_sample_weight (bsamp.pdf, 1, lval.pdf, 1);
+	      // Apply the "power heuristic" to weight our sample based
+	      // on the relative pro
+	      //
+	      bsamp_radiance
+		*= mis_sample_weight (bsamp.pdf, 1,
+				      lval.pdf * light_select_pdf, 1);
 
-		  // Filter the light through the BSDF function.
-		  //
-		  bsamp_radiance *= bsamp.val;
+	      // Filter the light through the BSDF function.
+	      //
+	      bsamp_radiance *= bsamp.val;
 
-		  // Apply cos theta term.
-		  //
-		  bsamp_radiance *= abs (isec.cos_n (bsamp.dir));
+	      // Apply cos theta term.
+	      //
+	      bsamp_radiance *= abs (isec.cos_n (bsamp.dir));
 
-		  bsamp_radiance /= bsamp.pdf;
+	      bsamp_radiance /= bsamp.pdf;
 
-		  radiance += bsamp_radiance;
-		}
+	      shadow_rays.push_back (isec.recursive_ray (bsamp.dir, lval.dist));
+	      shadow_ray_radiances.push_back (bsamp_radiance);
 	    }
 	}
     }
+}
+
+
+
+
+// DirectIllum::shadow_rays_radiance
+
+// Test all rays in SHADOW_RAYS for occlusion, and return the sum of the
+// corresponding entries in SHADOW_RAY_RADIANCES for those which aren't
+// (completely) occluded, attenuated appropriately.  Then clear
+// SHADOW_RAYS and SHADOW_RAY_RADIANCES.
+//
+// If LAST_OCCLUDER is non-zero, it is a cache of the last surface to
+// occlude a shadow-ray towards the same light (see Scene::occludes).
+//
+Color
+DirectIllum::shadow_rays_radiance (const Intersect &isec,
+				   const Surface::Renderable **last_occluder)
+  const
+{
+  RenderContext &context = isec.context;
+  const Scene &scene = context.scene;
+  const Medium &medium = isec.media.medium;
+
+  Color radiance = 0;
+
+  unsigned num_shadow_rays = shadow_rays.size ();
+
+  for (unsigned base = 0; base < num_shadow_rays;
+       base += Space::MAX_PACKET_SIZE)
+    {
+      unsigned num_rays = min (num_shadow_rays - base, Space::MAX_PACKET_SIZE);
+
+      const Ray *rays = &shadow_rays[base];
+
+      // Test a packet of shadow-rays for occlusion.
+      //
+      Color transmittances[Space::MAX_PACKET_SIZE];
+      bool occluded[Space::MAX_PACKET_SIZE];
+      for (unsigned i = 0; i < num_rays; i++)
+	transmittances[i] = 1;
+
+      scene.occludes (num_rays, rays, medium, transmittances, occluded,
+		      last_occluder, context);
+
+      // Add the radiance from those which aren't occluded, attenuated
+      // by partially occluding surfaces and by the medium.
+      //
+      for (unsigned i = 0; i < num_rays; i++)
+	if (! occluded[i])
+	  radiance
+	    += (shadow_ray_radiances[base + i]
+		* transmittances[i]
+		* context.volume_integ->transmittance (rays[i], medium));
+    }
+
+  shadow_rays.clear ();
+  shadow_ray_radiances.clear ();
 
   return radiance;
 }
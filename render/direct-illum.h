@@ -1,6 +1,6 @@
 // direct-illum.h -- Direct-lighting calculations
 //
-//  Copyright (C) 2010-2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2010-2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -13,6 +13,9 @@
 #ifndef SNOGRAY_DIRECT_ILLUM_H
 #define SNOGRAY_DIRECT_ILLUM_H
 
+#include <vector>
+
+#include "geometry/ray.h"
 #include "color/color.h"
 #include "material/bsdf.h"
 #include "sample-set.h"
@@ -37,10 +40,17 @@ public:
   public:
 
     // Constructor that allows explicitly setting the number of samples.
+    // PARAMS are the global render parameters.
     //
-    GlobalState (unsigned num_samples);
+    GlobalState (unsigned num_samples, const ValTable &params);
 
     unsigned num_samples;
+
+    // If the scene contains at least this many lights, then instead
+    // of sampling every light, NUM_SAMPLES lights are chosen using the
+    // scene's light-tree (see LightTree), and only those are sampled.
+    //
+    unsigned light_tree_threshold;
   };
 
   DirectIllum (RenderContext &context, const GlobalState &global_state);
@@ -59,24 +69,35 @@ public:
 		       unsigned flags = (Bsdf::ALL & ~Bsdf::SPECULAR))
     const
   {
-    // XXX  For now, just do all lights.  In the future we should add a way
-    // to limit the number of light samples in the case where there are
-    // many lights (e.g., divide the desired number of light samples among
-    // lights in the scene).
-    //
-    return sample_all_lights (isec, sample, flags);
+    Color radiance = sample_all_lights (isec, sample, flags);
+    if (use_light_tree)
+      radiance += sample_light_tree (isec, sample, flags);
+    return radiance;
   }
 
   // Given the intersection ISEC, resulting from a cast ray, sample
-  // all lights in the scene, and return the sum of their
-  // contribution in that ray's direction.  FLAGS specifies what
-  // part of the BSDF will be used.
+  // all lights in the scene which are sampled individually, and
+  // return the sum of their contribution in that ray's direction.
+  // Normally this is every light in the scene, but if the scene's
+  // light-tree is being used, only lights not in the tree are
+  // included.  FLAGS specifies what part of the BSDF will be used.
   //
   Color sample_all_lights (const Intersect &isec,
 			   const SampleSet::Sample &sample,
 			   unsigned flags = (Bsdf::ALL & ~Bsdf::SPECULAR))
     const;
 
+  // Given the intersection ISEC, resulting from a cast ray, sample
+  // lights chosen randomly using the scene's light-tree, and return
+  // an estimate of the sum of the contribution of all lights in the
+  // tree in that ray's direction.  FLAGS specifies what part of the
+  // BSDF will be used.
+  //
+  Color sample_light_tree (const Intersect &isec,
+			   const SampleSet::Sample &sample,
+			   unsigned flags = (Bsdf::ALL & ~Bsdf::SPECULAR))
+    const;
+
   // Use multiple-importance-sampling to estimate the radiance of
   // LIGHT_SAMPLER towards ISEC, LIGHT_PARAM, BSDF_PARAM, and
   // BSDF_LAYER_PARAM to sample both the light and the BSDF.  FLAGS
@@ -90,9 +111,58 @@ public:
 
 private:
 
+  // Return true if a DirectIllum object should use SCENE's light-tree
+  // to choose lights to sample.
+  //
+  static bool uses_light_tree (const Scene &scene,
+			       const GlobalState &global_state);
+
+  // If USE_LIGHT_TREE is true, allocate and return a light-tree sample
+  // channel in SAMPLES, otherwise return an unallocated channel.
+  // USE_LIGHT_TREE must already be initialized.
+  //
+  template<typename T>
+  SampleSet::Channel<T> light_tree_channel (SampleSet &samples,
+					    const GlobalState &global_state)
+  {
+    return (use_light_tree
+	    ? samples.add_channel<T> (global_state.num_samples)
+	    : SampleSet::Channel<T> ());
+  }
+
   // Common portion of constructors.
   //
-  void finish_init (SampleSet &samples, const GlobalState &global_state);
+  void finish_init (SampleSet &samples, RenderContext &context,
+		    const GlobalState &global_state);
+
+  // Add to SHADOW_RAYS the shadow-rays needed for one light sample and
+  // one BSDF sample of LIGHT_SAMPLER towards ISEC (using LIGHT_PARAM,
+  // BSDF_PARAM, and BSDF_LAYER_PARAM), and to SHADOW_RAY_RADIANCES the
+  // radiance each will contribute if not occluded.  FLAGS specifies
+  // what part of the BSDF will be used.
+  //
+  // LIGHT_SELECT_PDF is the probability with which LIGHT_SAMPLER was
+  // chosen to be sampled (1 if every light is sampled).
+  //
+  void gen_shadow_rays (const Intersect &isec,
+			const Light::Sampler *light_sampler,
+			const UV &light_param,
+			const UV &bsdf_param, float bsdf_layer_param,
+			unsigned flags, float light_select_pdf = 1)
+    const;
+
+  // Test all rays in SHADOW_RAYS for occlusion, and return the sum of
+  // the corresponding entries in SHADOW_RAY_RADIANCES for those which
+  // aren't (completely) occluded, attenuated appropriately.  Then
+  // clear SHADOW_RAYS and SHADOW_RAY_RADIANCES.
+  //
+  // If LAST_OCCLUDER is non-zero, it is a cache of the last surface
+  // to occlude a shadow-ray towards the same light (see
+  // Scene::occludes).
+  //
+  Color shadow_rays_radiance (const Intersect &isec,
+			      const Surface::Renderable **last_occluder)
+    const;
 
   // Sample channels for light sampling.
   //
@@ -103,14 +173,40 @@ private:
   SampleSet::ChannelVec<UV> bsdf_samp_channels;
   SampleSet::ChannelVec<float> bsdf_layer_channels;
 
-  // Number of lights we will sample each time.  All the above channel
-  // vectors have this size.
+  // Indices in Scene::light_samplers of the lights we sample
+  // individually each time.  All the above channel vectors have this
+  // size.
+  //
+  std::vector<unsigned> light_indices;
+
+  // True if we use the scene's light-tree to choose lights to sample,
+  // in addition to those in LIGHT_INDICES.
   //
-  unsigned num_lights_to_sample;
+  bool use_light_tree;
 
-  // XXX not used; for selecting a light if we're not sampling all lights.
+  // Sample channels used with the light-tree:  one for choosing
+  // lights, and the rest for sampling the chosen light and the BSDF.
+  // These are only allocated if USE_LIGHT_TREE is true.
   //
   SampleSet::Channel<float> light_select_chan;
+  SampleSet::Channel<UV> tree_light_samp_chan;
+  SampleSet::Channel<UV> tree_bsdf_samp_chan;
+  SampleSet::Channel<float> tree_bsdf_layer_chan;
+
+  // Scratch space for DirectIllum::gen_shadow_rays and
+  // DirectIllum::shadow_rays_radiance.  Shadow-rays for all samples
+  // of a light are accumulated here, so that they can be tested for
+  // occlusion together as packets, which is more efficient than
+  // testing them individually.
+  //
+  mutable std::vector<Ray> shadow_rays;
+  mutable std::vector<Color> shadow_ray_radiances;
+
+  // For each light in the scene, the last surface which occluded a
+  // shadow-ray towards that light, or zero.  As DirectIllum objects
+  // are per-thread, these need no locking.
+  //
+  mutable std::vector<const Surface::Renderable *> last_occluders;
 };
 
 
@@ -1,6 +1,6 @@
 // global-render-state.cc -- global information used during rendering
 //
-//  Copyright (C) 2010-2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2010-2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -12,11 +12,17 @@
 
 #include "util/excepts.h"
 #include "space/octree.h"
+#include "space/bvh.h"
 #include "space/triv-space.h"
+#include "surface/model.h"
 #include "grid.h"
+#include "sobol.h"
+#include "halton.h"
+#include "table-sample-gen.h"
 #include "direct-integ.h"
 #include "path-integ.h"
 #include "photon-integ.h"
+#include "sppm-integ.h"
 #include "filter-volume-integ.h"
 
 #include "global-render-state.h"
@@ -39,6 +45,12 @@ GlobalRenderState::GlobalRenderState (const Surface &scene_contents,
     params (_params),
     sample_gen (make_sample_gen (_params))
 {
+  // If requested, build the acceleration structures for all instanced
+  // models now, in parallel, rather than lazily during rendering.
+  //
+  if (_params.get_bool ("eager_models", false))
+    Model::make_pending_spaces (_params.get_uint ("setup_threads", 1));
+
   // Set up these separately, as they receive, and may use, our state.
   //
   // We first let them be default-initialized (to null pointers) in the
@@ -55,9 +67,30 @@ GlobalRenderState::GlobalRenderState (const Surface &scene_contents,
 //
 
 SampleGen *
-GlobalRenderState::make_sample_gen (const ValTable &)
+GlobalRenderState::make_sample_gen (const ValTable &params)
 {
-  return new Grid;
+  std::string gen_name = params.get_string ("sample_gen", "grid");
+
+  SampleGen *gen;
+  if (gen_name == "grid")
+    gen = new Grid;
+  else if (gen_name == "sobol")
+    gen = new Sobol;
+  else if (gen_name == "halton")
+    gen = new Halton;
+  else
+    throw std::runtime_error ("Unknown sample generator \""
+			      + gen_name + "\"");
+
+  // If "sample_tables" is non-zero, precompute that many tables of
+  // samples for each sample channel using GEN, and generate samples by
+  // randomizing them, instead of using GEN directly.
+  //
+  unsigned num_tables = params.get_uint ("sample_tables", 0);
+  if (num_tables != 0)
+    gen = new TableSampleGen (gen, num_tables);
+
+  return gen;
 }
 
 SpaceBuilderFactory *
@@ -65,8 +98,16 @@ GlobalRenderState::make_space_builder_factory (const ValTable &params)
 {
   std::string accel = params.get_string ("accel", "octree");
 
+  // If set, a file used to cache the scene's search accelerator
+  // between runs.
+  //
+  std::string cache_file = params.get_string ("accel_cache", "");
+
   if (accel == "octree")
-    return new Octree::BuilderFactory ();
+    return new Octree::BuilderFactory (cache_file);
+  else if (accel == "bvh")
+    return new Bvh::BuilderFactory (params.get_uint ("setup_threads", 1),
+				    cache_file);
   else if (accel == "triv" || accel == "trivial")
     return new TrivSpace::BuilderFactory ();
   else
@@ -86,6 +127,8 @@ GlobalRenderState::make_surface_integ_global_state (const ValTable &params)
     return new PathInteg::GlobalState (*this, sint_params);
   else if (sint == "photon")
     return new PhotonInteg::GlobalState (*this, sint_params);
+  else if (sint == "sppm")
+    return new SppmInteg::GlobalState (*this, sint_params);
   else
     throw std::runtime_error ("Unknown surface-integrator \"" + sint + "\"");
 }
@@ -1,6 +1,6 @@
 // grid.cc -- sample generator using a simple jittered grid
 //
-//  Copyright (C) 2006, 2007, 2010, 2012, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2006, 2007, 2010, 2012-2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -10,6 +10,8 @@
 // Written by Miles Bader <miles@gnu.org>
 //
 
+#include <algorithm>
+
 #include "util/snogmath.h"
 #include "util/snogassert.h"
 #include "util/random.h"
@@ -20,9 +22,15 @@
 using namespace snogray;
 
 
+// Using RANDOM as a source of randomness, add NUM samples to TABLE
+// through TABLE+NUM.  As each channel uses the same pattern, the
+// samples are randomly shuffled, so that different channels are not
+// correlated; we don't need the channel's dimension, DIM.
+//
 void
 Grid::gen_uv_samples (Random &random,
-		      const std::vector<UV>::iterator &table, unsigned num)
+		      const std::vector<UV>::iterator &table, unsigned num,
+		      unsigned /* dim */)
   const
 {
   ASSERT (num != 0);
@@ -64,6 +72,8 @@ Grid::gen_uv_samples (Random &random,
 
       v_offs += v_step;
     }
+
+  random_shuffle (table, table + num, random);
 }
 
 unsigned
@@ -79,17 +89,27 @@ Grid::adjust_uv_sample_count (unsigned num) const
   return unsigned (up * down);
 }
 
+// Using RANDOM as a source of randomness, add NUM samples to TABLE
+// through TABLE+NUM.  As each channel uses the same pattern, the
+// samples are randomly shuffled, so that different channels are not
+// correlated; we don't need the channel's dimension, DIM.
+//
 void
 Grid::gen_float_samples (Random &random,
 			 const std::vector<float>::iterator &table,
-			 unsigned num)
+			 unsigned num, unsigned /* dim */)
   const
 {
   float n_step = 1 / float (num);
   float offs = 0;
 
   for (unsigned i = 0; i < num; i++)
-    table[i] = clamp01 (offs + random () * n_step);
+    {
+      table[i] = clamp01 (offs + random () * n_step);
+      offs += n_step;
+    }
+
+  random_shuffle (table, table + num, random);
 }
 
 
@@ -1,6 +1,6 @@
 // grid.h -- sample generator using a simple jittered grid
 //
-//  Copyright (C) 2006, 2007, 2010, 2011  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2006, 2007, 2010, 2011, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -19,26 +19,30 @@
 namespace snogray {
 
 
+// A sample generator which generates samples using "jittered"
+// stratification:  each channel's samples are distributed randomly
+// within the cells of a regular grid covering the sample space.
+//
 class Grid : public SampleGen
 {
 protected:
 
   // The actual sample generating methods.  Using RANDOM as a source of
-  // randomness, add NUM samples to TABLE through TABLE+NUM.
+  // randomness, add NUM samples to TABLE through TABLE+NUM, for a
+  // channel whose first dimension is DIM.
   //
   virtual void gen_float_samples (Random &random,
 				  const std::vector<float>::iterator &table,
-				  unsigned num)
+				  unsigned num, unsigned dim)
     const;
   virtual void gen_uv_samples (Random &random,
 			       const std::vector<UV>::iterator &table,
-			       unsigned num)
+			       unsigned num, unsigned dim)
     const;
 
   virtual unsigned adjust_uv_sample_count (unsigned num) const;
 };
 
-
 }
 
 #endif /* SNOGRAY_GRID_H */
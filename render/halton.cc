@@ -0,0 +1,176 @@
+// halton.cc -- sample generator using randomized Halton sequences
+//
+//  Copyright (C) 2014  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#include <algorithm>
+
+#include "util/snogmath.h"
+#include "util/random.h"
+
+#include "halton.h"
+
+
+using namespace snogray;
+
+
+// The number of digits we need in base BASE to get at least 24 bits of
+// precision (the precision of a float).
+//
+static unsigned
+num_digits (unsigned base)
+{
+  unsigned digits = 0;
+  for (double scale = 1; scale < 16777216; scale *= base)
+    digits++;
+  return digits;
+}
+
+
+namespace { // keep local to file
+
+// A random digit scramble for one dimension of a Halton sequence.
+//
+// Each digit D of the radical inverse is replaced by (A * D + C) mod
+// BASE, using random A (non-zero) and C for each digit position; as
+// BASE is prime, this is a permutation of the digits.  Unlike a simple
+// random shift of each digit, this breaks up the strong correlations
+// between high dimensions of the Halton sequence when the number of
+// samples is small compared to the bases.
+//
+class DigitScramble
+{
+public:
+
+  // Make a random digit scramble for base BASE, using RANDOM as a
+  // source of randomness.
+  //
+  DigitScramble (unsigned _base, Random &random)
+    : base (_base), mults (num_digits (_base)), shifts (mults.size ())
+  {
+    for (unsigned i = 0; i < mults.size (); i++)
+      {
+	mults[i] = random (base - 1) + 1;
+	shifts[i] = random (base);
+      }
+  }
+
+  // Return the radical inverse of INDEX in our base (as calculated by
+  // snogray::radical_inverse in "util/radical-inverse.h"), with each
+  // digit scrambled.
+  //
+  // Digits beyond those of INDEX are zero, but are still scrambled, so
+  // that every sample is randomized to full precision.
+  //
+  float operator() (unsigned index) const
+  {
+    double inv_base = 1.0 / base;
+    double scale = inv_base;
+    double val = 0;
+
+    for (unsigned i = 0; i < mults.size (); i++)
+      {
+	unsigned digit = index % base;
+	digit = unsigned ((digit * (unsigned long long)mults[i] + shifts[i])
+			  % base);
+
+	val += digit * scale;
+
+	index /= base;
+	scale *= inv_base;
+      }
+
+    // Make sure the result is less than one after rounding.
+    //
+    return min (float (val), 1.f - 1.f / 16777216);
+  }
+
+private:
+
+  unsigned base;
+
+  std::vector<unsigned> mults, shifts;
+};
+
+} // namespace
+
+
+Halton::Halton ()
+{
+  // Find the first MAX_DIMS primes.
+  //
+  primes.reserve (MAX_DIMS);
+  for (unsigned n = 2; primes.size () < MAX_DIMS; n++)
+    {
+      bool is_prime = true;
+      for (std::vector<unsigned>::iterator pi = primes.begin ();
+	   pi != primes.end () && *pi * *pi <= n; ++pi)
+	if (n % *pi == 0)
+	  {
+	    is_prime = false;
+	    break;
+	  }
+
+      if (is_prime)
+	primes.push_back (n);
+    }
+}
+
+// Using RANDOM as a source of randomness, add NUM samples to TABLE
+// through TABLE+NUM, for a channel whose first dimension is DIM.
+//
+void
+Halton::gen_float_samples (Random &random,
+			   const std::vector<float>::iterator &table,
+			   unsigned num, unsigned dim)
+  const
+{
+  // If DIM is beyond our table, reuse an earlier dimension, and
+  // shuffle the result to decorrelate it from that dimension.
+  //
+  bool padded = (dim >= MAX_DIMS);
+  if (padded)
+    dim %= MAX_DIMS - 1;
+
+  DigitScramble radical_inverse (primes[dim], random);
+
+  for (unsigned i = 0; i < num; i++)
+    table[i] = radical_inverse (i);
+
+  if (padded)
+    random_shuffle (table, table + num, random);
+}
+
+// Using RANDOM as a source of randomness, add NUM samples to TABLE
+// through TABLE+NUM, for a channel whose first dimension is DIM.
+//
+void
+Halton::gen_uv_samples (Random &random,
+			const std::vector<UV>::iterator &table,
+			unsigned num, unsigned dim)
+  const
+{
+  // If DIM and DIM+1 are not both in our table, reuse earlier
+  // dimensions, and shuffle the result to decorrelate them from those
+  // dimensions.
+  //
+  bool padded = (dim + 1 >= MAX_DIMS);
+  if (padded)
+    dim %= MAX_DIMS - 1;
+
+  DigitScramble u_radical_inverse (primes[dim], random);
+  DigitScramble v_radical_inverse (primes[dim + 1], random);
+
+  for (unsigned i = 0; i < num; i++)
+    table[i] = UV (u_radical_inverse (i), v_radical_inverse (i));
+
+  if (padded)
+    random_shuffle (table, table + num, random);
+}
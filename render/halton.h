@@ -0,0 +1,74 @@
+// halton.h -- sample generator using randomized Halton sequences
+//
+//  Copyright (C) 2014  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#ifndef SNOGRAY_HALTON_H
+#define SNOGRAY_HALTON_H
+
+#include "sample-gen.h"
+
+
+namespace snogray {
+
+
+// A quasi-Monte Carlo sample generator using Halton sequences.
+//
+// Dimension D of the Halton sequence is the radical inverse of the
+// sample index in the base of the Dth prime.  As with the Sobol
+// generator, each channel uses its own dimensions of the sequence, so
+// samples with the same index in all channels are well-distributed
+// with respect to each other.  Each time samples are generated, every
+// dimension is randomized with a new random digit shift ("Cranley-
+// Patterson rotation" of each digit).
+//
+// Halton sequences in high dimensions, which use large bases, are
+// much less well-distributed than Sobol sequences for small numbers
+// of samples, so the Sobol generator is usually a better choice.
+//
+// Only the first MAX_DIMS dimensions are used; channels beyond that
+// reuse earlier dimensions, with their samples randomly shuffled.
+//
+class Halton : public SampleGen
+{
+public:
+
+  // Maximum number of dimensions supported.
+  //
+  static const unsigned MAX_DIMS = 1024;
+
+  Halton ();
+
+protected:
+
+  // The actual sample generating methods.  Using RANDOM as a source of
+  // randomness, add NUM samples to TABLE through TABLE+NUM, for a
+  // channel whose first dimension is DIM.
+  //
+  virtual void gen_float_samples (Random &random,
+				  const std::vector<float>::iterator &table,
+				  unsigned num, unsigned dim)
+    const;
+  virtual void gen_uv_samples (Random &random,
+			       const std::vector<UV>::iterator &table,
+			       unsigned num, unsigned dim)
+    const;
+
+private:
+
+  // The prime base for each dimension.
+  //
+  std::vector<unsigned> primes;
+};
+
+
+}
+
+#endif // SNOGRAY_HALTON_H
@@ -0,0 +1,435 @@
+// light-tree.cc -- Hierarchy of lights for choosing lights to sample
+//
+//  Copyright (C) 2014  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#include <algorithm>
+
+#include "util/snogmath.h"
+
+#include "light-tree.h"
+
+
+using namespace snogray;
+
+
+typedef Light::Sampler::Bounds Bounds;
+
+
+// Number of buckets per axis used to approximate the cost of
+// splitting a node.
+//
+static const unsigned NUM_BUCKETS = 12;
+
+
+// A light being put in the tree.
+//
+struct LightTree::BuildLight
+{
+  BuildLight (const Bounds &_bounds, unsigned _index)
+    : bounds (_bounds), index (_index), centroid (_bounds.bbox.center ())
+  { }
+
+  Bounds bounds;
+  unsigned index;
+  Pos centroid;
+};
+
+
+
+
+// Bounds helper functions
+
+// Return the angle between the unit vectors V1 and V2.
+//
+static float
+angle_between (const Vec &v1, const Vec &v2)
+{
+  return acos (clamp (float (dot (v1, v2)), -1.f, 1.f));
+}
+
+// Return the union of bounds B1 and B2.
+//
+static Bounds
+merge (const Bounds &b1, const Bounds &b2)
+{
+  // Make A the bounds with the wider cone.
+  //
+  const Bounds &a = (b1.theta_o >= b2.theta_o) ? b1 : b2;
+  const Bounds &b = (b1.theta_o >= b2.theta_o) ? b2 : b1;
+
+  BBox bbox = b1.bbox + b2.bbox;
+  float power = b1.power + b2.power;
+  float theta_e = max (b1.theta_e, b2.theta_e);
+
+  // Find the smallest cone containing both cones.
+  //
+  float theta_d = angle_between (a.axis, b.axis);
+
+  if (min (theta_d + b.theta_o, PIf) <= a.theta_o)
+    return Bounds (bbox, power, a.axis, a.theta_o, theta_e);
+
+  float theta_o = (a.theta_o + theta_d + b.theta_o) / 2;
+  if (theta_o >= PIf)
+    return Bounds (bbox, power, a.axis, PIf, theta_e);
+
+  // Rotate A's axis towards B's axis by the angle THETA_R, around an
+  // axis perpendicular to both.  If they're exactly opposite, any
+  // perpendicular axis will do.
+  //
+  float theta_r = theta_o - a.theta_o;
+  Vec rot_axis = cross (a.axis, b.axis);
+  if (rot_axis.length_squared () < 1e-12f)
+    rot_axis = cross (a.axis, (abs (a.axis.x) < 0.9f
+			       ? Vec (1, 0, 0) : Vec (0, 1, 0)));
+  rot_axis = rot_axis.unit ();
+
+  Vec axis
+    = a.axis * cos (theta_r) + cross (rot_axis, a.axis) * sin (theta_r);
+
+  return Bounds (bbox, power, axis.unit (), theta_o, theta_e);
+}
+
+// Return the surface area of BBOX.
+//
+static float
+surface_area (const BBox &bbox)
+{
+  Vec ext = bbox.extent ();
+  return float (2 * (ext.x * ext.y + ext.y * ext.z + ext.z * ext.x));
+}
+
+// Return a measure of the set of directions in which light described
+// by BOUNDS may be emitted.
+//
+static float
+orientation_measure (const Bounds &bounds)
+{
+  float theta_o = bounds.theta_o;
+  float theta_w = min (theta_o + bounds.theta_e, PIf);
+  float sin_o = sin (theta_o), cos_o = cos (theta_o);
+
+  return (2 * PIf * (1 - cos_o)
+	  + PIf / 2 * (2 * theta_w * sin_o - cos (theta_o - 2 * theta_w)
+		       - 2 * theta_o * sin_o + cos_o));
+}
+
+// Return the cost of a node described by BOUNDS, for the surface area
+// orientation heuristic.
+//
+static float
+node_cost (const Bounds &bounds)
+{
+  return (bounds.power * orientation_measure (bounds)
+	  * surface_area (bounds.bbox));
+}
+
+
+
+
+// LightTree construction
+
+// Build a tree for the lights in LIGHT_SAMPLERS.  Lights are
+// identified by their index in LIGHT_SAMPLERS.
+//
+LightTree::LightTree (
+	     const std::vector<const Light::Sampler *> &light_samplers)
+{
+  std::vector<BuildLight> build_lights;
+
+  for (unsigned i = 0; i < light_samplers.size (); i++)
+    {
+      Bounds bounds;
+      if (light_samplers[i]->get_bounds (bounds))
+	{
+	  // Lights which emit nothing can be ignored.
+	  //
+	  if (bounds.power > 0)
+	    build_lights.push_back (BuildLight (bounds, i));
+	}
+      else
+	unbounded_lights.push_back (i);
+    }
+
+  if (! build_lights.empty ())
+    {
+      nodes.reserve (build_lights.size () * 2 - 1);
+      build (build_lights.begin (), build_lights.end ());
+    }
+}
+
+// Return the bucket which a centroid with the coordinate COORD falls
+// in, when the centroid range along the split axis is MIN to MIN +
+// EXTENT.
+//
+static unsigned
+bucket_index (dist_t coord, dist_t min, dist_t extent)
+{
+  unsigned bucket = unsigned (NUM_BUCKETS * (coord - min) / extent);
+  return bucket < NUM_BUCKETS ? bucket : NUM_BUCKETS - 1;
+}
+
+// Predicate used to partition BuildLight objects when splitting a
+// node:  returns true if a light's centroid falls in a bucket less
+// than SPLIT_BUCKET, when the centroid range along AXIS is MIN to MIN
+// + EXTENT.
+//
+struct LightTree::BucketLess
+{
+  BucketLess (unsigned _axis, dist_t _min, dist_t _extent,
+	      unsigned _split_bucket)
+    : axis (_axis), min (_min), extent (_extent), split_bucket (_split_bucket)
+  { }
+
+  bool operator() (const BuildLight &light) const
+  {
+    return bucket_index (light.centroid[axis], min, extent) < split_bucket;
+  }
+
+  unsigned axis;
+  dist_t min, extent;
+  unsigned split_bucket;
+};
+
+// Add nodes for the lights from BEG to END to the tree, and return
+// the index of the first node added.
+//
+unsigned
+LightTree::build (std::vector<BuildLight>::iterator beg,
+		  std::vector<BuildLight>::iterator end)
+{
+  unsigned node_index = nodes.size ();
+  nodes.push_back (Node ());
+
+  if (end - beg == 1)
+    {
+      nodes[node_index].bounds = beg->bounds;
+      nodes[node_index].index = beg->index;
+      nodes[node_index].leaf = true;
+      return node_index;
+    }
+
+  Bounds bounds = beg->bounds;
+  BBox centroid_bbox (beg->centroid);
+  for (std::vector<BuildLight>::iterator l = beg + 1; l != end; ++l)
+    {
+      bounds = merge (bounds, l->bounds);
+      centroid_bbox += l->centroid;
+    }
+
+  // Find the best split, using the surface area orientation
+  // heuristic, approximated by putting the lights in buckets along
+  // each axis according to their centroids.
+  //
+  Vec centroid_extent = centroid_bbox.extent ();
+  dist_t max_extent = centroid_bbox.max_size ();
+
+  float best_cost = 0;
+  unsigned best_axis = 0, best_split = 0;
+
+  for (unsigned axis = 0; axis < 3; axis++)
+    {
+      dist_t extent = centroid_extent[axis];
+      if (extent <= 0)
+	continue;
+
+      dist_t min = centroid_bbox.min[axis];
+
+      Bounds buckets[NUM_BUCKETS];
+      unsigned counts[NUM_BUCKETS] = { 0 };
+
+      for (std::vector<BuildLight>::iterator l = beg; l != end; ++l)
+	{
+	  unsigned b = bucket_index (l->centroid[axis], min, extent);
+	  buckets[b] = counts[b] ? merge (buckets[b], l->bounds) : l->bounds;
+	  counts[b]++;
+	}
+
+      // Splitting along a short axis is penalized, as it tends to
+      // produce long thin nodes.
+      //
+      float axis_penalty = float (max_extent / extent);
+
+      for (unsigned split = 1; split < NUM_BUCKETS; split++)
+	{
+	  Bounds below, above;
+	  unsigned num_below = 0, num_above = 0;
+
+	  for (unsigned b = 0; b < NUM_BUCKETS; b++)
+	    if (counts[b])
+	      {
+		if (b < split)
+		  {
+		    below = num_below ? merge (below, buckets[b]) : buckets[b];
+		    num_below += counts[b];
+		  }
+		else
+		  {
+		    above = num_above ? merge (above, buckets[b]) : buckets[b];
+		    num_above += counts[b];
+		  }
+	      }
+
+	  if (num_below == 0 || num_above == 0)
+	    continue;
+
+	  float cost = axis_penalty * (node_cost (below) + node_cost (above));
+
+	  if (best_split == 0 || cost < best_cost)
+	    {
+	      best_cost = cost;
+	      best_axis = axis;
+	      best_split = split;
+	    }
+	}
+    }
+
+  std::vector<BuildLight>::iterator mid;
+  if (best_split != 0)
+    mid = std::partition (beg, end,
+			  BucketLess (best_axis, centroid_bbox.min[best_axis],
+				      centroid_extent[best_axis], best_split));
+  else
+    //
+    // All the centroids are in the same place, so just split the
+    // lights in half.
+    //
+    mid = beg + (end - beg) / 2;
+
+  build (beg, mid);
+  unsigned second_child = build (mid, end);
+
+  // Note that NODES may have been reallocated by the recursive calls,
+  // so we can't keep a reference to our node across them.
+  //
+  nodes[node_index].bounds = bounds;
+  nodes[node_index].index = second_child;
+  nodes[node_index].leaf = false;
+
+  return node_index;
+}
+
+
+
+
+// Choosing lights
+
+// Return an estimate of the importance of the lights described by
+// BOUNDS to the point POS with normal NORM.
+//
+float
+LightTree::importance (const Bounds &bounds, const Pos &pos, const Vec &norm,
+		       bool two_sided)
+{
+  Pos center = bounds.bbox.center ();
+  float radius = bounds.bbox.radius ();
+
+  Vec vec = pos - center;	// from the lights towards POS
+  float dist_sq = vec.length_squared ();
+  float dist = sqrt (dist_sq);
+
+  // THETA_U is the half-angle of a cone from POS containing the
+  // bounding sphere of the lights.
+  //
+  float theta_u;
+  if (dist <= radius)
+    theta_u = PIf;
+  else
+    theta_u = asin (radius / dist);
+
+  Vec dir = dist > 0 ? vec / dist : norm;
+
+  // The minimum angle between any emission direction of the lights
+  // and the direction towards POS; if this is greater than THETA_E,
+  // no light can reach POS.
+  //
+  float theta = angle_between (bounds.axis, dir);
+  float theta_emit = max (theta - bounds.theta_o - theta_u, 0.f);
+  if (theta_emit > bounds.theta_e)
+    return 0;
+
+  // The minimum angle between NORM and the direction towards any of
+  // the lights.
+  //
+  float cos_recv = float (dot (norm, -dir));
+  if (two_sided)
+    cos_recv = abs (cos_recv);
+  float theta_recv = max (acos (clamp (cos_recv, -1.f, 1.f)) - theta_u, 0.f);
+  if (theta_recv >= PIf / 2)
+    return 0;
+
+  // Don't let lights very close to POS dominate too much.
+  //
+  dist_sq = max (dist_sq, radius * radius);
+
+  return bounds.power * cos (theta_emit) * cos (theta_recv) / dist_sq;
+}
+
+// Randomly choose a light to illuminate the point POS, with normal
+// NORM, using PARAM as a random parameter in the range [0, 1).  If
+// TWO_SIDED is true, lights on both sides of NORM are considered,
+// otherwise only those on the side NORM points towards.
+//
+// If a light is chosen, LIGHT_INDEX is set to its index, and
+// SELECT_PDF to the probability with which it was chosen, and true
+// is returned.  If no light in the tree can illuminate POS, false
+// is returned.
+//
+bool
+LightTree::choose_light (const Pos &pos, const Vec &norm, bool two_sided,
+			 float param, unsigned &light_index, float &select_pdf)
+  const
+{
+  if (nodes.empty ())
+    return false;
+
+  float pdf = 1;
+  unsigned node_index = 0;
+
+  while (! nodes[node_index].leaf)
+    {
+      unsigned child1 = node_index + 1;
+      unsigned child2 = nodes[node_index].index;
+
+      float imp1 = importance (nodes[child1].bounds, pos, norm, two_sided);
+      float imp2 = importance (nodes[child2].bounds, pos, norm, two_sided);
+
+      if (imp1 == 0 && imp2 == 0)
+	return false;
+
+      // Choose a child with probability proportional to its
+      // importance, and rescale PARAM so that it can be reused for
+      // the next choice.
+      //
+      float prob1 = imp1 / (imp1 + imp2);
+
+      if (param < prob1)
+	{
+	  node_index = child1;
+	  param = param / prob1;
+	  pdf *= prob1;
+	}
+      else
+	{
+	  node_index = child2;
+	  param = (param - prob1) / (1 - prob1);
+	  pdf *= 1 - prob1;
+	}
+
+      // Avoid PARAM reaching 1 due to rounding.
+      //
+      param = min (param, 1 - 1.f / 16777216);
+    }
+
+  light_index = nodes[node_index].index;
+  select_pdf = pdf;
+
+  return true;
+}
@@ -0,0 +1,128 @@
+// light-tree.h -- Hierarchy of lights for choosing lights to sample
+//
+//  Copyright (C) 2014  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#ifndef SNOGRAY_LIGHT_TREE_H
+#define SNOGRAY_LIGHT_TREE_H
+
+#include <vector>
+
+#include "light/light-sampler.h"
+
+
+namespace snogray {
+
+
+// A bounding hierarchy of lights, which is used to randomly choose a
+// light to sample, with a probability roughly proportional to the
+// light's contribution to a particular point.
+//
+// Each node of the tree records the bounds of the lights below it (see
+// Light::Sampler::Bounds):  a bounding-box, their total power, and a
+// cone containing their emission directions.  To choose a light, the
+// tree is descended from the root, at each node choosing one of the
+// two children randomly, with a probability proportional to an
+// estimate of its importance at the point being illuminated.  The
+// estimate is conservative, so any light which could contribute to a
+// point will be chosen with some non-zero probability.
+//
+// Only lights with a finite extent (those whose
+// Light::Sampler::get_bounds method returns true) are put in the tree;
+// others, such as environment lights, are listed in
+// LightTree::unbounded_lights, and should be sampled separately.
+//
+// The tree is built using a "surface area orientation heuristic", as
+// described in:
+//
+//   Alejandro Conty Estevez and Christopher Kulla, "Importance Sampling
+//   of Many Lights with Adaptive Tree Splitting", 2018.
+//
+class LightTree
+{
+public:
+
+  // Build a tree for the lights in LIGHT_SAMPLERS.  Lights are
+  // identified by their index in LIGHT_SAMPLERS.
+  //
+  LightTree (const std::vector<const Light::Sampler *> &light_samplers);
+
+  // Randomly choose a light to illuminate the point POS, with normal
+  // NORM, using PARAM as a random parameter in the range [0, 1).  If
+  // TWO_SIDED is true, lights on both sides of NORM are considered,
+  // otherwise only those on the side NORM points towards.
+  //
+  // If a light is chosen, LIGHT_INDEX is set to its index, and
+  // SELECT_PDF to the probability with which it was chosen, and true
+  // is returned.  If no light in the tree can illuminate POS, false
+  // is returned.
+  //
+  bool choose_light (const Pos &pos, const Vec &norm, bool two_sided,
+		     float param, unsigned &light_index, float &select_pdf)
+    const;
+
+  // Return the number of lights in the tree.
+  //
+  unsigned num_lights () const { return (nodes.size () + 1) / 2; }
+
+  // Indices of lights which weren't put in the tree, because they
+  // don't have a finite extent.
+  //
+  std::vector<unsigned> unbounded_lights;
+
+private:
+
+  // A node in the tree.
+  //
+  struct Node
+  {
+    // The bounds of all lights below this node.
+    //
+    Light::Sampler::Bounds bounds;
+
+    // If this is a leaf node, the index of its light; otherwise, the
+    // index in LightTree::nodes of its second child (its first child
+    // immediately follows it).
+    //
+    unsigned index;
+
+    bool leaf;
+  };
+
+  // A light being put in the tree.
+  //
+  struct BuildLight;
+
+  // Predicate used to partition BuildLight objects when splitting a
+  // node.
+  //
+  struct BucketLess;
+
+  // Add nodes for the lights from BEG to END to the tree, and return
+  // the index of the first node added.
+  //
+  unsigned build (std::vector<BuildLight>::iterator beg,
+		  std::vector<BuildLight>::iterator end);
+
+  // Return an estimate of the importance of the lights described by
+  // BOUNDS to the point POS with normal NORM.
+  //
+  static float importance (const Light::Sampler::Bounds &bounds,
+			   const Pos &pos, const Vec &norm, bool two_sided);
+
+  // Nodes in the tree, in depth-first order; the root is the first.
+  //
+  std::vector<Node> nodes;
+};
+
+
+}
+
+#endif // SNOGRAY_LIGHT_TREE_H
@@ -1,6 +1,6 @@
 // path-integ.cc -- Path-tracing surface integrator
 //
-//  Copyright (C) 2010-2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2010-2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -16,6 +16,7 @@
 #include "photon/photon-shooter.h"
 #include "scene.h"
 #include "global-render-state.h"
+#include "volume-integ.h"
 
 #include "path-integ.h"
 
@@ -35,21 +36,25 @@ public:
   {
   }
 
-  // Deposit (or ignore) the photon PHOTON in some photon-set.
-  // ISEC is the intersection where the photon is being stored, and
-  // BSDF_HISTORY is the bitwise-or of all BSDF past interactions
-  // since this photon was emitted by the light (it will be zero for
-  // the first intersection).
+  // Return the photon-set in which the photon PHOTON should be
+  // deposited, or zero if it should be ignored.  ISEC is the
+  // intersection where the photon is being stored, and BSDF_HISTORY
+  // is the bitwise-or of all BSDF past interactions since this photon
+  // was emitted by the light (it will be zero for the first
+  // intersection).
   //
-  virtual void deposit (const Photon &photon, const Intersect &isec,
-			unsigned bsdf_history)
+  virtual const PhotonSet *choose_photon_set (const Photon &,
+					      const Intersect &isec,
+					      unsigned /*bsdf_history*/)
+    const
   {
     // We only deposit photons on diffuse surfaces, and only for
     // indirect illumination.
     //
-    if (!photon_set.complete ()
-	&& isec.bsdf->supports (Bsdf::ALL_DIRECTIONS | Bsdf::DIFFUSE))
-      photon_set.photons.push_back (photon);
+    if (isec.bsdf->supports (Bsdf::ALL_DIRECTIONS | Bsdf::DIFFUSE))
+      return &photon_set;
+    else
+      return 0;
   }
 
   PhotonSet photon_set;
@@ -65,7 +70,8 @@ PathInteg::GlobalState::GlobalState (const GlobalRenderState &rstate,
     max_path_len (params.get_uint ("max_path_len", 25)),
     direct_illum (
       params.get_uint ("direct_samples,dir_samples,dir_samps",
-		       rstate.params.get_uint ("direct_samples", 1))),
+		       rstate.params.get_uint ("direct_samples", 1)),
+      rstate.params),
     photon_eval (
       params.get_uint ("render_photons", 50),
       params.get_float ("photon_radius,radius", 5),
@@ -131,8 +137,26 @@ PathInteg::GlobalState::make_integrator (RenderContext &context)
 // "Li" means "Light incoming".
 //
 Tint
-PathInteg::Li (const Ray &ray, const Media &orig_media,
+PathInteg::Li (const Ray &ray, const Media &media,
 	       const SampleSet::Sample &sample)
+{
+  Ray isec_ray = ray;
+
+  const Surface::Renderable::IsecInfo *isec_info
+    = context.scene.intersect (isec_ray, context);
+
+  return Li (isec_ray, isec_info, media, sample);
+}
+
+// A variant of PathInteg::Li for when the closest intersection along
+// the ray has already been found.  FIRST_ISEC_RAY is the ray,
+// shortened to end at the intersection, and ISEC_INFO describes the
+// intersection, or is zero if the ray didn't hit anything.
+//
+Tint
+PathInteg::Li (const Ray &first_isec_ray,
+	       const Surface::Renderable::IsecInfo *isec_info,
+	       const Media &orig_media, const SampleSet::Sample &sample)
 {
   const Scene &scene = context.scene;
 
@@ -142,7 +166,10 @@ PathInteg::Li (const Ray &ray, const Media &orig_media,
   //
   const Media *innermost_media = &orig_media;
 
-  Ray isec_ray = ray;
+  // The ray for the current path vertex, ending at its intersection
+  // (ISEC_INFO).
+  //
+  Ray isec_ray = first_isec_ray;
 
   // Length of the current path.
   //
@@ -183,9 +210,6 @@ PathInteg::Li (const Ray &ray, const Media &orig_media,
   //
   for (;;)
     {
-      const Surface::Renderable::IsecInfo *isec_info
-	= scene.intersect (isec_ray, context);
-
       // Top of current media stack.
       //
       const Media &media = *innermost_media;
@@ -401,6 +425,10 @@ PathInteg::Li (const Ray &ray, const Media &orig_media,
 	Media::update_stack_for_transmission (innermost_media, isec);
 
       path_len++;
+
+      // Find the next path-vertex.
+      //
+      isec_info = scene.intersect (isec_ray, context);
     }
 
   return Tint (radiance, alpha);
@@ -1,6 +1,6 @@
 // photon-integ.cc -- Photon-mapping surface integrator
 //
-//  Copyright (C) 2010, 2012, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2010, 2012, 2013, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -12,7 +12,12 @@
 
 #include <iostream>
 
+#include "config.h"
+
 #include "util/snogmath.h"
+#include "util/mutex.h"
+#include "util/thread.h"
+#include "util/string-funs.h"
 #include "material/bsdf.h"
 #include "material/media.h"
 #include "material/material.h"
@@ -38,6 +43,8 @@ static const unsigned UNSPEC_UINT = 99999;
 PhotonInteg::GlobalState::GlobalState (const GlobalRenderState &rstate,
 				       const ValTable &params)
   : RecursiveInteg::GlobalState (rstate),
+    radiance_photon_interval (
+      params.get_uint ("radiance_photon_interval", 4)),
     caustic_scale (0), direct_scale (0), indirect_scale (0),
     photon_eval (
       params.get_uint ("use_photons", 50),
@@ -45,7 +52,8 @@ PhotonInteg::GlobalState::GlobalState (const GlobalRenderState &rstate,
       params.get_float ("marker_radius", 0)),
     direct_illum (
       params.get_uint ("direct_samples,dir_samples,dir_samps",
-		       rstate.params.get_uint ("direct_samples", 16))),
+		       rstate.params.get_uint ("direct_samples", 16)),
+      rstate.params),
     use_direct_illum (params.get_bool ("direct_illum,dir_illum", true)),
     num_fgather_samples (
       params.get_uint ("final_gather_samples,fg_samples,fg_samps",
@@ -144,7 +152,37 @@ PhotonInteg::GlobalState::GlobalState (const GlobalRenderState &rstate,
   if (use_direct_illum && num_fgather_samples == 0)
     num_direct = 0;
 
-  generate_photons (num_caustic, num_direct, num_indirect);
+  // Radiance photons are only used for final gathering.
+  //
+  if (num_fgather_samples == 0)
+    radiance_photon_interval = 0;
+
+  // If set, a file used to cache photon-maps between runs.
+  //
+  std::string cache_file = params.get_string ("photon_cache", "");
+
+  // Everything that affects our photon-maps.
+  //
+  PhotonCache::Key cache_key;
+  if (! cache_file.empty ())
+    {
+      cache_key.add (rstate.scene);
+      add_probe_photons (cache_key);
+      cache_key.add (num_caustic);
+      cache_key.add (num_direct);
+      cache_key.add (num_indirect);
+      cache_key.add (radiance_photon_interval);
+      cache_key.add (photon_eval.num_photons);
+      cache_key.add (float (photon_eval.search_radius_sq));
+    }
+
+  if (cache_file.empty () || ! load_cached_photons (cache_file, cache_key))
+    {
+      generate_photons (num_caustic, num_direct, num_indirect);
+
+      if (! cache_file.empty ())
+	save_cached_photons (cache_file, cache_key);
+    }
 
   std::cout << "* photon-integ:"
 	    << " photon search count: " << photon_eval.num_photons
@@ -206,56 +244,121 @@ public:
   {
   }
 
-  // Deposit (or ignore) the photon PHOTON in some photon-set.
-  // ISEC is the intersection where the photon is being stored, and
-  // BSDF_HISTORY is the bitwise-or of all BSDF past interactions
-  // since this photon was emitted by the light (it will be zero for
-  // the first intersection).
+  // Return the photon-set in which the photon PHOTON should be
+  // deposited, or zero if it should be ignored.  ISEC is the
+  // intersection where the photon is being stored, and BSDF_HISTORY
+  // is the bitwise-or of all BSDF past interactions since this photon
+  // was emitted by the light (it will be zero for the first
+  // intersection).
   //
-  virtual void deposit (const Photon &photon,
-			const Intersect &isec, unsigned bsdf_history);
+  virtual const PhotonSet *choose_photon_set (const Photon &photon,
+					      const Intersect &isec,
+					      unsigned bsdf_history)
+    const;
 
   PhotonSet caustic, direct, indirect;
 };
 
-// Deposit (or ignore) the photon PHOTON in some photon-set.
-// ISEC is the intersection where the photon is being stored, and
-// BSDF_HISTORY is the bitwise-or of all BSDF past interactions
-// since this photon was emitted by the light (it will be zero for
-// the first intersection).
+// Return the photon-set in which the photon PHOTON should be
+// deposited, or zero if it should be ignored.  ISEC is the
+// intersection where the photon is being stored, and BSDF_HISTORY is
+// the bitwise-or of all BSDF past interactions since this photon was
+// emitted by the light (it will be zero for the first intersection).
 //
-void PhotonInteg::Shooter::deposit (const Photon &photon,
-				    const Intersect &isec,
-				    unsigned bsdf_history)
+const PhotonShooter::PhotonSet *
+PhotonInteg::Shooter::choose_photon_set (const Photon &,
+					 const Intersect &isec,
+					 unsigned bsdf_history)
+  const
 {
   // We don't deposit photons on purely specular surfaces.
   //
-  if (isec.bsdf->supports (Bsdf::ALL & ~Bsdf::SPECULAR))
+  if (! isec.bsdf->supports (Bsdf::ALL & ~Bsdf::SPECULAR))
+    return 0;
+
+  // Choose which photon-map to put the photon in.
+  //
+  const PhotonSet *photon_set;
+  if (bsdf_history == 0)
+    // direct; path-type:  L(D|G)
+    photon_set = &direct;
+  else if (caustic.target_count != 0
+	   && ! (bsdf_history & Bsdf::ALL_LAYERS & ~Bsdf::SPECULAR))
+    // caustic; path-type:  L(S)+(D|G)
+    photon_set = &caustic;
+  else
+    // indirect; path-type:  L(D|G|S)*(D|G)(D|G|S)*
+    photon_set = &indirect;
+
+  return photon_set;
+}
+
+
+// PhotonInteg::ProbeShooter
+
+// A photon-shooter which deposits every photon, at every surface it
+// hits, in a single photon-set, used to make a fingerprint of the
+// scene for the photon cache key.
+//
+class PhotonInteg::ProbeShooter : public PhotonShooter
+{
+public:
+
+  ProbeShooter (unsigned num_photons)
+    : PhotonShooter ("photon-integ probe"),
+      probe (num_photons, "probe", *this)
+  {
+    probe.record_normals = true;
+  }
+
+  // Return the photon-set in which the photon PHOTON should be
+  // deposited, which is always our single photon-set.
+  //
+  virtual const PhotonSet *choose_photon_set (const Photon &,
+					      const Intersect &,
+					      unsigned)
+    const
+  {
+    return &probe;
+  }
+
+  PhotonSet probe;
+};
+
+
+// Number of photons shot by PhotonInteg::GlobalState::add_probe_photons.
+//
+static const unsigned NUM_PROBE_PHOTONS = 4096;
+
+// Shoot a small fixed set of probe photons, and add them to KEY.
+// These are the same as the first photons a full shoot would generate,
+// so this detects most changes to the materials or placement of
+// surfaces in the scene which would change our photon-maps, even if
+// the scene's overall extent doesn't change.
+//
+void
+PhotonInteg::GlobalState::add_probe_photons (PhotonCache::Key &key) const
+{
+  ProbeShooter shooter (NUM_PROBE_PHOTONS);
+
+  shooter.shoot (global_render_state);
+
+  const PhotonShooter::PhotonSet &probe = shooter.probe;
+
+  key.add (unsigned (probe.photons.size ()));
+  key.add (probe.num_paths);
+
+  for (unsigned i = 0; i < probe.photons.size (); i++)
     {
-      // Choose which photon-map to put PHOTON in.
-      //
-      if (bsdf_history == 0)
-	// direct; path-type:  L(D|G)
-	{
-	  if (! direct.complete ())
-	    direct.photons.push_back (photon);
-	}
-      else if (caustic.target_count != 0
-	       && ! (bsdf_history & Bsdf::ALL_LAYERS & ~Bsdf::SPECULAR))
-	// caustic; path-type:  L(S)+(D|G)
-	{
-	  if (! caustic.complete ())
-	    caustic.photons.push_back (photon);
-	}
-      else
-	// indirect; path-type:  L(D|G|S)*(D|G)(D|G|S)*
-	{
-	  if (! indirect.complete ())
-	    indirect.photons.push_back (photon);
-	}
+      const Photon &photon = probe.photons[i];
+      key.add (photon.pos);
+      key.add (photon.dir);
+      key.add (photon.power);
+      key.add (probe.normals[i]);
     }
 }
 
+
 
 // PhotonInteg::GlobalState::generate_photons
 
@@ -268,8 +371,32 @@ PhotonInteg::GlobalState::generate_photons (unsigned num_caustic,
 {
   Shooter shooter (num_caustic, num_direct, num_indirect);
 
+  // Radiance photons need the surface normal at each photon.
+  //
+  if (radiance_photon_interval != 0)
+    for (std::vector<PhotonShooter::PhotonSet *>::iterator psi
+	   = shooter.photon_sets.begin ();
+	 psi != shooter.photon_sets.end (); ++psi)
+      (*psi)->record_normals = true;
+
   shooter.shoot (global_render_state);
 
+  // Choose the locations of radiance photons.  This must be done
+  // before making the photon-maps, which reorders the photons.
+  //
+  std::vector<Photon> radiance_photons;
+  if (radiance_photon_interval != 0)
+    for (std::vector<PhotonShooter::PhotonSet *>::iterator psi
+	   = shooter.photon_sets.begin ();
+	 psi != shooter.photon_sets.end (); ++psi)
+      {
+	const PhotonShooter::PhotonSet &ps = **psi;
+	for (unsigned i = 0; i < ps.photons.size ();
+	     i += radiance_photon_interval)
+	  radiance_photons.push_back (
+			     Photon (ps.photons[i].pos, ps.normals[i], 0));
+      }
+
   caustic_photon_map.set_photons (shooter.caustic.photons);
   direct_photon_map.set_photons (shooter.direct.photons);
   indirect_photon_map.set_photons (shooter.indirect.photons);
@@ -280,6 +407,302 @@ PhotonInteg::GlobalState::generate_photons (unsigned num_caustic,
     direct_scale = 1 / float (shooter.direct.num_paths);
   if (shooter.indirect.num_paths > 0)
     indirect_scale = 1 / float (shooter.indirect.num_paths);
+
+  if (! radiance_photons.empty ())
+    make_radiance_photon_map (radiance_photons);
+}
+
+
+
+// Photon cache
+
+// Type of photon cache files we use.  The number should be changed
+// whenever the way photons are generated changes.
+//
+static const char PHOTON_CACHE_TYPE[] = "photon-integ1";
+
+// The number of photon-maps stored in a photon cache file:  direct,
+// caustic, indirect, and radiance photons.
+//
+static const unsigned NUM_CACHED_MAPS = 4;
+
+// If the photon cache file CACHE_FILE holds photon-maps generated from
+// the inputs identified by KEY, use them for our photon-maps, and
+// return true; otherwise, return false.
+//
+bool
+PhotonInteg::GlobalState::load_cached_photons (
+			    const std::string &cache_file,
+			    const PhotonCache::Key &key)
+{
+  UniquePtr<PhotonCache> cache (
+    PhotonCache::load (cache_file, PHOTON_CACHE_TYPE, NUM_CACHED_MAPS, key));
+
+  if (! cache.get ())
+    return false;
+
+  float radiance_scale;
+  if (! cache->get_map (0, direct_photon_map, direct_scale)
+      || ! cache->get_map (1, caustic_photon_map, caustic_scale)
+      || ! cache->get_map (2, indirect_photon_map, indirect_scale)
+      || ! cache->get_map (3, radiance_photon_map, radiance_scale))
+    {
+      // Don't leave any photon-maps referring to the cache file.
+      //
+      std::vector<Photon> no_photons;
+      direct_photon_map.set_photons (no_photons);
+      caustic_photon_map.set_photons (no_photons);
+      indirect_photon_map.set_photons (no_photons);
+      radiance_photon_map.set_photons (no_photons);
+
+      caustic_scale = direct_scale = indirect_scale = 0;
+
+      return false;
+    }
+
+  photon_cache.reset (cache.release ());
+
+  std::cout << "* photon-integ: "
+	    << commify (direct_photon_map.size ()) << " direct, "
+	    << commify (caustic_photon_map.size ()) << " caustic, "
+	    << commify (indirect_photon_map.size ()) << " indirect, "
+	    << commify (radiance_photon_map.size ()) << " radiance photons"
+	    << " (from " << cache_file << ")" << std::endl;
+
+  // Scene changes which don't affect the cache key (e.g., those which
+  // none of the probe photons encounter) aren't detected.
+  //
+  std::cout << "* photon-integ: warning: scene changes not affecting"
+	    << " probe photons are undetected; if in doubt, delete "
+	    << cache_file << std::endl;
+
+  return true;
+}
+
+// Save our photon-maps in the photon cache file CACHE_FILE, tagged with
+// KEY.
+//
+void
+PhotonInteg::GlobalState::save_cached_photons (
+			    const std::string &cache_file,
+			    const PhotonCache::Key &key)
+  const
+{
+  std::vector<const PhotonMap *> maps;
+  std::vector<float> scales;
+
+  maps.push_back (&direct_photon_map);
+  scales.push_back (direct_scale);
+  maps.push_back (&caustic_photon_map);
+  scales.push_back (caustic_scale);
+  maps.push_back (&indirect_photon_map);
+  scales.push_back (indirect_scale);
+  maps.push_back (&radiance_photon_map);
+  scales.push_back (1);
+
+  PhotonCache::save (cache_file, PHOTON_CACHE_TYPE, key, maps, scales);
+}
+
+
+// Radiance photons
+
+// State used while calculating radiance photons.
+//
+struct PhotonInteg::GlobalState::RadiancePhotonCalc
+{
+  // Number of consecutive radiance photons handled by a thread at
+  // once.
+  //
+  static const unsigned CHUNK_SIZE = 1024;
+
+  RadiancePhotonCalc (const GlobalState &_global_state,
+		      std::vector<Photon> &_radiance_photons)
+    : global_state (_global_state), radiance_photons (_radiance_photons),
+      next_chunk (0)
+  { }
+
+  // Calculate the irradiance for chunks of radiance photons until
+  // they're all done.  This is the main function of each thread.
+  //
+  void run ()
+  {
+    std::vector<Photon> found_photons;
+
+    for (;;)
+      {
+	unsigned beg;
+
+	{
+	  LockGuard guard (lock);
+	  beg = next_chunk++ * CHUNK_SIZE;
+	}
+
+	if (beg >= radiance_photons.size ())
+	  break;
+
+	unsigned end = min (beg + CHUNK_SIZE,
+			    unsigned (radiance_photons.size ()));
+
+	for (unsigned i = beg; i < end; i++)
+	  {
+	    Photon &rph = radiance_photons[i];
+	    rph.power = global_state.irradiance (rph.pos, rph.dir,
+						 found_photons);
+	  }
+      }
+  }
+
+  const GlobalState &global_state;
+
+  std::vector<Photon> &radiance_photons;
+
+  // Lock protecting NEXT_CHUNK.
+  //
+  Mutex lock;
+
+  // The number of the next chunk of radiance photons to handle.
+  //
+  unsigned next_chunk;
+};
+
+// Make RADIANCE_PHOTON_MAP from RADIANCE_PHOTONS, which should contain
+// the position and surface normal (in the Photon::dir field) of each
+// radiance photon.  The irradiance at each radiance photon is first
+// calculated from the other photon-maps, using multiple threads.
+//
+void
+PhotonInteg::GlobalState::make_radiance_photon_map (
+			    std::vector<Photon> &radiance_photons)
+{
+  RadiancePhotonCalc calc (*this, radiance_photons);
+
+#if USE_THREADS
+  unsigned num_threads
+    = global_render_state.params.get_uint ("setup_threads", 1);
+
+  // Calculate irradiance in NUM_THREADS threads, one of which is the
+  // calling thread.
+  //
+  std::vector<Thread *> threads;
+  for (unsigned i = 1; i < num_threads; i++)
+    threads.push_back (new Thread (&RadiancePhotonCalc::run, &calc));
+#endif
+
+  calc.run ();
+
+#if USE_THREADS
+  for (std::vector<Thread *>::iterator ti = threads.begin ();
+       ti != threads.end (); ++ti)
+    {
+      (*ti)->join ();
+      delete *ti;
+    }
+#endif
+
+  std::cout << "* photon-integ: " << commify (radiance_photons.size ())
+	    << " radiance photons" << std::endl;
+
+  radiance_photon_map.set_photons (radiance_photons);
+}
+
+// Return the irradiance at POS, on a surface whose normal is NORMAL,
+// estimated from the photons in all our photon-maps.  FOUND_PHOTONS is
+// used as temporary storage.
+//
+Color
+PhotonInteg::GlobalState::irradiance (const Pos &pos, const Vec &normal,
+				      std::vector<Photon> &found_photons)
+  const
+{
+  const PhotonMap *maps[3]
+    = { &direct_photon_map, &caustic_photon_map, &indirect_photon_map };
+  float scales[3] = { direct_scale, caustic_scale, indirect_scale };
+
+  Color irrad = 0;
+
+  for (unsigned m = 0; m < 3; m++)
+    if (scales[m] != 0)
+      {
+	found_photons.clear ();
+	dist_t max_dist_sq
+	  = maps[m]->find_photons (pos, photon_eval.num_photons,
+				   photon_eval.search_radius_sq,
+				   found_photons);
+
+	// Only photons which arrived from the same side of the
+	// surface as NORMAL contribute.
+	//
+	Color power = 0;
+	for (std::vector<Photon>::iterator i = found_photons.begin ();
+	     i != found_photons.end (); ++i)
+	  if (dot (i->dir, normal) > 0)
+	    power += i->power;
+
+	irrad += power * scales[m] / (float (max_dist_sq) * PIf);
+      }
+
+  return irrad;
+}
+
+// Return the light emitted from ISEC, for a final-gathering ray, using
+// the nearest radiance photon (see
+// PhotonInteg::GlobalState::radiance_photon_map).  If radiance photons
+// aren't being used, or there's no suitable radiance photon near ISEC,
+// the photon-maps are used directly instead.
+//
+Color
+PhotonInteg::Lo_radiance_photon (const Intersect &isec)
+{
+  // The number of nearby radiance photons we look at, in case the
+  // closest has a normal which is too different from ISEC's.
+  //
+  static const unsigned NUM_CANDIDATES = 8;
+
+  // The minimum cosine of the angle between a radiance photon's
+  // normal and ISEC's normal.
+  //
+  static const float MIN_NORMAL_COS = 0.9f;
+
+  const Pos &pos = isec.normal_frame.origin;
+  const Vec &normal = isec.normal_frame.z;
+
+  found_radiance_photons.clear ();
+  if (global.radiance_photon_map.size () != 0)
+    global.radiance_photon_map.find_photons (
+			      pos, NUM_CANDIDATES,
+			      global.photon_eval.search_radius_sq,
+			      found_radiance_photons);
+
+  const Photon *closest = 0;
+  dist_t closest_dist_sq = 0;
+  for (std::vector<Photon>::const_iterator i
+	 = found_radiance_photons.begin ();
+       i != found_radiance_photons.end (); ++i)
+    if (dot (i->dir, normal) > MIN_NORMAL_COS)
+      {
+	dist_t dist_sq = (i->pos - pos).length_squared ();
+	if (! closest || dist_sq < closest_dist_sq)
+	  {
+	    closest = &*i;
+	    closest_dist_sq = dist_sq;
+	  }
+      }
+
+  if (! closest)
+    return (Lo_photon (isec, global.direct_photon_map, global.direct_scale)
+	    + Lo_photon (isec, global.indirect_photon_map,
+			 global.indirect_scale)
+	    + Lo_photon (isec, global.caustic_photon_map,
+			 global.caustic_scale));
+
+  // Convert the irradiance to outgoing radiance using ISEC's BSDF,
+  // which is assumed to be roughly diffuse, so that it can be
+  // evaluated in any direction (we use the normal).
+  //
+  Bsdf::Value bsdf_val
+    = isec.bsdf->eval (Vec (0, 0, 1), Bsdf::ALL & ~Bsdf::SPECULAR);
+
+  return closest->power * bsdf_val.val;
 }
 
 
@@ -325,16 +748,7 @@ PhotonInteg::Lo_fgather_samp (const Intersect &isec, const Media &media,
 
 	  if (samp_isec.bsdf)
 	    {
-	      Color Li
-		= (Lo_photon (samp_isec,
-			      global.direct_photon_map,
-			      global.direct_scale)
-		   + Lo_photon (samp_isec,
-				global.indirect_photon_map,
-				global.indirect_scale)
-		   + Lo_photon (samp_isec,
-				global.caustic_photon_map,
-				global.caustic_scale));
+	      Color Li = Lo_radiance_photon (samp_isec);
 
 	      // Adjustment to compute outgoing radiance due to
 	      // BSDF_SAMP, due to incoming radiance from BSDF_SAMP.
@@ -1,6 +1,6 @@
 // photon-integ.h -- Photon-mapping surface integrator
 //
-//  Copyright (C) 2010, 2011, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2010, 2011, 2013, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -13,8 +13,12 @@
 #ifndef SNOGRAY_PHOTON_INTEG_H
 #define SNOGRAY_PHOTON_INTEG_H
 
+#include <string>
+
+#include "util/unique-ptr.h"
 #include "material/bsdf.h"
 #include "photon/photon-map.h"
+#include "photon/photon-cache.h"
 #include "photon/photon-eval.h"
 #include "direct-illum.h"
 
@@ -43,6 +47,7 @@ protected:
 private:
 
   class Shooter;
+  class ProbeShooter;
 
   // Integrator state for rendering a group of related samples.
   //
@@ -59,6 +64,14 @@ private:
     return photon_eval.Lo (isec, photon_map, scale, flags);
   }
 
+  // Return the light emitted from ISEC, for a final-gathering ray,
+  // using the nearest radiance photon (see
+  // PhotonInteg::GlobalState::radiance_photon_map).  If radiance
+  // photons aren't being used, or there's no suitable radiance photon
+  // near ISEC, the photon-maps are used directly instead.
+  //
+  Color Lo_radiance_photon (const Intersect &isec);
+
   // "Final gathering": Do a quick calculation of indirection
   // illumination by sampling the BRDF, shooting another level of
   // rays, and using only photon maps to calculate outgoing
@@ -106,6 +119,12 @@ private:
   SampleSet::Channel<UV> fgather_bsdf_chan;
   SampleSet::Channel<float> fgather_bsdf_layer_chan;
   SampleSet::Channel<UV> fgather_photon_chan;
+
+  // This is a temporary vector used by
+  // PhotonInteg::Lo_radiance_photon.  We keep it as a field here to
+  // avoid memory-allocation churn.
+  //
+  std::vector<Photon> found_radiance_photons;
 };
 
 
@@ -128,16 +147,86 @@ private:
 
   friend class PhotonInteg;
 
+  // State used while calculating radiance photons.
+  //
+  struct RadiancePhotonCalc;
+
   // Generate the specified number of photons and add them to our photon-maps.
   //
   void generate_photons (unsigned num_caustic, unsigned num_direct, unsigned num_indirect);
 
+  // Shoot a small fixed set of probe photons, and add them to KEY.
+  // These are the same as the first photons a full shoot would
+  // generate, so this detects most changes to the materials or
+  // placement of surfaces in the scene which would change our
+  // photon-maps, even if the scene's overall extent doesn't change.
+  //
+  void add_probe_photons (PhotonCache::Key &key) const;
+
+  // If the photon cache file CACHE_FILE holds photon-maps generated
+  // from the inputs identified by KEY, use them for our photon-maps,
+  // and return true; otherwise, return false.
+  //
+  bool load_cached_photons (const std::string &cache_file,
+			    const PhotonCache::Key &key);
+
+  // Save our photon-maps in the photon cache file CACHE_FILE, tagged
+  // with KEY.
+  //
+  void save_cached_photons (const std::string &cache_file,
+			    const PhotonCache::Key &key)
+    const;
+
+  // Make RADIANCE_PHOTON_MAP from RADIANCE_PHOTONS, which should
+  // contain the position and surface normal (in the Photon::dir
+  // field) of each radiance photon.  The irradiance at each radiance
+  // photon is first calculated from the other photon-maps, using
+  // multiple threads.
+  //
+  void make_radiance_photon_map (std::vector<Photon> &radiance_photons);
+
+  // Return the irradiance at POS, on a surface whose normal is NORMAL,
+  // estimated from the photons in all our photon-maps.  FOUND_PHOTONS
+  // is used as temporary storage.
+  //
+  Color irradiance (const Pos &pos, const Vec &normal,
+		    std::vector<Photon> &found_photons)
+    const;
+
   // Photon-maps for various types of photons.
   //
   PhotonMap direct_photon_map;
   PhotonMap caustic_photon_map;
   PhotonMap indirect_photon_map;
 
+  // "Radiance photons", as described in:
+  //
+  //   Per H. Christensen, "Faster Photon Map Global Illumination",
+  //   Journal of Graphics Tools, 1999.
+  //
+  // These are located at a subset of the positions of photons in the
+  // other photon-maps, and record the irradiance there, precomputed
+  // from the other photon-maps.  Each "photon" in this map has the
+  // surface normal in its Photon::dir field, and the irradiance in its
+  // Photon::power field.
+  //
+  // When final-gathering, a single lookup in this map replaces
+  // searching and evaluating photons in all the other maps.  It's
+  // empty if radiance photons aren't being used.
+  //
+  PhotonMap radiance_photon_map;
+
+  // If our photon-maps were loaded from a photon cache file, the
+  // mapping of that file.
+  //
+  UniquePtr<PhotonCache> photon_cache;
+
+  // A radiance photon is made at the position of every Nth photon
+  // in the other photon-maps, where this is N.  If zero, radiance
+  // photons aren't used.
+  //
+  unsigned radiance_photon_interval;
+
   // Amount by which we scale each photon during rendering.
   //
   float caustic_scale, direct_scale, indirect_scale;
@@ -0,0 +1,311 @@
+// raycast-bench.cc -- Benchmark for ray-casting through a scene
+//
+//  Copyright (C) 2014  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#include <stdexcept>
+
+#include "config.h"
+
+#include "util/snogmath.h"
+#include "util/timeval.h"
+#include "util/thread.h"
+#include "geometry/sphere-sample.h"
+#include "camera/camera.h"
+#include "global-render-state.h"
+#include "render-context.h"
+
+#include "raycast-bench.h"
+
+
+using namespace snogray;
+
+
+
+// Ray generation
+
+// Replace the current ray set with NUM_RAYS rays of kind KIND, and
+// return the number of rays actually generated.
+//
+unsigned
+RaycastBench::generate (const std::string &kind, unsigned num_rays)
+{
+  const Scene &scene = global_state.scene;
+
+  rays.clear ();
+  rays.reserve (num_rays);
+
+  if (kind == "camera")
+    {
+      gen_camera_rays (num_rays, 0, rays);
+      any_hit = false;
+    }
+  else if (kind == "random")
+    {
+      BBox bbox = scene.bbox ();
+      Vec extent = bbox.extent ();
+
+      for (unsigned i = 0; i < num_rays; i++)
+	{
+	  Pos org (bbox.min.x + extent.x * random (),
+		   bbox.min.y + extent.y * random (),
+		   bbox.min.z + extent.z * random ());
+	  Vec dir = sphere_sample (UV (random (), random ()));
+
+	  rays.push_back (Ray (org, dir, scene.horizon));
+	}
+
+      any_hit = false;
+    }
+  else if (kind == "shadow" || kind == "bounce")
+    {
+      bool shadow = (kind == "shadow");
+
+      BBox bbox = scene.bbox ();
+      Vec extent = bbox.extent ();
+
+      RenderContext context (global_state);
+      dist_t min_trace = context.params.min_trace;
+
+      // Shadow and bounce rays start where camera rays hit something,
+      // so we generate camera rays, a batch at a time, until we have
+      // enough hits.  If most camera rays miss, we give up after a
+      // while, returning fewer rays than requested.
+      //
+      unsigned max_camera_rays = max (num_rays * 4, width * height);
+      unsigned num_camera_rays = 0;
+      std::vector<Ray> camera_rays;
+
+      while (rays.size () < num_rays && num_camera_rays < max_camera_rays)
+	{
+	  camera_rays.clear ();
+	  gen_camera_rays (CHUNK_SIZE, num_camera_rays, camera_rays);
+	  num_camera_rays += CHUNK_SIZE;
+
+	  for (std::vector<Ray>::iterator ri = camera_rays.begin ();
+	       ri != camera_rays.end () && rays.size () < num_rays; ++ri)
+	    {
+	      const Surface::Renderable::IsecInfo *isec_info
+		= scene.intersect (*ri, context);
+
+	      if (isec_info)
+		{
+		  Pos org = ri->end ();
+
+		  if (shadow)
+		    {
+		      Pos targ (bbox.min.x + extent.x * random (),
+				bbox.min.y + extent.y * random (),
+				bbox.min.z + extent.z * random ());
+		      Vec dir = targ - org;
+		      dist_t len = dir.length ();
+
+		      if (len > min_trace)
+			rays.push_back (Ray (org, dir / len, min_trace, len));
+		    }
+		  else
+		    {
+		      // Bounce rays go in a uniformly distributed
+		      // direction on the same side of the surface as the
+		      // camera ray came from.
+		      //
+		      Vec norm = isec_info->normal ();
+		      Vec dir = sphere_sample (UV (random (), random ()));
+		      if ((dot (dir, norm) > 0) != (dot (ri->dir, norm) < 0))
+			dir = -dir;
+
+		      rays.push_back (Ray (org, dir, min_trace, scene.horizon));
+		    }
+		}
+
+	      context.mempool.reset ();
+	    }
+	}
+
+      any_hit = shadow;
+    }
+  else
+    throw std::runtime_error ("Unknown raycast benchmark ray kind \""
+			      + kind + "\"");
+
+  return rays.size ();
+}
+
+// Append NUM_RAYS camera rays to RAYS, starting with pixel
+// FIRST_PIXEL, and continuing in scanline order.
+//
+void
+RaycastBench::gen_camera_rays (unsigned num_rays, unsigned first_pixel,
+			       std::vector<Ray> &rays)
+{
+  const Scene &scene = global_state.scene;
+  dist_t max_trace = (scene.bbox () + camera.pos).diameter ();
+  unsigned num_pixels = width * height;
+
+  for (unsigned i = 0; i < num_rays; i++)
+    {
+      unsigned pixel = (first_pixel + i) % num_pixels;
+      float x = float (pixel % width) + random ();
+      float y = float (pixel / width) + random ();
+
+      // We flip the vertical coordinate because the output image has
+      // zero at the top, whereas rendering coordinates use zero at the
+      // bottom.
+      //
+      UV film_loc (x / width, (height - y) / height);
+
+      rays.push_back (camera.eye_ray (film_loc, max_trace));
+    }
+}
+
+
+
+// Tracing
+
+// Job which traces part of the ray set, in a single thread.
+//
+struct RaycastBench::TraceJob
+{
+  TraceJob (const RaycastBench &_bench, unsigned _first_chunk,
+	    unsigned _chunk_step, unsigned _packet_size)
+    : bench (_bench), first_chunk (_first_chunk), chunk_step (_chunk_step),
+      packet_size (_packet_size), num_hits (0)
+  { }
+
+  void run ();
+
+  const RaycastBench &bench;
+
+  // This job traces every CHUNK_STEPth chunk of CHUNK_SIZE rays,
+  // starting with chunk FIRST_CHUNK.
+  //
+  unsigned first_chunk, chunk_step;
+
+  unsigned packet_size;
+
+  // Results.
+  //
+  RenderStats stats;
+  unsigned long long num_hits;
+};
+
+void
+RaycastBench::TraceJob::run ()
+{
+  RenderContext context (bench.global_state);
+  const Scene &scene = context.scene;
+  const std::vector<Ray> &rays = bench.rays;
+
+  unsigned num_rays = rays.size ();
+
+  std::vector<Ray> packet_rays;
+  const Surface::Renderable::IsecInfo *isec_infos[Space::MAX_PACKET_SIZE];
+
+  for (unsigned chunk_beg = first_chunk * CHUNK_SIZE;
+       chunk_beg < num_rays;
+       chunk_beg += chunk_step * CHUNK_SIZE)
+    {
+      unsigned chunk_end = min (chunk_beg + CHUNK_SIZE, num_rays);
+
+      if (bench.any_hit)
+	{
+	  for (unsigned i = chunk_beg; i < chunk_end; i++)
+	    if (scene.intersects (rays[i], context))
+	      num_hits++;
+	}
+      else if (packet_size == 1)
+	{
+	  for (unsigned i = chunk_beg; i < chunk_end; i++)
+	    {
+	      Ray ray (rays[i]);
+	      if (scene.intersect (ray, context))
+		num_hits++;
+	      context.mempool.reset ();
+	    }
+	}
+      else
+	for (unsigned base = chunk_beg; base < chunk_end; base += packet_size)
+	  {
+	    unsigned num = min (chunk_end - base, packet_size);
+
+	    packet_rays.assign (rays.begin () + base,
+				rays.begin () + base + num);
+
+	    scene.intersect (num, &packet_rays[0], isec_infos, context);
+
+	    for (unsigned i = 0; i < num; i++)
+	      if (isec_infos[i])
+		num_hits++;
+
+	    context.mempool.reset ();
+	  }
+
+      context.mempool.reset ();
+    }
+
+  stats = context.stats;
+}
+
+// Trace all the rays in the current ray set using NUM_THREADS
+// threads, and return the elapsed wall-clock time in seconds.
+// Closest-hit rays are traced in packets of up to PACKET_SIZE rays.
+// STATS is updated with the search statistics.
+//
+double
+RaycastBench::trace (unsigned num_threads, unsigned packet_size,
+		     RenderStats &stats)
+{
+  packet_size = max (min (packet_size, Space::MAX_PACKET_SIZE), 1u);
+
+#if ! USE_THREADS
+  num_threads = 1;
+#endif
+
+  unsigned num_chunks = (rays.size () + CHUNK_SIZE - 1) / CHUNK_SIZE;
+  num_threads = max (min (num_threads, num_chunks), 1u);
+
+  std::vector<TraceJob> jobs;
+  for (unsigned i = 0; i < num_threads; i++)
+    jobs.push_back (TraceJob (*this, i, num_threads, packet_size));
+
+  Timeval beg_time (Timeval::TIME_OF_DAY);
+
+  // Run each job in a separate thread, except the first, which is run
+  // in the calling thread.
+  //
+#if USE_THREADS
+  std::vector<Thread *> threads;
+  for (unsigned i = 1; i < jobs.size (); i++)
+    threads.push_back (new Thread (&TraceJob::run, &jobs[i]));
+#endif
+
+  jobs[0].run ();
+
+#if USE_THREADS
+  for (std::vector<Thread *>::iterator ti = threads.begin ();
+       ti != threads.end (); ++ti)
+    {
+      (*ti)->join ();
+      delete *ti;
+    }
+#endif
+
+  Timeval end_time (Timeval::TIME_OF_DAY);
+
+  num_hits = 0;
+  for (std::vector<TraceJob>::iterator ji = jobs.begin ();
+       ji != jobs.end (); ++ji)
+    {
+      stats += ji->stats;
+      num_hits += ji->num_hits;
+    }
+
+  return end_time - beg_time;
+}
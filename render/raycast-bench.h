@@ -0,0 +1,139 @@
+// raycast-bench.h -- Benchmark for ray-casting through a scene
+//
+//  Copyright (C) 2014  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#ifndef SNOGRAY_RAYCAST_BENCH_H
+#define SNOGRAY_RAYCAST_BENCH_H
+
+#include <string>
+#include <vector>
+
+#include "util/random.h"
+#include "geometry/ray.h"
+#include "render-stats.h"
+
+
+namespace snogray {
+
+class GlobalRenderState;
+class Camera;
+
+
+// A benchmark for measuring the speed of a scene's search accelerator.
+//
+// A RaycastBench holds a set of rays, which are generated in advance by
+// RaycastBench::generate, and then traced through the scene, without
+// doing any shading, by RaycastBench::trace.  Only the tracing is timed.
+//
+// As the rays are generated deterministically, benchmarks of the same
+// scene using different kinds of search accelerator trace exactly the
+// same rays.
+//
+class RaycastBench
+{
+public:
+
+  // Make a benchmark for the scene in GLOBAL_STATE, whose camera rays
+  // come from CAMERA, with an image size of WIDTH x HEIGHT pixels.
+  //
+  RaycastBench (const GlobalRenderState &_global_state, const Camera &_camera,
+		unsigned _width, unsigned _height)
+    : global_state (_global_state), camera (_camera),
+      width (_width), height (_height), any_hit (false), num_hits (0)
+  { }
+
+  // Replace the current ray set with NUM_RAYS rays of kind KIND, and
+  // return the number of rays actually generated.  KIND may be one of:
+  //
+  //   "camera"  -- Rays from the camera, for pixels in scanline order,
+  //                which are very coherent.
+  //
+  //   "random"  -- Rays from random points in the scene's bounding-box,
+  //                in random directions, which are very incoherent.
+  //
+  //   "shadow"  -- Rays from the first intersection of camera rays to
+  //                random points in the scene's bounding-box, which
+  //                are traced using an "any hit" test.
+  //
+  //   "bounce"  -- Rays from the first intersection of camera rays in
+  //                random directions away from the surface, like the
+  //                secondary rays of a path-tracer.
+  //
+  // Shadow and bounce rays are only generated for camera rays which
+  // hit something, so there may be fewer of them than requested if
+  // the scene doesn't cover the whole image.
+  //
+  unsigned generate (const std::string &kind, unsigned num_rays);
+
+  // Trace all the rays in the current ray set using NUM_THREADS
+  // threads, and return the elapsed wall-clock time in seconds.
+  // Closest-hit rays are traced in packets of up to PACKET_SIZE rays
+  // (which is limited to Space::MAX_PACKET_SIZE); if PACKET_SIZE is 1,
+  // rays are traced individually.  STATS is updated with the search
+  // statistics.
+  //
+  double trace (unsigned num_threads, unsigned packet_size,
+		RenderStats &stats);
+
+  // Return the number of rays in the current ray set.
+  //
+  unsigned num_rays () const { return rays.size (); }
+
+  // Return the number of rays which hit some surface during the most
+  // recent call to RaycastBench::trace.
+  //
+  unsigned long long last_num_hits () const { return num_hits; }
+
+private:
+
+  // Job which traces part of the ray set, in a single thread.
+  //
+  struct TraceJob;
+
+  // Number of consecutive rays handed out to a thread at once.
+  // Threads take chunks in turn, so that each thread traces rays from
+  // all parts of the ray set, but nearby rays are traced together.
+  //
+  static const unsigned CHUNK_SIZE = 1024;
+
+  // Append NUM_RAYS camera rays to RAYS, starting with pixel
+  // FIRST_PIXEL, and continuing in scanline order.
+  //
+  void gen_camera_rays (unsigned num_rays, unsigned first_pixel,
+			std::vector<Ray> &rays);
+
+  const GlobalRenderState &global_state;
+
+  const Camera &camera;
+  unsigned width, height;
+
+  // The current ray set.
+  //
+  std::vector<Ray> rays;
+
+  // If true, the current ray set uses "any hit" tests, otherwise it
+  // searches for the closest hit.
+  //
+  bool any_hit;
+
+  // Number of rays which hit something in the most recent trace.
+  //
+  unsigned long long num_hits;
+
+  // Random number generator used for generating rays.
+  //
+  Random random;
+};
+
+
+}
+
+#endif // SNOGRAY_RAYCAST_BENCH_H
@@ -1,6 +1,6 @@
 // recursive-integ.cc -- Superclass for simple recursive surface integrators
 //
-//  Copyright (C) 2010, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2010, 2013, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -15,6 +15,7 @@
 #include "material/material.h"
 #include "scene.h"
 #include "global-render-state.h"
+#include "volume-integ.h"
 
 #include "recursive-integ.h"
 
@@ -176,12 +177,25 @@ Tint
 RecursiveInteg::Li (const Ray &ray, const Media &media,
 		 const SampleSet::Sample &sample)
 {
-  const Scene &scene = context.scene;
-
   Ray isec_ray = ray;
 
   const Surface::Renderable::IsecInfo *isec_info
-    = scene.intersect (isec_ray, context);
+    = context.scene.intersect (isec_ray, context);
+
+  return Li (isec_ray, isec_info, media, sample);
+}
+
+// A variant of RecursiveInteg::Li for when the closest intersection
+// along the ray has already been found.  ISEC_RAY is the ray, shortened
+// to end at the intersection, and ISEC_INFO describes the
+// intersection, or is zero if the ray didn't hit anything.
+//
+Tint
+RecursiveInteg::Li (const Ray &isec_ray,
+		    const Surface::Renderable::IsecInfo *isec_info,
+		    const Media &media, const SampleSet::Sample &sample)
+{
+  const Scene &scene = context.scene;
 
   Color radiance;
   float alpha;
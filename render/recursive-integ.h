@@ -1,6 +1,6 @@
 // recursive-integ.h -- Superclass for simple recursive surface integrators
 //
-//  Copyright (C) 2010, 2011, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2010, 2011, 2013, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -40,6 +40,15 @@ public:
   virtual Tint Li (const Ray &ray, const Media &media,
 		   const SampleSet::Sample &sample);
 
+  // A variant of RecursiveInteg::Li for when the closest intersection
+  // along the ray has already been found.  ISEC_RAY is the ray,
+  // shortened to end at the intersection, and ISEC_INFO describes the
+  // intersection, or is zero if the ray didn't hit anything.
+  //
+  virtual Tint Li (const Ray &isec_ray,
+		   const Surface::Renderable::IsecInfo *isec_info,
+		   const Media &media, const SampleSet::Sample &sample);
+
 protected:
 
   // Integrator state for rendering a group of related samples.
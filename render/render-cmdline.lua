@@ -1,6 +1,6 @@
 -- render-cmdline.lua -- Command-line handling for renderer params
 --
---  Copyright (C) 2012, 2013  Miles Bader <miles@gnu.org>
+--  Copyright (C) 2012, 2013, 2014  Miles Bader <miles@gnu.org>
 --
 -- This source code is free software; you can redistribute it and/or
 -- modify it under the terms of the GNU General Public License as
@@ -30,14 +30,49 @@ function render_cmdline.option_parser (params)
         doc = [[Use surface-integrator INTEG (default "direct"):\+
 	        \|"direct"  -- direct-lighting
 	        \|"path"    -- path-tracing
-	        \|"photon"  -- photon-mapping]] },
+	        \|"photon"  -- photon-mapping
+	        \|"sppm"    -- progressive photon-mapping (use with
+	                     "-R passes=N")]] },
+      { "--render-order=ORDER",
+	function (val)
+	   clp.store_with_sub_params (val, "render_order", params, "type")
+	end,
+        doc = [[Render pixels in ORDER (default "scanline"), which
+	        may be followed by "/tile-size=SIZE" (default 16):\+
+	        \|"scanline" -- one row at a time
+	        \|"tiled"    -- scanline order within square tiles
+	        \|"morton"   -- Z-curve order within square tiles
+	        \|"hilbert"  -- Hilbert-curve order within square tiles]] },
+      { "--sample-gen=GEN", { params, "sample_gen" },
+        doc = [[Use sample generator GEN (default "grid"):\+
+	        \|"grid"   -- jittered grid
+	        \|"sobol"  -- scrambled Sobol sequence
+	        \|"halton" -- randomized Halton sequence]] },
       { "-A/--background-alpha=ALPHA", { params, "background_alpha", 'float' },
         doc = [[Use ALPHA as the opacity of the background]] },
       { "-R/--render-options=OPTIONS",
 	function (options) clp.parse_params (options, params) end,
         doc = [[Set output-image options; OPTS has the format
 	        OPT1=VAL1[,...]; current options include:\+
-		\|"min-trace"  -- minimum trace ray length]] }
+		\|"min-trace"  -- \>minimum trace ray length
+		\|"passes"     -- render progressively, in up to this many
+		                passes of the normal number of samples
+		\|"adaptive-threshold" -- stop progressively sampling
+		                pixels whose relative error is below this
+		\|"snapshot-interval" -- seconds between snapshots of a
+		                progressive render
+		\|"snapshot-file" -- file to write snapshots to
+		\|"eager-models" -- build all instanced models'
+		                search accelerators in parallel before
+		                rendering, instead of on first use
+		\|"accel-cache" -- file in which to cache the scene's
+		                search accelerator between runs
+		\|"sample-tables" -- precompute this many tables of
+		                samples, and randomize them for each
+		                pixel, instead of generating new samples
+		\|"light-tree-threshold" -- with at least this many
+		                lights, sample a few lights chosen using
+		                a light hierarchy, instead of all lights]] }
    }
 end
 
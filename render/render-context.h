@@ -1,6 +1,6 @@
 // render-context.h --  "semi-global" information used during rendering
 //
-//  Copyright (C) 2005-2011, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2005-2011, 2013, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -16,11 +16,8 @@
 #include "util/unique-ptr.h"
 #include "util/random.h"
 #include "util/mempool.h"
-#include "util/pool.h"
 #include "material/medium.h"
 #include "sample-set.h"
-#include "surface-integ.h"
-#include "volume-integ.h"
 #include "render-stats.h"
 #include "render-params.h"
 
@@ -28,7 +25,8 @@
 namespace snogray {
 
 class GlobalRenderState;
-class IsecCache;
+class SurfaceInteg;
+class VolumeInteg;
 
 
 // Context in which tracing occurs.  This structure holds per-thread global
@@ -61,17 +59,6 @@ public:
   //
   SampleSet samples;
 
-  // Pool of intersection caches.
-  //
-  // The reason that we keep these in a pool is that we need a separate
-  // cache for each active search (and there be multiple active at once,
-  // e.g. in the case of instancing), and constructing a a cache object
-  // can be fairly expensive, so we don't want to allocate them on the
-  // stack each tim.  Thus, we keep a pool of already-constructed cache
-  // objects ready for use.
-  //
-  Pool<IsecCache> isec_cache_pool;
-
   RenderStats stats;
 
   // Random number generator.  This is a callable object.
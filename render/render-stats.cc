@@ -1,6 +1,6 @@
 // render-stats.cc -- Print post-rendering statistics
 //
-//  Copyright (C) 2005-2007, 2010, 2012, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2005-2007, 2010, 2012-2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -52,14 +52,12 @@ RenderStats::print (std::ostream &os)
   {
     long long surf_tests = intersect.surface_intersects_tests;
     long long neg_cache_hits = intersect.neg_cache_hits;
-    long long neg_cache_colls = intersect.neg_cache_collisions;
     long long tot_tries = surf_tests + neg_cache_hits;
     long long pos_tries = intersect.surface_intersects_hits;
 
     os << "     surface tests:   " << std::setw (16) << commify (tot_tries)
        << " (success = " << std::setw(2) << percent (pos_tries, tot_tries)
        << "%, cached = " << std::setw(2) << percent (neg_cache_hits, tot_tries)
-       << "%; coll = "<< std::setw(2) << percent (neg_cache_colls, tot_tries)
        << "%)"
        << std::endl;
   }
@@ -73,13 +71,20 @@ RenderStats::print (std::ostream &os)
       os << "  shadow:" << std::endl;
       os << "     rays:            "
 	 << std::setw (16) << commify (sst) << std::endl;
+
+      long long och = occluder_cache_hits;
+      if (och != 0)
+	os << "     occluder cache:  "
+	   << std::setw (16) << commify (och)
+	   << " (hits = " << std::setw(2) << percent (och, sst) << "%)"
+	   << std::endl;
+
       os << "     tree node tests: "
 	 << std::setw (16) << commify (tnt) << std::endl;
 
       {
 	long long surf_tests  = shadow.surface_intersects_tests;
 	long long neg_cache_hits = shadow.neg_cache_hits;
-	long long neg_cache_colls = shadow.neg_cache_collisions;
 	long long tot_tries = surf_tests + neg_cache_hits;
 	long long pos_tries = shadow.surface_intersects_hits;
 
@@ -87,8 +92,6 @@ RenderStats::print (std::ostream &os)
 	   << " (success = " << std::setw(2) << percent (pos_tries, tot_tries)
 	   << "%, cached = "
 	   << std::setw(2) << percent (neg_cache_hits, tot_tries)
-	   << "%; coll = "
-	   << std::setw(2) << percent (neg_cache_colls, tot_tries)
 	   << "%)"
 	   << std::endl;
       }
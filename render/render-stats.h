@@ -1,6 +1,6 @@
 // render-stats.h -- Print post-rendering statistics
 //
-//  Copyright (C) 2005, 2006, 2007, 2010, 2011  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2005, 2006, 2007, 2010, 2011, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -24,15 +24,15 @@ class Scene;
 struct RenderStats
 {
   RenderStats ()
-    : scene_intersect_calls (0), scene_shadow_tests (0), illum_calls (0)
+    : scene_intersect_calls (0), scene_shadow_tests (0), illum_calls (0),
+      occluder_cache_hits (0)
   { }
 
   struct IsecStats
   {
     IsecStats ()
       : surface_intersects_tests (0), surface_intersects_hits (0),
-	neg_cache_hits (0), neg_cache_collisions (0),
-	space_node_intersect_calls (0)
+	neg_cache_hits (0), space_node_intersect_calls (0)
     { }
 
     void operator+= (const IsecStats &is)
@@ -40,14 +40,12 @@ struct RenderStats
       surface_intersects_tests += is.surface_intersects_tests;
       surface_intersects_hits += is.surface_intersects_hits;
       neg_cache_hits += is.neg_cache_hits;
-      neg_cache_collisions += is.neg_cache_collisions;
       space_node_intersect_calls += is.space_node_intersect_calls;
     }
 
     unsigned long long surface_intersects_tests;
     unsigned long long surface_intersects_hits;
     unsigned long long neg_cache_hits;
-    unsigned long long neg_cache_collisions;
     unsigned long long space_node_intersect_calls;
   };
 
@@ -55,6 +53,7 @@ struct RenderStats
   {
     scene_intersect_calls += is.scene_intersect_calls;
     scene_shadow_tests += is.scene_shadow_tests;
+    occluder_cache_hits += is.occluder_cache_hits;
     illum_calls += is.illum_calls;
 
     intersect += is.intersect;
@@ -64,6 +63,12 @@ struct RenderStats
   unsigned long long scene_intersect_calls;
   unsigned long long scene_shadow_tests;
   unsigned long long illum_calls;
+
+  // Number of shadow-rays found to be occluded by the cached "last
+  // occluder" surface, without searching the scene (see
+  // Scene::occludes).
+  //
+  unsigned long long occluder_cache_hits;
   
   IsecStats intersect, shadow;
 
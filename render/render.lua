@@ -1,6 +1,6 @@
 -- render.lua -- Rendering-related functions
 --
---  Copyright (C) 2012  Miles Bader <miles@gnu.org>
+--  Copyright (C) 2012, 2014  Miles Bader <miles@gnu.org>
 --
 -- This source code is free software; you can redistribute it and/or
 -- modify it under the terms of the GNU General Public License as
@@ -22,6 +22,7 @@ render.context = raw.RenderContext
 render.manager = raw.RenderMgr
 render.pattern = raw.RenderPattern
 render.stats = raw.RenderStats
+render.raycast_bench = raw.RaycastBench
 
 
 -- return module
@@ -1,6 +1,6 @@
 // sample-gen.h -- Sample generator
 //
-//  Copyright (C) 2010, 2011, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2010, 2011, 2013, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -26,6 +26,18 @@ class Random;
 // A sample generator, which can generate a specified number of samples to
 // cover a certain number of dimensions "evenly".
 //
+// Samples are generated for one SampleSet channel at a time.  Each
+// channel is allocated its own "dimensions" by the SampleSet, one
+// dimension for float channels and two for UV channels, numbered
+// consecutively in the order channels are added.  Generators which
+// generate points of a multi-dimensional sequence (e.g., Sobol) use
+// the channel's dimensions of the sequence, so that samples with the
+// same index in different channels are well-distributed with respect
+// to each other, not just within each channel.  Generators which
+// generate each channel independently (e.g., Grid) ignore the
+// dimensions, but must then randomly shuffle each channel's samples,
+// so that different channels are not correlated.
+//
 // This class is defined in generically using a templates, but only certain
 // types of samples are supported:  float, UV
 //
@@ -33,13 +45,15 @@ class SampleGen
 {
 public:
 
+  virtual ~SampleGen () { }
+
   // Using RANDOM as a source of randomness, add NUM samples to TABLE
-  // through TABLE+NUM.
+  // through TABLE+NUM, for a channel whose first dimension is DIM.
   //
   template<typename T>
   void gen_samples (Random &random,
 		    const typename std::vector<T>::iterator &table,
-		    unsigned num)
+		    unsigned num, unsigned dim)
     const;
 
   // Return the number of samples we'd like to generate instead of NUM.
@@ -51,15 +65,15 @@ protected:
 
   // The actual sample generating methods, defined by subclasses.
   // Using RANDOM as a source of randomness, add NUM samples to TABLE
-  // through TABLE+NUM.
+  // through TABLE+NUM, for a channel whose first dimension is DIM.
   //
   virtual void gen_float_samples (Random &random,
 				  const std::vector<float>::iterator &table,
-				  unsigned num)
+				  unsigned num, unsigned dim)
     const = 0;
   virtual void gen_uv_samples (Random &random,
 			       const std::vector<UV>::iterator &table,
-			       unsigned num)
+			       unsigned num, unsigned dim)
     const = 0;
 
   // Sample-count adjusting methods defined by subclasses.  By default,
@@ -84,20 +98,20 @@ template<>
 inline void
 SampleGen::gen_samples<float> (Random &random,
 			       const std::vector<float>::iterator &table,
-			       unsigned num)
+			       unsigned num, unsigned dim)
   const
 {
-  gen_float_samples (random, table, num);
+  gen_float_samples (random, table, num, dim);
 }
 
 template<>
 inline void
 SampleGen::gen_samples<UV> (Random &random,
 			    const std::vector<UV>::iterator &table,
-			    unsigned num)
+			    unsigned num, unsigned dim)
   const
 {
-  gen_uv_samples (random, table, num);
+  gen_uv_samples (random, table, num, dim);
 }
 
 
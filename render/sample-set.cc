@@ -1,6 +1,6 @@
 // sample-set.cc -- Set of samples
 //
-//  Copyright (C) 2010, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2010, 2013, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -29,6 +29,8 @@ SampleSet::clear ()
 
   float_channels.clear ();
   uv_channels.clear ();
+
+  num_dims = 0;
 }
 
 // Compute a completely new set of sample values in all channels.
@@ -39,20 +41,14 @@ SampleSet::generate ()
   for (std::vector<Channel<float> >::iterator i = float_channels.begin();
        i != float_channels.end (); ++i)
     if (i->num_total_samples != 0)
-      {
-	std::vector<float>::iterator base = sample<float> (i->base_offset);
-	gen.gen_samples<float> (random, base, i->num_total_samples);
-	random_shuffle (base, base + i->num_total_samples, random);
-      }
+      gen.gen_samples<float> (random, sample<float> (i->base_offset),
+			      i->num_total_samples, i->dim);
 
   for (std::vector<Channel<UV> >::iterator i = uv_channels.begin();
        i != uv_channels.end (); ++i)
     if (i->num_total_samples != 0)
-      {
-	std::vector<UV>::iterator base = sample<UV> (i->base_offset);
-	gen.gen_samples<UV> (random, base, i->num_total_samples);
-	random_shuffle (base, base + i->num_total_samples, random);
-      }
+      gen.gen_samples<UV> (random, sample<UV> (i->base_offset),
+			   i->num_total_samples, i->dim);
 }
 
 
@@ -1,6 +1,6 @@
 // sample-set.h -- Set of samples
 //
-//  Copyright (C) 2010, 2011, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2010, 2011, 2013, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -28,8 +28,9 @@ namespace snogray {
 
 // A set of samples.  There are zero or more channels, each holding the
 // same number of samples.  Each channel has samples generated by the same
-// generator, but the channels are explicitly de-correlated from each other
-// by randomly shuffling the samples in each channel after generation.
+// generator, using its own "dimensions" (see SampleGen), so that the
+// generator can keep the channels from being correlated with each
+// other.
 //
 class SampleSet
 {
@@ -62,7 +63,7 @@ public:
   // RANDOM as a source of randomness.
   //
   SampleSet (unsigned _num_samples, const SampleGen &_gen, Random &_random)
-    : num_samples (_num_samples), gen (_gen), random (_random)
+    : num_samples (_num_samples), num_dims (0), gen (_gen), random (_random)
   {}
 
 
@@ -115,6 +116,17 @@ public:
   //
   void generate ();
 
+  // Copy all sample values from FROM, which should have the same
+  // channels as this sample-set (normally this set should be a copy
+  // of FROM).  This allows a generated set of samples to be saved for
+  // later use, while FROM is used to generate more samples.
+  //
+  void copy_samples (const SampleSet &from)
+  {
+    float_samples = from.float_samples;
+    uv_samples = from.uv_samples;
+  }
+
   // Number of top-level samples.
   //
   unsigned num_samples;
@@ -142,12 +154,21 @@ private:
   template<typename T>
   Channel<T> _add_channel (const Channel<T> &chan);
 
+  // Return the number of sample dimensions used by a sample of type T.
+  //
+  template<typename T>
+  static unsigned sample_dims ();
+
   std::vector<float> float_samples;
   std::vector<UV> uv_samples;
 
   std::vector<Channel<float> > float_channels;
   std::vector<Channel<UV> > uv_channels;
 
+  // Number of sample dimensions allocated to channels so far.
+  //
+  unsigned num_dims;
+
 
 public:
 
@@ -184,7 +205,7 @@ public:
   //
   Channel (const Channel &from)
     : size (from.size), base_offset (from.base_offset),
-      num_total_samples (from.num_total_samples)
+      num_total_samples (from.num_total_samples), dim (from.dim)
   {}
 
   // Number of sub-samples this channel contains.  There are this many
@@ -200,9 +221,10 @@ private:
   // Normal constructor.  This is private, as BASE_OFFSET is an
   // implementation detail.
   //
-  Channel (unsigned _base_offset, unsigned _size, unsigned _num_total_samples)
+  Channel (unsigned _base_offset, unsigned _size, unsigned _num_total_samples,
+	   unsigned _dim)
     : size (_size), base_offset (_base_offset),
-      num_total_samples (_num_total_samples)
+      num_total_samples (_num_total_samples), dim (_dim)
   {}
 
   // Offset of our first sample in the appropriate sample vector of
@@ -217,6 +239,12 @@ private:
   // are in random order.
   //
   unsigned num_total_samples;
+
+  // The first sample dimension allocated to this channel (see
+  // SampleGen).  Float channels use one dimension, and UV channels
+  // two.
+  //
+  unsigned dim;
 };
 
 
@@ -348,8 +376,13 @@ SampleSet::add_channel (unsigned num_sub_samples)
   //
   unsigned base_sample_offset = add_sample_space<T> (num_total_samples);
 
+  // Allocate sample dimensions for the new channel.
+  //
+  unsigned dim = num_dims;
+  num_dims += sample_dims<T> ();
+
   return _add_channel<T> (Channel<T> (base_sample_offset, num_sub_samples,
-				      num_total_samples));
+				      num_total_samples, dim));
 }
 
 // Allocate and return a vector of channels in this set, each
@@ -436,6 +469,24 @@ SampleSet::_add_channel (const Channel<UV> &chan)
   return chan;
 }
 
+//
+// Specializations of SampleSet::sample_dims for supported sample types.
+//
+
+template<>
+inline unsigned
+SampleSet::sample_dims<float> ()
+{
+  return 1;
+}
+
+template<>
+inline unsigned
+SampleSet::sample_dims<UV> ()
+{
+  return 2;
+}
+
 
 }
 
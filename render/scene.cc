@@ -1,6 +1,6 @@
 // scene.cc -- Scene interface during rendering
 //
-//  Copyright (C) 2005-2010, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2005-2010, 2013, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -15,6 +15,7 @@
 #include "space/space.h"
 #include "space/space-builder.h"
 #include "render-context.h"
+#include "light-tree.h"
 
 #include "scene.h"
 
@@ -27,7 +28,9 @@ Scene::Scene (const Surface &_root_surface,
 	      const SpaceBuilderFactory &space_builder_factory)
   : horizon (_root_surface.bbox ().diameter ()),
     root_surface (_root_surface),
-    space (space_builder_factory.make_space (root_surface))
+    space (space_builder_factory.make_space (root_surface)),
+    partially_occluding_surfaces (
+      root_surface.stats ().num_partially_occluding_surfaces != 0)
 {
   // Add light-samplers for all lights.
   //
@@ -41,6 +44,8 @@ Scene::Scene (const Surface &_root_surface,
        si != light_samplers.end(); ++si)
     if ((*si)->is_environ_light ())
       environ_light_samplers.push_back (*si);
+
+  light_tree.reset (new LightTree (light_samplers));
 }
 
 Scene::~Scene ()
@@ -55,6 +60,107 @@ Scene::~Scene ()
 
 
 
+// Scene::occludes
+
+// Packet variant of Scene::occludes:  For each of the NUM_RAYS rays in
+// RAYS, set the corresponding entry in OCCLUDED to true if some
+// surface in the scene completely occludes it; otherwise set it to
+// false, and multiply the corresponding entry of TOTAL_TRANSMITTANCES
+// by the transmittance of any surfaces which partially occlude it,
+// evaluated in medium MEDIUM.  NUM_RAYS must not be greater than
+// Space::MAX_PACKET_SIZE.
+//
+// If LAST_OCCLUDER is non-zero, it points to a cache of the surface
+// which last occluded a similar ray (or zero), which is tested before
+// searching the scene, and is updated whenever a search finds an
+// occluding surface.  The cache is only used if no surface in the
+// scene can partially occlude a ray.
+//
+void
+Scene::occludes (unsigned num_rays, const Ray *rays, const Medium &medium,
+		 Color *total_transmittances, bool *occluded,
+		 const Surface::Renderable **last_occluder,
+		 RenderContext &context)
+  const
+{
+  context.stats.scene_shadow_tests += num_rays;
+
+  if (partially_occluding_surfaces)
+    {
+      space->occludes (num_rays, rays, medium, total_transmittances,
+		       occluded, context);
+      return;
+    }
+
+  // No surface can partially occlude a ray, so a ray is occluded
+  // exactly when it intersects some surface, and we can just find any
+  // intersecting surface, without looking at materials at all.
+
+  // The occluding surfaces found by searching, and the number of rays
+  // we searched for.
+  //
+  const Surface::Renderable *occluders[Space::MAX_PACKET_SIZE];
+  unsigned num_searched;
+
+  const Surface::Renderable *cached_occluder
+    = last_occluder ? *last_occluder : 0;
+
+  if (! cached_occluder)
+    {
+      space->intersects (num_rays, rays, occluders, context);
+
+      for (unsigned i = 0; i < num_rays; i++)
+	occluded[i] = (occluders[i] != 0);
+
+      num_searched = num_rays;
+    }
+  else
+    {
+      // First test the cached occluder against each ray, and then
+      // search the scene for any rays it doesn't occlude.
+
+      // Rays which still need to be searched for, and their indices in
+      // RAYS.  These are allocated in CONTEXT's mempool, as Ray has no
+      // default constructor.
+      //
+      Ray *search_rays
+	= static_cast<Ray *> (operator new (num_rays * sizeof (Ray),
+					    context));
+      unsigned search_ray_indices[Space::MAX_PACKET_SIZE];
+      unsigned num_search_rays = 0;
+
+      for (unsigned i = 0; i < num_rays; i++)
+	if (cached_occluder->intersects (rays[i], context))
+	  {
+	    occluded[i] = true;
+	    context.stats.occluder_cache_hits++;
+	  }
+	else
+	  {
+	    new (&search_rays[num_search_rays]) Ray (rays[i]);
+	    search_ray_indices[num_search_rays++] = i;
+	  }
+
+      if (num_search_rays != 0)
+	space->intersects (num_search_rays, search_rays, occluders, context);
+
+      for (unsigned i = 0; i < num_search_rays; i++)
+	occluded[search_ray_indices[i]] = (occluders[i] != 0);
+
+      num_searched = num_search_rays;
+    }
+
+  // Remember the last occluder found by searching, so that it will be
+  // tested first next time.
+  //
+  if (last_occluder)
+    for (unsigned i = 0; i < num_searched; i++)
+      if (occluders[i])
+	*last_occluder = occluders[i];
+}
+
+
+
 // Scene background rendering
 
 // Returns the background color in the given direction.
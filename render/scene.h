@@ -1,6 +1,6 @@
 // scene.h -- Scene interface during rendering
 //
-//  Copyright (C) 2005-2011, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2005-2011, 2013, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -15,6 +15,7 @@
 
 #include <vector>
 
+#include "util/unique-ptr.h"
 #include "geometry/ray.h"
 #include "surface/surface.h"
 #include "light/light.h"
@@ -27,6 +28,7 @@ namespace snogray {
 
 
 class SpaceBuilderFactory;
+class LightTree;
 
 
 // A Scene is the interface to the scene used during rendering.
@@ -57,6 +59,21 @@ public:
     return space->intersect (ray, context);
   }
 
+  // Packet variant of Scene::intersect:  For each of the NUM_RAYS rays
+  // in RAYS, set the corresponding entry of ISEC_INFOS to the closest
+  // surface in this scene which intersects it, or zero if there is
+  // none, shortening the ray to reflect the point of intersection.
+  // NUM_RAYS must not be greater than Space::MAX_PACKET_SIZE.
+  //
+  void intersect (unsigned num_rays, Ray *rays,
+		  const Surface::Renderable::IsecInfo **isec_infos,
+		  RenderContext &context)
+    const
+  {
+    context.stats.scene_intersect_calls += num_rays;
+    space->intersect (num_rays, rays, isec_infos, context);
+  }
+
   // Return true if any surface blocks RAY.
   //
   bool intersects (const Ray &ray, RenderContext &context) const
@@ -77,15 +94,44 @@ public:
   // well as transmitting it), nor does it deal with anything except
   // surfaces.
   //
+  // If no surface in the scene can partially occlude a ray, this just
+  // uses a simpler "any hit" test, Space::intersects.
+  //
   bool occludes (const Ray &ray, const Medium &medium,
 		 Color &total_transmittance,
 		 RenderContext &context)
     const
   {
     context.stats.scene_shadow_tests++;
-    return space->occludes (ray, medium, total_transmittance, context);
+
+    if (partially_occluding_surfaces)
+      return space->occludes (ray, medium, total_transmittance, context);
+    else
+      return space->intersects (ray, context);
   }
 
+  // Packet variant of Scene::occludes:  For each of the NUM_RAYS rays
+  // in RAYS, set the corresponding entry in OCCLUDED to true if some
+  // surface in the scene completely occludes it; otherwise set it to
+  // false, and multiply the corresponding entry of
+  // TOTAL_TRANSMITTANCES by the transmittance of any surfaces which
+  // partially occlude it, evaluated in medium MEDIUM.  NUM_RAYS must
+  // not be greater than Space::MAX_PACKET_SIZE.
+  //
+  // If LAST_OCCLUDER is non-zero, it points to a cache of the surface
+  // which last occluded a similar ray (or zero), which is tested
+  // before searching the scene, and is updated whenever a search finds
+  // an occluding surface.  Shadow-rays towards the same light from
+  // nearby points are often blocked by the same surface, so the
+  // caller should keep a separate cache for each light.  The cache is
+  // only used if no surface in the scene can partially occlude a ray.
+  //
+  void occludes (unsigned num_rays, const Ray *rays, const Medium &medium,
+		 Color *total_transmittances, bool *occluded,
+		 const Surface::Renderable **last_occluder,
+		 RenderContext &context)
+    const;
+
 
   unsigned num_light_samplers () const { return light_samplers.size (); }
 
@@ -93,6 +139,19 @@ public:
   //
   BBox bbox () const { return root_surface.bbox (); }
 
+  // Return statistics about the surfaces in the scene.
+  //
+  Surface::Stats surface_stats () const { return root_surface.stats (); }
+
+  // Return the number of bytes of memory used by the scene's search
+  // accelerator, including those of any instanced models which have
+  // been built.
+  //
+  unsigned long space_memory_use () const
+  {
+    return space->memory_use () + surface_stats ().model_space_memory_use;
+  }
+
   // Light-samplers for all lights in the scene.
   //
   std::vector<const Light::Sampler *> light_samplers;
@@ -102,6 +161,11 @@ public:
   //
   std::vector<const Light::Sampler *> environ_light_samplers;
 
+  // A hierarchy of the lights in LIGHT_SAMPLERS, used to choose which
+  // lights to sample when there are too many to sample them all.
+  //
+  UniquePtr<const LightTree> light_tree;
+
   // A distance which is further than the furthest surface from any point.
   //
   dist_t horizon;
@@ -116,6 +180,13 @@ private:
   // Acceleration structure for doing ray-surface intersection testing.
   //
   UniquePtr<const Space> space;
+
+  // True if some surface in the scene may partially occlude rays
+  // (see Material::PARTIALLY_OCCLUDING).  Otherwise, a ray is occluded
+  // exactly when it intersects any surface, and shadow-rays can use a
+  // simpler and faster test.
+  //
+  bool partially_occluding_surfaces;
 };
 
 
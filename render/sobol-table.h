@@ -0,0 +1,39 @@
+// sobol-table.h -- Initialization data for Sobol sequences
+//
+//  Copyright (C) 2014  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#ifndef SNOGRAY_SOBOL_TABLE_H
+#define SNOGRAY_SOBOL_TABLE_H
+
+
+namespace snogray {
+
+
+// Number of Sobol dimensions for which we have data.
+//
+static const unsigned SOBOL_TABLE_DIMS = 1024;
+
+// Primitive polynomials over GF(2), one for each Sobol dimension after
+// the first.  Bit I of each entry is the coefficient of z^I, so the
+// degree of a polynomial is the index of its highest set bit.
+//
+extern const unsigned short sobol_table_polys[SOBOL_TABLE_DIMS - 1];
+
+// Initial direction numbers m_1 ... m_S for each polynomial in
+// SOBOL_TABLE_POLYS, where S is the polynomial's degree, stored
+// consecutively.
+//
+extern const unsigned short sobol_table_init[];
+
+
+}
+
+#endif // SNOGRAY_SOBOL_TABLE_H
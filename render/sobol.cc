@@ -0,0 +1,173 @@
+// sobol.cc -- sample generator using scrambled Sobol sequences
+//
+//  Copyright (C) 2014  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#include <algorithm>
+
+#include "util/random.h"
+
+#include "sobol-table.h"
+#include "sobol.h"
+
+
+using namespace snogray;
+
+
+Sobol::Sobol ()
+  : directions (SOBOL_TABLE_DIMS * 32)
+{
+  // Dimension 0 is the van der Corput sequence in base 2.
+  //
+  for (unsigned bit = 0; bit < 32; bit++)
+    directions[bit] = 1u << (31 - bit);
+
+  // Other dimensions are computed from the primitive polynomials and
+  // initial direction numbers in "sobol-table.cc".
+  //
+  const unsigned short *init = sobol_table_init;
+  for (unsigned dim = 1; dim < SOBOL_TABLE_DIMS; dim++)
+    {
+      unsigned *dir = &directions[dim * 32];
+      unsigned poly = sobol_table_polys[dim - 1];
+
+      // The degree of POLY.
+      //
+      unsigned deg = 0;
+      while (poly >> (deg + 1))
+	deg++;
+
+      // The coefficients of POLY, excluding the first and last (which
+      // are always 1).
+      //
+      unsigned coeffs = (poly >> 1) & ((1u << (deg - 1)) - 1);
+
+      for (unsigned k = 0; k < deg && k < 32; k++)
+	dir[k] = unsigned (*init++) << (31 - k);
+
+      for (unsigned k = deg; k < 32; k++)
+	{
+	  unsigned d = dir[k - deg] ^ (dir[k - deg] >> deg);
+
+	  for (unsigned j = 1; j < deg; j++)
+	    if ((coeffs >> (deg - 1 - j)) & 1)
+	      d ^= dir[k - j];
+
+	  dir[k] = d;
+	}
+    }
+}
+
+
+
+// Scrambling
+
+// Return X with the order of its bits reversed.
+//
+static inline unsigned
+reverse_bits (unsigned x)
+{
+  x = ((x >> 1) & 0x55555555) | ((x & 0x55555555) << 1);
+  x = ((x >> 2) & 0x33333333) | ((x & 0x33333333) << 2);
+  x = ((x >> 4) & 0x0F0F0F0F) | ((x & 0x0F0F0F0F) << 4);
+  x = ((x >> 8) & 0x00FF00FF) | ((x & 0x00FF00FF) << 8);
+  return (x >> 16) | (x << 16);
+}
+
+// Return X, a 32-bit binary fraction, randomly scrambled using a
+// nested uniform scramble determined by SEED.
+//
+// Flipping each bit of X according to a hash of all the more
+// significant bits is an Owen scramble.  This uses the hash of Laine
+// and Karras ("Stratified sampling for stochastic transparency", 2011),
+// which, when applied to the bit-reversed value, changes each bit
+// based only on the bits below it (the more significant bits of the
+// original).
+//
+static inline unsigned
+owen_scramble (unsigned x, unsigned seed)
+{
+  x = reverse_bits (x);
+
+  x += seed;
+  x ^= x * 0x6c50b47c;
+  x ^= x * 0xb82f1e52;
+  x ^= x * 0xc7afe638;
+  x ^= x * 0x8d22f6e6;
+
+  return reverse_bits (x);
+}
+
+// Return X, a 32-bit binary fraction, as a float in the range [0, 1).
+// Only the 24 most significant bits are used, so the result is never
+// rounded up to 1.
+//
+static inline float
+to_float (unsigned x)
+{
+  return float (x >> 8) * (1.f / 16777216);
+}
+
+
+
+// Sample generation
+
+// Using RANDOM as a source of randomness, add NUM samples to TABLE
+// through TABLE+NUM, for a channel whose first dimension is DIM.
+//
+void
+Sobol::gen_float_samples (Random &random,
+			  const std::vector<float>::iterator &table,
+			  unsigned num, unsigned dim)
+  const
+{
+  // If DIM is beyond our table, reuse an earlier dimension, and
+  // shuffle the result to decorrelate it from that dimension.
+  //
+  bool padded = (dim >= SOBOL_TABLE_DIMS);
+  if (padded)
+    dim %= SOBOL_TABLE_DIMS - 1;
+
+  unsigned seed = random.bits32 ();
+
+  for (unsigned i = 0; i < num; i++)
+    table[i] = to_float (owen_scramble (sample (i, dim), seed));
+
+  if (padded)
+    random_shuffle (table, table + num, random);
+}
+
+// Using RANDOM as a source of randomness, add NUM samples to TABLE
+// through TABLE+NUM, for a channel whose first dimension is DIM.
+//
+void
+Sobol::gen_uv_samples (Random &random,
+		       const std::vector<UV>::iterator &table,
+		       unsigned num, unsigned dim)
+  const
+{
+  // If DIM and DIM+1 are not both in our table, reuse earlier
+  // dimensions, and shuffle the result to decorrelate them from those
+  // dimensions.
+  //
+  bool padded = (dim + 1 >= SOBOL_TABLE_DIMS);
+  if (padded)
+    dim %= SOBOL_TABLE_DIMS - 1;
+
+  unsigned u_seed = random.bits32 ();
+  unsigned v_seed = random.bits32 ();
+
+  for (unsigned i = 0; i < num; i++)
+    table[i] = UV (to_float (owen_scramble (sample (i, dim), u_seed)),
+		   to_float (owen_scramble (sample (i, dim + 1), v_seed)));
+
+  if (padded)
+    random_shuffle (table, table + num, random);
+}
@@ -0,0 +1,85 @@
+// sobol.h -- sample generator using scrambled Sobol sequences
+//
+//  Copyright (C) 2014  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#ifndef SNOGRAY_SOBOL_H
+#define SNOGRAY_SOBOL_H
+
+#include "sample-gen.h"
+
+
+namespace snogray {
+
+
+// A quasi-Monte Carlo sample generator using Sobol sequences.
+//
+// Each channel uses its own dimensions of the Sobol sequence, so the
+// samples with the same index in all channels together form a single
+// point of a multi-dimensional Sobol sequence, and are well-distributed
+// with respect to each other.  Each time samples are generated, every
+// dimension is randomized using a new random nested-uniform ("Owen")
+// scramble, which preserves the good distribution of the sequence, but
+// makes the samples for every pixel independent.
+//
+// We only have data for the first SOBOL_TABLE_DIMS dimensions (see
+// "sobol-table.h"); channels beyond that (e.g., the per-light channels
+// in scenes with very many lights) reuse earlier dimensions, with
+// their samples randomly shuffled to decorrelate them from other
+// channels, much as with the Grid generator.
+//
+class Sobol : public SampleGen
+{
+public:
+
+  Sobol ();
+
+protected:
+
+  // The actual sample generating methods.  Using RANDOM as a source of
+  // randomness, add NUM samples to TABLE through TABLE+NUM, for a
+  // channel whose first dimension is DIM.
+  //
+  virtual void gen_float_samples (Random &random,
+				  const std::vector<float>::iterator &table,
+				  unsigned num, unsigned dim)
+    const;
+  virtual void gen_uv_samples (Random &random,
+			       const std::vector<UV>::iterator &table,
+			       unsigned num, unsigned dim)
+    const;
+
+private:
+
+  // Return element INDEX of dimension DIM of the (unscrambled) Sobol
+  // sequence, as a 32-bit binary fraction.
+  //
+  unsigned sample (unsigned index, unsigned dim) const
+  {
+    const unsigned *dir = &directions[dim * 32];
+    unsigned val = 0;
+
+    for (; index != 0; index >>= 1, dir++)
+      if (index & 1)
+	val ^= *dir;
+
+    return val;
+  }
+
+  // Direction numbers, 32 for each dimension, as 32-bit binary
+  // fractions.
+  //
+  std::vector<unsigned> directions;
+};
+
+
+}
+
+#endif // SNOGRAY_SOBOL_H
@@ -0,0 +1,178 @@
+// sppm-integ.cc -- Progressive photon-mapping surface integrator
+//
+//  Copyright (C) 2014  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#include <iostream>
+
+#include "util/snogmath.h"
+#include "material/bsdf.h"
+#include "photon/photon-shooter.h"
+#include "global-render-state.h"
+
+#include "sppm-integ.h"
+
+
+using namespace snogray;
+
+
+
+// SppmInteg::Shooter class
+
+class SppmInteg::Shooter : public PhotonShooter
+{
+public:
+
+  Shooter (unsigned num_photons)
+    : PhotonShooter ("sppm-integ"), indirect (num_photons, "indirect", *this)
+  {
+  }
+
+  // Return the photon-set in which the photon PHOTON should be
+  // deposited, or zero if it should be ignored.  ISEC is the
+  // intersection where the photon is being stored, and BSDF_HISTORY
+  // is the bitwise-or of all BSDF past interactions since this photon
+  // was emitted by the light (it will be zero for the first
+  // intersection).
+  //
+  virtual const PhotonSet *choose_photon_set (const Photon &,
+					      const Intersect &isec,
+					      unsigned bsdf_history)
+    const
+  {
+    // Direct lighting is handled by DirectIllum, and we don't deposit
+    // photons on purely specular surfaces.
+    //
+    if (bsdf_history == 0
+	|| ! isec.bsdf->supports (Bsdf::ALL & ~Bsdf::SPECULAR))
+      return 0;
+
+    return &indirect;
+  }
+
+  PhotonSet indirect;
+};
+
+
+
+// Constructors etc
+
+SppmInteg::GlobalState::GlobalState (const GlobalRenderState &rstate,
+				     const ValTable &params)
+  : SurfaceInteg::GlobalState (rstate),
+    shooter (new Shooter (params.get_uint ("photons", 200000))),
+    photon_scale (0),
+    radius_alpha (params.get_float ("radius_alpha", 2.f / 3.f)),
+    // Every photon within the search radius is used, so the radius
+    // alone, which shrinks with each pass, determines the estimate.
+    //
+    photon_eval (
+      PhotonMap::ALL_PHOTONS,
+      params.get_float ("photon_radius", 0.1)),
+    direct_illum (
+      params.get_uint ("direct_samples,dir_samples,dir_samps",
+		       rstate.params.get_uint ("direct_samples", 16)),
+      rstate.params)
+{
+  initial_radius_sq = photon_eval.search_radius_sq;
+
+  std::cout << "* sppm-integ: "
+	    << shooter->indirect.target_count << " photons per pass"
+	    << ", initial search radius: " << sqrt (initial_radius_sq)
+	    << ", " << direct_illum.num_samples << " direct sample"
+	    << (direct_illum.num_samples == 1 ? "" : "s")
+	    << std::endl;
+
+  // Photons for the first pass.
+  //
+  generate_photons ();
+}
+
+// The destructor is defined here, where the Shooter class is complete.
+//
+SppmInteg::GlobalState::~GlobalState ()
+{
+}
+
+// Integrator state for rendering a group of related samples.
+//
+SppmInteg::SppmInteg (RenderContext &context, GlobalState &global_state)
+  : RecursiveInteg (context), global (global_state),
+    photon_eval (context, global_state.photon_eval),
+    direct_illum (context, global_state.direct_illum)
+{
+}
+
+// Return a new integrator, allocated in context.
+//
+SurfaceInteg *
+SppmInteg::GlobalState::make_integrator (RenderContext &context)
+{
+  return new SppmInteg (context, *this);
+}
+
+
+// SppmInteg::GlobalState::start_pass
+
+// Prepare for progressive-rendering pass PASS, by reducing the photon
+// search radius, and shooting a new set of photons.
+//
+void
+SppmInteg::GlobalState::start_pass (unsigned pass)
+{
+  // Calculate the radius for pass PASS, using Knaus and Zwicker's
+  // rule, where the search area for pass number I+1 (counting from 1)
+  // is the area for pass I times (I + RADIUS_ALPHA) / (I + 1).
+  //
+  dist_t radius_sq = initial_radius_sq;
+  for (unsigned i = 1; i <= pass; i++)
+    radius_sq *= (i + radius_alpha) / (i + 1);
+
+  photon_eval.search_radius_sq = radius_sq;
+
+  generate_photons ();
+}
+
+
+// SppmInteg::GlobalState::generate_photons
+
+// Replace the photons in PHOTON_MAP with a new set.
+//
+void
+SppmInteg::GlobalState::generate_photons ()
+{
+  shooter->indirect.clear ();
+
+  shooter->shoot (global_render_state);
+
+  photon_map.set_photons (shooter->indirect.photons);
+
+  photon_scale = 0;
+  if (shooter->indirect.num_paths > 0)
+    photon_scale = 1 / float (shooter->indirect.num_paths);
+
+  // Free the shooter's copy of the photons until the next pass.
+  //
+  std::vector<Photon> ().swap (shooter->indirect.photons);
+}
+
+
+// SppmInteg::Lo
+
+// This method is called by RecursiveInteg to return any radiance
+// not due to specular reflection/transmission or direct emission.
+//
+Color
+SppmInteg::Lo (const Intersect &isec, const Media &,
+	       const SampleSet::Sample &sample)
+{
+  return (direct_illum.sample_lights (isec, sample)
+	  + photon_eval.Lo (isec, global.photon_map, global.photon_scale));
+}
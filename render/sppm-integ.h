@@ -0,0 +1,152 @@
+// sppm-integ.h -- Progressive photon-mapping surface integrator
+//
+//  Copyright (C) 2014  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#ifndef SNOGRAY_SPPM_INTEG_H
+#define SNOGRAY_SPPM_INTEG_H
+
+#include "util/unique-ptr.h"
+#include "photon/photon-map.h"
+#include "photon/photon-eval.h"
+#include "direct-illum.h"
+
+#include "recursive-integ.h"
+
+
+namespace snogray {
+
+
+// A progressive photon-mapping integrator, which is meant to be used
+// with progressive rendering (the "passes" render parameter).
+//
+// Every rendering pass uses a new photon-map, containing a fixed
+// number of photons, and the search radius used to estimate radiance
+// from photons is reduced after each pass.  As each pass adds the
+// normal number of samples to every pixel, the final image is the
+// average of all passes, and converges to the correct result as the
+// number of passes increases, while only needing memory for a single
+// pass's photons.
+//
+// This is the probabilistic formulation of progressive photon-mapping
+// described in:
+//
+//   Claude Knaus and Matthias Zwicker, "Progressive Photon Mapping:
+//   A Probabilistic Approach", ACM Transactions on Graphics, 2011.
+//
+// Unlike the original "stochastic progressive photon mapping", which
+// keeps a separate radius and photon count for each pixel, the radius
+// is the same for all points in a pass, so no per-pixel state is
+// needed.
+//
+// Direct lighting is calculated using DirectIllum, and specular
+// surfaces are handled by recursion (see RecursiveInteg), so the
+// photon-map only holds photons which have been scattered at least
+// once.
+//
+class SppmInteg : public RecursiveInteg
+{
+public:
+
+  // Global state for SppmInteg, for rendering an entire scene.
+  //
+  class GlobalState;
+
+protected:
+
+  // This method is called by RecursiveInteg to return any radiance
+  // not due to specular reflection/transmission or direct emission.
+  //
+  virtual Color Lo (const Intersect &isec, const Media &media,
+		    const SampleSet::Sample &sample);
+
+private:
+
+  class Shooter;
+
+  // Integrator state for rendering a group of related samples.
+  //
+  SppmInteg (RenderContext &context, GlobalState &global_state);
+
+  // Pointer to our global state info.
+  //
+  const GlobalState &global;
+
+  // The photon-map evaluator.
+  //
+  PhotonEval photon_eval;
+
+  // State used by the direct-lighting calculator.
+  //
+  DirectIllum direct_illum;
+};
+
+
+
+// SppmInteg::GlobalState
+
+// Global state for SppmInteg, for rendering an entire scene.
+//
+class SppmInteg::GlobalState : public SurfaceInteg::GlobalState
+{
+public:
+
+  GlobalState (const GlobalRenderState &rstate, const ValTable &params);
+  ~GlobalState ();
+
+  // Return a new integrator, allocated in context.
+  //
+  virtual SurfaceInteg *make_integrator (RenderContext &context);
+
+  // Prepare for progressive-rendering pass PASS, by reducing the
+  // photon search radius, and shooting a new set of photons.
+  //
+  virtual void start_pass (unsigned pass);
+
+private:
+
+  friend class SppmInteg;
+
+  // Replace the photons in PHOTON_MAP with a new set.
+  //
+  void generate_photons ();
+
+  // Object used to shoot photons.  It's kept between passes so that
+  // each pass gets different photons.
+  //
+  UniquePtr<Shooter> shooter;
+
+  // Photons for the current pass.
+  //
+  PhotonMap photon_map;
+
+  // Amount by which we scale each photon during rendering.
+  //
+  float photon_scale;
+
+  // Search radius (squared) used during the first pass.
+  //
+  dist_t initial_radius_sq;
+
+  // Parameter controlling how quickly the search radius is reduced;
+  // it should be between 0 and 1, with smaller values reducing the
+  // radius more quickly.
+  //
+  float radius_alpha;
+
+  PhotonEval::GlobalState photon_eval;
+
+  DirectIllum::GlobalState direct_illum;
+};
+
+
+}
+
+#endif // SNOGRAY_SPPM_INTEG_H
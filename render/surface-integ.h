@@ -1,6 +1,6 @@
 // surface-integ.h -- Light integrator interface for surfaces
 //
-//  Copyright (C) 2010, 2011, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2010, 2011, 2013, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -15,6 +15,7 @@
 
 #include "geometry/ray.h"
 #include "color/tint.h"
+#include "surface/surface-renderable.h"
 #include "sample-set.h"
 
 #include "integ.h"
@@ -42,6 +43,13 @@ public:
     // Return a new surface integrator, allocated in context.
     //
     virtual SurfaceInteg *make_integrator (RenderContext &context) = 0;
+
+    // When rendering progressively, this is called before every pass
+    // except the first, with PASS the number of the pass about to be
+    // rendered.  No integrators are in use while it is called, so
+    // global state may be updated for the new pass.
+    //
+    virtual void start_pass (unsigned /* pass */) { }
   };
 
   // Return the light arriving at RAY's origin, from points up until
@@ -56,6 +64,18 @@ public:
   virtual Tint Li (const Ray &ray, const Media &media,
 		   const SampleSet::Sample &sample) = 0;
 
+  // A variant of SurfaceInteg::Li for when the closest intersection
+  // along the ray has already been found (for instance, by tracing a
+  // packet of camera rays at once using the packet variant of
+  // Scene::intersect).  ISEC_RAY is the ray, shortened to end at the
+  // intersection, and ISEC_INFO describes the intersection, or is zero
+  // if the ray didn't hit anything.
+  //
+  virtual Tint Li (const Ray &isec_ray,
+		   const Surface::Renderable::IsecInfo *isec_info,
+		   const Media &media, const SampleSet::Sample &sample)
+    = 0;
+
 protected:
 
   SurfaceInteg (RenderContext &_context) : Integ (_context) { }
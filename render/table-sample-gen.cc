@@ -0,0 +1,160 @@
+// table-sample-gen.cc -- sample generator using precomputed sample tables
+//
+//  Copyright (C) 2014  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#include "util/random.h"
+
+#include "table-sample-gen.h"
+
+
+using namespace snogray;
+
+
+// The precomputed tables for a single sample channel.
+//
+template<typename T>
+struct TableSampleGen::Tables
+{
+  Tables (unsigned _num, unsigned _dim, unsigned num_tables, Tables *_next)
+    : num (_num), dim (_dim), samples (_num * num_tables), next (_next)
+  { }
+
+  // The number of samples in each table, and the first dimension of
+  // the channel the tables are for.
+  //
+  unsigned num, dim;
+
+  // All the tables, one after the other.
+  //
+  std::vector<T> samples;
+
+  // Next entry in the same hash bucket.
+  //
+  Tables *next;
+};
+
+
+TableSampleGen::TableSampleGen (SampleGen *_base_gen, unsigned _num_tables)
+  : base_gen (_base_gen), num_tables (_num_tables)
+{
+}
+
+TableSampleGen::~TableSampleGen ()
+{
+  for (unsigned i = 0; i < NUM_BUCKETS; i++)
+    {
+      for (Tables<float> *t = float_buckets[i].load (); t; )
+	{
+	  Tables<float> *next = t->next;
+	  delete t;
+	  t = next;
+	}
+      for (Tables<UV> *t = uv_buckets[i].load (); t; )
+	{
+	  Tables<UV> *next = t->next;
+	  delete t;
+	  t = next;
+	}
+    }
+}
+
+// Return the tables for samples of type T, for a channel whose first
+// dimension is DIM, and which has NUM samples, looking them up in
+// BUCKETS.  If no such tables exist, they are generated first.
+//
+template<typename T>
+const TableSampleGen::Tables<T> &
+TableSampleGen::find_tables (AtomicPtr<Tables<T> > *buckets,
+			     unsigned num, unsigned dim)
+  const
+{
+  AtomicPtr<Tables<T> > &bucket = buckets[dim % NUM_BUCKETS];
+
+  // The common case:  the tables already exist.
+  //
+  for (Tables<T> *t = bucket.load (); t; t = t->next)
+    if (t->dim == dim && t->num == num)
+      return *t;
+
+  LockGuard guard (add_tables_lock);
+
+  // Search again while holding the lock, in case another thread
+  // added the tables we want while we were waiting for it.
+  //
+  Tables<T> *head = bucket.load ();
+  for (Tables<T> *t = head; t; t = t->next)
+    if (t->dim == dim && t->num == num)
+      return *t;
+
+  Tables<T> *tables = new Tables<T> (num, dim, num_tables, head);
+
+  // The tables are generated using their own random-number generator,
+  // seeded by the channel, so that they don't depend on the order in
+  // which threads happen to request them.
+  //
+  Random random (dim * 0x9E3779B9 + num);
+
+  for (unsigned i = 0; i < num_tables; i++)
+    base_gen->gen_samples<T> (random, tables->samples.begin () + i * num,
+			      num, dim);
+
+  bucket.store (tables);
+
+  return *tables;
+}
+
+// Return X, which should be in the range [0, 1), rotated by OFFS,
+// modulo 1.
+//
+static inline float
+rotate (float x, float offs)
+{
+  x += offs;
+  return x < 1 ? x : x - 1;
+}
+
+// Using RANDOM as a source of randomness, add NUM samples to TABLE
+// through TABLE+NUM, for a channel whose first dimension is DIM.
+//
+void
+TableSampleGen::gen_float_samples (Random &random,
+				   const std::vector<float>::iterator &table,
+				   unsigned num, unsigned dim)
+  const
+{
+  const Tables<float> &tables = find_tables (float_buckets, num, dim);
+
+  std::vector<float>::const_iterator src
+    = tables.samples.begin () + random (num_tables) * num;
+  float offs = random ();
+
+  for (unsigned i = 0; i < num; i++)
+    table[i] = rotate (src[i], offs);
+}
+
+// Using RANDOM as a source of randomness, add NUM samples to TABLE
+// through TABLE+NUM, for a channel whose first dimension is DIM.
+//
+void
+TableSampleGen::gen_uv_samples (Random &random,
+				const std::vector<UV>::iterator &table,
+				unsigned num, unsigned dim)
+  const
+{
+  const Tables<UV> &tables = find_tables (uv_buckets, num, dim);
+
+  std::vector<UV>::const_iterator src
+    = tables.samples.begin () + random (num_tables) * num;
+  float u_offs = random (), v_offs = random ();
+
+  for (unsigned i = 0; i < num; i++)
+    table[i] = UV (rotate (src[i].u, u_offs), rotate (src[i].v, v_offs));
+}
@@ -0,0 +1,127 @@
+// table-sample-gen.h -- sample generator using precomputed sample tables
+//
+//  Copyright (C) 2014  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#ifndef SNOGRAY_TABLE_SAMPLE_GEN_H
+#define SNOGRAY_TABLE_SAMPLE_GEN_H
+
+#include "util/unique-ptr.h"
+#include "util/atomic-ptr.h"
+#include "util/mutex.h"
+
+#include "sample-gen.h"
+
+
+namespace snogray {
+
+
+// A sample generator which, instead of generating new samples every
+// time, copies them from a set of tables precomputed using another
+// sample generator, the "base generator".
+//
+// For each distinct sample channel (i.e., each combination of sample
+// type, channel dimension, and number of samples), NUM_TABLES tables of
+// samples are generated by the base generator the first time that
+// channel is requested.  Subsequent requests choose one of the tables
+// at random, and apply a random Cranley-Patterson rotation to it
+// (adding a random offset to every sample, modulo 1), which preserves
+// the stratification of the table, but makes the samples of different
+// pixels independent.  This only needs one or two random numbers per
+// channel, instead of at least one per sample, so is much faster than
+// regenerating every sample, particularly for expensive base generators
+// or scenes with many sample channels.
+//
+// As the tables are shared, a single TableSampleGen object may be used
+// by multiple threads simultaneously.
+//
+class TableSampleGen : public SampleGen
+{
+public:
+
+  // Make a new TableSampleGen, which precomputes NUM_TABLES tables for
+  // each sample channel using BASE_GEN.  BASE_GEN is owned by the
+  // new object, and will be deleted when it is.
+  //
+  TableSampleGen (SampleGen *base_gen, unsigned num_tables);
+  ~TableSampleGen ();
+
+protected:
+
+  // The actual sample generating methods.  Using RANDOM as a source of
+  // randomness, add NUM samples to TABLE through TABLE+NUM, for a
+  // channel whose first dimension is DIM.
+  //
+  virtual void gen_float_samples (Random &random,
+				  const std::vector<float>::iterator &table,
+				  unsigned num, unsigned dim)
+    const;
+  virtual void gen_uv_samples (Random &random,
+			       const std::vector<UV>::iterator &table,
+			       unsigned num, unsigned dim)
+    const;
+
+  // Sample counts are whatever the base generator wants.
+  //
+  virtual unsigned adjust_float_sample_count (unsigned num) const
+  {
+    return base_gen->adjust_sample_count<float> (num);
+  }
+  virtual unsigned adjust_uv_sample_count (unsigned num) const
+  {
+    return base_gen->adjust_sample_count<UV> (num);
+  }
+
+private:
+
+  // The precomputed tables for a single sample channel.
+  //
+  template<typename T>
+  struct Tables;
+
+  // Number of hash buckets used to look up tables.  Channels are
+  // hashed by dimension.
+  //
+  static const unsigned NUM_BUCKETS = 256;
+
+  // Return the tables for samples of type T, for a channel whose first
+  // dimension is DIM, and which has NUM samples, looking them up in
+  // BUCKETS.  If no such tables exist, they are generated first.
+  //
+  template<typename T>
+  const Tables<T> &find_tables (AtomicPtr<Tables<T> > *buckets,
+				unsigned num, unsigned dim)
+    const;
+
+  // Generator used to fill in tables.
+  //
+  UniquePtr<SampleGen> base_gen;
+
+  // Number of tables generated for each channel.
+  //
+  unsigned num_tables;
+
+  // Hash buckets for finding tables, each containing a list of tables
+  // linked through their Tables::next field.  Lists are only added to
+  // (at the beginning), and table contents never changed once in a
+  // list, so lists may be searched without locking.
+  //
+  mutable AtomicPtr<Tables<float> > float_buckets[NUM_BUCKETS];
+  mutable AtomicPtr<Tables<UV> > uv_buckets[NUM_BUCKETS];
+
+  // Lock held while adding new tables.
+  //
+  mutable Mutex add_tables_lock;
+};
+
+
+}
+
+#endif // SNOGRAY_TABLE_SAMPLE_GEN_H
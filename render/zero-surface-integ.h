@@ -1,6 +1,6 @@
 // zero-surface-integ.h -- Constant-zero SurfaceInteg
 //
-//  Copyright (C) 2010, 2011, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2010, 2011, 2013, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -59,6 +59,15 @@ public:
     return 0;
   }
 
+  // A variant of ZeroSurfaceInteg::Li for when the closest
+  // intersection along the ray has already been found.
+  //
+  virtual Tint Li (const Ray &, const Surface::Renderable::IsecInfo *,
+		   const Media &, const SampleSet::Sample &)
+  {
+    return 0;
+  }
+
 protected:
 
   // Integrator state for rendering a group of related samples.
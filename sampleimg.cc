@@ -1,6 +1,6 @@
 // sampleimg.cc -- Generate samples from an input image
 //
-//  Copyright (C) 2010-2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2010-2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -19,6 +19,8 @@
 #include "geometry/hist-2d.h"
 #include "geometry/hist-2d-dist.h"
 #include "render/grid.h"
+#include "render/sobol.h"
+#include "render/halton.h"
 #include "render/sample-set.h"
 #include "util/radical-inverse.h"
 
@@ -68,6 +70,8 @@ s "   radical     Radical inverse"
 s "   random      Completely random"
 s "   stratified  Random within a grid pattern"
 s "   grid        Rigid grid pattern"
+s "   sobol       Scrambled Sobol sequence"
+s "   halton      Randomized Halton sequence"
 n
 s "If the -v/--value option is not given, a value will chosen"
 s "automatically to try and approximate the input image's intensity."
@@ -133,7 +137,7 @@ int main (int argc, char *argv[])
 	exit (1);
       }
 
-  enum { RADICAL, RANDOM, STRATIFIED, GRID } method;
+  enum { RADICAL, RANDOM, STRATIFIED, GRID, SOBOL, HALTON } method;
 
   if (strcmp (meth_name, "radical-inverse") == 0
       || strcmp (meth_name, "radical") == 0
@@ -159,6 +163,16 @@ int main (int argc, char *argv[])
       method = GRID;
       meth_name = "grid";
     }
+  else if (strcmp (meth_name, "sobol") == 0)
+    {
+      method = SOBOL;
+      meth_name = "sobol";
+    }
+  else if (strcmp (meth_name, "halton") == 0)
+    {
+      method = HALTON;
+      meth_name = "halton";
+    }
   else
     {
       std::cerr << prog_name << ": " << meth_name
@@ -203,12 +217,22 @@ int main (int argc, char *argv[])
   double inv_pdf_sum = 0;
   unsigned zero_count = 0, nan_count = 0;
 
+  // Sample generators for methods which use a SampleSet.
+  //
   Grid strat;
-  SampleSet sample_set (num_samples, strat, rng);
+  Sobol sobol;
+  Halton halton;
+  SampleGen *sample_gen = &strat;
+  if (method == SOBOL)
+    sample_gen = &sobol;
+  else if (method == HALTON)
+    sample_gen = &halton;
+
+  SampleSet sample_set (num_samples, *sample_gen, rng);
   SampleSet::Channel<UV> chan = sample_set.add_channel<UV> ();
   std::vector<UV> grid;
 
-  if (method == STRATIFIED)
+  if (method == STRATIFIED || method == SOBOL || method == HALTON)
     sample_set.generate ();
   else if (method == GRID)
     {
@@ -251,7 +275,7 @@ int main (int argc, char *argv[])
       UV param;
       if (method == RADICAL)
 	param = UV (radical_inverse (i+1,2), radical_inverse(i+1,3));
-      else if (method == STRATIFIED)
+      else if (method == STRATIFIED || method == SOBOL || method == HALTON)
 	param = sample_set.get (chan, i);
       else if (method == GRID)
 	param = grid[i];
@@ -0,0 +1,19 @@
+// snogbench.cc -- Main driver for snogray search-accelerator benchmark
+//
+//  Copyright (C) 2014  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#include "lua/invoke-lua-driver.h"
+
+int main (int, const char **argv)
+{
+  snogray::invoke_lua_driver ("snogbench.lua", argv);
+  return 0;
+}
@@ -0,0 +1,305 @@
+-- snogbench.lua -- Top-level driver for snogbench
+--
+--  Copyright (C) 2014  Miles Bader <miles@gnu.org>
+--
+-- This source code is free software; you can redistribute it and/or
+-- modify it under the terms of the GNU General Public License as
+-- published by the Free Software Foundation; either version 3, or (at
+-- your option) any later version.  See the file COPYING for more details.
+--
+-- Written by Miles Bader <miles@gnu.org>
+--
+
+-- snogbench loads a scene in the same way as snogray, and then, for
+-- each kind of search accelerator, builds the accelerator and traces
+-- sets of rays through the scene (without doing any shading),
+-- reporting the time taken to build the accelerator, the memory it
+-- uses, and the speed of ray tracing.
+--
+
+local cmdline = ...
+
+local default_width, default_height = 720, 480
+
+
+----------------------------------------------------------------
+-- Imports
+
+local string = require 'snogray.string'
+local commify = string.commify
+local lpad = string.left_pad
+local rpad = string.right_pad
+
+local table = require 'snogray.table'
+
+local clp = require 'snogray.cmdlineparser'
+
+local load = require 'snogray.load'
+local render = require 'snogray.render'
+local sys = require 'snogray.sys'
+local camera = require 'snogray.camera'
+local environ = require 'snogray.environ'
+local surface = require 'snogray.surface'
+
+local render_cmdline = require 'snogray.render-cmdline'
+local scene_cmdline = require 'snogray.scene-cmdline'
+local camera_cmdline = require 'snogray.camera-cmdline'
+
+
+----------------------------------------------------------------
+-- Parse command-line options
+--
+
+-- option values
+--
+local accels = { "octree", "bvh" }
+local ray_kinds = { "camera", "random", "shadow", "bounce" }
+local num_rays = 1000000
+local packet_size = 1
+local num_threads = sys.num_cores ()
+local width, height = default_width, default_height
+local render_params = {}
+local scene_params = {}
+local camera_params = {}
+
+-- All parameters together.
+--
+local params = { render = render_params, scene = scene_params,
+		 camera = camera_params }
+
+
+-- Return a table containing the comma-separated elements of STR.
+--
+local function comma_list (str)
+   local list = {}
+   for elem in string.gmatch (str, "[^,]+") do
+      list[#list + 1] = elem
+   end
+   return list
+end
+
+local function set_size (arg)
+   local w, h = string.match (arg, "^(%d+)%s*[,x]%s*(%d+)$")
+   w = tonumber (w)
+   h = tonumber (h)
+   if not w or not h or w == 0 or h == 0 then
+      clp.error ("invalid size option \""..arg.."\"")
+   end
+   width, height = w, h
+end
+
+
+-- Command-line parser.
+--
+local parser = clp.standard_parser {
+   desc = "Benchmark ray-tracing search accelerators",
+   usage = "SCENE_FILE",
+   prog_name = cmdline[0],
+   package = "snogray",
+   version = environ.version,
+
+   "Benchmark options:",
+   { "-a/--accel=ACCELS",
+     function (arg) accels = comma_list (arg) end,
+     doc = [[Benchmark the comma-separated list of search
+	     accelerators ACCELS (default "octree,bvh"):\+
+	     \|"octree" -- octree
+	     \|"bvh"    -- bounding volume hierarchy
+	     \|"triv"   -- no accelerator (very slow)]] },
+   { "-r/--rays=KINDS",
+     function (arg) ray_kinds = comma_list (arg) end,
+     doc = [[Trace the comma-separated list of ray sets KINDS
+	     (default "camera,random,shadow,bounce"):\+
+	     \|"camera" -- coherent rays from the camera
+	     \|"random" -- rays between random points in the scene
+	     \|"shadow" -- rays from camera-ray hits to random points
+	     \|"bounce" -- rays from camera-ray hits in random directions]] },
+   { "-N/--num-rays=NUM",
+     function (num) num_rays = clp.unsigned_argument (num) end,
+     doc = [[Trace NUM rays in each ray set (default 1000000)]] },
+   { "--packet-size=NUM",
+     function (num) packet_size = clp.unsigned_argument (num) end,
+     doc = [[Trace closest-hit rays in packets of NUM rays
+	     (default 1, which traces rays individually)]] },
+   { "-s/--size=WIDTHxHEIGHT", set_size,
+     doc = [[Generate camera rays for an image of WIDTHxHEIGHT
+	     pixels (default 720x480)]] },
+   { "-j/--threads=NUM",
+     function (num) num_threads = clp.unsigned_argument (num) end,
+     doc = [[Use NUM threads for tracing (default all cores)]] },
+
+   "Rendering options:",
+   render_cmdline.option_parser (render_params),
+
+   "Scene options:",
+   scene_cmdline.option_parser (scene_params),
+
+   "Camera options:",
+   camera_cmdline.option_parser (camera_params),
+}
+
+
+local args = parser (cmdline)
+
+if #args ~= 1 then
+   parser:usage_error ()
+end
+
+local scene_file = args[1]
+
+
+----------------------------------------------------------------
+-- Scene loading
+--
+
+local coord = require 'snogray.coord'
+local accel = require 'snogray.accel'
+
+-- Load the scene from SCENE_FILE, and return the scene and camera.
+--
+-- The scene is loaded again for each search accelerator, because
+-- the accelerators of instanced models are chosen when the scene is
+-- loaded:  ACCEL_TYPE is made the default accelerator type during
+-- loading, so that models use the same type of accelerator as the
+-- scene itself.
+--
+local function load_scene (accel_type)
+   local scene = surface.group ()
+   local camera = camera.new ()  	-- note, shadows variable, but oh well
+
+   camera:set_aspect_ratio (width / height)
+
+   -- The Lua environment passed to the scene loader.  This is the
+   -- same as snogray's scene-loading environment, except that it
+   -- doesn't support old-style scene files.
+   --
+   local load_environ = {
+      scene = scene,
+      camera = camera,
+
+      params = table.deep_copy (params),
+
+      coord = coord,
+      light = require 'snogray.light',
+      material = require 'snogray.material',
+      surface = require 'snogray.surface',
+      texture = require 'snogray.texture',
+      transform = require 'snogray.transform',
+
+      pos = coord.pos, vec = coord.vec
+   }
+   -- inherit from the default global environment
+   setmetatable (load_environ, {__index = _G})
+
+   local old_default_accel = accel.default
+   accel.default = accel_type
+
+   load.scene (scene_file, load_environ)
+
+   accel.default = old_default_accel
+
+   scene = load_environ.scene
+   camera = load_environ.camera
+
+   -- Use any scene-specified render parameters the user didn't
+   -- override.
+   --
+   if load_environ.params.render then
+      for k, v in pairs (load_environ.params.render) do
+	 if render_params[k] == nil then
+	    render_params[k] = v
+	 end
+      end
+   end
+
+   scene_cmdline.apply (scene_params, scene)
+
+   camera:set_aspect_ratio (width / height)
+   camera_cmdline.apply (camera_params, camera, scene)
+
+   return scene, camera
+end
+
+
+----------------------------------------------------------------
+-- Benchmarking
+--
+
+-- Setup can use as many threads as tracing, and we build the search
+-- accelerators of instanced models up front, so that building them
+-- is included in the build time, rather than the tracing time.
+--
+if not render_params.setup_threads then
+   render_params.setup_threads = num_threads
+end
+if render_params.eager_models == nil then
+   render_params.eager_models = true
+end
+
+-- Return NUM / DEN as a float; if DEN == 0, return 0;
+--
+local function fraction (num, den)
+   if den == 0 then return 0 else return num / den end
+end
+
+local function fmt (places, num)
+   return string.format ("%."..places.."f", num)
+end
+
+print ("* scene: "..scene_file)
+print ("* tracing "..commify (num_rays).." rays per set, using "
+       ..commify (num_threads).." threads"
+       ..(packet_size > 1 and (", packets of "..packet_size) or ""))
+
+for _, accel_type in ipairs (accels) do
+   render_params.accel = accel_type
+
+   local load_beg_time = sys.wall_clock_time ()
+   local scene, camera = load_scene (accel_type)
+   local load_end_time = sys.wall_clock_time ()
+
+   local build_beg_time = sys.wall_clock_time ()
+   local grstate = render_cmdline.make_global_render_state (scene, render_params)
+   local build_end_time = sys.wall_clock_time ()
+
+   print ""
+   print ("* "..accel_type..": "
+	  ..commify (scene:stats ().num_render_surfaces).." surfaces, load "
+	  ..fmt (2, load_end_time - load_beg_time).." sec, build "
+	  ..fmt (2, build_end_time - build_beg_time).." sec, memory "
+	  ..fmt (2, grstate.scene:space_memory_use () / (1024 * 1024))
+	  .." MB")
+
+   local bench = render.raycast_bench (grstate, camera, width, height)
+
+   for _, kind in ipairs (ray_kinds) do
+      local nrays = bench:generate (kind, num_rays)
+      local stats = render.stats ()
+      local elapsed = bench:trace (num_threads, packet_size, stats)
+
+      -- Shadow rays are traced using an "any hit" test, whose
+      -- statistics are kept separately.
+      --
+      local sstats = (kind == "shadow") and stats.shadow or stats.intersect
+
+      print ("    "..rpad (kind..":", 8)
+	     ..lpad (commify (nrays), 10).." rays"
+	     ..lpad (fmt (3, elapsed), 9).." sec"
+	     ..lpad (fmt (2, fraction (nrays, elapsed) / 1e6), 8).." Mrays/s"
+	     ..lpad (fmt (1, 100 * fraction (bench:last_num_hits (), nrays)), 6)
+	     .."% hit"
+	     ..lpad (fmt (1, fraction (sstats.space_node_intersect_calls,
+				       nrays)), 8).." nodes/ray"
+	     ..lpad (fmt (1, fraction (sstats.surface_intersects_tests,
+				       nrays)), 7).." surfs/ray")
+   end
+
+   -- Let the garbage collector free this scene and accelerator before
+   -- we load the next one.
+   --
+   bench = nil
+   grstate = nil
+   scene = nil
+   camera = nil
+   collectgarbage ()
+end
@@ -1,6 +1,6 @@
 -- snogray.lua -- Top-level driver for snogray
 --
---  Copyright (C) 2012, 2013  Miles Bader <miles@gnu.org>
+--  Copyright (C) 2012, 2013, 2014  Miles Bader <miles@gnu.org>
 --
 -- This source code is free software; you can redistribute it and/or
 -- modify it under the terms of the GNU General Public License as
@@ -421,6 +421,27 @@ if render_params.background_alpha and render_params.background_alpha ~= 1 then
 end
 
 
+-- Progressive rendering (more than one pass) doesn't write any output
+-- rows until all passes are finished, so instead we periodically write
+-- a snapshot of the current state to a separate file, which is removed
+-- when rendering is done.
+--
+local progressive = tonumber (render_params.passes or 1) > 1
+local tmp_snapshot_file = nil
+if progressive then
+   if recover then
+      error ("The `--continue' option cannot be used with progressive rendering", 0)
+   end
+   if not render_params.snapshot_file then
+      local base, ext = string.match (output_file, "^(.*)(%.[^./]+)$")
+      if base then
+	 tmp_snapshot_file = base.."-snapshot"..ext
+	 render_params.snapshot_file = tmp_snapshot_file
+      end
+   end
+end
+
+
 -- If we're in recovery mode, move an existing output file out of the
 -- way; otherwise an existing output file is an error (to prevent
 -- accidental overwriting).
@@ -531,6 +552,12 @@ end
 -- Pre-render setup (this can be time-consuming)
 --
 
+-- Setup can use as many threads as rendering.
+--
+if not render_params.setup_threads then
+   render_params.setup_threads = num_threads
+end
+
 local setup_beg_ru = sys.rusage ()
 local grstate = render_cmdline.make_global_render_state (scene, render_params)
 local setup_end_ru = sys.rusage ()
@@ -541,13 +568,17 @@ local setup_end_ru = sys.rusage ()
 --
 
 -- The pattern of pixels we will render; we add a small margin around
--- the output image to keep the edges clean.
+-- the output image to keep the edges clean.  Whatever the order,
+-- pixels are rendered in horizontal bands from top to bottom, so only
+-- completed rows are ever written to the output file, and recovery
+-- works as usual.
 --
 local x_margin = image_out:filter_x_radius ()
 local y_margin = image_out:filter_y_radius ()
 local render_pattern
    = render.pattern (limit_x - x_margin, limit_y - y_margin,
-		     limit_width + x_margin * 2, limit_height + y_margin * 2)
+		     limit_width + x_margin * 2, limit_height + y_margin * 2,
+		     render_params.render_order or {})
 
 local render_stats = render.stats ()
 local render_mgr = render.manager (grstate, camera, width, height)
@@ -559,6 +590,10 @@ local render_beg_ru = sys.rusage () -- begin marker for rendering
 render_mgr:render (num_threads, render_pattern, image_out,
 		   tty_prog, render_stats)
 
+if tmp_snapshot_file then
+   os.remove (tmp_snapshot_file)
+end
+
 local render_end_ru = sys.rusage () -- end marker for rendering
 local end_time = os.time ()
 
@@ -614,15 +649,13 @@ if not quiet then
 	 local node_tests = sstats.space_node_intersect_calls
 	 local surf_tests = sstats.surface_intersects_tests
 	 local neg_cache_hits = sstats.neg_cache_hits
-	 local neg_cache_colls = sstats.neg_cache_collisions
 	 local tot_tries = surf_tests + neg_cache_hits
 	 local pos_tries = sstats.surface_intersects_hits
 
 	 print("     tree node tests: "..lpad (commify (node_tests), 16))
 	 print("     surface tests:   "..lpad (commify (tot_tries), 16)
 	       .." (success = "..lpad(percent(pos_tries, tot_tries), 2).."%"
-	       ..", cached = "..lpad(percent(neg_cache_hits, tot_tries), 2).."%"
-	       .."; coll = "..lpad(percent(neg_cache_colls, tot_tries), 2).."%)")
+	       ..", cached = "..lpad(percent(neg_cache_hits, tot_tries), 2).."%)")
       end
 
       local sic = rstats.scene_intersect_calls
@@ -639,6 +672,12 @@ if not quiet then
 	 print "  shadow:"
 	 print("     rays:            "..lpad (commify (sst), 16))
 
+	 local och = rstats.occluder_cache_hits
+	 if och ~= 0 then
+	    print("     occluder cache:  "..lpad (commify (och), 16)
+		  .." (hits = "..lpad(percent(och, sst), 2).."%)")
+	 end
+
 	 print_search_stats (rstats.shadow)
       end
 
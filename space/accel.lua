@@ -1,6 +1,6 @@
 -- accel.lua -- Search accelerators
 --
---  Copyright (C) 2012  Miles Bader <miles@gnu.org>
+--  Copyright (C) 2012, 2014  Miles Bader <miles@gnu.org>
 --
 -- This source code is free software; you can redistribute it and/or
 -- modify it under the terms of the GNU General Public License as
@@ -27,7 +27,9 @@ accel.default = "octree"
 -- Constructors for factories of each accelerator type.
 --
 local accel_factory_ctors = {
-   octree = raw.OctreeBuilderFactory
+   octree = raw.OctreeBuilderFactory,
+   bvh = raw.BvhBuilderFactory,
+   triv = raw.TrivBuilderFactory
 }
 
 -- Actual factory objects for each accelerator type.
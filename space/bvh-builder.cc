@@ -0,0 +1,1041 @@
+// bvh-builder.cc -- BVH construction
+//
+//  Copyright (C) 2014  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#include <algorithm>
+
+#include "util/snogassert.h"
+#include "util/thread.h"
+#include "util/unique-ptr.h"
+
+#include "bvh.h"
+#include "bvh-node.h"
+
+
+using namespace snogray;
+
+
+
+// Bvh::Builder
+
+// A class used for building a BVH.
+//
+// Surfaces are simply accumulated as they are added, and the actual
+// tree is built all at once by Bvh::Builder::build_space, as the
+// surface-area heuristic needs to look at all surfaces together.
+//
+// If more than one thread is allowed, large nodes are built in
+// parallel:  the bounding-boxes of their surfaces, and the
+// surface-area heuristic buckets, are computed by splitting the
+// surfaces into chunks, one per thread, and the two children of a
+// node are built simultaneously in separate threads.  As the way a
+// node is split depends only on the surfaces in it, the resulting tree
+// is exactly the same regardless of the number of threads used.
+//
+class Bvh::Builder : public SpaceBuilder
+{
+public:
+
+  // Make a builder which uses at most NUM_THREADS threads to build
+  // the BVH.  If CACHE_FILE is not empty, it is used as an accelerator
+  // cache (see Bvh::BuilderFactory).
+  //
+  Builder (unsigned _num_threads = 1, const std::string &_cache_file = "")
+    : num_threads (std::max (_num_threads, 1u)), cache_file (_cache_file)
+  { }
+
+  // Add SURFACE to the space being built.  The surface's bounding-box
+  // isn't calculated until the tree is actually built, so that it can
+  // be done in parallel.
+  //
+  virtual void add (const Surface::Renderable *surface)
+  {
+    entries.push_back (Entry (surface));
+  }
+
+  // Make the final space.  Note that this can only be done once.
+  //
+  virtual const Space *build_space ();
+
+  // Build the BVH tree from all the surfaces that have been added,
+  // and store it into BVH.  If we have an accelerator cache file
+  // which holds a tree for the same surfaces, it is used instead.
+  //
+  void build (Bvh &bvh);
+
+private:
+
+  // Type name used for BVHs in accelerator cache files.  The
+  // version number must be changed if the way BVHs are built changes.
+  //
+#if USE_COMPACT_ACCEL
+  static const char *cache_type () { return "bvh-compact-1"; }
+#else
+  static const char *cache_type () { return "bvh-1"; }
+#endif
+
+  // The size of the "extra" data in accelerator cache files, which
+  // holds Bvh::root_bounds when using compact nodes.
+  //
+#if USE_COMPACT_ACCEL
+  static unsigned cache_extra_size () { return sizeof (Bounds); }
+#else
+  static unsigned cache_extra_size () { return 0; }
+#endif
+
+  // The number of buckets used to approximate the surface-area
+  // heuristic along each axis.  Rather than trying every possible
+  // split position, the surfaces in a node are sorted into buckets
+  // according to their centroids, and only splits between buckets are
+  // considered.
+  //
+  static const unsigned NUM_SAH_BUCKETS = 16;
+
+  // The number of surfaces above which a node will always be split,
+  // even if the surface-area heuristic says a leaf would be cheaper.
+  //
+  static const unsigned MAX_SAH_LEAF_SURFACES = 8;
+
+  // Below this depth, nodes are split using the surface-area
+  // heuristic; at or above it, nodes are split by simply dividing their
+  // surfaces in half, which guarantees that the remaining tree depth
+  // is logarithmic in the number of surfaces, so Node::MAX_DEPTH is
+  // never exceeded.
+  //
+  static const unsigned MAX_SAH_DEPTH = Node::MAX_DEPTH - 33;
+
+  // The estimated cost of testing a ray against a node's bounding-box,
+  // relative to the cost of a (virtual) surface intersection test,
+  // which is 1.
+  //
+  static dist_t node_isec_cost () { return 0.125f; }
+
+  // The minimum number of surfaces for which it's worth using more
+  // than one thread; below this, the overhead of starting threads
+  // outweighs any gain.
+  //
+  static const unsigned MIN_PARALLEL_ENTRIES = 16384;
+
+  // An entry for a surface being added to the BVH.
+  //
+  struct Entry
+  {
+    Entry (const Surface::Renderable *_surface) : surface (_surface) { }
+
+    // Return the centroid of this surface's bounding-box, which is
+    // the point used to decide which side of a split it goes on.
+    //
+    Pos centroid () const
+    {
+      return Pos ((bbox.min.x + bbox.max.x) / 2,
+		  (bbox.min.y + bbox.max.y) / 2,
+		  (bbox.min.z + bbox.max.z) / 2);
+    }
+
+    const Surface::Renderable *surface;
+    BBox bbox;
+  };
+
+  // Information accumulated about a single bucket, when evaluating
+  // the surface-area heuristic.
+  //
+  struct SahBucket
+  {
+    SahBucket () : num_surfaces (0) { }
+    unsigned num_surfaces;
+    BBox bbox;
+  };
+
+  // A set of surface-area heuristic buckets for each axis.
+  //
+  struct SahBuckets
+  {
+    SahBucket buckets[3][NUM_SAH_BUCKETS];
+  };
+
+  // Classes used to divide up work amongst multiple threads.  Each
+  // handles a range of entries, and has a "run" method which does the
+  // actual work.
+  //
+  struct EntryBBoxJob;
+  struct BoundsJob;
+  struct BinJob;
+  struct SubtreeJob;
+
+  // Functor which returns true if an entry's centroid lies in a
+  // bucket less than or equal to a given split bucket.  This is used
+  // with std::partition to divide entries according to a split.
+  //
+  struct InLowBuckets
+  {
+    InLowBuckets (unsigned _axis, unsigned _split_bucket,
+		  coord_t _cent_min, coord_t _cent_scale)
+      : axis (_axis), split_bucket (_split_bucket),
+	cent_min (_cent_min), cent_scale (_cent_scale)
+    { }
+    bool operator() (const Entry &entry) const
+    {
+      return (bucket_index (entry.centroid ()[axis], cent_min, cent_scale)
+	      <= split_bucket);
+    }
+    unsigned axis, split_bucket;
+    coord_t cent_min, cent_scale;
+  };
+
+  // Functor which orders entries by the position of their centroid
+  // along a given axis.  This is used with std::nth_element for
+  // median splits.
+  //
+  struct CentroidLess
+  {
+    CentroidLess (unsigned _axis) : axis (_axis) { }
+    bool operator() (const Entry &e1, const Entry &e2) const
+    {
+      return e1.centroid ()[axis] < e2.centroid ()[axis];
+    }
+    unsigned axis;
+  };
+
+  // Return the index of the bucket containing a centroid at
+  // coordinate CENT, given the minimum centroid coordinate CENT_MIN,
+  // and CENT_SCALE, which maps the range of centroid coordinates to
+  // [0, NUM_SAH_BUCKETS).
+  //
+  static unsigned bucket_index (coord_t cent, coord_t cent_min,
+				coord_t cent_scale)
+  {
+    unsigned bucket = unsigned ((cent - cent_min) * cent_scale);
+    return bucket < NUM_SAH_BUCKETS ? bucket : NUM_SAH_BUCKETS - 1;
+  }
+
+  // Return the surface area of BBOX.
+  //
+  static dist_t surface_area (const BBox &bbox)
+  {
+    Vec ext = bbox.extent ();
+    return 2 * (ext.x * ext.y + ext.y * ext.z + ext.z * ext.x);
+  }
+
+  // Recursively build a BVH node for the entries from BEG_ENTRY to
+  // END_ENTRY (exclusive), which is at depth DEPTH in the tree, and
+  // whose parent node has bounds PARENT_BOUNDS, adding it and all its
+  // descendants to the end of TO_NODES.  At most THREADS threads
+  // (including the calling thread) will be used.
+  //
+  void build_node (unsigned beg_entry, unsigned end_entry, unsigned depth,
+		   const Bounds &parent_bounds, unsigned threads,
+		   NodeVec &to_nodes,
+		   std::vector<const Surface::Renderable *> &to_surface_ptrs);
+
+  // Calculate the bounding-box of the entries from BEG_ENTRY to
+  // END_ENTRY, and of their centroids, storing them into NODE_BBOX and
+  // CENT_BBOX.  At most THREADS threads will be used.
+  //
+  void calc_bounds (unsigned beg_entry, unsigned end_entry, unsigned threads,
+		    BBox &node_bbox, BBox &cent_bbox)
+    const;
+
+  // Add the entries from BEG_ENTRY to END_ENTRY to the surface-area
+  // heuristic buckets in BUCKETS, for every axis on which CENT_BBOX,
+  // the bounding-box of their centroids, has a non-zero extent.  At
+  // most THREADS threads will be used.
+  //
+  void bin_entries (unsigned beg_entry, unsigned end_entry,
+		    const BBox &cent_bbox, unsigned threads,
+		    SahBuckets &buckets)
+    const;
+
+  // Try to find a split for the entries from BEG_ENTRY to END_ENTRY
+  // using the surface-area heuristic.  NODE_BBOX is the bounding-box
+  // of all those entries, and CENT_BBOX the bounding-box of their
+  // centroids.  At most THREADS threads will be used.
+  //
+  // If splitting is better than making a leaf, or if there are too
+  // many entries for a leaf, partition the entries so that those for
+  // the first child come first, set SPLIT_AXIS to the axis used, and
+  // return the index of the first entry for the second child.
+  // Otherwise return 0.
+  //
+  unsigned sah_split (unsigned beg_entry, unsigned end_entry,
+		      const BBox &node_bbox, const BBox &cent_bbox,
+		      unsigned threads, unsigned &split_axis);
+
+  // Return the number of threads to use for an operation on NUM_ENTRIES
+  // entries, given that at most THREADS threads are available.
+  //
+  static unsigned useful_threads (unsigned num_entries, unsigned threads)
+  {
+    return num_entries < MIN_PARALLEL_ENTRIES ? 1 : threads;
+  }
+
+  // Return the index of the first entry in chunk CHUNK, when the
+  // entries from BEG_ENTRY to END_ENTRY are divided into NUM_CHUNKS
+  // roughly equal chunks.
+  //
+  static unsigned chunk_start (unsigned beg_entry, unsigned end_entry,
+			       unsigned chunk, unsigned num_chunks)
+  {
+    return (beg_entry
+	    + unsigned ((unsigned long long)(end_entry - beg_entry)
+			* chunk / num_chunks));
+  }
+
+  // Call the "run" method of every job in JOBS, each in a separate
+  // thread (the first job is run in the calling thread), and wait for
+  // them all to finish.
+  //
+  template<class Job>
+  static void run_jobs (std::vector<Job> &jobs);
+
+  // If our accelerator cache file holds a BVH built from the surfaces
+  // in SURFACES (in the order they were added), whose bounding-boxes
+  // have key KEY, store it into BVH and return true; otherwise return
+  // false.
+  //
+  bool load_cached (const std::vector<const Surface::Renderable *> &surfaces,
+		    const SpaceCache::Key &key, Bvh &bvh)
+    const;
+
+  // Return true if the NUM_NODES nodes at NODES form a plausible tree
+  // referring to NUM_SURFACE_PTRS surface pointers.  This makes sure
+  // that a tree loaded from an accelerator cache file can't cause
+  // out-of-bounds accesses when searched.
+  //
+  static bool valid_nodes (const Node *nodes, unsigned num_nodes,
+			   unsigned num_surface_ptrs);
+
+  // The maximum number of threads to use for building.
+  //
+  unsigned num_threads;
+
+  // Accelerator cache file to use, or an empty string for none.
+  //
+  std::string cache_file;
+
+  // Entries for all surfaces added so far.
+  //
+  std::vector<Entry> entries;
+};
+
+
+
+// Bvh::Builder job classes
+
+// Job which calculates the bounding-boxes of a range of entries.
+//
+struct Bvh::Builder::EntryBBoxJob
+{
+  EntryBBoxJob (Builder &_builder, unsigned _beg_entry, unsigned _end_entry)
+    : builder (_builder), beg_entry (_beg_entry), end_entry (_end_entry)
+  { }
+
+  void run ()
+  {
+    for (unsigned i = beg_entry; i < end_entry; i++)
+      builder.entries[i].bbox = builder.entries[i].surface->bbox ();
+  }
+
+  Builder &builder;
+  unsigned beg_entry, end_entry;
+};
+
+// Job which calculates the bounding-box of a range of entries, and of
+// their centroids.
+//
+struct Bvh::Builder::BoundsJob
+{
+  BoundsJob (const Builder &_builder, unsigned _beg_entry, unsigned _end_entry)
+    : builder (_builder), beg_entry (_beg_entry), end_entry (_end_entry)
+  { }
+
+  void run ()
+  {
+    for (unsigned i = beg_entry; i < end_entry; i++)
+      {
+	node_bbox += builder.entries[i].bbox;
+	cent_bbox += builder.entries[i].centroid ();
+      }
+  }
+
+  const Builder &builder;
+  unsigned beg_entry, end_entry;
+
+  // Results.
+  //
+  BBox node_bbox, cent_bbox;
+};
+
+// Job which sorts a range of entries into surface-area heuristic
+// buckets.
+//
+struct Bvh::Builder::BinJob
+{
+  BinJob (const Builder &_builder, unsigned _beg_entry, unsigned _end_entry,
+	  const BBox &_cent_bbox)
+    : builder (_builder), beg_entry (_beg_entry), end_entry (_end_entry),
+      cent_bbox (_cent_bbox)
+  { }
+
+  void run ()
+  {
+    builder.bin_entries (beg_entry, end_entry, cent_bbox, 1, buckets);
+  }
+
+  const Builder &builder;
+  unsigned beg_entry, end_entry;
+  BBox cent_bbox;
+
+  // Results.
+  //
+  SahBuckets buckets;
+};
+
+// Job which builds a complete subtree into its own vectors of nodes
+// and surface pointers; node and surface indices in the result are
+// relative to the start of those vectors.
+//
+struct Bvh::Builder::SubtreeJob
+{
+  SubtreeJob (Builder &_builder, unsigned _beg_entry, unsigned _end_entry,
+	      unsigned _depth, const Bounds &_parent_bounds,
+	      unsigned _threads)
+    : builder (_builder), beg_entry (_beg_entry), end_entry (_end_entry),
+      depth (_depth), parent_bounds (_parent_bounds), threads (_threads)
+  { }
+
+  void run ()
+  {
+    builder.build_node (beg_entry, end_entry, depth, parent_bounds, threads,
+			nodes, surface_ptrs);
+  }
+
+  Builder &builder;
+  unsigned beg_entry, end_entry, depth;
+  Bounds parent_bounds;
+  unsigned threads;
+
+  // Results.
+  //
+  NodeVec nodes;
+  std::vector<const Surface::Renderable *> surface_ptrs;
+};
+
+// Call the "run" method of every job in JOBS, each in a separate
+// thread (the first job is run in the calling thread), and wait for
+// them all to finish.
+//
+template<class Job>
+void
+Bvh::Builder::run_jobs (std::vector<Job> &jobs)
+{
+#if USE_THREADS
+  std::vector<Thread *> threads;
+  for (unsigned i = 1; i < jobs.size (); i++)
+    threads.push_back (new Thread (&Job::run, &jobs[i]));
+#endif
+
+  if (! jobs.empty ())
+    jobs[0].run ();
+
+#if USE_THREADS
+  for (std::vector<Thread *>::iterator ti = threads.begin ();
+       ti != threads.end (); ++ti)
+    {
+      (*ti)->join ();
+      delete *ti;
+    }
+#else
+  for (unsigned i = 1; i < jobs.size (); i++)
+    jobs[i].run ();
+#endif
+}
+
+
+
+// Bvh::Builder::build
+
+// Build the BVH tree from all the surfaces that have been added, and
+// store it into BVH.  If we have an accelerator cache file which holds
+// a tree for the same surfaces, it is used instead.
+//
+void
+Bvh::Builder::build (Bvh &bvh)
+{
+  if (entries.empty ())
+    return;
+
+  // Calculate the bounding-box of every entry.
+  //
+  unsigned num_entries = entries.size ();
+  unsigned threads = useful_threads (num_entries, num_threads);
+  std::vector<EntryBBoxJob> bbox_jobs;
+  for (unsigned t = 0; t < threads; t++)
+    bbox_jobs.push_back (
+      EntryBBoxJob (*this, chunk_start (0, num_entries, t, threads),
+		    chunk_start (0, num_entries, t + 1, threads)));
+  run_jobs (bbox_jobs);
+
+  // If using an accelerator cache, the tree is identified by the
+  // bounding-boxes of our entries, in the order they were added, so
+  // remember that order before building reorders them.
+  //
+  SpaceCache::Key key;
+  std::vector<const Surface::Renderable *> surfaces;
+  if (! cache_file.empty ())
+    {
+      surfaces.reserve (num_entries);
+      for (std::vector<Entry>::const_iterator ei = entries.begin ();
+	   ei != entries.end (); ++ei)
+	{
+	  key.add (ei->bbox);
+	  surfaces.push_back (ei->surface);
+	}
+
+      if (load_cached (surfaces, key, bvh))
+	{
+	  std::vector<Entry> ().swap (entries);
+	  return;
+	}
+    }
+
+  NodeVec &to_nodes = bvh.node_storage;
+  std::vector<const Surface::Renderable *> &to_surface_ptrs
+    = bvh.surface_ptrs;
+
+  // A binary tree with N leaves has 2N - 1 nodes, and there's at
+  // least one surface per leaf.
+  //
+  to_nodes.reserve (2 * num_entries - 1);
+  to_surface_ptrs.reserve (num_entries);
+
+  // The root node has no parent, so we use its own bounds in place of
+  // its parent's; when using compact nodes, these must be kept in the
+  // BVH for use when searching.
+  //
+  BBox root_bbox, root_cent_bbox;
+  calc_bounds (0, num_entries, threads, root_bbox, root_cent_bbox);
+  Bounds root_bounds;
+  Node::round_bounds (root_bbox, root_bounds);
+#if USE_COMPACT_ACCEL
+  bvh.root_bounds = root_bounds;
+#endif
+
+  build_node (0, num_entries, 1, root_bounds, num_threads,
+	      to_nodes, to_surface_ptrs);
+
+  ASSERT (to_surface_ptrs.size () == entries.size ());
+
+  bvh.nodes = &to_nodes[0];
+  bvh.num_nodes = to_nodes.size ();
+
+  // We don't need our entries any more, so free the memory they use
+  // (for large scenes this is substantial).
+  //
+  std::vector<Entry> ().swap (entries);
+
+  if (! cache_file.empty ())
+    {
+      std::vector<unsigned> surface_indices;
+      SpaceCache::get_surface_indices (surfaces, to_surface_ptrs,
+				       surface_indices);
+
+#if USE_COMPACT_ACCEL
+      const void *extra = &bvh.root_bounds;
+#else
+      const void *extra = 0;
+#endif
+
+      SpaceCache::save (cache_file, cache_type (), key,
+			bvh.nodes, sizeof (Node), bvh.num_nodes,
+			surface_indices, extra, cache_extra_size ());
+    }
+}
+
+
+
+// Bvh::Builder::load_cached
+
+// If our accelerator cache file holds a BVH built from the surfaces in
+// SURFACES (in the order they were added), whose bounding-boxes have
+// key KEY, store it into BVH and return true; otherwise return false.
+//
+bool
+Bvh::Builder::load_cached (
+		const std::vector<const Surface::Renderable *> &surfaces,
+		const SpaceCache::Key &key, Bvh &bvh)
+  const
+{
+  UniquePtr<SpaceCache> cache (
+    SpaceCache::load (cache_file, cache_type (), sizeof (Node),
+		      cache_extra_size (), key));
+
+  if (! cache.get ())
+    return false;
+
+  const Node *nodes = static_cast<const Node *> (cache->nodes ());
+  unsigned num_nodes = cache->num_nodes ();
+
+  if (! cache->get_surface_ptrs (surfaces, bvh.surface_ptrs)
+      || ! valid_nodes (nodes, num_nodes, bvh.surface_ptrs.size ()))
+    {
+      bvh.surface_ptrs.clear ();
+      return false;
+    }
+
+  bvh.nodes = nodes;
+  bvh.num_nodes = num_nodes;
+#if USE_COMPACT_ACCEL
+  bvh.root_bounds = *static_cast<const Bounds *> (cache->extra ());
+#endif
+  bvh.cache.reset (cache.release ());
+
+  return true;
+}
+
+// Return true if the NUM_NODES nodes at NODES form a plausible tree
+// referring to NUM_SURFACE_PTRS surface pointers.  This makes sure that
+// a tree loaded from an accelerator cache file can't cause
+// out-of-bounds accesses when searched.
+//
+bool
+Bvh::Builder::valid_nodes (const Node *nodes, unsigned num_nodes,
+			   unsigned num_surface_ptrs)
+{
+  for (unsigned i = 0; i < num_nodes; i++)
+    {
+      const Node &node = nodes[i];
+
+      if (node.is_leaf_node ())
+	{
+	  if (node.index > num_surface_ptrs
+	      || node.num_surfaces > num_surface_ptrs - node.index)
+	    return false;
+	}
+      else if (node.index <= i + 1 || node.index >= num_nodes
+	       || node.split_axis > 2)
+	return false;
+    }
+
+  return true;
+}
+
+
+
+// Bvh::Builder::build_node
+
+// Recursively build a BVH node for the entries from BEG_ENTRY to
+// END_ENTRY (exclusive), which is at depth DEPTH in the tree, and whose
+// parent node has bounds PARENT_BOUNDS, adding it and all its
+// descendants to the end of TO_NODES.  At most THREADS threads
+// (including the calling thread) will be used.
+//
+void
+Bvh::Builder::build_node (
+		unsigned beg_entry, unsigned end_entry, unsigned depth,
+		const Bounds &parent_bounds, unsigned threads,
+		NodeVec &to_nodes,
+		std::vector<const Surface::Renderable *> &to_surface_ptrs)
+{
+  unsigned num_entries = end_entry - beg_entry;
+
+  threads = useful_threads (num_entries, threads);
+
+  // Calculate the bounding-box of all our entries, and of their
+  // centroids.
+  //
+  BBox node_bbox, cent_bbox;
+  calc_bounds (beg_entry, end_entry, threads, node_bbox, cent_bbox);
+
+  // BOUNDS are this node's bounds as a search will see them, which
+  // are needed to build our children (compact nodes store their
+  // bounds relative to those of their parent).
+  //
+  Bounds bounds;
+  unsigned node_index = to_nodes.size ();
+  to_nodes.push_back (Node ());
+  to_nodes[node_index].set_bbox (node_bbox, parent_bounds, bounds);
+
+  // Decide how to split this node, if at all.  If MID_ENTRY remains
+  // 0, we make a leaf node.
+  //
+  unsigned mid_entry = 0;
+  unsigned split_axis = 0;
+
+  if (num_entries > 1)
+    {
+      if (depth < MAX_SAH_DEPTH)
+	mid_entry = sah_split (beg_entry, end_entry, node_bbox, cent_bbox,
+			       threads, split_axis);
+      else if (num_entries > MAX_SAH_LEAF_SURFACES)
+	{
+	  // We're very deep in the tree, so just split in half along
+	  // the longest centroid axis, to guarantee that the tree
+	  // depth remains bounded.
+	  //
+	  Vec cent_ext = cent_bbox.extent ();
+	  split_axis = ((cent_ext.x > cent_ext.y && cent_ext.x > cent_ext.z)
+			? 0 : (cent_ext.y > cent_ext.z) ? 1 : 2);
+	  mid_entry = beg_entry + num_entries / 2;
+	  std::nth_element (entries.begin () + beg_entry,
+			    entries.begin () + mid_entry,
+			    entries.begin () + end_entry,
+			    CentroidLess (split_axis));
+	}
+    }
+
+  if (mid_entry == 0)
+    {
+      // Make a leaf node.
+
+      ASSERT (num_entries <= Node::MAX_LEAF_SURFACES);
+
+      to_nodes[node_index].make_leaf_node (to_surface_ptrs.size (),
+					   num_entries);
+
+      for (unsigned i = beg_entry; i < end_entry; i++)
+	to_surface_ptrs.push_back (entries[i].surface);
+    }
+  else if (threads > 1)
+    {
+      // Make an interior node, building the second child's subtree in
+      // a new thread while this thread builds the first child's.  The
+      // available threads are divided between them.
+      //
+      // The second subtree is built into separate vectors, which are
+      // then appended to TO_NODES and TO_SURFACE_PTRS after the first
+      // subtree, adjusting their indices to match; the result is
+      // exactly what building them in order would produce.
+
+      unsigned lo_threads = threads / 2;
+
+      SubtreeJob hi_job (*this, mid_entry, end_entry, depth + 1, bounds,
+			 threads - lo_threads);
+
+#if USE_THREADS
+      Thread hi_thread (&SubtreeJob::run, &hi_job);
+#endif
+
+      build_node (beg_entry, mid_entry, depth + 1, bounds, lo_threads,
+		  to_nodes, to_surface_ptrs);
+
+#if USE_THREADS
+      hi_thread.join ();
+#else
+      hi_job.run ();
+#endif
+
+      unsigned node_offs = to_nodes.size ();
+      unsigned surface_offs = to_surface_ptrs.size ();
+
+      to_nodes[node_index].make_interior_node (node_offs, split_axis);
+
+      for (NodeVec::iterator ni = hi_job.nodes.begin ();
+	   ni != hi_job.nodes.end (); ++ni)
+	{
+	  if (ni->is_leaf_node ())
+	    ni->index += surface_offs;
+	  else
+	    ni->index += node_offs;
+	  to_nodes.push_back (*ni);
+	}
+
+      to_surface_ptrs.insert (to_surface_ptrs.end (),
+			      hi_job.surface_ptrs.begin (),
+			      hi_job.surface_ptrs.end ());
+    }
+  else
+    {
+      // Make an interior node.  The first child immediately follows
+      // this node in TO_NODES, and the second child follows all the
+      // descendants of the first child.
+
+      build_node (beg_entry, mid_entry, depth + 1, bounds, 1,
+		  to_nodes, to_surface_ptrs);
+
+      // Note that TO_NODES may have been reallocated by now, so we
+      // can't keep a reference to our node across the recursive calls.
+      //
+      to_nodes[node_index].make_interior_node (to_nodes.size (), split_axis);
+
+      build_node (mid_entry, end_entry, depth + 1, bounds, 1,
+		  to_nodes, to_surface_ptrs);
+    }
+}
+
+
+
+// Bvh::Builder::calc_bounds
+
+// Calculate the bounding-box of the entries from BEG_ENTRY to
+// END_ENTRY, and of their centroids, storing them into NODE_BBOX and
+// CENT_BBOX.  At most THREADS threads will be used.
+//
+void
+Bvh::Builder::calc_bounds (unsigned beg_entry, unsigned end_entry,
+			   unsigned threads,
+			   BBox &node_bbox, BBox &cent_bbox)
+  const
+{
+  std::vector<BoundsJob> jobs;
+  for (unsigned t = 0; t < threads; t++)
+    jobs.push_back (
+      BoundsJob (*this, chunk_start (beg_entry, end_entry, t, threads),
+		 chunk_start (beg_entry, end_entry, t + 1, threads)));
+
+  run_jobs (jobs);
+
+  // Merging bounding-boxes is exact, so the result doesn't depend on
+  // how the entries were divided up.
+  //
+  for (std::vector<BoundsJob>::iterator ji = jobs.begin ();
+       ji != jobs.end (); ++ji)
+    {
+      node_bbox += ji->node_bbox;
+      cent_bbox += ji->cent_bbox;
+    }
+}
+
+
+
+// Bvh::Builder::bin_entries
+
+// Add the entries from BEG_ENTRY to END_ENTRY to the surface-area
+// heuristic buckets in BUCKETS, for every axis on which CENT_BBOX, the
+// bounding-box of their centroids, has a non-zero extent.  At most
+// THREADS threads will be used.
+//
+void
+Bvh::Builder::bin_entries (unsigned beg_entry, unsigned end_entry,
+			   const BBox &cent_bbox, unsigned threads,
+			   SahBuckets &buckets)
+  const
+{
+  if (threads > 1)
+    {
+      std::vector<BinJob> jobs;
+      for (unsigned t = 0; t < threads; t++)
+	jobs.push_back (
+	  BinJob (*this, chunk_start (beg_entry, end_entry, t, threads),
+		  chunk_start (beg_entry, end_entry, t + 1, threads),
+		  cent_bbox));
+
+      run_jobs (jobs);
+
+      // As with bounding-boxes, merging buckets is exact.
+      //
+      for (std::vector<BinJob>::iterator ji = jobs.begin ();
+	   ji != jobs.end (); ++ji)
+	for (unsigned axis = 0; axis < 3; axis++)
+	  for (unsigned b = 0; b < NUM_SAH_BUCKETS; b++)
+	    {
+	      const SahBucket &from = ji->buckets.buckets[axis][b];
+	      SahBucket &to = buckets.buckets[axis][b];
+	      to.num_surfaces += from.num_surfaces;
+	      to.bbox += from.bbox;
+	    }
+
+      return;
+    }
+
+  coord_t cent_min[3], cent_scale[3];
+  bool useful[3];
+  for (unsigned axis = 0; axis < 3; axis++)
+    {
+      cent_min[axis] = cent_bbox.min[axis];
+      coord_t cent_extent = cent_bbox.max[axis] - cent_min[axis];
+      useful[axis] = (cent_extent > 0);
+      cent_scale[axis] = useful[axis] ? NUM_SAH_BUCKETS / cent_extent : 0;
+    }
+
+  for (unsigned i = beg_entry; i < end_entry; i++)
+    {
+      const Entry &entry = entries[i];
+      Pos cent = entry.centroid ();
+
+      for (unsigned axis = 0; axis < 3; axis++)
+	if (useful[axis])
+	  {
+	    SahBucket &bucket
+	      = buckets.buckets[axis][bucket_index (cent[axis],
+						    cent_min[axis],
+						    cent_scale[axis])];
+	    bucket.num_surfaces++;
+	    bucket.bbox += entry.bbox;
+	  }
+    }
+}
+
+
+
+// Bvh::Builder::sah_split
+
+// Try to find a split for the entries from BEG_ENTRY to END_ENTRY
+// using the surface-area heuristic.  NODE_BBOX is the bounding-box of
+// all those entries, and CENT_BBOX the bounding-box of their
+// centroids.
+//
+// If splitting is better than making a leaf, or if there are too many
+// entries for a leaf, partition the entries so that those for the
+// first child come first, set SPLIT_AXIS to the axis used, and return
+// the index of the first entry for the second child.  Otherwise
+// return 0.  At most THREADS threads will be used.
+//
+unsigned
+Bvh::Builder::sah_split (unsigned beg_entry, unsigned end_entry,
+			 const BBox &node_bbox, const BBox &cent_bbox,
+			 unsigned threads, unsigned &split_axis)
+{
+  unsigned num_entries = end_entry - beg_entry;
+
+  // The best split found so far, in terms of axis, the last bucket
+  // on the low side of the split, and estimated cost.  The cost is
+  // relative to that of a single surface intersection test, and
+  // doesn't include the node's own bounding-box test, which is the
+  // same whether we split or not.
+  //
+  unsigned best_axis = 0, best_split_bucket = 0;
+  dist_t best_cost = 0;
+  bool found_split = false;
+
+  dist_t node_area = surface_area (node_bbox);
+
+  // Sort entries into buckets, for all axes at once.
+  //
+  SahBuckets all_buckets;
+  bin_entries (beg_entry, end_entry, cent_bbox, threads, all_buckets);
+
+  for (unsigned axis = 0; axis < 3; axis++)
+    {
+      // If all centroids are in the same position on this axis, it's
+      // useless for splitting.
+      //
+      if (cent_bbox.max[axis] - cent_bbox.min[axis] <= 0)
+	continue;
+
+      const SahBucket *buckets = all_buckets.buckets[axis];
+
+      // Sweep from the high end, recording the area and surface-count
+      // of everything above each possible split.
+      //
+      dist_t hi_areas[NUM_SAH_BUCKETS];
+      unsigned hi_counts[NUM_SAH_BUCKETS];
+      BBox hi_bbox;
+      unsigned hi_count = 0;
+      for (unsigned b = NUM_SAH_BUCKETS - 1; b > 0; b--)
+	{
+	  hi_bbox += buckets[b].bbox;
+	  hi_count += buckets[b].num_surfaces;
+	  hi_areas[b] = hi_count ? surface_area (hi_bbox) : 0;
+	  hi_counts[b] = hi_count;
+	}
+
+      // Now sweep from the low end, evaluating the cost of splitting
+      // after each bucket.
+      //
+      BBox lo_bbox;
+      unsigned lo_count = 0;
+      for (unsigned b = 0; b < NUM_SAH_BUCKETS - 1; b++)
+	{
+	  lo_bbox += buckets[b].bbox;
+	  lo_count += buckets[b].num_surfaces;
+
+	  if (lo_count == 0 || hi_counts[b + 1] == 0)
+	    continue;
+
+	  dist_t cost
+	    = (2 * node_isec_cost ()
+	       + (surface_area (lo_bbox) * lo_count
+		  + hi_areas[b + 1] * hi_counts[b + 1])
+	         / node_area);
+
+	  if (!found_split || cost < best_cost)
+	    {
+	      best_axis = axis;
+	      best_split_bucket = b;
+	      best_cost = cost;
+	      found_split = true;
+	    }
+	}
+    }
+
+  if (! found_split)
+    {
+      // All centroids are coincident, so the surface-area heuristic
+      // is useless; if there are too many surfaces for a leaf, just
+      // split them in half.
+      //
+      if (num_entries > MAX_SAH_LEAF_SURFACES)
+	{
+	  split_axis = 0;
+	  return beg_entry + num_entries / 2;
+	}
+      return 0;
+    }
+
+  // If there aren't too many surfaces, see if just making a leaf is
+  // cheaper; the cost of a leaf is just the cost of testing all its
+  // surfaces.  [If NODE_AREA is zero, the costs are meaningless, so
+  // make a leaf if we can.]
+  //
+  if (num_entries <= MAX_SAH_LEAF_SURFACES
+      && (node_area <= 0 || dist_t (num_entries) <= best_cost))
+    return 0;
+
+  coord_t cent_min = cent_bbox.min[best_axis];
+  coord_t cent_scale
+    = NUM_SAH_BUCKETS / (cent_bbox.max[best_axis] - cent_min);
+
+  std::vector<Entry>::iterator mid
+    = std::partition (entries.begin () + beg_entry,
+		      entries.begin () + end_entry,
+		      InLowBuckets (best_axis, best_split_bucket,
+				    cent_min, cent_scale));
+
+  split_axis = best_axis;
+  return mid - entries.begin ();
+}
+
+
+
+// Bvh::Builder::build_space
+
+// Make the final space.  Note that this can only be done once.
+//
+const Space *
+Bvh::Builder::build_space ()
+{
+  return new Bvh (*this);
+}
+
+
+
+// Bvh constructor
+
+// Make a new BVH, using info from BUILDER.  This should only be
+// invoked directly by Bvh::Builder::build_space.
+//
+Bvh::Bvh (Builder &builder)
+  : Space (builder), nodes (0), num_nodes (0)
+{
+  builder.build (*this);
+}
+
+
+
+// Bvh::BuilderFactory
+
+// Return a new SpaceBuilder object.
+//
+SpaceBuilder *
+Bvh::BuilderFactory::make_space_builder () const
+{
+  return new Bvh::Builder (num_threads, cache_file);
+}
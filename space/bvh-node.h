@@ -0,0 +1,274 @@
+// bvh-node.h -- Node in a Bvh
+//
+//  Copyright (C) 2014  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#ifndef SNOGRAY_BVH_NODE_H
+#define SNOGRAY_BVH_NODE_H
+
+#include <cmath>
+
+#include "geometry/bbox.h"
+
+#include "bvh.h"
+
+
+namespace snogray {
+
+
+// A node in the BVH, holding a bounding-box which encloses everything
+// below it.  Interior nodes have exactly two children, and leaf nodes
+// have a contiguous range of surfaces.
+//
+// Nodes are stored in depth-first order in the Bvh::nodes vector, so
+// the first child of an interior node is always the node immediately
+// following it, and only the index of the second child need be stored.
+//
+// Nodes are exactly 32 bytes, so two fit in a typical 64-byte cache
+// line; to achieve this, the bounding-box is always stored in
+// single-precision, even when coord_t is double-precision.
+//
+// If USE_COMPACT_ACCEL is defined, nodes instead store their
+// bounding-box quantized to 8 bits per bound, relative to the
+// bounding-box of their parent node, which makes them only 16 bytes.
+// A search must then decode each node's bounds from its parent's (see
+// Bvh::Node::get_bounds), which costs a few extra multiply-adds per
+// node, but for very large scenes, halving the size of the tree more
+// than makes up for that.
+//
+struct Bvh::Node
+{
+  // The maximum number of surfaces a leaf node can hold.
+  //
+  static const unsigned MAX_LEAF_SURFACES = 0xFFFF;
+
+  // The maximum depth of a BVH tree.  Searching uses a fixed-size
+  // stack of this size, and Bvh::Builder makes sure it is never
+  // exceeded.
+  //
+  static const unsigned MAX_DEPTH = 96;
+
+#if USE_COMPACT_ACCEL
+  // The number of quantization steps between a parent node's lower
+  // and upper bound on each axis.
+  //
+  static const unsigned QUANT_STEPS = 255;
+
+  // The size of nodes when not using compact nodes, which is used to
+  // calculate how much memory they save.
+  //
+  static const unsigned UNCOMPRESSED_SIZE = 32;
+#endif
+
+  Node () : index (0), num_surfaces (0), split_axis (0) { }
+
+  // Set the bounds of this node to BBOX, where PARENT_BOUNDS are the
+  // bounds of its parent node (as returned by Bvh::Node::get_bounds),
+  // and store the resulting bounds of this node, as a search will see
+  // them, into BOUNDS.  If BBOX cannot be exactly represented, it is
+  // rounded outwards, so the result always encloses BBOX.
+  //
+  // PARENT_BOUNDS must enclose BBOX; for the root node, they should
+  // just be BBox rounded outwards (see Bvh::Node::round_bounds).
+  //
+  void set_bbox (const BBox &bbox, const Bounds &parent_bounds,
+		 Bounds &bounds)
+  {
+    round_bounds (bbox, bounds);
+
+#if USE_COMPACT_ACCEL
+    for (unsigned axis = 0; axis < 3; axis++)
+      {
+	float lo = bounds.corner[0][axis], hi = bounds.corner[1][axis];
+	float parent_lo = parent_bounds.corner[0][axis];
+	float parent_hi = parent_bounds.corner[1][axis];
+	float step = quant_step (parent_lo, parent_hi);
+
+	// Leave a little slack, so that slightly different rounding
+	// when a search decodes the bounds (e.g., due to the use of
+	// fused multiply-add instructions) can't make them too small.
+	//
+	lo = nextafterf (lo, -MAX_COORD);
+	hi = nextafterf (hi, MAX_COORD);
+
+	// Start with the tightest quantized bound, and then move it
+	// outwards until it encloses the real bound (which may be
+	// necessary due to rounding).  A quantized
+	// bound of zero is always exactly the parent's bound, which
+	// encloses everything in the node.
+	//
+	unsigned q_lo = quantize (lo - parent_lo, step);
+	while (q_lo > 0 && decode_lo (parent_lo, q_lo, step) > lo)
+	  q_lo--;
+	unsigned q_hi = quantize (parent_hi - hi, step);
+	while (q_hi > 0 && decode_hi (parent_hi, q_hi, step) < hi)
+	  q_hi--;
+
+	quant_bounds[0][axis] = q_lo;
+	quant_bounds[1][axis] = q_hi;
+      }
+
+    get_bounds (parent_bounds, bounds);
+#else // !USE_COMPACT_ACCEL
+    (void)parent_bounds;
+    for (unsigned axis = 0; axis < 3; axis++)
+      {
+	this->bounds[0][axis] = bounds.corner[0][axis];
+	this->bounds[1][axis] = bounds.corner[1][axis];
+      }
+#endif // USE_COMPACT_ACCEL
+  }
+
+  // Store the bounds of this node into BOUNDS, where PARENT_BOUNDS
+  // are the bounds of its parent node.  For the root node, the bounds
+  // passed to Bvh::Node::set_bbox as PARENT_BOUNDS should be used.
+  //
+  void get_bounds (const Bounds &parent_bounds, Bounds &bounds) const
+  {
+#if USE_COMPACT_ACCEL
+    for (unsigned axis = 0; axis < 3; axis++)
+      {
+	float parent_lo = parent_bounds.corner[0][axis];
+	float parent_hi = parent_bounds.corner[1][axis];
+	float step = quant_step (parent_lo, parent_hi);
+	bounds.corner[0][axis]
+	  = decode_lo (parent_lo, quant_bounds[0][axis], step);
+	bounds.corner[1][axis]
+	  = decode_hi (parent_hi, quant_bounds[1][axis], step);
+      }
+#else // !USE_COMPACT_ACCEL
+    (void)parent_bounds;
+    for (unsigned axis = 0; axis < 3; axis++)
+      {
+	bounds.corner[0][axis] = this->bounds[0][axis];
+	bounds.corner[1][axis] = this->bounds[1][axis];
+      }
+#endif // USE_COMPACT_ACCEL
+  }
+
+  // Store BBOX into BOUNDS, rounded outwards to single-precision if
+  // it cannot be exactly represented, so that BOUNDS always encloses
+  // BBOX.
+  //
+  static void round_bounds (const BBox &bbox, Bounds &bounds)
+  {
+    for (unsigned axis = 0; axis < 3; axis++)
+      {
+	float lo = bbox.min[axis], hi = bbox.max[axis];
+	if (lo > bbox.min[axis])
+	  lo = nextafterf (lo, -MAX_COORD);
+	if (hi < bbox.max[axis])
+	  hi = nextafterf (hi, MAX_COORD);
+	bounds.corner[0][axis] = lo;
+	bounds.corner[1][axis] = hi;
+      }
+  }
+
+  // Return true if this is a leaf node.
+  //
+  bool is_leaf_node () const { return num_surfaces != 0; }
+
+  // Make this node a leaf node, holding the NUM entries in
+  // Bvh::surface_ptrs starting at index FIRST.
+  //
+  void make_leaf_node (unsigned first, unsigned num)
+  {
+    index = first;
+    num_surfaces = num;
+  }
+
+  // Make this node an interior node whose second child is at index
+  // SECOND_CHILD in Bvh::nodes, and whose children were split along
+  // axis AXIS (0 = x, 1 = y, 2 = z).
+  //
+  void make_interior_node (unsigned second_child, unsigned axis)
+  {
+    index = second_child;
+    num_surfaces = 0;
+    split_axis = axis;
+  }
+
+#if USE_COMPACT_ACCEL
+
+  // Return the size of a quantization step for a parent node whose
+  // bounds on some axis are PARENT_LO and PARENT_HI.  The division is
+  // done before the subtraction, so that it can't overflow even for
+  // huge bounds.
+  //
+  static float quant_step (float parent_lo, float parent_hi)
+  {
+    const float scale = 1.f / QUANT_STEPS;
+    return parent_hi * scale - parent_lo * scale;
+  }
+
+  // Return the number of whole quantization steps of size STEP in the
+  // distance DIST, clamped to the range [0, QUANT_STEPS].
+  //
+  static unsigned quantize (float dist, float step)
+  {
+    if (step <= 0 || dist <= 0)
+      return 0;
+    float q = dist / step;
+    return q < float (QUANT_STEPS) ? unsigned (q) : QUANT_STEPS;
+  }
+
+  // Return the lower or upper bound, respectively, corresponding to a
+  // quantized bound of Q steps of size STEP inwards from the parent
+  // node's bound PARENT_LO or PARENT_HI.
+  //
+  static float decode_lo (float parent_lo, unsigned q, float step)
+  {
+    return parent_lo + float (q) * step;
+  }
+  static float decode_hi (float parent_hi, unsigned q, float step)
+  {
+    return parent_hi - float (q) * step;
+  }
+
+  // Bounding-box enclosing everything in this node, as quantization
+  // steps inwards from the bounds of the parent node: QUANT_BOUNDS[0]
+  // is the number of steps upwards from the parent's minimum corner,
+  // and QUANT_BOUNDS[1] the number of steps downwards from its maximum
+  // corner.
+  //
+  unsigned char quant_bounds[2][3];
+
+#else // !USE_COMPACT_ACCEL
+
+  // Bounding-box enclosing everything in this node, in the same form
+  // as Bvh::Bounds.
+  //
+  float bounds[2][3];
+
+#endif // USE_COMPACT_ACCEL
+
+  // For an interior node, the index in Bvh::nodes of the second child
+  // (the first child is always at the following index).  For a leaf
+  // node, the index in Bvh::surface_ptrs of the first surface.
+  //
+  unsigned index;
+
+  // The number of surfaces in a leaf node, or zero if this is an
+  // interior node.
+  //
+  unsigned short num_surfaces;
+
+  // For an interior node, the axis along which the children were
+  // split; the first child is on the "low" side of the split.  This
+  // is used during searching to visit children in the order the ray
+  // encounters them.
+  //
+  unsigned char split_axis;
+};
+
+
+}
+
+#endif // SNOGRAY_BVH_NODE_H
@@ -0,0 +1,617 @@
+// bvh.cc -- Bounding-volume hierarchy search accelerator
+//
+//  Copyright (C) 2014  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#include "bvh.h"
+#include "bvh-node.h"
+
+
+using namespace snogray;
+
+
+
+// Bvh::SearchState
+
+struct Bvh::SearchState : Space::SearchState
+{
+  SearchState (const Bvh &bvh, const Ray &_ray, IntersectCallback &_callback)
+    : Space::SearchState (_callback),
+      ray (_ray),
+      inv_dir (ray.dir.x == 0 ? dist_t (1e9) : 1 / ray.dir.x,
+	       ray.dir.y == 0 ? dist_t (1e9) : 1 / ray.dir.y,
+	       ray.dir.z == 0 ? dist_t (1e9) : 1 / ray.dir.z),
+      nodes (bvh.nodes), surface_ptrs (bvh.surface_ptrs)
+#if USE_COMPACT_ACCEL
+      , root_bounds (bvh.root_bounds)
+#endif
+  {
+    dir_is_neg[0] = (inv_dir.x < 0);
+    dir_is_neg[1] = (inv_dir.y < 0);
+    dir_is_neg[2] = (inv_dir.z < 0);
+  }
+
+  // Call our callback for each surface in the BVH that might
+  // intersect our ray.
+  //
+  void for_each_possible_intersector ();
+
+  // Return true if our ray intersects a node with bounds BOUNDS
+  // (in the form of Bvh::Bounds::corner), within the ray's current
+  // bounds.
+  //
+  bool intersects_node (const float (&bounds)[2][3])
+  {
+    node_intersect_calls++;
+
+    // Because we know the direction of the ray on each axis, we can
+    // directly choose the near and far bounding-planes without
+    // comparing them.
+    //
+    dist_t x_min_t = (bounds[dir_is_neg[0]][0] - ray.origin.x) * inv_dir.x;
+    dist_t x_max_t = (bounds[1 - dir_is_neg[0]][0] - ray.origin.x) * inv_dir.x;
+    dist_t y_min_t = (bounds[dir_is_neg[1]][1] - ray.origin.y) * inv_dir.y;
+    dist_t y_max_t = (bounds[1 - dir_is_neg[1]][1] - ray.origin.y) * inv_dir.y;
+    dist_t z_min_t = (bounds[dir_is_neg[2]][2] - ray.origin.z) * inv_dir.z;
+    dist_t z_max_t = (bounds[1 - dir_is_neg[2]][2] - ray.origin.z) * inv_dir.z;
+
+    dist_t min_t = max (ray.t0, max (x_min_t, max (y_min_t, z_min_t)));
+    dist_t max_t = min (ray.t1, min (x_max_t, min (y_max_t, z_max_t)));
+
+    // Note that we use "<=" rather than "<", as bounding-boxes may be
+    // flat in some dimension (e.g., a single axis-aligned triangle).
+    //
+    return min_t <= max_t;
+  }
+
+  // Ray being searched along.  Note that this must be a reference,
+  // not a copy, as the ray it points to may actually change (and
+  // ignoring those changes would mean we lose the opportunity to
+  // prune the search).
+  //
+  const Ray &ray;
+
+  // The reciprocal of each component of RAY's direction.
+  //
+  Vec inv_dir;
+
+  // For each axis, true if RAY's direction is negative in that axis.
+  //
+  unsigned dir_is_neg[3];
+
+  // Nodes and surface pointers from Bvh.
+  //
+  const Node *nodes;
+  const std::vector<const Surface::Renderable *> &surface_ptrs;
+
+#if USE_COMPACT_ACCEL
+  // Bounds of the root node's "parent" from Bvh.
+  //
+  const Bounds &root_bounds;
+#endif
+};
+
+
+
+
+// Bvh::PacketSearchState
+
+// State for searching a BVH for a packet of rays at once.
+//
+// Ray data is kept in "structure of arrays" form, with one array
+// element (or "lane") per ray, so that the compiler can turn the
+// per-ray loop in Bvh::PacketSearchState::intersects_node into SIMD
+// code.
+//
+struct Bvh::PacketSearchState
+{
+  // The number of lanes is always rounded up to a multiple of this,
+  // so that vectorized loops don't need any special handling for
+  // left-over lanes.  Unused lanes are set up so that they never
+  // intersect anything.
+  //
+  static const unsigned LANE_GROUP = 4;
+
+  PacketSearchState (const Bvh &bvh, unsigned _num_rays, const Ray *_rays,
+		     IntersectCallback *const *_callbacks)
+    : num_rays (_num_rays),
+      num_lanes ((_num_rays + LANE_GROUP - 1) & ~(LANE_GROUP - 1)),
+      rays (_rays), callbacks (_callbacks), live_mask (0),
+      nodes (bvh.nodes), surface_ptrs (bvh.surface_ptrs),
+#if USE_COMPACT_ACCEL
+      root_bounds (bvh.root_bounds),
+#endif
+      node_intersect_calls (0), surf_isec_tests (0), surf_isec_hits (0)
+  {
+    for (unsigned i = 0; i < num_lanes; i++)
+      if (i < num_rays)
+	{
+	  const Ray &ray = rays[i];
+
+	  for (unsigned axis = 0; axis < 3; axis++)
+	    {
+	      org[axis][i] = ray.origin[axis];
+	      inv_dir[axis][i]
+		= ray.dir[axis] == 0 ? dist_t (1e9) : 1 / ray.dir[axis];
+	    }
+
+	  t0[i] = ray.t0;
+	  t1[i] = ray.t1;
+
+	  if (! callbacks[i]->stop)
+	    live_mask |= (1u << i);
+	}
+      else
+	{
+	  for (unsigned axis = 0; axis < 3; axis++)
+	    org[axis][i] = inv_dir[axis][i] = 0;
+
+	  t0[i] = 1;
+	  t1[i] = 0;
+	}
+
+    // Children of interior nodes are visited in the order given by
+    // the first ray's direction (Bvh::for_each_possible_packet_intersector
+    // makes sure that all rays agree).
+    //
+    for (unsigned axis = 0; axis < 3; axis++)
+      dir_is_neg[axis] = (rays[0].dir[axis] < 0);
+  }
+
+  // Call the appropriate callback for each surface in the BVH that
+  // might intersect one of our rays.
+  //
+  void for_each_possible_intersector ();
+
+  // Return a bit-mask of those live rays which intersect a node with
+  // bounds BOUNDS (in the form of Bvh::Bounds::corner), within each
+  // ray's current bounds.  Bit I in the mask corresponds to ray I.
+  //
+  unsigned intersects_node (const float (&bounds)[2][3])
+  {
+    node_intersect_calls++;
+
+    // Rather than choosing the near and far bounding-planes using the
+    // ray direction, as Bvh::SearchState::intersects_node does, we
+    // just use min and max, which are cheap SIMD operations.
+    //
+    unsigned char hit[MAX_PACKET_SIZE];
+    for (unsigned i = 0; i < num_lanes; i++)
+      {
+	dist_t x_lo_t = (bounds[0][0] - org[0][i]) * inv_dir[0][i];
+	dist_t x_hi_t = (bounds[1][0] - org[0][i]) * inv_dir[0][i];
+	dist_t y_lo_t = (bounds[0][1] - org[1][i]) * inv_dir[1][i];
+	dist_t y_hi_t = (bounds[1][1] - org[1][i]) * inv_dir[1][i];
+	dist_t z_lo_t = (bounds[0][2] - org[2][i]) * inv_dir[2][i];
+	dist_t z_hi_t = (bounds[1][2] - org[2][i]) * inv_dir[2][i];
+
+	dist_t min_t
+	  = max (t0[i], max (min (x_lo_t, x_hi_t),
+			     max (min (y_lo_t, y_hi_t), min (z_lo_t, z_hi_t))));
+	dist_t max_t
+	  = min (t1[i], min (max (x_lo_t, x_hi_t),
+			     min (max (y_lo_t, y_hi_t), max (z_lo_t, z_hi_t))));
+
+	hit[i] = (min_t <= max_t);
+      }
+
+    unsigned mask = 0;
+    for (unsigned i = 0; i < num_lanes; i++)
+      mask |= unsigned (hit[i]) << i;
+
+    return mask & live_mask;
+  }
+
+  // Update the global statistical counters in ISEC_STATS with the
+  // results from this search.
+  //
+  void update_isec_stats (RenderStats::IsecStats &isec_stats)
+  {
+    isec_stats.surface_intersects_tests   += surf_isec_tests;
+    isec_stats.surface_intersects_hits    += surf_isec_hits;
+    isec_stats.space_node_intersect_calls += node_intersect_calls;
+  }
+
+  // Number of rays in the packet, and number of lanes in our ray
+  // arrays (NUM_RAYS rounded up to a multiple of LANE_GROUP).
+  //
+  unsigned num_rays, num_lanes;
+
+  // The rays being searched along, and the callback for each.  Rays
+  // are referred to directly (rather than just copied into our
+  // arrays), as a ray may change during the search, which T1 must
+  // track.
+  //
+  const Ray *rays;
+  IntersectCallback *const *callbacks;
+
+  // Ray origins, reciprocal ray directions, and ray bounds, one lane
+  // per ray.
+  //
+  dist_t org[3][MAX_PACKET_SIZE];
+  dist_t inv_dir[3][MAX_PACKET_SIZE];
+  dist_t t0[MAX_PACKET_SIZE], t1[MAX_PACKET_SIZE];
+
+  // A bit-mask of rays whose callback hasn't stopped the search yet.
+  //
+  unsigned live_mask;
+
+  // For each axis, true if the rays' direction is negative in that
+  // axis.
+  //
+  unsigned dir_is_neg[3];
+
+  // Nodes and surface pointers from Bvh.
+  //
+  const Node *nodes;
+  const std::vector<const Surface::Renderable *> &surface_ptrs;
+
+#if USE_COMPACT_ACCEL
+  // Bounds of the root node's "parent" from Bvh.
+  //
+  const Bounds &root_bounds;
+#endif
+
+  // Keep track of some intersection statistics.  Note that
+  // NODE_INTERSECT_CALLS counts a node test for an entire packet only
+  // once.
+  //
+  unsigned long node_intersect_calls;
+  unsigned surf_isec_tests, surf_isec_hits;
+};
+
+
+
+// Ray intersection testing (Bvh::for_each_possible_intersector)
+
+// Call CALLBACK for each surface in the BVH that _might_ intersect
+// RAY (any further intersection testing needs to be done directly on
+// the resulting surfaces).  CONTEXT is used to access various cache
+// data structures.  ISEC_STATS will be updated.
+//
+void
+Bvh::for_each_possible_intersector (const Ray &ray,
+				    IntersectCallback &callback,
+				    RenderContext &,
+				    RenderStats::IsecStats &isec_stats)
+  const
+{
+  if (num_nodes != 0)
+    {
+      // As every surface occurs in exactly one leaf node, there's no
+      // need for a negative-intersection cache, as the octree uses.
+
+      SearchState ss (*this, ray, callback);
+
+      ss.for_each_possible_intersector ();
+
+      ss.update_isec_stats (isec_stats);
+    }
+}
+
+// Packet variant of Bvh::for_each_possible_intersector:  For each
+// surface in the BVH that _might_ intersect one of the NUM_RAYS rays
+// in RAYS, call the corresponding entry of CALLBACKS with it.  All rays
+// are searched for simultaneously, so each node is only visited once
+// per packet.  NUM_RAYS must not be greater than MAX_PACKET_SIZE.
+//
+void
+Bvh::for_each_possible_packet_intersector (unsigned num_rays,
+					   const Ray *rays,
+					   IntersectCallback *const *callbacks,
+					   RenderContext &context,
+					   RenderStats::IsecStats &isec_stats)
+  const
+{
+  // Searching for a packet is only a win if the rays are coherent,
+  // so that they visit mostly the same nodes.  As a cheap test for
+  // that, we require that all rays have the same direction signs
+  // (which also means that they agree on the order in which to visit
+  // child nodes); otherwise, just search for each ray separately.
+  //
+  bool coherent = (num_rays > 1);
+  for (unsigned i = 1; i < num_rays && coherent; i++)
+    coherent = ((rays[i].dir.x < 0) == (rays[0].dir.x < 0)
+		&& (rays[i].dir.y < 0) == (rays[0].dir.y < 0)
+		&& (rays[i].dir.z < 0) == (rays[0].dir.z < 0));
+
+  if (! coherent)
+    Space::for_each_possible_packet_intersector (num_rays, rays, callbacks,
+						 context, isec_stats);
+  else if (num_nodes != 0)
+    {
+      PacketSearchState ss (*this, num_rays, rays, callbacks);
+
+      ss.for_each_possible_intersector ();
+
+      ss.update_isec_stats (isec_stats);
+    }
+}
+
+
+
+// Ray intersection testing (Bvh::SearchState::for_each_possible_intersector)
+
+// Call our callback for each surface in the BVH that might intersect
+// our ray.
+//
+// Children of each interior node are visited in the order the ray
+// encounters them, so that when searching for the closest
+// intersection, the ray's upper bound (Ray::t1) will be reduced as
+// early as possible, pruning any nodes which lie entirely beyond it.
+//
+// This method is critical for speed.
+//
+void
+Bvh::SearchState::for_each_possible_intersector ()
+{
+  // Stack of nodes yet to be visited.  As the tree is binary, and we
+  // push at most one node per level, this only needs to be as large
+  // as the maximum tree depth (Bvh::Builder guarantees this limit).
+  //
+  unsigned node_stack[Node::MAX_DEPTH];
+  unsigned stack_depth = 0;
+
+#if USE_COMPACT_ACCEL
+  // Compact nodes store their bounds relative to those of their
+  // parent, so we also need to keep track of the bounds of the parent
+  // of the current node, and of each node in NODE_STACK.  Entry I in
+  // PARENT_BOUNDS_STACK holds the bounds of the parent of entry I in
+  // NODE_STACK; as both children of a node have the same parent, the
+  // current node's PARENT_BOUNDS usually points into it too.
+  //
+  Bounds parent_bounds_stack[Node::MAX_DEPTH];
+  const Bounds *parent_bounds = &root_bounds;
+  Bounds bounds;
+#endif
+
+  unsigned node_index = 0;
+
+  for (;;)
+    {
+      const Node &node = nodes[node_index];
+
+#if USE_COMPACT_ACCEL
+      node.get_bounds (*parent_bounds, bounds);
+      if (intersects_node (bounds.corner))
+#else
+      if (intersects_node (node.bounds))
+#endif
+	{
+	  if (node.is_leaf_node ())
+	    {
+	      // Invoke the callback on each of this node's surfaces.
+	      //
+	      unsigned surf_ptr_index = node.index;
+	      unsigned surf_ptr_end = surf_ptr_index + node.num_surfaces;
+
+	      for (; surf_ptr_index < surf_ptr_end; surf_ptr_index++)
+		{
+		  surf_isec_tests++;
+
+		  if (callback (surface_ptrs[surf_ptr_index]))
+		    surf_isec_hits++;
+
+		  if (unlikely (callback.stop))
+		    return;
+		}
+	    }
+	  else
+	    {
+	      // Visit the nearer child next, and push the farther one
+	      // to visit later.  The first child is at the following
+	      // index, and is on the low side of the split.
+	      //
+	      if (dir_is_neg[node.split_axis])
+		{
+		  node_stack[stack_depth++] = node_index + 1;
+		  node_index = node.index;
+		}
+	      else
+		{
+		  node_stack[stack_depth++] = node.index;
+		  node_index = node_index + 1;
+		}
+
+#if USE_COMPACT_ACCEL
+	      parent_bounds_stack[stack_depth - 1] = bounds;
+	      parent_bounds = &parent_bounds_stack[stack_depth - 1];
+#endif
+
+	      continue;
+	    }
+	}
+
+      if (stack_depth == 0)
+	break;
+
+      node_index = node_stack[--stack_depth];
+
+#if USE_COMPACT_ACCEL
+      parent_bounds = &parent_bounds_stack[stack_depth];
+#endif
+    }
+}
+
+
+
+
+// Ray intersection testing (Bvh::PacketSearchState::for_each_possible_intersector)
+
+// Call the appropriate callback for each surface in the BVH that might
+// intersect one of our rays.
+//
+// This works just like Bvh::SearchState::for_each_possible_intersector,
+// except that a node is visited if any live ray intersects it, and a
+// leaf node's surfaces are only passed to the callbacks of rays which
+// intersect the leaf.
+//
+void
+Bvh::PacketSearchState::for_each_possible_intersector ()
+{
+  unsigned node_stack[Node::MAX_DEPTH];
+  unsigned stack_depth = 0;
+
+#if USE_COMPACT_ACCEL
+  Bounds parent_bounds_stack[Node::MAX_DEPTH];
+  const Bounds *parent_bounds = &root_bounds;
+  Bounds bounds;
+#endif
+
+  unsigned node_index = 0;
+
+  for (;;)
+    {
+      const Node &node = nodes[node_index];
+
+#if USE_COMPACT_ACCEL
+      node.get_bounds (*parent_bounds, bounds);
+      unsigned hit_mask = intersects_node (bounds.corner);
+#else
+      unsigned hit_mask = intersects_node (node.bounds);
+#endif
+
+      if (hit_mask)
+	{
+	  if (node.is_leaf_node ())
+	    {
+	      // Invoke the callback for each intersecting ray on each of
+	      // this node's surfaces.
+	      //
+	      unsigned surf_ptr_index = node.index;
+	      unsigned surf_ptr_end = surf_ptr_index + node.num_surfaces;
+
+	      for (; surf_ptr_index < surf_ptr_end; surf_ptr_index++)
+		{
+		  const Surface::Renderable *surf
+		    = surface_ptrs[surf_ptr_index];
+
+		  for (unsigned i = 0; i < num_rays; i++)
+		    if (hit_mask & live_mask & (1u << i))
+		      {
+			IntersectCallback &callback = *callbacks[i];
+
+			surf_isec_tests++;
+
+			if (callback (surf))
+			  surf_isec_hits++;
+
+			// The callback may have shortened the ray.
+			//
+			t1[i] = rays[i].t1;
+
+			if (unlikely (callback.stop))
+			  live_mask &= ~(1u << i);
+		      }
+
+		  if (unlikely (live_mask == 0))
+		    return;
+		}
+	    }
+	  else
+	    {
+	      if (dir_is_neg[node.split_axis])
+		{
+		  node_stack[stack_depth++] = node_index + 1;
+		  node_index = node.index;
+		}
+	      else
+		{
+		  node_stack[stack_depth++] = node.index;
+		  node_index = node_index + 1;
+		}
+
+#if USE_COMPACT_ACCEL
+	      parent_bounds_stack[stack_depth - 1] = bounds;
+	      parent_bounds = &parent_bounds_stack[stack_depth - 1];
+#endif
+
+	      continue;
+	    }
+	}
+
+      if (stack_depth == 0)
+	break;
+
+      node_index = node_stack[--stack_depth];
+
+#if USE_COMPACT_ACCEL
+      parent_bounds = &parent_bounds_stack[stack_depth];
+#endif
+    }
+}
+
+
+
+// Statistics gathering
+
+// Return various statistics about this BVH.
+//
+Bvh::Stats
+Bvh::stats () const
+{
+  Stats stats;
+  if (num_nodes != 0)
+    upd_stats (0, 1, stats);
+  if (stats.num_leaf_nodes != 0)
+    stats.avg_depth /= stats.num_leaf_nodes;
+
+  stats.node_memory = (unsigned long)num_nodes * sizeof (Node);
+  stats.surface_ref_memory
+    = (unsigned long)surface_ptrs.size () * sizeof (surface_ptrs[0]);
+#if USE_COMPACT_ACCEL
+  stats.memory_saved
+    = (long)num_nodes * long (Node::UNCOMPRESSED_SIZE - sizeof (Node));
+#endif
+
+  return stats;
+}
+
+// Return the number of bytes of memory used by this BVH's nodes and
+// surface references.
+//
+unsigned long
+Bvh::memory_use () const
+{
+  Stats st = stats ();
+  return st.node_memory + st.surface_ref_memory;
+}
+
+// Update STATS to reflect the node at index NODE_INDEX, which is at
+// depth DEPTH in the tree.
+//
+void
+Bvh::upd_stats (unsigned node_index, unsigned depth, Stats &stats) const
+{
+  const Node &node = nodes[node_index];
+
+  stats.num_nodes++;
+
+  if (depth > stats.max_depth)
+    stats.max_depth = depth;
+
+  if (node.is_leaf_node ())
+    {
+      stats.num_leaf_nodes++;
+      stats.num_surfaces += node.num_surfaces;
+
+      if (node.num_surfaces > stats.max_leaf_surfaces)
+	stats.max_leaf_surfaces = node.num_surfaces;
+
+      // Bvh::stats will divide this by the number of leaf nodes.
+      //
+      stats.avg_depth += depth;
+    }
+  else
+    {
+      upd_stats (node_index + 1, depth + 1, stats);
+      upd_stats (node.index, depth + 1, stats);
+    }
+}
@@ -0,0 +1,235 @@
+// bvh.h -- Bounding-volume hierarchy search accelerator
+//
+//  Copyright (C) 2014  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#ifndef SNOGRAY_BVH_H
+#define SNOGRAY_BVH_H
+
+#include <vector>
+#include <string>
+
+#include "config.h"
+
+#include "util/aligned-alloc.h"
+#include "util/unique-ptr.h"
+
+#include "space.h"
+#include "space-builder.h"
+#include "space-cache.h"
+
+
+namespace snogray {
+
+
+// A bounding-volume hierarchy.  Unlike an Octree, where surfaces that
+// straddle a split-plane are stored in the parent node, every surface in
+// a BVH is stored in exactly one leaf node, and each node has its own
+// tight bounding-box.  Nodes are arranged using the "surface-area
+// heuristic" (SAH), which tries to minimize the expected cost of
+// intersecting a random ray with the tree.
+//
+class Bvh : public Space
+{
+public:
+
+  // A class used for building a Space object.
+  //
+  class Builder;
+
+  // Subclass of SpaceBuilderFactory for making BVH builders.
+  //
+  class BuilderFactory;
+
+
+  // Call CALLBACK for each surface in the BVH that _might_ intersect
+  // RAY (any further intersection testing needs to be done directly
+  // on the resulting surfaces).  CONTEXT is used to access various
+  // cache data structures.  ISEC_STATS will be updated.
+  //
+  virtual void for_each_possible_intersector (const Ray &ray,
+					      IntersectCallback &callback,
+					      RenderContext &context,
+					      RenderStats::IsecStats &isec_stats)
+    const;
+
+  // Packet variant of Bvh::for_each_possible_intersector:  For each
+  // surface in the BVH that _might_ intersect one of the NUM_RAYS rays
+  // in RAYS, call the corresponding entry of CALLBACKS with it.  All
+  // rays are searched for simultaneously, so each node is only visited
+  // once per packet.  NUM_RAYS must not be greater than
+  // MAX_PACKET_SIZE.
+  //
+  virtual void for_each_possible_packet_intersector (
+			unsigned num_rays, const Ray *rays,
+			IntersectCallback *const *callbacks,
+			RenderContext &context,
+			RenderStats::IsecStats &isec_stats)
+    const;
+
+  // BVH statistics.
+  //
+  struct Stats
+  {
+    Stats ()
+      : num_nodes (0), num_leaf_nodes (0), num_surfaces (0),
+	max_leaf_surfaces (0), max_depth (0), avg_depth (0),
+	node_memory (0), surface_ref_memory (0), memory_saved (0)
+    { }
+
+    unsigned long num_nodes;
+    unsigned long num_leaf_nodes;
+    unsigned long num_surfaces;
+    unsigned max_leaf_surfaces;
+    unsigned max_depth;
+    float avg_depth;
+
+    // Bytes of memory used for nodes, and for references from leaf
+    // nodes to surfaces.
+    //
+    unsigned long node_memory;
+    unsigned long surface_ref_memory;
+
+    // Bytes of memory saved by using compact nodes (the configure
+    // option "--enable-compact-accel"), compared to the normal node
+    // layout; zero if compact nodes aren't being used.
+    //
+    long memory_saved;
+  };
+
+  // Return various statistics about this BVH.
+  //
+  Stats stats () const;
+
+  // Return the number of bytes of memory used by this BVH's nodes and
+  // surface references.
+  //
+  virtual unsigned long memory_use () const;
+
+
+private:
+
+  // A node in the BVH, holding a bounding-box which encloses
+  // everything below it.  Interior nodes have exactly two children,
+  // and leaf nodes have a contiguous range of surfaces.
+  //
+  struct Node;
+
+  // The single-precision bounding-box of a node, as used when
+  // searching.  CORNER[0] is the minimum corner, and CORNER[1] the
+  // maximum corner; storing them in an array means a search can
+  // select the near or far bound on each axis by indexing, using the
+  // sign of the ray's direction.
+  //
+  struct Bounds
+  {
+    float corner[2][3];
+  };
+
+  // Vector type used to hold nodes.  Nodes are aligned to their own
+  // size, so that no node straddles a cache-line boundary.
+  //
+  typedef std::vector<Node, AlignedAllocator<Node, 32> > NodeVec;
+
+  // Class holding state during BVH searches.
+  //
+  struct SearchState;
+
+  // Class holding state during BVH searches for a packet of rays.
+  //
+  struct PacketSearchState;
+
+
+  // Make a new BVH from BUILDER.  This should only be invoked
+  // directly by Bvh::Builder::build_space.
+  //
+  Bvh (Builder &builder);
+
+
+  // Update STATS to reflect the node at index NODE_INDEX, which is
+  // at depth DEPTH in the tree.
+  //
+  void upd_stats (unsigned node_index, unsigned depth, Stats &stats) const;
+
+
+  // Nodes in this BVH, in depth-first order.  The root node is at
+  // index 0, and the first child of any interior node immediately
+  // follows it.  These are either in Bvh::node_storage, or in a
+  // memory-mapped accelerator cache file.
+  //
+  const Node *nodes;
+  unsigned num_nodes;
+
+  // Storage for nodes, if they were built in memory.
+  //
+  NodeVec node_storage;
+
+  // If our nodes were loaded from an accelerator cache file, the
+  // mapping of that file.
+  //
+  UniquePtr<SpaceCache> cache;
+
+#if USE_COMPACT_ACCEL
+  // Bounds of the root node.  Compact nodes store their bounds
+  // relative to those of their parent, and these are used as the
+  // "parent" bounds of the root node.
+  //
+  Bounds root_bounds;
+#endif
+
+  // Pointers to surfaces referred to in this BVH.  Each leaf node
+  // refers to a contiguous run of entries in this vector.
+  //
+  std::vector<const Surface::Renderable *> surface_ptrs;
+};
+
+
+
+// Bvh::BuilderFactory
+
+// Subclass of SpaceBuilderFactory for making BVH builders.
+//
+class Bvh::BuilderFactory : public SpaceBuilderFactory
+{
+public:
+
+  // Make a factory for builders which use at most NUM_THREADS threads
+  // when building a BVH.  The resulting BVH is the same regardless of
+  // the number of threads.
+  //
+  // If CACHE_FILE is not empty, it is used as an accelerator cache:
+  // if it holds a BVH built from the same geometry, that is used
+  // instead of building a new one, and otherwise the newly built BVH
+  // is saved there.
+  //
+  BuilderFactory (unsigned _num_threads = 1,
+		  const std::string &_cache_file = "")
+    : num_threads (_num_threads), cache_file (_cache_file)
+  { }
+
+  // Return a new SpaceBuilder object.
+  //
+  virtual SpaceBuilder *make_space_builder () const;
+
+private:
+
+  // The maximum number of threads builders should use.
+  //
+  unsigned num_threads;
+
+  // Accelerator cache file to use, or an empty string for none.
+  //
+  std::string cache_file;
+};
+
+
+}
+
+#endif // SNOGRAY_BVH_H
@@ -0,0 +1,206 @@
+// isec-mailbox.h -- Per-search set of already-tested surfaces
+//
+//  Copyright (C) 2007, 2011, 2013, 2014  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#ifndef SNOGRAY_ISEC_MAILBOX_H
+#define SNOGRAY_ISEC_MAILBOX_H
+
+#include "config.h"
+
+#include "util/mempool.h"
+#include "surface/surface.h"
+
+
+// We use intptr_t below.  If the system defines, it we must include
+// the proper include file, otherwise, it should be defined in
+// "config.h".  Note that we use the C versions of the header files.
+//
+#if HAVE_INTPTR_T
+# if HAVE_STDINT_H
+#  include <stdint.h>
+# elif HAVE_INTTYPES_H
+#  include <inttypes.h>
+# endif
+#endif // HAVE_INTPTR_T
+
+
+namespace snogray {
+
+
+// A set of surfaces which have already been tested against the ray
+// during a single search, and found not to intersect it.  This is used
+// by search accelerators which may list the same surface in more than
+// one node (e.g., Octree), to avoid testing a surface more than once
+// per search; accelerators which never do that (e.g., Bvh) don't need
+// one.
+//
+// A mailbox lives in the search state, so every search, including
+// nested searches of instanced models, has its own.  Most searches
+// only test a modest number of surfaces, so they are held in a small
+// inline hash table, which is cheap to set up (only a small bitmap of
+// used slots needs to be cleared) and is only touched where surfaces
+// are actually added; if that fills up, a larger table is allocated
+// from a Mempool.
+//
+// Unlike a lossy cache, a mailbox never forgets a surface, which is
+// important for callbacks that are not idempotent (for instance,
+// shadow-ray callbacks accumulate the transmittance of every partially
+// occluding surface, which must only happen once per surface).
+//
+class IsecMailbox
+{
+public:
+
+  // Make an empty mailbox.  MEMPOOL is used to allocate memory if the
+  // number of surfaces grows beyond the inline table; such memory is
+  // only freed when MEMPOOL is reset.
+  //
+  IsecMailbox (Mempool &_mempool)
+    : table (inline_table), used (inline_used),
+      table_mask (INLINE_TABLE_SIZE - 1),
+      table_shift (32 - INLINE_TABLE_BITS), num_surfaces (0),
+      mempool (_mempool)
+  {
+    // Only the bitmap needs to be cleared, not the table itself, which
+    // keeps the cost of setting up a search small.
+    //
+    for (unsigned i = 0; i < INLINE_USED_WORDS; i++)
+      inline_used[i] = 0;
+  }
+
+  // Return true if SURF has been added to this mailbox.
+  //
+  bool contains (const Surface::Renderable *surf) const
+  {
+    for (unsigned i = slot (surf); slot_used (i); i = (i + 1) & table_mask)
+      if (table[i] == surf)
+	return true;
+    return false;
+  }
+
+  // Add SURF to this mailbox.  SURF must not already be present.
+  //
+  void add (const Surface::Renderable *surf)
+  {
+    // Keep the table at most half full, so that probe sequences stay
+    // short.
+    //
+    if (num_surfaces >= (table_mask + 1) / 2)
+      grow ();
+
+    insert (surf);
+    num_surfaces++;
+  }
+
+private:
+
+  // Number of bits in each word of a "used" bitmap.
+  //
+  static const unsigned WORD_BITS = sizeof (unsigned) * 8;
+
+  // The size of the inline hash table is 2^INLINE_TABLE_BITS.
+  //
+  static const unsigned INLINE_TABLE_BITS = 8;
+  static const unsigned INLINE_TABLE_SIZE = 1 << INLINE_TABLE_BITS;
+  static const unsigned INLINE_USED_WORDS = INLINE_TABLE_SIZE / WORD_BITS;
+
+  // Return the first slot in SURF's probe sequence.
+  //
+  unsigned slot (const Surface::Renderable *surf) const
+  {
+    // Surfaces are often allocated consecutively (e.g., mesh
+    // triangles), so using the pointer directly as a hash value would
+    // result in long runs of occupied slots, which make linear probing
+    // slow.  Instead we scramble the pointer with a multiplicative
+    // hash, and use the top bits of the result, which depend on all
+    // the bits of the pointer.
+    //
+    // We first cast to intptr_t to avoid compiler warnings about a
+    // lossy cast (as unsigned may be smaller than a pointer), and then
+    // to unsigned to throw away any upper bits we don't care about.
+    // The hash is truncated to 32 bits in case unsigned is wider.
+    //
+    unsigned hash = (unsigned)((intptr_t)surf >> 3) * 2654435769u;
+    return (hash & 0xFFFFFFFFu) >> table_shift;
+  }
+
+  // Return true if slot I in the table holds a surface.
+  //
+  bool slot_used (unsigned i) const
+  {
+    return (used[i / WORD_BITS] >> (i % WORD_BITS)) & 1;
+  }
+
+  // Add SURF to the first empty slot in its probe sequence.
+  //
+  void insert (const Surface::Renderable *surf)
+  {
+    unsigned i = slot (surf);
+    while (slot_used (i))
+      i = (i + 1) & table_mask;
+    table[i] = surf;
+    used[i / WORD_BITS] |= 1u << (i % WORD_BITS);
+  }
+
+  // Replace the hash table with one twice the size, and re-add all
+  // existing surfaces to it.
+  //
+  void grow ()
+  {
+    const Surface::Renderable **old_table = table;
+    const unsigned *old_used = used;
+    unsigned old_size = table_mask + 1;
+
+    unsigned new_size = old_size * 2;
+    unsigned new_used_words = new_size / WORD_BITS;
+
+    table = static_cast<const Surface::Renderable **> (
+	      operator new (new_size * sizeof table[0], mempool));
+    unsigned *new_used = static_cast<unsigned *> (
+			   operator new (new_used_words * sizeof used[0],
+					 mempool));
+    for (unsigned i = 0; i < new_used_words; i++)
+      new_used[i] = 0;
+    used = new_used;
+
+    table_mask = new_size - 1;
+    table_shift--;
+
+    for (unsigned i = 0; i < old_size; i++)
+      if ((old_used[i / WORD_BITS] >> (i % WORD_BITS)) & 1)
+	insert (old_table[i]);
+  }
+
+  // The hash table, which uses linear probing, and has a size of
+  // TABLE_MASK + 1, or 2^(32 - TABLE_SHIFT).  Slots which hold a
+  // surface are marked in the bitmap USED; other slots are garbage.
+  //
+  // Initially these point to INLINE_TABLE and INLINE_USED, but when
+  // they fill up, they point to larger arrays allocated from MEMPOOL.
+  //
+  const Surface::Renderable **table;
+  unsigned *used;
+  unsigned table_mask, table_shift;
+
+  // Number of surfaces in TABLE.
+  //
+  unsigned num_surfaces;
+
+  const Surface::Renderable *inline_table[INLINE_TABLE_SIZE];
+  unsigned inline_used[INLINE_USED_WORDS];
+
+  Mempool &mempool;
+};
+
+}
+
+
+#endif // SNOGRAY_ISEC_MAILBOX_H
@@ -1,6 +1,6 @@
 // octree-builder.cc -- Octree construction
 //
-//  Copyright (C) 2005-2007, 2009, 2010, 2012, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2005-2007, 2009, 2010, 2012-2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -13,6 +13,7 @@
 #include <deque>
 
 #include "util/snogassert.h"
+#include "util/unique-ptr.h"
 
 #include "octree.h"
 #include "octree-node.h"
@@ -30,10 +31,14 @@ class Octree::Builder : public SpaceBuilder
 {
 public:
 
-  Builder ()
+  // Make an octree builder.  If CACHE_FILE is not empty, it is used
+  // as an accelerator cache (see Octree::BuilderFactory).
+  //
+  Builder (const std::string &_cache_file = "")
     // surface_ptr_list_nodes is initialized with dummy entry
     : num_real_surfaces (0),
-      surface_ptr_list_nodes (1, SurfacePtrListNode (0,0))
+      surface_ptr_list_nodes (1, SurfacePtrListNode (0,0)),
+      cache_file (_cache_file)
   { }
 
   // Add SURFACE to the space being built.
@@ -41,21 +46,48 @@ public:
   virtual void add (const Surface::Renderable *surface)
   {
     num_real_surfaces++;
-    add (surface, surface->bbox ());
+
+    BBox surface_bbox = surface->bbox ();
+
+    // When using an accelerator cache, we don't know whether we
+    // actually need to build anything until all surfaces have been
+    // added, so just remember them until Octree::Builder::build.
+    //
+    if (cache_file.empty ())
+      {
+#if USE_COMPACT_ACCEL
+	surfaces.push_back (surface);
+#endif
+	add (surface, surface_bbox);
+      }
+    else
+      {
+	cache_key.add (surface_bbox);
+	surfaces.push_back (surface);
+	pending_surface_bboxes.push_back (surface_bbox);
+      }
   }
 
   // Make the final space.  Note that this can only be done once.
   //
-  virtual const Space *make_space ();
+  virtual const Space *build_space ();
+
+  // Finish building the octree, and store it into OCTREE.  If we have
+  // an accelerator cache file which holds an octree for the same
+  // surfaces, it is used instead.
+  //
+  void build (Octree &octree);
 
-  // Copy all of our nodes into TO_NODES, and their associated surface
-  // pointers into zero-terminated spans in TO_SURFACE_PTRS, using an
-  // "optimized order", where nodes nearer the top of the node-tree
-  // are closer to the front of TO_NODES (and the corresponding
-  // surface lists are closer to beginning of TO_SURFACE_PTRS).
+  // Copy all of our nodes into TO_NODES, in the compact form used for
+  // searching, and their associated surface pointers into contiguous
+  // spans in TO_SURFACE_PTRS, using an "optimized order", where nodes
+  // nearer the top of the node-tree are closer to the front of
+  // TO_NODES (and the corresponding surface lists are closer to
+  // beginning of TO_SURFACE_PTRS), and all children of a node are
+  // adjacent.
   //
   void copy_optimized_nodes (
-	 std::vector<Node> &to_nodes,
+	 NodeVec &to_nodes,
 	 std::vector<const Surface::Renderable *> &to_surface_ptrs)
     const;
 
@@ -73,6 +105,54 @@ public:
 
 private:
 
+  // Type name used for octrees in accelerator cache files.  The
+  // version number must be changed if the way octrees are built
+  // changes.
+  //
+  static const char *cache_type () { return "octree-1"; }
+
+  // Octree information stored in the "extra" section of accelerator
+  // cache files.
+  //
+  struct CacheExtra
+  {
+    coord_t origin[3];
+    dist_t size;
+    unsigned long long num_real_surfaces;
+  };
+
+  // A node in the octree during construction.  This is similar to
+  // Octree::Node, but allows children to be added at any time, and
+  // keeps its surfaces in a linked list.
+  //
+  struct BuildNode
+  {
+    BuildNode ()
+      : surface_ptrs_head_index (0)
+    {
+      for (unsigned i = 0; i < 8; i++)
+	child_node_indices[i] = 0;
+    }
+
+    // Indices of sub-nodes of this node in the
+    // Octree::Builder::nodes vector; each sub-node is exactly half the
+    // size of this node in all dimensions, so in total there are
+    // eight.  The index in this array is a combination of
+    // Octree::Node::DirBits values.
+    //
+    // A value of zero means "none" (the root node always has that
+    // index).
+    //
+    unsigned child_node_indices[8];
+
+    // Index of the first surface-pointer at this level of the tree in
+    // the Octree::Builder::surface_ptr_list_nodes vector, or zero if
+    // there are none.  All surfaces listed in a node must fit
+    // entirely within it.
+    //
+    unsigned surface_ptrs_head_index;
+  };
+
   // An entry in a linked list of Surface::Renderable pointers.  These are
   // referred to by integer indices (to make it possible to store them
   // in a growing vector).  Note that index 0 always means "end of
@@ -135,32 +215,67 @@ private:
 
   // Add the surface pointers in the linked-list whose head is at
   // HEAD_INDEX in Octree::Builder::surface_ptr_list_nodes, to the end
-  // of SURFACE_PTRs, returning the index in SURFACE_PTRS of the first
-  // entry (the the last entry will be at the end of SURFACE_PTRS).
-  // An additional final zero entry is also added to terminate the
-  // list.
+  // of SURFACE_PTRs, returning the number of entries added (the last
+  // entry will be at the end of SURFACE_PTRS).
   //
   unsigned unroll_surface_ptr_list (
 	     unsigned head_index,
 	     std::vector<const Surface::Renderable *> &surface_ptrs)
     const
   {
-    unsigned rval = surface_ptrs.size ();
+    unsigned num = 0;
     for (unsigned index = head_index;
 	 index; index = surface_ptr_list_nodes[index].next_node_index)
-      surface_ptrs.push_back (surface_ptr_list_nodes[index].surface);
-    surface_ptrs.push_back (0); // list terminator
-    return rval;
+      {
+	surface_ptrs.push_back (surface_ptr_list_nodes[index].surface);
+	num++;
+      }
+    return num;
   }
 
+  // If our accelerator cache file holds an octree built from the
+  // surfaces in Octree::Builder::surfaces, store it into OCTREE and
+  // return true; otherwise return false.
+  //
+  bool load_cached (Octree &octree);
+
+  // Return true if the NUM_NODES nodes at NODES form a plausible tree
+  // referring to NUM_SURFACE_PTRS surface pointers.  This makes sure
+  // that a tree loaded from an accelerator cache file can't cause
+  // out-of-bounds accesses when searched.
+  //
+  static bool valid_nodes (const Node *nodes, unsigned num_nodes,
+			   unsigned num_surface_ptrs);
+
   // Nodes in the octree.
   //
-  std::vector<Node> nodes;
+  std::vector<BuildNode> nodes;
 
   // Nodes in various linked-list of surface-pointers.  As index 0
   // always means "end of list," the first entry is a dummy value.
   //
   std::vector<SurfacePtrListNode> surface_ptr_list_nodes;
+
+  // Accelerator cache file to use, or an empty string for none.
+  //
+  std::string cache_file;
+
+  // All surfaces added, in the order they were added.  This is only
+  // kept when using an accelerator cache, which refers to surfaces by
+  // their position in this vector, or when using compact nodes, where
+  // the octree itself does so.
+  //
+  std::vector<const Surface::Renderable *> surfaces;
+
+  // When using an accelerator cache, the bounding-boxes of all
+  // surfaces in Octree::Builder::surfaces.  Surfaces are only actually
+  // added to the octree if the cache can't be used.
+  //
+  std::vector<BBox> pending_surface_bboxes;
+
+  // Key identifying the surfaces in Octree::Builder::surfaces.
+  //
+  SpaceCache::Key cache_key;
 };
 
 
@@ -198,7 +313,7 @@ Octree::Builder::add (const Surface::Renderable *surface, const BBox &surface_bb
   else
     // SURFACE will be the first node
     {
-      nodes.push_back (Node ());
+      nodes.push_back (BuildNode ());
       origin = surface_bbox.min;
       size = surface_bbox.max_size ();
 
@@ -235,7 +350,7 @@ Octree::Builder::grow_to_include (const Surface::Renderable *surface,
   //
   unsigned old_root_index = nodes.size ();
   nodes.push_back (nodes[0]);	// move old root to end
-  nodes[0] = Node ();		// initialize new root
+  nodes[0] = BuildNode ();	// initialize new root
 
   // Decide which directions to grow our volume
   //
@@ -516,7 +631,7 @@ Octree::Builder::add_to_child (const Surface::Renderable *surface, const BBox &s
       // create the child
       child_node_index = nodes.size ();
       // make an empty node
-      nodes.push_back (Node ());
+      nodes.push_back (BuildNode ());
       // record it in the parent
       nodes[node_index].child_node_indices[child_num] = child_node_index;
     }
@@ -528,15 +643,16 @@ Octree::Builder::add_to_child (const Surface::Renderable *surface, const BBox &s
 
 // Octree::Builder::copy_optimized_nodes
 
-// Copy all of our nodes into TO_NODES, and their associated surface
-// pointers into zero-terminated spans in TO_SURFACE_PTRS, using an
-// "optimized order", where nodes nearer the top of the node-tree are
-// closer to the front of TO_NODES (and the corresponding surface
-// lists are closer to beginning of TO_SURFACE_PTRS).
+// Copy all of our nodes into TO_NODES, in the compact form used for
+// searching, and their associated surface pointers into contiguous
+// spans in TO_SURFACE_PTRS, using an "optimized order", where nodes
+// nearer the top of the node-tree are closer to the front of TO_NODES
+// (and the corresponding surface lists are closer to beginning of
+// TO_SURFACE_PTRS), and all children of a node are adjacent.
 //
 void
 Octree::Builder::copy_optimized_nodes (
-		   std::vector<Node> &to_nodes,
+		   NodeVec &to_nodes,
 		   std::vector<const Surface::Renderable *> &to_surface_ptrs)
   const
 {
@@ -544,38 +660,12 @@ Octree::Builder::copy_optimized_nodes (
   // Do initial setup of TO_NODES and TO_SURFACE_PTRS.
   //
 
-  // Count the number of nodes that have surfaces, to use below in the
-  // calculation of NUM_SURFACE_PTR_ENTRIES.
-  //
-  unsigned num_nodes_with_surfaces = 0;
-  for (std::vector<Node>::const_iterator node = nodes.begin();
-       node != nodes.end(); ++node)
-    if (node->surface_ptrs_head_index)
-      num_nodes_with_surfaces++;
-
-  // The total number of surface pointers entries that we will use.
-  //
-  // Besides the number of actual surface pointers (which is the same
-  // as the size of Octree::Builder::surface_ptr_list_nodes), we add
-  // an extra zero-entry for each node with surfaces, to mark the end
-  // of each node's surface-pointer list; this extra entry is not
-  // explicitly stored in our linked-list form, but will be used in
-  // the final packed form, so we need to account for it.
-  //
-  // [Both forms have a reserved zero entry, so we don't need to add that.]
-  //
-  unsigned num_surface_ptr_entries 
-    = surface_ptr_list_nodes.size () + num_nodes_with_surfaces;
-
   // Pre-size OCTREE's vectors, for efficiency, and to avoid
-  // over-allocation.
+  // over-allocation.  Note that the first entry in
+  // Octree::Builder::surface_ptr_list_nodes is a dummy entry.
   //
   to_nodes.reserve (nodes.size ());
-  to_surface_ptrs.reserve (num_surface_ptr_entries);
-
-  // Add the reserved zero-entry to octree.surface_ptrs
-  //
-  to_surface_ptrs.push_back (0);
+  to_surface_ptrs.reserve (surface_ptr_list_nodes.size () - 1);
 
 
   //
@@ -598,7 +688,8 @@ Octree::Builder::copy_optimized_nodes (
   // Now copy nodes, continually getting the next node to copy from
   // the front of NODE_INDEX_QUEUE, and pushing its non-zero
   // child-node indices onto the back.  The result will be that all
-  // nodes are copied in a breadth-first order.
+  // nodes are copied in a breadth-first order, and that all the
+  // children of any node will be adjacent.
   //
   while (! node_index_queue.empty ())
     {
@@ -606,7 +697,7 @@ Octree::Builder::copy_optimized_nodes (
       //
       unsigned from_index = node_index_queue.front ();
       node_index_queue.pop_front ();
-      const Node &from_node = nodes[from_index];
+      const BuildNode &from_node = nodes[from_index];
 
       // The new node in TO_NODES we're copying to, which starts out empty.
       //
@@ -618,45 +709,201 @@ Octree::Builder::copy_optimized_nodes (
       // entries in TO_SURFACE_PTRS to hold them (rather than the linked
       // list used by FROM_NODE's surface-pointers).
       //
-      if (from_node.surface_ptrs_head_index)
-	to_node.surface_ptrs_head_index
-	  = unroll_surface_ptr_list (from_node.surface_ptrs_head_index,
-				     to_surface_ptrs);
+      to_node.surface_ptrs_index = to_surface_ptrs.size ();
+      to_node.num_surfaces
+	= unroll_surface_ptr_list (from_node.surface_ptrs_head_index,
+				   to_surface_ptrs);
 
       // Push the indices of sub-nodes of FROM_NODE onto the end of
-      // NODE_INDEX_QUEUE, and mark TO_NODE as a leaf if there are no
-      // sub-nodes
+      // NODE_INDEX_QUEUE, and record which ones exist in TO_NODE.
+      //
+      // Because we're copying in FIFO order, we know that the child
+      // nodes will be stored contiguously, in child-number order,
+      // following all nodes already in NODE_INDEX_QUEUE.
       //
-      unsigned num_child_nodes = 0;
+      to_node.first_child_index = next_free_node_index;
       for (unsigned i = 0; i < 8; i++)
 	if (from_node.child_node_indices[i])
 	  {
-	    num_child_nodes++;
-
 	    node_index_queue.push_back (from_node.child_node_indices[i]);
-
-	    // Because we're copying in FIFO order, we know that each
-	    // child node will be stored following nodes in
-	    // NODE_INDEX_QUEUE.
-	    //
-	    to_node.child_node_indices[i] = next_free_node_index++;
+	    to_node.child_mask |= (1 << i);
+	    next_free_node_index++;
 	  }
-      if (num_child_nodes == 0)
-	to_node.mark_as_leaf_node ();
     }
 
   ASSERT (to_nodes.size () == nodes.size ());
-  ASSERT (to_surface_ptrs.size () == num_surface_ptr_entries);
+  ASSERT (to_surface_ptrs.size () == surface_ptr_list_nodes.size () - 1);
+}
+
+
+
+// Octree::Builder::build
+
+// Finish building the octree, and store it into OCTREE.  If we have an
+// accelerator cache file which holds an octree for the same surfaces,
+// it is used instead.
+//
+void
+Octree::Builder::build (Octree &octree)
+{
+  if (! cache_file.empty ())
+    {
+      if (load_cached (octree))
+	return;
+
+      // The cache couldn't be used, so actually add all the surfaces.
+      //
+      for (unsigned i = 0; i < surfaces.size (); i++)
+	add (surfaces[i], pending_surface_bboxes[i]);
+
+      std::vector<BBox> ().swap (pending_surface_bboxes);
+    }
+
+  octree.origin = origin;
+  octree.size = size;
+  octree.num_real_surfaces = num_real_surfaces;
+
+#if USE_COMPACT_ACCEL
+  // Compact octrees refer to surfaces using their index in SURFACES,
+  // rather than a pointer.
+  //
+  {
+    std::vector<const Surface::Renderable *> surface_ptrs;
+    copy_optimized_nodes (octree.node_storage, surface_ptrs);
+    SpaceCache::get_surface_indices (surfaces, surface_ptrs,
+				     octree.surface_index_storage);
+  }
+  if (! octree.surface_index_storage.empty ())
+    octree.surface_indices = &octree.surface_index_storage[0];
+#else
+  copy_optimized_nodes (octree.node_storage, octree.surface_ptrs);
+#endif
+
+  if (! octree.node_storage.empty ())
+    octree.nodes = &octree.node_storage[0];
+  octree.num_nodes = octree.node_storage.size ();
+
+  if (! cache_file.empty () && octree.num_nodes != 0)
+    {
+      CacheExtra extra;
+      extra.origin[0] = origin.x;
+      extra.origin[1] = origin.y;
+      extra.origin[2] = origin.z;
+      extra.size = size;
+      extra.num_real_surfaces = num_real_surfaces;
+
+#if USE_COMPACT_ACCEL
+      const std::vector<unsigned> &surface_indices
+	= octree.surface_index_storage;
+#else
+      std::vector<unsigned> surface_indices;
+      SpaceCache::get_surface_indices (surfaces, octree.surface_ptrs,
+				       surface_indices);
+#endif
+
+      SpaceCache::save (cache_file, cache_type (), cache_key,
+			octree.nodes, sizeof (Node), octree.num_nodes,
+			surface_indices, &extra, sizeof extra);
+    }
+
+#if USE_COMPACT_ACCEL
+  octree.surfaces.swap (surfaces);
+#endif
 }
 
 
 
-// Octree::Builder::make_space
+// Octree::Builder::load_cached
+
+// If our accelerator cache file holds an octree built from the
+// surfaces in Octree::Builder::surfaces, store it into OCTREE and
+// return true; otherwise return false.
+//
+bool
+Octree::Builder::load_cached (Octree &octree)
+{
+  UniquePtr<SpaceCache> cache (
+    SpaceCache::load (cache_file, cache_type (), sizeof (Node),
+		      sizeof (CacheExtra), cache_key));
+
+  if (! cache.get ())
+    return false;
+
+  const Node *cached_nodes = static_cast<const Node *> (cache->nodes ());
+  unsigned num_cached_nodes = cache->num_nodes ();
+
+#if USE_COMPACT_ACCEL
+  // Compact octrees use the surface indices directly from the cache
+  // file.
+  //
+  const unsigned *surface_indices = cache->surface_indices (surfaces.size ());
+  if (! surface_indices
+      || ! valid_nodes (cached_nodes, num_cached_nodes,
+			cache->num_surface_indices ()))
+    return false;
+
+  octree.surface_indices = surface_indices;
+  octree.surfaces.swap (surfaces);
+#else
+  if (! cache->get_surface_ptrs (surfaces, octree.surface_ptrs)
+      || ! valid_nodes (cached_nodes, num_cached_nodes,
+			octree.surface_ptrs.size ()))
+    {
+      octree.surface_ptrs.clear ();
+      return false;
+    }
+#endif
+
+  const CacheExtra &extra
+    = *static_cast<const CacheExtra *> (cache->extra ());
+
+  octree.origin = Pos (extra.origin[0], extra.origin[1], extra.origin[2]);
+  octree.size = extra.size;
+  octree.num_real_surfaces = extra.num_real_surfaces;
+
+  octree.nodes = cached_nodes;
+  octree.num_nodes = num_cached_nodes;
+  octree.cache.reset (cache.release ());
+
+  return true;
+}
+
+// Return true if the NUM_NODES nodes at NODES form a plausible tree
+// referring to NUM_SURFACE_PTRS surface pointers.  This makes sure that
+// a tree loaded from an accelerator cache file can't cause
+// out-of-bounds accesses when searched.
+//
+bool
+Octree::Builder::valid_nodes (const Node *nodes, unsigned num_nodes,
+			      unsigned num_surface_ptrs)
+{
+  for (unsigned i = 0; i < num_nodes; i++)
+    {
+      const Node &node = nodes[i];
+
+      if (node.surface_ptrs_index > num_surface_ptrs
+	  || node.num_surfaces > num_surface_ptrs - node.surface_ptrs_index)
+	return false;
+
+      if (! node.is_leaf_node ()
+	  && (node.first_child_index <= i
+	      || node.first_child_index > num_nodes
+	      || (Node::count_bits (node.child_mask)
+		  > num_nodes - node.first_child_index)))
+	return false;
+    }
+
+  return true;
+}
+
+
+
+// Octree::Builder::build_space
 
 // Make the final space.  Note that this can only be done once.
 //
 const Space *
-Octree::Builder::make_space ()
+Octree::Builder::build_space ()
 {
   return new Octree (*this);
 }
@@ -665,15 +912,17 @@ Octree::Builder::make_space ()
 
 // Octree constructor
 
-// Make a new, empty, octree, using info from BUILDER.  This should
-// only be invoked directly by Octree::Builder::make_space.
+// Make a new octree, using info from BUILDER.  This should only be
+// invoked directly by Octree::Builder::build_space.
 //
 Octree::Octree (Octree::Builder &builder)
-  : Space (builder),
-    origin (builder.origin), size (builder.size),
-    num_real_surfaces (builder.num_real_surfaces)
+  : Space (builder), nodes (0), num_nodes (0),
+#if USE_COMPACT_ACCEL
+    surface_indices (0),
+#endif
+    size (0), num_real_surfaces (0)
 {
-  builder.copy_optimized_nodes (nodes, surface_ptrs);
+  builder.build (*this);
 }
 
 
@@ -685,5 +934,5 @@ Octree::Octree (Octree::Builder &builder)
 SpaceBuilder *
 Octree::BuilderFactory::make_space_builder () const
 {
-  return new Octree::Builder ();
+  return new Octree::Builder (cache_file);
 }
@@ -1,6 +1,6 @@
 // octree-node.h -- Node in an Octree
 //
-//  Copyright (C) 2005, 2007, 2009-2011, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2005, 2007, 2009-2011, 2013, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -24,11 +24,18 @@ namespace snogray {
 // into 8 equally-sized sub-nodes by splitting the node equally along
 // each axis.
 //
+// This is the compact representation used for searching, which is
+// emitted by Octree::Builder after construction is complete (the
+// builder uses its own, more flexible, representation while adding
+// surfaces).  Nodes are 16 bytes, so four fit exactly into a typical
+// 64-byte cache line, and the nodes vector is allocated so that nodes
+// never straddle a cache-line boundary.
+//
 struct Octree::Node
 {
   // Constants for symbolic access to child node indices.  One each of
-  // the X, Y, and Z constants may be or-ed together to form an index
-  // in child_node_indices.
+  // the X, Y, and Z constants may be or-ed together to form a child
+  // number.
   //
   enum DirBits {
     X_LO = 0, X_HI = 4,
@@ -37,52 +44,65 @@ struct Octree::Node
   };
 
   Node ()
-    : surface_ptrs_head_index (0)
+    : first_child_index (0), surface_ptrs_index (0), num_surfaces (0),
+      child_mask (0)
+  { }
+
+  // Return true if this is a leaf node.
+  //
+  bool is_leaf_node () const { return child_mask == 0; }
+
+  // Return true if this node has a child with child-number CHILD_NUM
+  // (a combination of DirBits values).
+  //
+  bool has_child (unsigned child_num) const
   {
-    for (unsigned i = 0; i < 8; i++)
-      child_node_indices[i] = 0;
+    return child_mask & (1 << child_num);
   }
 
-  // Return true if this is a leaf node.  See the comment for the
-  // child-index index fields below.
+  // Return the index in Octree::nodes of the child with child-number
+  // CHILD_NUM (a combination of DirBits values).  The child must
+  // actually exist.
   //
-  bool is_leaf_node () const
+  unsigned child_node_index (unsigned child_num) const
   {
-    return child_node_indices[0] == 1 && child_node_indices[1] == 1;
+    // Children are stored contiguously in order of child-number, so
+    // the index is just the number of children that come before
+    // CHILD_NUM.
+    //
+    return first_child_index
+      + count_bits (child_mask & ((1 << child_num) - 1));
   }
 
-  // Mark this node as a leaf-node.  See the comment for the
-  // child-index index fields below.
+  // Return the number of bits set in the 8-bit value BITS.
   //
-  void mark_as_leaf_node ()
+  static unsigned count_bits (unsigned bits)
   {
-    child_node_indices[0] = 1;
-    child_node_indices[1] = 1;
+    bits = bits - ((bits >> 1) & 0x55);
+    bits = (bits & 0x33) + ((bits >> 2) & 0x33);
+    return (bits + (bits >> 4)) & 0x0F;
   }
 
-  // Indices of sub-nodes of this node in the Octree::nodes vector;
-  // each sub-node is exactly half the size of this node in all
-  // dimensions, so in total there are eight.
-  //
-  // A value of zero means "none" (the root node always has that
-  // index).
+  // Index in Octree::nodes of the first child of this node; all
+  // existing children of a node are stored contiguously, in order of
+  // their child-number.  Only meaningful if CHILD_MASK is non-zero.
   //
-  // As a special case, if the first two entries have a value of 1, it
-  // means "this is a leaf node."  [Note that such a state would
-  // normally be invalid because a node cannot have the same child
-  // twice.]  This special state only exists after an octree has
-  // completely been setup.
+  unsigned first_child_index;
+
+  // The surfaces at this level of the tree are the NUM_SURFACES
+  // entries in the Octree::surface_ptrs vector (or, when using compact
+  // nodes, the Octree::surface_indices array) starting at index
+  // SURFACE_PTRS_INDEX.  All surfaces listed in a node must fit
+  // entirely within it.
   //
-  unsigned child_node_indices[8];
-
-  // Index of the first surface-pointer at this level of the tree in
-  // the Octree::surface_ptrs vector; the list of pointers for a node
-  // is terminated by a pointer with the low-bit set (but that last
-  // pointer is still a valid pointer).  All surfaces listed in a node
-  // must fit entirely within it.  Any given surface is only present
-  // in a single node.
+  unsigned surface_ptrs_index;
+  unsigned num_surfaces;
+
+  // A bit-mask of which children of this node exist; bit N is set if
+  // there's a child with child-number N.  Zero means this is a leaf
+  // node.
   //
-  unsigned surface_ptrs_head_index;
+  unsigned char child_mask;
 };
 
 
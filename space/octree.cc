@@ -1,6 +1,6 @@
 // octree.cc -- Voxel tree datatype (hierarchically arranges 3D space)
 //
-//  Copyright (C) 2005-2007, 2009, 2010, 2012, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2005-2007, 2009, 2010, 2012-2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -10,9 +10,8 @@
 // Written by Miles Bader <miles@gnu.org>
 //
 
-#include "util/grab.h"
 #include "geometry/bbox.h"
-#include "isec-cache.h"
+#include "isec-mailbox.h"
 
 #include "octree.h"
 #include "octree-node.h"
@@ -27,15 +26,20 @@ using namespace snogray;
 struct Octree::SearchState : Space::SearchState
 {
   SearchState (const Octree &_octree, const Ray &_ray,
-	       IntersectCallback &_callback, IsecCache &_negative_isec_cache)
+	       IntersectCallback &_callback, Mempool &mempool)
     : Space::SearchState (_callback),
       ray (_ray),
       ray_origin_octant ((ray.dir.x >= 0 ? Node::X_LO : Node::X_HI)
 			 | (ray.dir.y >= 0 ? Node::Y_LO : Node::Y_HI)
 			 | (ray.dir.z >= 0 ? Node::Z_LO : Node::Z_HI)),
-      nodes (_octree.nodes), surface_ptrs (_octree.surface_ptrs),
-      negative_isec_cache (_negative_isec_cache),
-      neg_cache_hits (0), neg_cache_collisions (0)
+      nodes (_octree.nodes),
+#if USE_COMPACT_ACCEL
+      surfaces (&_octree.surfaces[0]),
+      surface_indices (_octree.surface_indices),
+#else
+      surface_ptrs (_octree.surface_ptrs),
+#endif
+      negative_isec_cache (mempool), neg_cache_hits (0)
   { }
 
 
@@ -54,8 +58,7 @@ struct Octree::SearchState : Space::SearchState
   //
   void update_isec_stats (RenderStats::IsecStats &isec_stats)
   {
-    isec_stats.neg_cache_collisions += neg_cache_collisions;
-    isec_stats.neg_cache_hits	      += neg_cache_hits;
+    isec_stats.neg_cache_hits += neg_cache_hits;
 
     Space::SearchState::update_isec_stats (isec_stats);
   }
@@ -74,19 +77,37 @@ struct Octree::SearchState : Space::SearchState
   //
   unsigned ray_origin_octant;
 
-  // Node and surface-pointer vectors from Octree.
+  // Return the surface referred to by entry INDEX in the octree's
+  // surface references.
   //
-  const std::vector<Node> &nodes;
+  const Surface::Renderable *surface (unsigned index) const
+  {
+#if USE_COMPACT_ACCEL
+    return surfaces[surface_indices[index]];
+#else
+    return surface_ptrs[index];
+#endif
+  }
+
+  // Nodes and surface references from Octree.
+  //
+  const Node *nodes;
+#if USE_COMPACT_ACCEL
+  const Surface::Renderable *const *surfaces;
+  const unsigned *surface_indices;
+#else
   const std::vector<const Surface::Renderable *> &surface_ptrs;
+#endif
 
-  // Cache of negative surface intersection test results, so we can
-  // avoid testing the same object twice.
+  // Surfaces we've already tested and found not to intersect, so we
+  // can avoid testing the same surface twice (an octree may list a
+  // surface in several nodes).
   //
-  IsecCache &negative_isec_cache;
+  IsecMailbox negative_isec_cache;
 
   // Keep track of some statics for the negative intersection cache.
   //
-  unsigned neg_cache_hits, neg_cache_collisions;
+  unsigned neg_cache_hits;
 };
 
 
@@ -105,7 +126,7 @@ Octree::for_each_possible_intersector (const Ray &ray,
 				       RenderStats::IsecStats &isec_stats)
   const
 {
-  if (! nodes.empty ())
+  if (num_nodes != 0)
     {
       //
       // Compute the intersections of RAY with each of ROOT's bounding
@@ -144,11 +165,7 @@ Octree::for_each_possible_intersector (const Ray &ray,
       // runtime, so we don't bother.
       //
 
-      // Get an IsecCache object.
-      //
-      Grab<IsecCache> isec_cache_grab (context.isec_cache_pool);
-
-      SearchState ss (*this, ray, callback, *isec_cache_grab);
+      SearchState ss (*this, ray, callback, context.mempool);
 
       // Search starting form the top-level node.
       //
@@ -192,31 +209,27 @@ Octree::SearchState::for_each_possible_intersector (
 
   // Invoke the callback on each of this node's surfaces
   //
-  if (node.surface_ptrs_head_index)
-    for (unsigned surf_ptr_index = node.surface_ptrs_head_index;
-	 surface_ptrs[surf_ptr_index]; surf_ptr_index++)
-      {
-	const Surface::Renderable *surf = surface_ptrs[surf_ptr_index];
-
-	if (! negative_isec_cache.contains (surf))
-	  {
-	    surf_isec_tests++;
-
-	    if (callback (surf))
-	      surf_isec_hits++;
-	    else
-	      {
-		bool collision = negative_isec_cache.add (surf);
-		if (collision)
-		  neg_cache_collisions++;
-	      }
-	  }
-	else
-	  neg_cache_hits++;
-
-	if (callback.stop)
-	  return;
-      }
+  unsigned surf_ptr_index = node.surface_ptrs_index;
+  unsigned surf_ptr_end = surf_ptr_index + node.num_surfaces;
+  for (; surf_ptr_index < surf_ptr_end; surf_ptr_index++)
+    {
+      const Surface::Renderable *surf = surface (surf_ptr_index);
+
+      if (! negative_isec_cache.contains (surf))
+	{
+	  surf_isec_tests++;
+
+	  if (callback (surf))
+	    surf_isec_hits++;
+	  else
+	    negative_isec_cache.add (surf);
+	}
+      else
+	neg_cache_hits++;
+
+      if (callback.stop)
+	return;
+    }
 
   // Recursively deal with any non-null sub-nodes
   //
@@ -234,42 +247,39 @@ Octree::SearchState::for_each_possible_intersector (
       dist_t y_mid_t = y_min_t + y_half_t;
       dist_t z_mid_t = z_min_t + z_half_t;
 
-      for (unsigned i = 0; i < 8; i++)
-	{
-	  // CHILD is the child index in "parametric order":  that
-	  // is where each bit in CHILD, being "HI" (1) or "LO"
-	  // (0) doesn't correspond to high or low in that
-	  // dimension in actual physical coordinates, but rather
-	  // from the viewpoint or the ray's direction.  We can
-	  // then use RAY_ORIGIN_OCTANT to translate to "real"
-	  // physical order.
-	  //
-	  // CHILD is mostly the same as I, but we slightly
-	  // perturb the bits so that the number of zero-bits
-	  // never decreases.  This ensures that we search more
-	  // likely child nodes first.
-	  //
-	  unsigned child = (i == 3) ? 4 : (i == 4) ? 3 : i;
+      // We visit child nodes in the order in which the ray passes
+      // through them, so that closer surfaces are found first, and
+      // each subsequent child can be pruned if the ray has been
+      // shortened to end before it.
+      //
+      // CHILD is the child index in "parametric order":  that is where
+      // each bit in CHILD, being "HI" (1) or "LO" (0) doesn't
+      // correspond to high or low in that dimension in actual physical
+      // coordinates, but rather from the viewpoint or the ray's
+      // direction.  We can then use RAY_ORIGIN_OCTANT to translate to
+      // "real" physical order.
+      //
+      // In parametric order, the ray always moves from LO to HI along
+      // each axis, and it does so exactly when it crosses that axis's
+      // mid-plane.  So we start with the child containing the point
+      // where the ray enters this node, and then at each step, set
+      // the bit for the axis whose mid-plane the ray crosses next.
+      // At most four children are visited.
+      //
+      unsigned child = ((x_mid_t < min_t ? Node::X_HI : Node::X_LO)
+			| (y_mid_t < min_t ? Node::Y_HI : Node::Y_LO)
+			| (z_mid_t < min_t ? Node::Z_HI : Node::Z_LO));
 
-	  // REAL_CHILD is the actual index in
-	  // Node::child_node_indices, corresponding to physical
-	  // space.
+      for (;;)
+	{
+	  // REAL_CHILD is the actual child-number, corresponding to
+	  // physical space.
 	  //
 	  unsigned real_child = child ^ ray_origin_octant;
 
-	  // The index in Octree::nodes of the child.
+	  // If there actually is a child node, recurse into it.
 	  //
-	  unsigned child_node_index = node.child_node_indices[real_child];
-
-	  // Test whether there actually is a child node, and if
-	  // so whether the ray falls within it; if so, recurse
-	  // into that child node.
-	  //
-	  dist_t t0 = ray.t0, t1 = ray.t1;
-	  if (child_node_index
-	      && ((child & Node::X_HI) ? (t1 > x_mid_t) : (t0 < x_mid_t))
-	      && ((child & Node::Y_HI) ? (t1 > y_mid_t) : (t0 < y_mid_t))
-	      && ((child & Node::Z_HI) ? (t1 > z_mid_t) : (t0 < z_mid_t)))
+	  if (node.has_child (real_child))
 	    {
 	      // The lower bounds of the child node in parametric space.
 	      //
@@ -282,6 +292,7 @@ Octree::SearchState::for_each_possible_intersector (
 
 	      // Recurse into the child node.
 	      //
+	      unsigned child_node_index = node.child_node_index (real_child);
 	      for_each_possible_intersector (child_node_index,
 					     child_x_min_t,
 					     child_x_min_t + x_half_t,
@@ -295,6 +306,29 @@ Octree::SearchState::for_each_possible_intersector (
 	      if (unlikely (callback.stop))
 		return;
 	    }
+
+	  // Find the next mid-plane the ray crosses, which is the
+	  // closest one on an axis where we're still in the LO half.
+	  //
+	  unsigned next_bit = 0;
+	  dist_t next_t = max_t;
+	  if (! (child & Node::X_HI) && x_mid_t < next_t)
+	    next_t = x_mid_t, next_bit = Node::X_HI;
+	  if (! (child & Node::Y_HI) && y_mid_t < next_t)
+	    next_t = y_mid_t, next_bit = Node::Y_HI;
+	  if (! (child & Node::Z_HI) && z_mid_t < next_t)
+	    next_t = z_mid_t, next_bit = Node::Z_HI;
+
+	  // Stop if the ray leaves this node before crossing another
+	  // mid-plane, or if the ray now ends before the crossing (RAY
+	  // may have been shortened by an intersection found in a
+	  // previous child, in which case no later child can contain a
+	  // closer one).
+	  //
+	  if (! next_bit || next_t >= ray.t1)
+	    break;
+
+	  child |= next_bit;
 	}
     }
 }
@@ -309,12 +343,36 @@ Octree::Stats
 Octree::stats () const
 {
   Stats stats;
-  if (! nodes.empty ())
+  if (num_nodes != 0)
     upd_stats (nodes[0], stats);
   stats.num_dup_surfaces = stats.num_surfaces - num_real_surfaces;
+
+  stats.node_memory = (unsigned long)num_nodes * sizeof (Node);
+  unsigned long surface_ptrs_memory
+    = stats.num_surfaces * sizeof (const Surface::Renderable *);
+#if USE_COMPACT_ACCEL
+  stats.surface_ref_memory
+    = (stats.num_surfaces * sizeof (unsigned)
+       + surfaces.size () * sizeof (surfaces[0]));
+  stats.memory_saved
+    = long (surface_ptrs_memory) - long (stats.surface_ref_memory);
+#else
+  stats.surface_ref_memory = surface_ptrs_memory;
+#endif
+
   return stats;
 }
 
+// Return the number of bytes of memory used by this octree's nodes and
+// surface references.
+//
+unsigned long
+Octree::memory_use () const
+{
+  Stats st = stats ();
+  return st.node_memory + st.surface_ref_memory;
+}
+
 // Update STATS to reflect NODE.
 //
 void
@@ -336,8 +394,8 @@ Octree::upd_stats (const Node &node, Stats &stats) const
 
   if (! node.is_leaf_node ())
     for (unsigned i = 0; i < 8; i++)
-      if (node.child_node_indices[i])
-	num_subnodes++, upd_stats (nodes[node.child_node_indices[i]], stats);
+      if (node.has_child (i))
+	num_subnodes++, upd_stats (nodes[node.child_node_index (i)], stats);
 
   // Now update STATS
 
@@ -349,8 +407,7 @@ Octree::upd_stats (const Node &node, Stats &stats) const
 
   // Num surfaces
   //
-  for (unsigned spi = node.surface_ptrs_head_index; surface_ptrs[spi]; spi++)
-    stats.num_surfaces++;
+  stats.num_surfaces += node.num_surfaces;
 
   // Update `max_depth' field.
   //
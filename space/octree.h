@@ -1,6 +1,6 @@
 // octree.h -- Voxel tree datatype (hierarchically arranges 3D space)
 //
-//  Copyright (C) 2005, 2007, 2009-2011, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2005, 2007, 2009-2011, 2013, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -13,12 +13,18 @@
 #ifndef SNOGRAY_OCTREE_H
 #define SNOGRAY_OCTREE_H
 
-#include <list>
+#include <vector>
+#include <string>
 
+#include "config.h"
+
+#include "util/aligned-alloc.h"
+#include "util/unique-ptr.h"
 #include "geometry/pos.h"
 
 #include "space.h"
 #include "space-builder.h"
+#include "space-cache.h"
 
 
 namespace snogray {
@@ -55,7 +61,8 @@ public:
     Stats ()
       : num_nodes (0), num_leaf_nodes (0),
 	num_surfaces (0), num_dup_surfaces (0),
-	max_depth (0), avg_depth (0)
+	max_depth (0), avg_depth (0),
+	node_memory (0), surface_ref_memory (0), memory_saved (0)
     { }
 
     unsigned long num_nodes;
@@ -64,12 +71,31 @@ public:
     unsigned long num_dup_surfaces;
     unsigned max_depth;
     float avg_depth;
+
+    // Bytes of memory used for nodes, and for references from nodes
+    // to surfaces.
+    //
+    unsigned long node_memory;
+    unsigned long surface_ref_memory;
+
+    // Bytes of memory saved by using compact nodes (the configure
+    // option "--enable-compact-accel"), compared to the normal
+    // layout; zero if compact nodes aren't being used.  This is
+    // negative if few surfaces are listed in more than one node, as
+    // compact octrees also need a table of all surfaces.
+    //
+    long memory_saved;
   };
 
   // Return various statistics about this octree.
   //
   Stats stats () const;
 
+  // Return the number of bytes of memory used by this octree's nodes
+  // and surface references.
+  //
+  virtual unsigned long memory_use () const;
+
 
 private:
 
@@ -80,13 +106,18 @@ private:
   //
   struct Node;
 
+  // Vector type used to hold nodes.  Nodes are aligned to their own
+  // size, so that no node straddles a cache-line boundary.
+  //
+  typedef std::vector<Node, AlignedAllocator<Node, 16> > NodeVec;
+
   // Class holding state during Octree searches.
   //
   struct SearchState;
 
 
   // Make a new octree from BUILDER.  This should only be invoked
-  // directly by Octree::Builder::make_space.
+  // directly by Octree::Builder::build_space.
   //
   Octree (Builder &builder);
 
@@ -96,16 +127,53 @@ private:
   void upd_stats (const Node &node, Stats &stats) const;
 
 
-  // Nodes in this octree.
+  // Nodes in this octree, in breadth-first order.  The root node is
+  // at index 0, and all children of a given node are contiguous.
+  // These are either in Octree::node_storage, or in a memory-mapped
+  // accelerator cache file.
+  //
+  const Node *nodes;
+  unsigned num_nodes;
+
+  // Storage for nodes, if they were built in memory.
+  //
+  NodeVec node_storage;
+
+  // If our nodes were loaded from an accelerator cache file, the
+  // mapping of that file.
+  //
+  UniquePtr<SpaceCache> cache;
+
+#if USE_COMPACT_ACCEL
+
+  // All surfaces in this octree, in the order they were added to the
+  // builder.
   //
-  std::vector<Node> nodes;
+  std::vector<const Surface::Renderable *> surfaces;
 
-  // Pointers to surfaces referred to in this octree.
-  // Surface-pointers occur in runs inside this vector with a NULL
-  // pointer following the last entry in a list.
+  // Surfaces referred to in this octree, as indices in
+  // Octree::surfaces.  Each node refers to a contiguous run of entries
+  // in this array.  As an octree may list the same surface in many
+  // nodes, 32-bit indices take much less memory than pointers.
+  //
+  // These are either in Octree::surface_index_storage, or in a
+  // memory-mapped accelerator cache file.
+  //
+  const unsigned *surface_indices;
+
+  // Storage for surface indices, if they were built in memory.
+  //
+  std::vector<unsigned> surface_index_storage;
+
+#else // !USE_COMPACT_ACCEL
+
+  // Pointers to surfaces referred to in this octree.  Each node
+  // refers to a contiguous run of entries in this vector.
   //
   std::vector<const Surface::Renderable *> surface_ptrs;
 
+#endif // USE_COMPACT_ACCEL
+
   // One corner of the octree.
   //
   Pos origin;
@@ -129,9 +197,24 @@ class Octree::BuilderFactory : public SpaceBuilderFactory
 {
 public:
 
+  // Make a factory for octree builders.  If CACHE_FILE is not empty,
+  // it is used as an accelerator cache:  if it holds an octree built
+  // from the same geometry, that is used instead of building a new
+  // one, and otherwise the newly built octree is saved there.
+  //
+  BuilderFactory (const std::string &_cache_file = "")
+    : cache_file (_cache_file)
+  { }
+
   // Return a new SpaceBuilder object.
   //
   virtual SpaceBuilder *make_space_builder () const;
+
+private:
+
+  // Accelerator cache file to use, or an empty string for none.
+  //
+  std::string cache_file;
 };
 
 
@@ -0,0 +1,133 @@
+// space-builder.cc -- Builder for Space objects
+//
+//  Copyright (C) 2014  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#include "util/unique-ptr.h"
+
+#include "space.h"
+#include "bvh.h"
+
+#include "space-builder.h"
+
+
+using namespace snogray;
+
+
+
+// SpaceBuilder::InstanceSpace
+
+// A surface holding all the instances added to a SpaceBuilder, which
+// are searched using a BVH built just for them.  This is added to the
+// main space as a single surface, with a bounding-box enclosing all
+// the instances.
+//
+// An instance only transforms a ray into its model's space once the
+// ray has reached the instance's bounding-box in this BVH, and all
+// tests within the model then use that transformed ray.
+//
+class SpaceBuilder::InstanceSpace : public Surface::Renderable
+{
+public:
+
+  InstanceSpace (const Space *_space, const BBox &_bbox)
+    : space (_space), _bbox (_bbox)
+  { }
+
+  // If this surface intersects RAY, change RAY's maximum bound
+  // (Ray::t1) to reflect the point of intersection, and return a
+  // Surface::Renderable::IsecInfo object describing the intersection
+  // (which should be allocated using placement-new with CONTEXT);
+  // otherwise return zero.
+  //
+  virtual const IsecInfo *intersect (Ray &ray, RenderContext &context) const
+  {
+    return space->intersect (ray, context);
+  }
+
+  // Return true if this surface intersects RAY.
+  //
+  virtual bool intersects (const Ray &ray, RenderContext &context) const
+  {
+    return space->intersects (ray, context);
+  }
+
+  // Return true if this surface completely occludes RAY.  If it does
+  // not completely occlude RAY, then return false, and multiply
+  // TOTAL_TRANSMITTANCE by the transmittance of the surface in medium
+  // MEDIUM.
+  //
+  virtual bool occludes (const Ray &ray, const Medium &medium,
+			 Color &total_transmittance,
+			 RenderContext &context)
+    const
+  {
+    return space->occludes (ray, medium, total_transmittance, context);
+  }
+
+  // Return a bounding box for this surface.
+  //
+  virtual BBox bbox () const { return _bbox; }
+
+private:
+
+  // BVH holding our instances.
+  //
+  UniquePtr<const Space> space;
+
+  BBox _bbox;
+};
+
+
+
+// SpaceBuilder::make_space
+
+// Return a space containing the objects added through this builder.
+//
+// Note that this can only be done once; after calling this method, the
+// builder should be considered "used" (for instance, it may have
+// transfered some resources to the space object), and the only valid
+// operation on it is to destroy it.
+//
+const Space *
+SpaceBuilder::make_space ()
+{
+  // A single instance gains nothing from a separate BVH, so it's just
+  // added normally.
+  //
+  if (instances.size () == 1)
+    add (instances[0]);
+  else if (! instances.empty ())
+    {
+      UniquePtr<SpaceBuilder> instance_builder
+	(Bvh::BuilderFactory ().make_space_builder ());
+
+      BBox bbox;
+      for (std::vector<const Surface::Renderable *>::const_iterator ii
+	     = instances.begin ();
+	   ii != instances.end (); ++ii)
+	{
+	  instance_builder->add (*ii);
+	  bbox += (*ii)->bbox ();
+	}
+
+      InstanceSpace *instance_space
+	= new InstanceSpace (instance_builder->make_space (), bbox);
+
+      add (instance_space);
+      delete_after_rendering (instance_space);
+    }
+
+  // Free the memory used by the instance list.
+  //
+  std::vector<const Surface::Renderable *> ().swap (instances);
+
+  return build_space ();
+}
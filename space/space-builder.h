@@ -1,6 +1,6 @@
 // space-builder.h -- Builder for Space objects
 //
-//  Copyright (C) 2007, 2009, 2011, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2007, 2009, 2011, 2013, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -42,6 +42,24 @@ public:
   //
   virtual void add (const Surface::Renderable *renderable) = 0;
 
+  // Add RENDERABLE, which represents an instance of a model, to the
+  // space being built.
+  //
+  // Instances are not added to the space directly; instead, they are
+  // all collected into a separate BVH, which is added to the space as
+  // a single surface by SpaceBuilder::make_space.  Scenes may contain
+  // huge numbers of instances with large, overlapping bounding-boxes,
+  // which most space types handle poorly, and keeping them separate
+  // means the main space only contains ordinary surfaces.
+  //
+  // As with SpaceBuilder::add, RENDERABLE should be valid as long as
+  // the space is, but will not be deallocated by it.
+  //
+  void add_instance (const Surface::Renderable *renderable)
+  {
+    instances.push_back (renderable);
+  }
+
   // Arrange for PTR to be deleted properly after rendering is
   // complete.  This is intended for use by allocated instances of
   // Surface::Renderable, but can be used for other things too.
@@ -59,12 +77,29 @@ public:
   // transfered some resources to the space object), and the only valid
   // operation on it is to destroy it.
   //
-  virtual const Space *make_space () = 0;
+  const Space *make_space ();
+
+protected:
+
+  // Return a space containing the surfaces added through this
+  // builder.  This is called by SpaceBuilder::make_space, after any
+  // instances have been added as a single surface, and the same
+  // restrictions apply.
+  //
+  virtual const Space *build_space () = 0;
 
 private:
 
   friend class Space;
 
+  // A surface holding all instances added to a builder.
+  //
+  class InstanceSpace;
+
+  // Instances added using SpaceBuilder::add_instance.
+  //
+  std::vector<const Surface::Renderable *> instances;
+
   // A list of things to be deleted after rendering.  This is intended
   // for use by allocated instances of Surface::Renderable, but can be
   // used for other things too.
@@ -0,0 +1,464 @@
+// space-cache.cc -- On-disk cache of search-accelerator structures
+//
+//  Copyright (C) 2014  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#include "config.h"
+
+#include <fstream>
+#include <algorithm>
+#include <utility>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+
+extern "C"
+{
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#if HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#if HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+}
+
+#include "util/snogassert.h"
+#include "util/excepts.h"
+#include "util/unique-ptr.h"
+#include "util/file-funs.h"
+
+#include "space-cache.h"
+
+
+using namespace snogray;
+
+
+// Header at the beginning of every cache file.  Everything following
+// the header is covered by the checksum.
+//
+struct SpaceCache::Header
+{
+  // Always MAGIC.
+  //
+  char magic[8];
+
+  // The type of space stored, as passed to SpaceCache::save.
+  //
+  char type[16];
+
+  // Always BYTE_ORDER_MARK, as written by the machine which wrote the
+  // file; this detects files written with a different byte order.
+  //
+  unsigned byte_order_mark;
+
+  // Sizes of various types in the program which wrote the file.
+  //
+  unsigned coord_size, index_size, header_size;
+
+  // The size of each node, the number of nodes, the number of surface
+  // indices, and the size of the extra data.
+  //
+  unsigned node_size, num_nodes, num_surface_indices, extra_size;
+
+  // The key of the geometry this space was built from.
+  //
+  unsigned long long key_hash, key_num_surfaces;
+
+  // Offsets in the file of each section, and the total file size.
+  //
+  unsigned long long nodes_offset, surface_indices_offset, extra_offset;
+  unsigned long long file_size;
+
+  // Hash of everything in the file following the header.
+  //
+  unsigned long long checksum;
+};
+
+static const char MAGIC[8] = "snogspc";
+static const unsigned BYTE_ORDER_MARK = 0x01020304;
+
+// Each section of a cache file starts at a multiple of this many
+// bytes, which is larger than the alignment any node should need.
+//
+static const unsigned SECTION_ALIGNMENT = 64;
+
+// Return OFFSET rounded up to a multiple of SECTION_ALIGNMENT.
+//
+static unsigned long long
+align_offset (unsigned long long offset)
+{
+  return (offset + SECTION_ALIGNMENT - 1) & ~(SECTION_ALIGNMENT - 1ULL);
+}
+
+
+// SpaceCache::hash_words
+
+// Update HASH with the SIZE bytes at DATA, and return the result.
+// SIZE should be a multiple of sizeof (unsigned).
+//
+// This is basically FNV-1a, but operating on a word at a time, as
+// bytewise hashing is unnecessarily slow for large cache files.
+//
+unsigned long long
+SpaceCache::hash_words (unsigned long long hash, const void *data, size_t size)
+{
+  const char *bytes = static_cast<const char *> (data);
+  size_t num_words = size / sizeof (unsigned);
+
+  for (size_t i = 0; i < num_words; i++)
+    {
+      // DATA may be of any type, so use memcpy to avoid aliasing
+      // problems (it will be optimized into a simple load).
+      //
+      unsigned word;
+      memcpy (&word, bytes + i * sizeof word, sizeof word);
+
+      hash = (hash ^ word) * 1099511628211ULL;
+    }
+
+  return hash;
+}
+
+// Add a surface with bounding-box BBOX to the key.
+//
+void
+SpaceCache::Key::add (const BBox &bbox)
+{
+  coord_t coords[6] = { bbox.min.x, bbox.min.y, bbox.min.z,
+			bbox.max.x, bbox.max.y, bbox.max.z };
+  hash = hash_words (hash, coords, sizeof coords);
+  num_surfaces++;
+}
+
+
+// SpaceCache::load
+
+// Return a SpaceCache object for the cache file FILE_NAME, if it holds
+// a space of type TYPE, with NODE_SIZE-byte nodes and EXTRA_SIZE bytes
+// of extra data, built from the geometry identified by KEY.  If the
+// file doesn't exist or is unusable for any reason, return a null
+// pointer instead.
+//
+SpaceCache *
+SpaceCache::load (const std::string &file_name, const char *type,
+		  unsigned node_size, unsigned extra_size, const Key &key)
+{
+#if HAVE_UNISTD_H && HAVE_FCNTL_H && HAVE_SYS_MMAN_H && HAVE_SYS_STAT_H
+
+  int fd = open (file_name.c_str (), O_RDONLY);
+  if (fd < 0)
+    return 0;
+
+  void *map = MAP_FAILED;
+  size_t map_size = 0;
+
+  struct stat statb;
+  if (fstat (fd, &statb) == 0 && size_t (statb.st_size) >= sizeof (Header))
+    {
+      map_size = statb.st_size;
+      map = mmap (0, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+
+  // The mapping remains valid after the file is closed.
+  //
+  close (fd);
+
+  if (map == MAP_FAILED)
+    return 0;
+
+  UniquePtr<SpaceCache> cache (new SpaceCache (map, map_size));
+
+  if (! cache->valid (type, node_size, extra_size, key))
+    return 0;
+
+  return cache.release ();
+
+#else // !(HAVE_UNISTD_H && HAVE_FCNTL_H && HAVE_SYS_MMAN_H && HAVE_SYS_STAT_H)
+
+  // Without mmap, just always rebuild.
+  //
+  return 0;
+
+#endif // HAVE_UNISTD_H && HAVE_FCNTL_H && HAVE_SYS_MMAN_H && HAVE_SYS_STAT_H
+}
+
+SpaceCache::~SpaceCache ()
+{
+#if HAVE_SYS_MMAN_H
+  munmap (const_cast<void *> (map), map_size);
+#endif
+}
+
+
+
+
+// SpaceCache accessors
+
+// Return the nodes in this cache file.
+//
+const void *
+SpaceCache::nodes () const
+{
+  return at (header ().nodes_offset);
+}
+unsigned
+SpaceCache::num_nodes () const
+{
+  return header ().num_nodes;
+}
+
+// Return the extra data in this cache file.
+//
+const void *
+SpaceCache::extra () const
+{
+  return at (header ().extra_offset);
+}
+
+// Return the surface indices in this cache file, which refer to
+// surfaces by the order in which they were added to the space builder,
+// or a null pointer if any index is not less than NUM_SURFACES (in
+// which case the cache file shouldn't be used).
+//
+const unsigned *
+SpaceCache::surface_indices (size_t num_surfaces) const
+{
+  const Header &hdr = header ();
+  const unsigned *indices
+    = static_cast<const unsigned *> (at (hdr.surface_indices_offset));
+
+  for (unsigned i = 0; i < hdr.num_surface_indices; i++)
+    if (indices[i] >= num_surfaces)
+      return 0;
+
+  return indices;
+}
+unsigned
+SpaceCache::num_surface_indices () const
+{
+  return header ().num_surface_indices;
+}
+
+
+// SpaceCache::valid
+
+// Return true if this cache file holds a space of type TYPE, with
+// NODE_SIZE-byte nodes and EXTRA_SIZE bytes of extra data, built from
+// the geometry identified by KEY, and isn't corrupt.
+//
+bool
+SpaceCache::valid (const char *type, unsigned node_size, unsigned extra_size,
+		   const Key &key)
+  const
+{
+  const Header &hdr = header ();
+
+  // Check that this is the kind of file we want, written by a
+  // compatible program, from the same geometry.
+  //
+  if (memcmp (hdr.magic, MAGIC, sizeof MAGIC) != 0
+      || strncmp (hdr.type, type, sizeof hdr.type) != 0
+      || hdr.byte_order_mark != BYTE_ORDER_MARK
+      || hdr.coord_size != sizeof (coord_t)
+      || hdr.index_size != sizeof (unsigned)
+      || hdr.header_size != sizeof (Header)
+      || hdr.node_size != node_size
+      || hdr.extra_size != extra_size
+      || hdr.key_hash != key.hash
+      || hdr.key_num_surfaces != key.num_surfaces)
+    return false;
+
+  // Check that the file layout is sane, and the file is complete.
+  //
+  unsigned long long nodes_end
+    = hdr.nodes_offset + (unsigned long long)hdr.num_nodes * node_size;
+  unsigned long long surface_indices_end
+    = (hdr.surface_indices_offset
+       + (unsigned long long)hdr.num_surface_indices * sizeof (unsigned));
+
+  if (hdr.file_size != map_size
+      || hdr.nodes_offset != align_offset (sizeof (Header))
+      || hdr.surface_indices_offset != align_offset (nodes_end)
+      || hdr.extra_offset != align_offset (surface_indices_end)
+      || hdr.file_size != align_offset (hdr.extra_offset + extra_size))
+    return false;
+
+  // Finally, make sure the contents weren't corrupted.
+  //
+  unsigned long long checksum
+    = hash_words (HASH_INIT, at (sizeof (Header)),
+		  map_size - sizeof (Header));
+
+  return checksum == hdr.checksum;
+}
+
+
+// SpaceCache::save
+
+// Write a cache file FILE_NAME for a space of type TYPE, built from the
+// geometry identified by KEY.  The space has NUM_NODES nodes, each
+// NODE_SIZE bytes, starting at NODES, surface indices SURFACE_INDICES,
+// and EXTRA_SIZE bytes of extra data at EXTRA.
+//
+// The file is written under a temporary name and then renamed, so
+// other processes using an old version of the file are unaffected.  If
+// the file can't be written, an exception is thrown.
+//
+void
+SpaceCache::save (const std::string &file_name, const char *type,
+		  const Key &key,
+		  const void *nodes, unsigned node_size, unsigned num_nodes,
+		  const std::vector<unsigned> &surface_indices,
+		  const void *extra, unsigned extra_size)
+{
+  Header hdr;
+  memset (&hdr, 0, sizeof hdr);
+
+  memcpy (hdr.magic, MAGIC, sizeof MAGIC);
+  strncpy (hdr.type, type, sizeof hdr.type - 1);
+
+  hdr.byte_order_mark = BYTE_ORDER_MARK;
+  hdr.coord_size = sizeof (coord_t);
+  hdr.index_size = sizeof (unsigned);
+  hdr.header_size = sizeof (Header);
+
+  hdr.node_size = node_size;
+  hdr.num_nodes = num_nodes;
+  hdr.num_surface_indices = surface_indices.size ();
+  hdr.extra_size = extra_size;
+
+  hdr.key_hash = key.hash;
+  hdr.key_num_surfaces = key.num_surfaces;
+
+  hdr.nodes_offset = align_offset (sizeof (Header));
+  hdr.surface_indices_offset
+    = align_offset (hdr.nodes_offset
+		    + (unsigned long long)num_nodes * node_size);
+  hdr.extra_offset
+    = align_offset (hdr.surface_indices_offset
+		    + surface_indices.size () * sizeof (unsigned));
+  hdr.file_size = align_offset (hdr.extra_offset + extra_size);
+
+  // Assemble the whole file in memory, so we can compute the
+  // checksum of everything following the header before writing
+  // anything.  The header is always present, so CONTENTS is never
+  // empty, even if there's nothing following the header.
+  //
+  std::vector<char> contents (hdr.file_size, 0);
+  char *file_start = &contents[0];
+
+  if (num_nodes != 0)
+    memcpy (file_start + hdr.nodes_offset, nodes, num_nodes * node_size);
+  if (! surface_indices.empty ())
+    memcpy (file_start + hdr.surface_indices_offset, &surface_indices[0],
+	    surface_indices.size () * sizeof (unsigned));
+  if (extra_size != 0)
+    memcpy (file_start + hdr.extra_offset, extra, extra_size);
+
+  hdr.checksum = hash_words (HASH_INIT, file_start + sizeof (Header),
+			     contents.size () - sizeof (Header));
+
+  memcpy (file_start, &hdr, sizeof hdr);
+
+  std::string temp_name = temp_file_name (file_name);
+
+  {
+    std::ofstream out (temp_name.c_str (), std::ios::binary);
+
+    out.write (file_start, contents.size ());
+
+    if (! out)
+      {
+	int err = errno;
+	out.close ();
+	remove (temp_name.c_str ());
+	throw file_error (temp_name + ": " + strerror (err));
+      }
+  }
+
+  if (rename (temp_name.c_str (), file_name.c_str ()) != 0)
+    {
+      int err = errno;
+      remove (temp_name.c_str ());
+      throw file_error (file_name + ": " + strerror (err));
+    }
+}
+
+
+// Surface indices
+
+// Set SURFACE_PTRS to the surfaces referred to by this cache file's
+// surface indices, where SURFACES holds all surfaces in the order they
+// were added to the space builder.  Return false if any index is out
+// of range (in which case the cache file shouldn't be used).
+//
+bool
+SpaceCache::get_surface_ptrs (
+	      const std::vector<const Surface::Renderable *> &surfaces,
+	      std::vector<const Surface::Renderable *> &surface_ptrs)
+  const
+{
+  const Header &hdr = header ();
+  const unsigned *indices
+    = static_cast<const unsigned *> (at (hdr.surface_indices_offset));
+
+  surface_ptrs.resize (hdr.num_surface_indices);
+
+  for (unsigned i = 0; i < hdr.num_surface_indices; i++)
+    {
+      if (indices[i] >= surfaces.size ())
+	return false;
+      surface_ptrs[i] = surfaces[indices[i]];
+    }
+
+  return true;
+}
+
+// Return in INDICES the index in SURFACES of each surface in
+// SURFACE_PTRS, where SURFACES holds all surfaces in the order they
+// were added to the space builder.  This is the inverse of
+// SpaceCache::get_surface_ptrs, and is used for SpaceCache::save.
+//
+void
+SpaceCache::get_surface_indices (
+		const std::vector<const Surface::Renderable *> &surfaces,
+		const std::vector<const Surface::Renderable *> &surface_ptrs,
+		std::vector<unsigned> &indices)
+{
+  typedef std::pair<const Surface::Renderable *, unsigned> SurfaceIndex;
+
+  // A table of all surfaces with their index, sorted by address, so
+  // that we can find each surface using binary search.
+  //
+  std::vector<SurfaceIndex> table;
+  table.reserve (surfaces.size ());
+  for (unsigned i = 0; i < surfaces.size (); i++)
+    table.push_back (SurfaceIndex (surfaces[i], i));
+  std::sort (table.begin (), table.end ());
+
+  indices.resize (surface_ptrs.size ());
+
+  for (unsigned i = 0; i < surface_ptrs.size (); i++)
+    {
+      std::vector<SurfaceIndex>::iterator entry
+	= std::lower_bound (table.begin (), table.end (),
+			    SurfaceIndex (surface_ptrs[i], 0));
+
+      ASSERT (entry != table.end () && entry->first == surface_ptrs[i]);
+
+      indices[i] = entry->second;
+    }
+}
@@ -0,0 +1,189 @@
+// space-cache.h -- On-disk cache of search-accelerator structures
+//
+//  Copyright (C) 2014  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#ifndef SNOGRAY_SPACE_CACHE_H
+#define SNOGRAY_SPACE_CACHE_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+#include "geometry/bbox.h"
+#include "surface/surface.h"
+
+
+namespace snogray {
+
+
+// A SpaceCache is a cache file holding the nodes of a search
+// accelerator, mapped into memory.  Building a large accelerator can
+// take a long time, so when the same geometry is rendered over and
+// over, the result of building it once can be saved with
+// SpaceCache::save, and later mapped back in with SpaceCache::load.
+//
+// A cache file holds a flat array of nodes, an array of surface
+// indices (which refer to surfaces by the order in which they were
+// added to the space builder, as surface pointers are only valid for a
+// single run), and a small block of "extra" data for the space's own
+// use.  The nodes are used directly from the mapped file, so they must
+// not contain any pointers.
+//
+// Every cache file is tagged with a SpaceCache::Key, computed from the
+// geometry it was built from, and with the type and node layout of the
+// space; SpaceCache::load ignores any file that doesn't match, or which
+// appears to be corrupt, and the caller should then build the space
+// normally (and probably save it to the cache again).
+//
+class SpaceCache
+{
+public:
+
+  // A key identifying the geometry a space was built from.  This is a
+  // hash of the bounding-boxes of all surfaces added to the space, in
+  // the order they were added.  As our accelerators are built using
+  // only surface bounding-boxes, geometry with the same key always
+  // results in the same space.
+  //
+  class Key
+  {
+  public:
+
+    Key () : hash (HASH_INIT), num_surfaces (0) { }
+
+    // Add a surface with bounding-box BBOX to the key.
+    //
+    void add (const BBox &bbox);
+
+    unsigned long long hash;
+    unsigned long long num_surfaces;
+  };
+
+  ~SpaceCache ();
+
+  // Return a SpaceCache object for the cache file FILE_NAME, if it
+  // holds a space of type TYPE, with NODE_SIZE-byte nodes and
+  // EXTRA_SIZE bytes of extra data, built from the geometry
+  // identified by KEY.  If the file doesn't exist or is unusable for
+  // any reason, return a null pointer instead.
+  //
+  // TYPE is a short string (at most 15 characters) naming the type of
+  // space; it should also include a version number, which must be
+  // changed whenever the way that space is built changes.
+  //
+  static SpaceCache *load (const std::string &file_name, const char *type,
+			   unsigned node_size, unsigned extra_size,
+			   const Key &key);
+
+  // Write a cache file FILE_NAME for a space of type TYPE, built from
+  // the geometry identified by KEY.  The space has NUM_NODES nodes,
+  // each NODE_SIZE bytes, starting at NODES, surface indices
+  // SURFACE_INDICES, and EXTRA_SIZE bytes of extra data at EXTRA.
+  //
+  // The file is written under a temporary name and then renamed, so
+  // other processes using an old version of the file are unaffected.
+  // If the file can't be written, an exception is thrown.
+  //
+  static void save (const std::string &file_name, const char *type,
+		    const Key &key,
+		    const void *nodes, unsigned node_size, unsigned num_nodes,
+		    const std::vector<unsigned> &surface_indices,
+		    const void *extra, unsigned extra_size);
+
+  // Return the nodes in this cache file.
+  //
+  const void *nodes () const;
+  unsigned num_nodes () const;
+
+  // Return the extra data in this cache file.
+  //
+  const void *extra () const;
+
+  // Return the surface indices in this cache file, which refer to
+  // surfaces by the order in which they were added to the space
+  // builder, or a null pointer if any index is not less than
+  // NUM_SURFACES (in which case the cache file shouldn't be used).
+  // This is for spaces which refer to surfaces using indices, and so
+  // can use them directly from the file.
+  //
+  const unsigned *surface_indices (size_t num_surfaces) const;
+  unsigned num_surface_indices () const;
+
+  // Set SURFACE_PTRS to the surfaces referred to by this cache file's
+  // surface indices, where SURFACES holds all surfaces in the order
+  // they were added to the space builder.  Return false if any index
+  // is out of range (in which case the cache file shouldn't be used).
+  //
+  bool get_surface_ptrs (
+	 const std::vector<const Surface::Renderable *> &surfaces,
+	 std::vector<const Surface::Renderable *> &surface_ptrs)
+    const;
+
+  // Return in INDICES the index in SURFACES of each surface in
+  // SURFACE_PTRS, where SURFACES holds all surfaces in the order they
+  // were added to the space builder.  This is the inverse of
+  // SpaceCache::get_surface_ptrs, and is used for SpaceCache::save.
+  //
+  static void get_surface_indices (
+		const std::vector<const Surface::Renderable *> &surfaces,
+		const std::vector<const Surface::Renderable *> &surface_ptrs,
+		std::vector<unsigned> &indices);
+
+private:
+
+  // Header at the beginning of every cache file.
+  //
+  struct Header;
+
+  // Initial hash value used for both Key and file checksums.
+  //
+  static const unsigned long long HASH_INIT = 14695981039346656037ULL;
+
+  // Update HASH with the SIZE bytes at DATA, and return the result.
+  // SIZE should be a multiple of sizeof (unsigned).
+  //
+  static unsigned long long hash_words (unsigned long long hash,
+					const void *data, size_t size);
+
+  SpaceCache (const void *_map, size_t _map_size)
+    : map (_map), map_size (_map_size)
+  { }
+
+  // Return true if this cache file holds a space of type TYPE, with
+  // NODE_SIZE-byte nodes and EXTRA_SIZE bytes of extra data, built
+  // from the geometry identified by KEY, and isn't corrupt.
+  //
+  bool valid (const char *type, unsigned node_size, unsigned extra_size,
+	      const Key &key)
+    const;
+
+  const Header &header () const
+  {
+    return *static_cast<const Header *> (map);
+  }
+
+  // Return a pointer to the data at OFFSET bytes into the file.
+  //
+  const void *at (unsigned long long offset) const
+  {
+    return static_cast<const char *> (map) + offset;
+  }
+
+  // The memory-mapped file.
+  //
+  const void *map;
+  size_t map_size;
+};
+
+
+}
+
+#endif // SNOGRAY_SPACE_CACHE_H
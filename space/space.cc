@@ -1,6 +1,6 @@
 // space.cc -- Space-division abstraction (hierarchically arranges 3D space)
 //
-//  Copyright (C) 2006-2011, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2006-2011, 2013, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -20,6 +20,9 @@
 using namespace snogray;
 
 
+const unsigned Space::MAX_PACKET_SIZE;
+
+
 // Initialize Space, using info from BUILDER.  Note that this can
 // only be done once, as it may modify BUILDER.
 //
@@ -28,6 +31,27 @@ Space::Space (SpaceBuilder &builder)
   deletion_list.swap (builder.deletion_list);
 }
 
+// Packet variant of Space::for_each_possible_intersector:  For each
+// surface that _might_ intersect one of the NUM_RAYS rays in RAYS,
+// call the corresponding entry of CALLBACKS with it.  Once a callback
+// has stopped iteration, it is not called again.  NUM_RAYS must not
+// be greater than MAX_PACKET_SIZE.
+//
+// This default implementation just searches for each ray separately.
+//
+void
+Space::for_each_possible_packet_intersector (
+			unsigned num_rays, const Ray *rays,
+			IntersectCallback *const *callbacks,
+			RenderContext &context,
+			RenderStats::IsecStats &isec_stats)
+  const
+{
+  for (unsigned i = 0; i < num_rays; i++)
+    for_each_possible_intersector (rays[i], *callbacks[i], context,
+				   isec_stats);
+}
+
 
 
 // "Closest" intersection testing (tests all surfaces for intersection
@@ -83,6 +107,39 @@ Space::intersect (Ray &ray, RenderContext &context) const
   return closest_isec_cb.closest;
 }
 
+// Packet variant of Space::intersect:  For each of the NUM_RAYS rays
+// in RAYS, find the closest intersecting surface in this space, and
+// set the corresponding entry in ISEC_INFOS to a
+// Surface::Renderable::IsecInfo object describing the intersection (or
+// zero if there's none), shortening the ray to reflect the point of
+// intersection.  NUM_RAYS must not be greater than MAX_PACKET_SIZE.
+//
+void
+Space::intersect (unsigned num_rays, Ray *rays,
+		  const Surface::Renderable::IsecInfo **isec_infos,
+		  RenderContext &context)
+  const
+{
+  // One callback per ray.  These are allocated in CONTEXT's mempool
+  // (like the IsecInfo objects they return), as they have no default
+  // constructor.
+  //
+  ClosestIntersectCallback *closest_isec_cbs[MAX_PACKET_SIZE];
+  for (unsigned i = 0; i < num_rays; i++)
+    closest_isec_cbs[i]
+      = new (context) ClosestIntersectCallback (rays[i], context);
+
+  IntersectCallback *callbacks[MAX_PACKET_SIZE];
+  for (unsigned i = 0; i < num_rays; i++)
+    callbacks[i] = closest_isec_cbs[i];
+
+  for_each_possible_packet_intersector (num_rays, rays, callbacks, context,
+					context.stats.intersect);
+
+  for (unsigned i = 0; i < num_rays; i++)
+    isec_infos[i] = closest_isec_cbs[i]->closest;
+}
+
 
 
 // Simple (boolean) intersection testing
@@ -90,26 +147,30 @@ Space::intersect (Ray &ray, RenderContext &context) const
 struct Space::IntersectsCallback : Space::IntersectCallback
 {
   IntersectsCallback (const Ray &_ray, RenderContext &_context)
-    : ray (_ray), intersects (false), context (_context)
+    : ray (_ray), intersector (0), context (_context)
   { }
 
   virtual bool operator() (const Surface::Renderable *surf)
   {
-    intersects = surf->intersects (ray, context);
+    if (surf->intersects (ray, context))
+      {
+	intersector = surf;
 
-    if (intersects)
-      // We can immediately return it; stop looking any further.
-      //
-      stop_iteration ();
+	// We can immediately return it; stop looking any further.
+	//
+	stop_iteration ();
+
+	return true;
+      }
 
-    return intersects;
+    return false;
   }
 
   const Ray &ray;
 
-  // True if we found an intersecting object.
+  // The intersecting surface we found, or zero if none.
   //
-  bool intersects;
+  const Surface::Renderable *intersector;
 
   RenderContext &context;
 };
@@ -125,7 +186,35 @@ Space::intersects (const Ray &ray, RenderContext &context) const
   for_each_possible_intersector (ray, intersects_cb, context,
 				 context.stats.shadow);
 
-  return intersects_cb.intersects;
+  return intersects_cb.intersector != 0;
+}
+
+// Packet variant of Space::intersects:  For each of the NUM_RAYS rays
+// in RAYS, set the corresponding entry in INTERSECTORS to some surface
+// in this space which intersects it, or zero if there is none.
+// NUM_RAYS must not be greater than MAX_PACKET_SIZE.
+//
+void
+Space::intersects (unsigned num_rays, const Ray *rays,
+		   const Surface::Renderable **intersectors,
+		   RenderContext &context)
+  const
+{
+  // One callback per ray, allocated in CONTEXT's mempool.
+  //
+  IntersectsCallback *intersects_cbs[MAX_PACKET_SIZE];
+  for (unsigned i = 0; i < num_rays; i++)
+    intersects_cbs[i] = new (context) IntersectsCallback (rays[i], context);
+
+  IntersectCallback *callbacks[MAX_PACKET_SIZE];
+  for (unsigned i = 0; i < num_rays; i++)
+    callbacks[i] = intersects_cbs[i];
+
+  for_each_possible_packet_intersector (num_rays, rays, callbacks, context,
+					context.stats.shadow);
+
+  for (unsigned i = 0; i < num_rays; i++)
+    intersectors[i] = intersects_cbs[i]->intersector;
 }
 
 
@@ -193,5 +282,37 @@ Space::occludes (const Ray &ray, const Medium &medium,
   return occludes_cb.occludes;
 }
 
+// Packet variant of Space::occludes:  For each of the NUM_RAYS rays in
+// RAYS, set the corresponding entry in OCCLUDED to true if some surface
+// in this space completely occludes it; otherwise set it to false, and
+// multiply the corresponding entry of TOTAL_TRANSMITTANCES by the
+// transmittance of any surfaces which partially occlude it, evaluated
+// in medium MEDIUM.  NUM_RAYS must not be greater than MAX_PACKET_SIZE.
+//
+void
+Space::occludes (unsigned num_rays, const Ray *rays, const Medium &medium,
+		 Color *total_transmittances, bool *occluded,
+		 RenderContext &context)
+  const
+{
+  // One callback per ray, allocated in CONTEXT's mempool.
+  //
+  OccludesCallback *occludes_cbs[MAX_PACKET_SIZE];
+  for (unsigned i = 0; i < num_rays; i++)
+    occludes_cbs[i]
+      = new (context) OccludesCallback (rays[i], medium,
+					total_transmittances[i], context);
+
+  IntersectCallback *callbacks[MAX_PACKET_SIZE];
+  for (unsigned i = 0; i < num_rays; i++)
+    callbacks[i] = occludes_cbs[i];
+
+  for_each_possible_packet_intersector (num_rays, rays, callbacks, context,
+					context.stats.shadow);
+
+  for (unsigned i = 0; i < num_rays; i++)
+    occluded[i] = occludes_cbs[i]->occludes;
+}
+
 
 // arch-tag: 550f9905-7373-4008-9c4e-e939d931f01d
@@ -1,6 +1,6 @@
 // space.h -- Space-division abstraction (hierarchically arranges 3D space)
 //
-//  Copyright (C) 2005, 2007-2011, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2005, 2007-2011, 2013, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -59,6 +59,61 @@ public:
 		 RenderContext &context)
     const;
 
+  // Return the number of bytes of memory used by this space's search
+  // structures (not including the surfaces themselves, or the search
+  // accelerators of any instanced models).
+  //
+  virtual unsigned long memory_use () const = 0;
+
+
+  // The maximum number of rays in a "ray packet" passed to the packet
+  // variants of Space::intersect and Space::occludes.
+  //
+  static const unsigned MAX_PACKET_SIZE = 16;
+
+  // Packet variant of Space::intersect:  For each of the NUM_RAYS rays
+  // in RAYS, find the closest intersecting surface in this space, and
+  // set the corresponding entry in ISEC_INFOS to a
+  // Surface::Renderable::IsecInfo object describing the intersection
+  // (or zero if there's none), shortening the ray to reflect the point
+  // of intersection.  NUM_RAYS must not be greater than
+  // MAX_PACKET_SIZE.
+  //
+  // Searching is more efficient if the rays are "coherent", e.g.,
+  // camera rays for nearby pixels.
+  //
+  void intersect (unsigned num_rays, Ray *rays,
+		  const Surface::Renderable::IsecInfo **isec_infos,
+		  RenderContext &context)
+    const;
+
+  // Packet variant of Space::intersects:  For each of the NUM_RAYS
+  // rays in RAYS, set the corresponding entry in INTERSECTORS to some
+  // surface in this space which intersects it, or zero if there is
+  // none.  NUM_RAYS must not be greater than MAX_PACKET_SIZE.
+  //
+  // Unlike Space::occludes, this is an "any hit" test, which ignores
+  // materials entirely, so it's only a valid shadow test if no
+  // surface can partially occlude a ray.
+  //
+  void intersects (unsigned num_rays, const Ray *rays,
+		   const Surface::Renderable **intersectors,
+		   RenderContext &context)
+    const;
+
+  // Packet variant of Space::occludes:  For each of the NUM_RAYS rays
+  // in RAYS, set the corresponding entry in OCCLUDED to true if some
+  // surface in this space completely occludes it; otherwise set it to
+  // false, and multiply the corresponding entry of
+  // TOTAL_TRANSMITTANCES by the transmittance of any surfaces which
+  // partially occlude it, evaluated in medium MEDIUM.  NUM_RAYS must
+  // not be greater than MAX_PACKET_SIZE.
+  //
+  void occludes (unsigned num_rays, const Ray *rays, const Medium &medium,
+		 Color *total_transmittances, bool *occluded,
+		 RenderContext &context)
+    const;
+
 
 protected:
 
@@ -82,6 +137,22 @@ protected:
 					      RenderStats::IsecStats &isec_stats)
     const = 0;
 
+  // Packet variant of Space::for_each_possible_intersector:  For each
+  // surface that _might_ intersect one of the NUM_RAYS rays in RAYS,
+  // call the corresponding entry of CALLBACKS with it.  Once a callback
+  // has stopped iteration, it is not called again.  NUM_RAYS must not
+  // be greater than MAX_PACKET_SIZE.
+  //
+  // The default implementation just searches for each ray separately;
+  // subclasses may override it to search for all rays at once.
+  //
+  virtual void for_each_possible_packet_intersector (
+			unsigned num_rays, const Ray *rays,
+			IntersectCallback *const *callbacks,
+			RenderContext &context,
+			RenderStats::IsecStats &isec_stats)
+    const;
+
 
 private:
 
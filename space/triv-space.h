@@ -1,6 +1,6 @@
 // triv-space.h -- Trivial space search accelerator
 //
-//  Copyright (C) 2010, 2011, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2010, 2011, 2013, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -57,10 +57,18 @@ public:
       callback (*i);
   }
 
+  // Return the number of bytes of memory used by this space's list of
+  // surfaces.
+  //
+  virtual unsigned long memory_use () const
+  {
+    return (unsigned long)surfaces.size () * sizeof (surfaces[0]);
+  }
+
 private:  
 
   // Make a new space from BUILDER.  This should only be invoked
-  // directly by TrivSpace::Builder::make_space.
+  // directly by TrivSpace::Builder::build_space.
   //
   TrivSpace (Builder &builder);
 
@@ -88,7 +96,7 @@ public:
 
   // Make the final space.  Note that this can only be done once.
   //
-  virtual const Space *make_space ()
+  virtual const Space *build_space ()
   {
     return new TrivSpace (*this);
   }
@@ -1,6 +1,6 @@
 // instance.cc -- Transformed object model
 //
-//  Copyright (C) 2005-2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2005-2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -29,7 +29,9 @@ class Instance::Renderable : public Surface::Renderable
 {
 public:
 
-  Renderable (const Instance &_instance) : instance (_instance) { }
+  Renderable (const Instance &_instance)
+    : instance (_instance), _bbox (_instance.bbox ())
+  { }
 
   // If this surface intersects RAY, change RAY's maximum bound
   // (Ray::t1) to reflect the point of intersection, and return a
@@ -60,13 +62,20 @@ public:
 
   // Return a bounding box for this surface.
   //
-  virtual BBox bbox () const { return instance.bbox (); }
+  virtual BBox bbox () const { return _bbox; }
 
 private:
 
   class IsecInfo;
 
   const Instance &instance;
+
+  // Our bounding-box in world space.  Computing this requires
+  // transforming the model's bounding-box, so it's done once, when
+  // the renderable is created, as instance bounding-boxes are used
+  // heavily while building the top-level space.
+  //
+  BBox _bbox;
 };
 
 
@@ -206,13 +215,14 @@ Instance::bbox () const
 }
 
 // Add this (or some other) surfaces to the space being built by
-// SPACE_BUILDER.
+// SPACE_BUILDER.  Instances are kept in a separate top-level
+// space (see SpaceBuilder::add_instance).
 //
 void
 Instance::add_to_space (SpaceBuilder &space_builder) const
 {
   Renderable *renderable = new Renderable (*this);
-  space_builder.add (renderable);
+  space_builder.add_instance (renderable);
   space_builder.delete_after_rendering (renderable);
 }
 
@@ -239,6 +249,7 @@ Instance::accum_stats (Stats &stats, StatsCache &cache) const
 
       Stats model_stats;
       surface->accum_stats (model_stats, cache);
+      model_stats.model_space_memory_use += model->space_memory_use ();
 
       cache.insert (std::make_pair (surface, model_stats));
 
@@ -251,5 +262,7 @@ Instance::accum_stats (Stats &stats, StatsCache &cache) const
 
       const Stats &model_stats = cached_stats->second;
       stats.num_render_surfaces += model_stats.num_render_surfaces;
+      stats.num_partially_occluding_surfaces
+	+= model_stats.num_partially_occluding_surfaces;
     }
 }
@@ -1,6 +1,6 @@
 // mesh.cc -- Mesh surface
 //
-//  Copyright (C) 2005-2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2005-2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -11,12 +11,14 @@
 //
 
 #include <iostream>
+#include <algorithm>
 
 #include "util/globals.h"
 #include "util/excepts.h"
 #include "util/string-funs.h"
 
 #include "geometry/tripar-isec.h"
+#include "geometry/triangle-block.h"
 #include "space/space-builder.h"
 
 #include "mesh.h"
@@ -166,6 +168,11 @@ struct Mesh::Part
   //
   class Triangle;
 
+  // A block of nearby triangles in the mesh, which are intersected
+  // together using a single TriangleBlock test.
+  //
+  class Block;
+
   // The mesh this part belongs to.
   //
   const Mesh &mesh;
@@ -177,6 +184,21 @@ struct Mesh::Part
   // A vector of Mesh::Part::Triangle surfaces that use this part.
   //
   std::vector<Triangle> triangles;
+
+private:
+
+  // Group the non-degenerate triangles in this part into blocks of
+  // spatially nearby triangles, and store the result in
+  // Mesh::Part::blocks.
+  //
+  void make_blocks () const;
+
+  // Blocks of triangles from Mesh::Part::triangles, which are what
+  // actually gets added to a space.  This is calculated lazily by
+  // Mesh::Part::add_to_space (the mesh geometry may still change
+  // before then).
+  //
+  mutable std::vector<Block> blocks;
 };
 
 
@@ -278,9 +300,20 @@ public:
 private:
 
   friend class Mesh;
+  friend class Mesh::Part::Block;
 
   class IsecInfo;
 
+  // Return true if this triangle, which RAY intersects at parametric
+  // distance T and barycentric coordinates U and V, completely
+  // occludes RAY.  If it does not completely occlude RAY, then return
+  // false, and multiply TOTAL_TRANSMITTANCE by the transmittance of
+  // the surface in medium MEDIUM.
+  //
+  bool isec_occludes (const Ray &ray, dist_t t, dist_t u, dist_t v,
+		      const Medium &medium, Color &total_transmittance)
+    const;
+
   // Return 2D texture-coordinate information for this triangle.
   // The 2D texture-coordinate of vertex 0 (with barycentric
   // coordinate 0,0) is returned in T0.  The change in 2D
@@ -332,6 +365,90 @@ private:
 };
 
 
+
+// Mesh::Part::Block
+
+
+// A block of up to TriangleBlock::SIZE nearby triangles from a single
+// Mesh::Part.  A ray is tested against all the triangles in a block
+// at once, using SIMD instructions where possible, so adding blocks
+// to a space instead of individual triangles reduces both the number
+// of surfaces the space must handle, and the cost of testing them.
+//
+class Mesh::Part::Block : public Surface::Renderable
+{
+public:
+
+  Block (const Part &_part) : part (&_part), _num_triangles (0) { }
+
+  // Add TRIANGLE to this block.  The block must not be full.
+  //
+  void add (const Triangle &triangle)
+  {
+    Pos corner = triangle.v(0);
+    geom.set (_num_triangles, SPos (corner),
+	      SVec (triangle.v(1) - corner), SVec (triangle.v(2) - corner));
+    triangles[_num_triangles++] = &triangle;
+  }
+
+  // Return true if this block cannot hold any more triangles.
+  //
+  bool full () const { return _num_triangles == TriangleBlock::SIZE; }
+
+  // Return the number of triangles in this block.
+  //
+  unsigned num_triangles () const { return _num_triangles; }
+
+  // Return triangle NUM in this block.
+  //
+  const Triangle &triangle (unsigned num) const { return *triangles[num]; }
+
+  // If this surface intersects RAY, change RAY's maximum bound
+  // (Ray::t1) to reflect the point of intersection, and return a
+  // Surface::Renderable::IsecInfo object describing the intersection
+  // (which should be allocated using placement-new with CONTEXT);
+  // otherwise return zero.
+  //
+  virtual const IsecInfo *intersect (Ray &ray, RenderContext &context) const;
+
+  // Return true if this surface intersects RAY.
+  //
+  virtual bool intersects (const Ray &ray, RenderContext &context)
+    const;
+
+  // Return true if this surface completely occludes RAY.  If it does
+  // not completely occlude RAY, then return false, and multiply
+  // TOTAL_TRANSMITTANCE by the transmittance of the surface in medium
+  // MEDIUM.
+  //
+  virtual bool occludes (const Ray &ray, const Medium &medium,
+			 Color &total_transmittance,
+			 RenderContext &context)
+    const;
+
+  // Return a bounding box for this surface.
+  //
+  virtual BBox bbox () const;
+
+private:
+
+  // The mesh part our triangles come from.  This is a pointer rather
+  // than a reference so that blocks can be stored in a std::vector.
+  //
+  const Part *part;
+
+  // Triangle geometry, in a form suitable for fast intersection.
+  //
+  TriangleBlock geom;
+
+  // The triangles in this block, corresponding to the entries in GEOM.
+  //
+  const Triangle *triangles[TriangleBlock::SIZE];
+
+  unsigned _num_triangles;
+};
+
+
 
 // Bulk vertex addition
 
@@ -782,28 +899,42 @@ Mesh::Part::Triangle::occludes (const Ray &ray, const Medium &medium,
 
   dist_t t, u, v;
   if (triangle_intersects (corner, edge1, edge2, ray, t, u, v))
-    {
-      // Avoid unnecessary calculation if possible.
-      if (part.material->fully_occluding ())
-	return true;
+    return isec_occludes (ray, t, u, v, medium, total_transmittance);
 
-      IsecInfo isec_info (Ray (ray, t), *this, u, v);
-      if (part.material->occlusion_requires_tex_coords ())
-	{
-	  UV T0, dTdu, dTdv;
-	  get_texture_params (T0, dTdu, dTdv);
-	  UV T = T0 + dTdu * u + dTdv * v;
+  return false;
+}
 
-	  TexCoords tex_coords (ray (t), T);
+// Return true if this triangle, which RAY intersects at parametric
+// distance T and barycentric coordinates U and V, completely occludes
+// RAY.  If it does not completely occlude RAY, then return false, and
+// multiply TOTAL_TRANSMITTANCE by the transmittance of the surface in
+// medium MEDIUM.
+//
+bool
+Mesh::Part::Triangle::isec_occludes (const Ray &ray,
+				     dist_t t, dist_t u, dist_t v,
+				     const Medium &medium,
+				     Color &total_transmittance)
+  const
+{
+  // Avoid unnecessary calculation if possible.
+  if (part.material->fully_occluding ())
+    return true;
 
-	  return part.material->occludes (isec_info, tex_coords, medium,
-					  total_transmittance);
-	}
-      else
-	return part.material->occludes (isec_info, medium, total_transmittance);
-    }
+  IsecInfo isec_info (Ray (ray, t), *this, u, v);
+  if (part.material->occlusion_requires_tex_coords ())
+    {
+      UV T0, dTdu, dTdv;
+      get_texture_params (T0, dTdu, dTdv);
+      UV T = T0 + dTdu * u + dTdv * v;
 
-  return false;
+      TexCoords tex_coords (ray (t), T);
+
+      return part.material->occludes (isec_info, tex_coords, medium,
+				      total_transmittance);
+    }
+  else
+    return part.material->occludes (isec_info, medium, total_transmittance);
 }
 
 
@@ -822,6 +953,198 @@ Mesh::Part::Triangle::bbox () const
 }
 
 
+
+// Mesh::Part::Block intersection
+
+// If this surface intersects RAY, change RAY's maximum bound
+// (Ray::t1) to reflect the point of intersection, and return a
+// Surface::Renderable::IsecInfo object describing the intersection
+// (which should be allocated using placement-new with CONTEXT);
+// otherwise return zero.
+//
+const Surface::Renderable::IsecInfo *
+Mesh::Part::Block::intersect (Ray &ray, RenderContext &context) const
+{
+  float t[TriangleBlock::SIZE], u[TriangleBlock::SIZE], v[TriangleBlock::SIZE];
+  unsigned hits = geom.intersect (ray, t, u, v);
+
+  if (! hits)
+    return 0;
+
+  // Find the closest intersection.
+  //
+  unsigned closest = 0;
+  for (unsigned i = 0; i < _num_triangles; i++)
+    if ((hits & (1 << i)) && t[i] < ray.t1)
+      {
+	ray.t1 = t[i];
+	closest = i;
+      }
+
+  return new (context) Triangle::IsecInfo (ray, *triangles[closest],
+					   u[closest], v[closest]);
+}
+
+// Return true if this surface intersects RAY.
+//
+bool
+Mesh::Part::Block::intersects (const Ray &ray, RenderContext &) const
+{
+  float t[TriangleBlock::SIZE], u[TriangleBlock::SIZE], v[TriangleBlock::SIZE];
+  return geom.intersect (ray, t, u, v) != 0;
+}
+
+// Return true if this surface completely occludes RAY.  If it does
+// not completely occlude RAY, then return false, and multiply
+// TOTAL_TRANSMITTANCE by the transmittance of the surface in medium
+// MEDIUM.
+//
+bool
+Mesh::Part::Block::occludes (const Ray &ray, const Medium &medium,
+			     Color &total_transmittance,
+			     RenderContext &)
+  const
+{
+  float t[TriangleBlock::SIZE], u[TriangleBlock::SIZE], v[TriangleBlock::SIZE];
+  unsigned hits = geom.intersect (ray, t, u, v);
+
+  for (unsigned i = 0; hits; i++, hits >>= 1)
+    if ((hits & 1)
+	&& triangles[i]->isec_occludes (ray, t[i], u[i], v[i],
+					medium, total_transmittance))
+      return true;
+
+  return false;
+}
+
+// Return a bounding box for this surface.
+//
+BBox
+Mesh::Part::Block::bbox () const
+{
+  BBox bbox;
+  for (unsigned i = 0; i < _num_triangles; i++)
+    bbox += triangles[i]->bbox ();
+  return bbox;
+}
+
+
+
+// Mesh::Part::make_blocks
+
+
+namespace { // keep local to file
+
+// An entry used when grouping triangles into blocks.
+//
+struct BlockEntry
+{
+  BlockEntry (unsigned _tri_index, const Pos &_centroid)
+    : tri_index (_tri_index), centroid (_centroid)
+  { }
+
+  unsigned tri_index;
+  Pos centroid;
+};
+
+// Functor for ordering BlockEntry objects by their centroids' position
+// along a given axis.
+//
+struct BlockEntryAxisLess
+{
+  BlockEntryAxisLess (unsigned _axis) : axis (_axis) { }
+  bool operator() (const BlockEntry &e1, const BlockEntry &e2) const
+  {
+    return e1.centroid[axis] < e2.centroid[axis];
+  }
+  unsigned axis;
+};
+
+// Reorder the entries in the range BEG to END so that each
+// consecutive run of BLOCK_SIZE entries contains triangles which are
+// close together.  This is done by recursively splitting the range at
+// the median centroid along its widest axis, always keeping the
+// number of entries on the low side a multiple of BLOCK_SIZE.
+//
+void
+group_block_entries (std::vector<BlockEntry>::iterator beg,
+		     std::vector<BlockEntry>::iterator end,
+		     unsigned block_size)
+{
+  unsigned num = end - beg;
+  if (num <= block_size)
+    return;
+
+  BBox cent_bbox;
+  for (std::vector<BlockEntry>::iterator i = beg; i != end; ++i)
+    cent_bbox += i->centroid;
+
+  Vec extent = cent_bbox.extent ();
+  unsigned axis = 0;
+  if (extent.y > extent[axis])
+    axis = 1;
+  if (extent.z > extent[axis])
+    axis = 2;
+
+  unsigned num_lo_blocks = (num + block_size - 1) / block_size / 2;
+  std::vector<BlockEntry>::iterator mid = beg + num_lo_blocks * block_size;
+
+  std::nth_element (beg, mid, end, BlockEntryAxisLess (axis));
+
+  group_block_entries (beg, mid, block_size);
+  group_block_entries (mid, end, block_size);
+}
+
+} // namespace
+
+
+// Group the non-degenerate triangles in this part into blocks of
+// spatially nearby triangles, and store the result in
+// Mesh::Part::blocks.
+//
+void
+Mesh::Part::make_blocks () const
+{
+  // Find the non-degenerate triangles, and their centroids.
+  //
+  std::vector<BlockEntry> entries;
+  for (unsigned i = 0; i < triangles.size(); i++)
+    {
+      const Triangle &tri = triangles[i];
+
+      // Degenerate triangles (those with a zero-length normal) can
+      // cause a crash during rendering, so only add non-degenerate
+      // triangles.
+      //
+      if (tri.raw_normal_unscaled().length_squared() > 0)
+	{
+	  BBox tri_bbox = tri.bbox ();
+	  entries.push_back (BlockEntry (i, midpoint (tri_bbox.min,
+						      tri_bbox.max)));
+	}
+    }
+
+  // Reorder the entries so that triangles in the same block are close
+  // together.  Mesh triangles are often in a fairly coherent order
+  // already, but not always.
+  //
+  group_block_entries (entries.begin (), entries.end (),
+		       TriangleBlock::SIZE);
+
+  // Fill blocks with consecutive triangles.
+  //
+  blocks.clear ();
+  blocks.reserve ((entries.size () + TriangleBlock::SIZE - 1)
+		  / TriangleBlock::SIZE);
+  for (unsigned i = 0; i < entries.size (); i++)
+    {
+      if (blocks.empty () || blocks.back ().full ())
+	blocks.push_back (Block (*this));
+      blocks.back ().add (triangles[entries[i].tri_index]);
+    }
+}
+
+
 
 // Mesh::Part::add_to_space
 
@@ -832,6 +1155,12 @@ Mesh::Part::Triangle::bbox () const
 void
 Mesh::Part::add_to_space (SpaceBuilder &space_builder) const
 {
+#if USE_DOUBLE_COORDS
+
+  // TriangleBlock always does single-precision intersection tests, so
+  // when using double-precision coordinates, just add individual
+  // triangles.
+
   for (unsigned i = 0; i < triangles.size(); i++)
     {
       const Triangle &tri = triangles[i];
@@ -843,6 +1172,26 @@ Mesh::Part::add_to_space (SpaceBuilder &space_builder) const
       if (tri.raw_normal_unscaled().length_squared() > 0)
 	space_builder.add (&tri);
     }
+
+#else // !USE_DOUBLE_COORDS
+
+  if (blocks.empty ())
+    make_blocks ();
+
+  for (unsigned i = 0; i < blocks.size (); i++)
+    {
+      const Block &block = blocks[i];
+
+      // A block containing only a single triangle has no advantage
+      // over the triangle itself.
+      //
+      if (block.num_triangles () == 1)
+	space_builder.add (&block.triangle (0));
+      else
+	space_builder.add (&block);
+    }
+
+#endif // USE_DOUBLE_COORDS
 }
 
 
@@ -1137,6 +1486,11 @@ Mesh::accum_stats (Stats &stats, StatsCache &) const
   unsigned num_tris = num_triangles ();
   stats.num_render_surfaces += num_tris;
   stats.num_real_surfaces += num_tris;
+
+  for (std::vector<Part *>::const_iterator pi = parts.begin ();
+       pi != parts.end (); ++pi)
+    if (! (*pi)->material->fully_occluding ())
+      stats.num_partially_occluding_surfaces += (*pi)->triangles.size ();
 }
 
 // Recalculate this mesh's bounding box.
@@ -1,6 +1,6 @@
 // model.cc -- A surface encapsulated into its own model
 //
-//  Copyright (C) 2007, 2009-2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2007, 2009-2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -11,8 +11,11 @@
 //
 
 #include <memory>
+#include <set>
+#include <vector>
 
 #include "util/snogassert.h"
+#include "util/thread.h"
 #include "space/space.h"
 #include "space/space-builder.h"
 
@@ -22,28 +25,145 @@
 using namespace snogray;
 
 
+// All models whose spaces haven't been built yet, for
+// Model::make_pending_spaces.
+//
+static std::set<const Model *> pending_models;
+
+// Mutex protecting PENDING_MODELS.
+//
+static Mutex pending_models_lock;
+
+
 Model::Model (Surface *surf,
 		    const SpaceBuilderFactory &space_builder_factory)
   : _surface (surf),
     space_builder (space_builder_factory.make_space_builder ())
-{ }
+{
+  LockGuard guard (pending_models_lock);
+  pending_models.insert (this);
+}
+
+Model::~Model ()
+{
+  delete space.load ();
+
+  LockGuard guard (pending_models_lock);
+  pending_models.erase (this);
+}
 
 
-// Setup our acceleration structure.
+// Build our acceleration structure if that hasn't been done yet, and
+// return it.
 //
-void
+const Space &
 Model::make_space () const
 {
   LockGuard guard (make_space_lock);
 
-  if (! space)
+  // Another thread may have built the space while we were waiting
+  // for the lock.
+  //
+  const Space *sp = space.load ();
+
+  if (! sp)
     {
       ASSERT (space_builder);
 
       _surface->add_to_space (*space_builder);
 
-      space.reset (space_builder->make_space ());
+      sp = space_builder->make_space ();
 
       space_builder.reset ();
+
+      // Make the new space visible to other threads; any thread that
+      // sees this pointer will also see the completely built space.
+      //
+      space.store (sp);
+
+      LockGuard pending_guard (pending_models_lock);
+      pending_models.erase (this);
+    }
+
+  return *sp;
+}
+
+
+
+// Model::make_pending_spaces
+
+// State used by Model::make_pending_spaces to distribute models
+// amongst threads.  Each thread repeatedly grabs the next model from
+// the list, and builds its space.
+//
+class Model::PendingSpacesJob
+{
+public:
+
+  PendingSpacesJob (const std::vector<const Model *> &_models)
+    : models (_models), next (0)
+  { }
+
+  void run ()
+  {
+    while (const Model *model = next_model ())
+      model->make_space ();
+  }
+
+private:
+
+  const Model *next_model ()
+  {
+    LockGuard guard (lock);
+    return next < models.size () ? models[next++] : 0;
+  }
+
+  const std::vector<const Model *> &models;
+
+  // Index of the next model in MODELS to build.
+  //
+  unsigned next;
+
+  Mutex lock;
+};
+
+// Build the acceleration structures of all existing models which
+// haven't been built yet, using NUM_THREADS threads.  Normally a
+// model's acceleration structure is only built when it's first used
+// during rendering, but building them all in advance avoids stalls
+// when many threads all want the same model at once, and allows the
+// building to proceed in parallel.
+//
+// No models should be created or destroyed while this is running.
+//
+void
+Model::make_pending_spaces (unsigned num_threads)
+{
+  std::vector<const Model *> models;
+  {
+    LockGuard guard (pending_models_lock);
+    models.assign (pending_models.begin (), pending_models.end ());
+  }
+
+  PendingSpacesJob job (models);
+
+#if USE_THREADS
+  num_threads = std::min (num_threads, unsigned (models.size ()));
+
+  if (num_threads > 1)
+    {
+      std::vector<Thread *> threads;
+      for (unsigned i = 0; i < num_threads; i++)
+	threads.push_back (new Thread (&PendingSpacesJob::run, &job));
+
+      for (std::vector<Thread *>::iterator ti = threads.begin ();
+	   ti != threads.end (); ++ti)
+	{
+	  (*ti)->join ();
+	  delete *ti;
+	}
     }
+  else
+#endif // USE_THREADS
+    job.run ();
 }
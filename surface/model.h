@@ -1,6 +1,6 @@
 // model.h -- A surface encapsulated into its own model
 //
-//  Copyright (C) 2007-2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2007-2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -16,6 +16,7 @@
 #include "util/ref.h"
 #include "util/unique-ptr.h"
 #include "util/mutex.h"
+#include "util/atomic-ptr.h"
 #include "geometry/ray.h"
 #include "space/space.h"
 #include "space/space-builder.h"
@@ -37,6 +38,16 @@ class Model : public RefCounted
 public:
 
   Model (Surface *surf, const SpaceBuilderFactory &space_builder_factory);
+  ~Model ();
+
+  // Build the acceleration structures of all existing models which
+  // haven't been built yet, using NUM_THREADS threads.  Normally a
+  // model's acceleration structure is only built when it's first
+  // used during rendering, but building them all in advance avoids
+  // stalls when many threads all want the same model at once, and
+  // allows the building to proceed in parallel.
+  //
+  static void make_pending_spaces (unsigned num_threads);
 
   // If the associated surface intersects RAY, change RAY's maximum
   // bound (Ray::t1) to reflect the point of intersection, and return
@@ -48,16 +59,14 @@ public:
 					 Ray &ray, RenderContext &context)
     const
   {
-    ensure_space ();
-    return space->intersect (ray, context);
+    return get_space ().intersect (ray, context);
   }
 
   // Return true if something in this model intersects RAY.
   //
   bool intersects (const Ray &ray, RenderContext &context) const
   {
-    ensure_space ();
-    return space->intersects (ray, context);
+    return get_space ().intersects (ray, context);
   }
 
   // Return true if some surface in this model completely occludes
@@ -77,8 +86,8 @@ public:
 			 RenderContext &context)
     const
   {
-    ensure_space ();
-    return space->occludes (ray, medium, total_transmittance, context);
+    return get_space ().occludes (ray, medium, total_transmittance,
+				  context);
   }
 
   // Return a pointer to the model's actual surface.  The returned
@@ -86,31 +95,57 @@ public:
   //
   Surface *surface () const { return _surface.get (); }
 
+  // Return the number of bytes of memory used by the model's search
+  // accelerator, or zero if it hasn't been built yet.
+  //
+  unsigned long space_memory_use () const
+  {
+    const Space *sp = space.load ();
+    return sp ? sp->memory_use () : 0;
+  }
+
 private:
 
-  // Make sure our acceleration structure is set up.
+  // State used by Model::make_pending_spaces to distribute models
+  // amongst threads.
   //
-  void ensure_space () const { if (! space) make_space (); }
+  class PendingSpacesJob;
+
+  // Return our acceleration structure, building it if necessary.
+  //
+  // Once built, the space is "published" using an atomic store with
+  // release semantics, so the common case of an already-built space
+  // only needs a single atomic load, with no locking.
+  //
+  const Space &get_space () const
+  {
+    const Space *sp = space.load ();
+    return sp ? *sp : make_space ();
+  }
 
-  // Setup our acceleration structure.
+  // Build our acceleration structure if that hasn't been done yet, and
+  // return it.
   //
-  void make_space () const;
+  const Space &make_space () const;
 
   // The top-level surface in this model.
   //
   UniquePtr<Surface> _surface;
 
   // Space holding everything from SURFACE, or zero if it hasn't been
-  // built yet.
+  // built yet.  It is only set by Model::make_space, while holding
+  // Model::make_space_lock.
   //
-  mutable UniquePtr<const Space> space;
+  mutable AtomicPtr<const Space> space;
 
   // SpaceBuilder that can be used to build SPACE, or zero if it's
   // already been built.
   //
   mutable UniquePtr<SpaceBuilder> space_builder;
 
-  // A lock used to serialize initialization of the Model::space field.
+  // A lock used to serialize initialization of the Model::space field,
+  // so that only one thread ever builds it; any other threads which
+  // want it at the same time wait for that thread to finish.
   //
   // Only used by Model::make_space (which is only called if
   // Model::space is zero).
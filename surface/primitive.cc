@@ -1,6 +1,6 @@
 // surface.cc -- Primitive surface
 //
-//  Copyright (C) 2010, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2010, 2013, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -70,4 +70,7 @@ Primitive::accum_stats (Stats &stats, StatsCache &) const
 
   if (material->emits_light ())
     stats.num_lights++;
+
+  if (! material->fully_occluding ())
+    stats.num_partially_occluding_surfaces++;
 }
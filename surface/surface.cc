@@ -1,6 +1,6 @@
 // surface.cc -- Physical surface
 //
-//  Copyright (C) 2005-2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2005-2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -45,6 +45,8 @@ Surface::Stats::operator+= (const Stats &stats)
   num_render_surfaces += stats.num_render_surfaces;
   num_real_surfaces += stats.num_real_surfaces;
   num_lights += stats.num_lights;
+  num_partially_occluding_surfaces += stats.num_partially_occluding_surfaces;
+  model_space_memory_use += stats.model_space_memory_use;
   return *this;
 }
 
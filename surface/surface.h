@@ -1,6 +1,6 @@
 // surface.h -- Physical surface
 //
-//  Copyright (C) 2005-2011, 2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2005-2011, 2013, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -104,7 +104,10 @@ public:
 // Surface::Stats
 struct Surface::Stats
 {
-  Stats () : num_render_surfaces (0), num_real_surfaces (0), num_lights (0) { }
+  Stats ()
+    : num_render_surfaces (0), num_real_surfaces (0), num_lights (0),
+      num_partially_occluding_surfaces (0), model_space_memory_use (0)
+  { }
 
   Stats &operator+= (const Stats &stats);
 
@@ -125,6 +128,19 @@ struct Surface::Stats
   // similar split to the above?]
   //
   unsigned long num_lights;
+
+  // Number of surfaces taking place in rendering (like
+  // NUM_RENDER_SURFACES) whose material may only partially occlude
+  // rays (see Material::PARTIALLY_OCCLUDING).  If this is zero, shadow
+  // rays can use a simple "any hit" test.
+  //
+  unsigned long num_partially_occluding_surfaces;
+
+  // Number of bytes of memory used by the search accelerators of
+  // instanced models (only those which have already been built).
+  // Like NUM_REAL_SURFACES, each model is only counted once.
+  //
+  unsigned long model_space_memory_use;
 };
 
 
@@ -0,0 +1,116 @@
+// aligned-alloc.h -- Allocator for over-aligned objects
+//
+//  Copyright (C) 2014  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#ifndef SNOGRAY_ALIGNED_ALLOC_H
+#define SNOGRAY_ALIGNED_ALLOC_H
+
+#include <cstddef>
+#include <new>
+
+#include "config.h"
+
+// We use intptr_t below.  If the system defines, it we must include
+// the proper include file, otherwise, it should be defined in
+// "config.h".  Note that we use the C versions of the header files.
+//
+#if HAVE_INTPTR_T
+# if HAVE_STDINT_H
+#  include <stdint.h>
+# elif HAVE_INTTYPES_H
+#  include <inttypes.h>
+# endif
+#endif // HAVE_INTPTR_T
+
+
+namespace snogray {
+
+
+// Return a block of memory of SIZE bytes, aligned to a multiple of
+// ALIGNMENT bytes, which must be a power of two.  The block must be
+// freed using free_aligned.
+//
+inline void *
+alloc_aligned (size_t size, size_t alignment)
+{
+  // We over-allocate enough to both align the result, and store the
+  // original pointer just before it (for use by free_aligned).
+
+  char *raw = static_cast<char *> (
+		operator new (size + alignment + sizeof (void *)));
+
+  intptr_t addr = reinterpret_cast<intptr_t> (raw + sizeof (void *));
+  addr = (addr + intptr_t (alignment - 1)) & ~intptr_t (alignment - 1);
+
+  void **aligned = reinterpret_cast<void **> (addr);
+  aligned[-1] = raw;
+
+  return aligned;
+}
+
+// Free a block of memory allocated with alloc_aligned.
+//
+inline void
+free_aligned (void *mem)
+{
+  if (mem)
+    operator delete (static_cast<void **> (mem)[-1]);
+}
+
+
+// An STL allocator which returns memory aligned to a multiple of
+// ALIGNMENT bytes.  This is mainly useful for keeping small
+// fixed-size objects, e.g. search-accelerator nodes, from straddling
+// cache-line boundaries when stored in a std::vector.
+//
+template<typename T, size_t ALIGNMENT>
+class AlignedAllocator
+{
+public:
+
+  typedef T value_type;
+  typedef T *pointer;
+  typedef const T *const_pointer;
+  typedef T &reference;
+  typedef const T &const_reference;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+
+  template<typename U>
+  struct rebind { typedef AlignedAllocator<U, ALIGNMENT> other; };
+
+  AlignedAllocator () { }
+  template<typename U>
+  AlignedAllocator (const AlignedAllocator<U, ALIGNMENT> &) { }
+
+  pointer address (reference x) const { return &x; }
+  const_pointer address (const_reference x) const { return &x; }
+
+  pointer allocate (size_type num, const void * = 0)
+  {
+    void *mem = alloc_aligned (num * sizeof (T), ALIGNMENT);
+    return static_cast<pointer> (mem);
+  }
+  void deallocate (pointer mem, size_type) { free_aligned (mem); }
+
+  size_type max_size () const { return size_type (-1) / sizeof (T); }
+
+  void construct (pointer p, const T &val) { new (p) T (val); }
+  void destroy (pointer p) { p->~T (); }
+
+  bool operator== (const AlignedAllocator &) const { return true; }
+  bool operator!= (const AlignedAllocator &) const { return false; }
+};
+
+
+}
+
+#endif // SNOGRAY_ALIGNED_ALLOC_H
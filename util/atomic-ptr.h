@@ -0,0 +1,100 @@
+// atomic-ptr.h -- Pointer with atomic acquire/release access
+//
+//  Copyright (C) 2014  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+// If threading is enabled, AtomicPtr is a pointer which can be safely
+// loaded and stored by multiple threads at once, with acquire/release
+// memory ordering.  Otherwise, it's just a simple pointer (so it
+// should be always usable, even on systems without threading
+// support).
+//
+
+
+#ifndef SNOGRAY_ATOMIC_PTR_H
+#define SNOGRAY_ATOMIC_PTR_H
+
+#include "threading.h"
+
+#if USE_STD_THREAD
+#include <atomic>
+#elif USE_BOOST_THREAD
+#include "mutex.h"
+#endif
+
+
+namespace snogray {
+
+
+// A pointer to a T object, which can be used to safely "publish" an
+// object to other threads:  once a thread has seen a non-null value
+// returned from AtomicPtr::load, it is guaranteed to also see all
+// changes to the pointed-to object made by the storing thread before
+// it called AtomicPtr::store.
+//
+// This only provides atomic loads and stores, nothing fancier.
+//
+template<typename T>
+class AtomicPtr
+{
+public:
+
+  AtomicPtr (T *_ptr = 0) : ptr (_ptr) { }
+
+#if USE_STD_THREAD
+
+  // Return the current value (with "acquire" memory ordering).
+  //
+  T *load () const { return ptr.load (std::memory_order_acquire); }
+
+  // Set the current value to NEW_PTR (with "release" memory ordering).
+  //
+  void store (T *new_ptr) { ptr.store (new_ptr, std::memory_order_release); }
+
+private:
+
+  std::atomic<T *> ptr;
+
+#elif USE_BOOST_THREAD
+
+  // Boost.Thread doesn't provide atomic operations (there's a separate
+  // Boost.Atomic library, but it's relatively recent), so just use a
+  // mutex, which implies the necessary memory barriers.
+
+  T *load () const { LockGuard guard (mutex); return ptr; }
+  void store (T *new_ptr) { LockGuard guard (mutex); ptr = new_ptr; }
+
+private:
+
+  T *ptr;
+
+  mutable Mutex mutex;
+
+#else // !USE_STD_THREAD && !USE_BOOST_THREAD
+
+  T *load () const { return ptr; }
+  void store (T *new_ptr) { ptr = new_ptr; }
+
+private:
+
+  T *ptr;
+
+#endif // !USE_STD_THREAD && !USE_BOOST_THREAD
+
+  // Not copyable.
+  //
+  AtomicPtr (const AtomicPtr &);
+  AtomicPtr &operator= (const AtomicPtr &);
+};
+
+
+}
+
+
+#endif // SNOGRAY_ATOMIC_PTR_H
@@ -1,6 +1,6 @@
 // file-funs.cc -- Functions for operating on files
 //
-//  Copyright (C) 2005-2007, 2012  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2005-2007, 2012, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -10,10 +10,19 @@
 // Written by Miles Bader <miles@gnu.org>
 //
 
+#include "config.h"
+
 #include <fstream>
 #include <cerrno>
 #include <cstring>
 
+extern "C"
+{
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+}
+
 #include "string-funs.h"
 #include "excepts.h"
 
@@ -60,5 +69,20 @@ snogray::rename_to_backup_file (const std::string &file_name,
   return backup_name;
 }
 
+// Return a name for a temporary file in the same directory as
+// FILE_NAME, which can be written and then renamed to FILE_NAME.  The
+// name includes the process id, so that different processes writing
+// FILE_NAME at the same time don't use the same temporary file.
+//
+std::string
+snogray::temp_file_name (const std::string &file_name)
+{
+#if HAVE_UNISTD_H
+  return file_name + "." + stringify (unsigned (getpid ())) + ".tmp";
+#else
+  return file_name + ".tmp";
+#endif
+}
+
 
 // arch-tag: 3ebecb5b-999a-4574-ae71-08b47ccf14e3
@@ -1,6 +1,6 @@
 // file-funs.h -- Functions for operating on files
 //
-//  Copyright (C) 2005, 2006, 2007, 2011  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2005, 2006, 2007, 2011, 2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -31,6 +31,13 @@ extern bool file_exists (const std::string &file_name);
 extern std::string rename_to_backup_file (const std::string &file_name,
 					  unsigned backup_limit = 100);
 
+// Return a name for a temporary file in the same directory as
+// FILE_NAME, which can be written and then renamed to FILE_NAME.  The
+// name includes the process id, so that different processes writing
+// FILE_NAME at the same time don't use the same temporary file.
+//
+extern std::string temp_file_name (const std::string &file_name);
+
 
 }
 
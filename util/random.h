@@ -1,6 +1,6 @@
 // random.h -- Random number classes
 //
-//  Copyright (C) 2010-2013  Miles Bader <miles@gnu.org>
+//  Copyright (C) 2010-2014  Miles Bader <miles@gnu.org>
 //
 // This source code is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License as
@@ -51,6 +51,15 @@ public:
   //
   unsigned operator() (unsigned n) { return rng () % n; }
 
+  // Return a random integer with 32 random bits (any bits above the
+  // low 32 bits are zero).  This works even if the underlying RNG
+  // produces fewer than 32 bits per call.
+  //
+  unsigned bits32 ()
+  {
+    return ((*this) (0x10000) << 16) | (*this) (0x10000);
+  }
+
   // Re-seed this random number generator with integer seed SEED.
   //
   void seed (unsigned seed) { rng.seed (seed); }